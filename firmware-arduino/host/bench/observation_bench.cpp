@@ -0,0 +1,438 @@
+// Benchmark for the observation encoders in ../src/observation.cpp, see README.md.
+//
+// Compares the JSON encoder with the String-based one it replaced (reproduced below), and with the
+// CBOR encoder, for a typical observation: the payload's size, the heap allocations per
+// observation, including the copy into the MQTT queue, and the time.  The host's String is a
+// std::string, which grows geometrically and keeps short strings inline, so the old encoder
+// reallocates less often here than with the Arduino core's String.  Also checks the float
+// formatting against printf's "%.3f".
+//
+// It also has a decoder for the CBOR payload, as a server would decode it, and checks that random
+// observations survive the round trip: decoded, they encode to the same JSON as the original.
+// Exits with a nonzero status if any float is formatted differently or any observation does not
+// survive.
+
+#include "observation.h"
+
+#include <chrono>
+#include <math.h>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+# include <x86intrin.h>
+# define HAVE_RDTSC
+#endif
+
+static size_t allocations;
+
+void* operator new(size_t n) {
+  allocations++;
+  void* p = malloc(n == 0 ? 1 : n);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+// The old encoder.
+
+static void old_format_value(float v, char* buf, char* buflim) {
+  snprintf(buf, buflim - buf, "%f", v);
+}
+
+static void old_format_value(unsigned v, char* buf, char* buflim) {
+  snprintf(buf, buflim - buf, "%u", v);
+}
+
+static void old_format_value(uint16_t v, char* buf, char* buflim) {
+  old_format_value(unsigned(v), buf, buflim);
+}
+
+static void old_format_value(uint8_t v, char* buf, char* buflim) {
+  old_format_value(unsigned(v), buf, buflim);
+}
+
+static void old_format_value(bool v, char* buf, char* buflim) {
+  old_format_value(unsigned(v), buf, buflim);
+}
+
+static String old_format_readings_as_json(const SnappySenseData& data) {
+  String buf;
+  char tmp[256];
+  buf += '{';
+  buf += "\"version\":\"";
+  buf += "1.0.0";
+  buf += '"';
+  buf += ",\"sequenceno\":";
+  old_format_value(data.sequence_number, tmp, tmp+sizeof(tmp));
+  buf += tmp;
+  buf += ",\"sent\":";
+  // format_timestamp() made a String.
+  snprintf(tmp, sizeof(tmp), "%llu", (unsigned long long)data.time);
+  buf += String(tmp);
+#define FACTOR(FLAG, field, type, key, ...)                     \
+  if (data.is_valid(FACTOR_##FLAG)) {                           \
+    buf += ",\"F#" key "\":";                                   \
+    old_format_value(data.field, tmp, tmp+sizeof(tmp));         \
+    buf += tmp;                                                 \
+  }
+#define FACTOR_FIELD FACTOR
+#include "sensor_factors.h"
+  buf += '}';
+  return buf;
+}
+
+// What the MQTT queue gets.
+
+static String old_encode(const SnappySenseData& data) {
+  return old_format_readings_as_json(data);
+}
+
+static String new_encode(const SnappySenseData& data) {
+  char body[OBSERVATION_JSON_MAX];
+  format_observation_json(data, body, sizeof(body));
+  return String(body);
+}
+
+static String cbor_encode(const SnappySenseData& data) {
+  uint8_t body[OBSERVATION_CBOR_MAX];
+  size_t len = format_observation_cbor(data, body, sizeof(body));
+  return String(body, len);
+}
+
+// The CBOR decoder.  It takes the subset of CBOR that MQTT-PROTOCOL.md allows and skips fields it
+// does not know, as a server should for forward compatibility.
+
+struct CborReader {
+  CborReader(const uint8_t* buf, size_t len) : p(buf), lim(buf + len) {}
+
+  // Read the head of a data item: its major type, the additional information, and the argument,
+  // which is the value for an integer and the length for a string or map.
+  bool head(uint8_t* major, uint8_t* info, uint64_t* arg) {
+    if (p == lim) {
+      return false;
+    }
+    *major = *p >> 5;
+    *info = *p & 31;
+    p++;
+    if (*info < 24) {
+      *arg = *info;
+      return true;
+    }
+    if (*info > 27) {
+      return false;
+    }
+    size_t n = size_t(1) << (*info - 24);
+    if (size_t(lim - p) < n) {
+      return false;
+    }
+    *arg = 0;
+    for ( size_t i = 0; i < n; i++ ) {
+      *arg = (*arg << 8) | *p++;
+    }
+    return true;
+  }
+
+  bool get(uint64_t* v) {
+    uint8_t major, info;
+    return head(&major, &info, v) && major == CBOR_UNSIGNED;
+  }
+
+  bool get(unsigned* v) {
+    uint64_t x;
+    if (!get(&x) || x > 0xFFFFFFFF) {
+      return false;
+    }
+    *v = unsigned(x);
+    return true;
+  }
+
+  bool get(uint16_t* v) {
+    uint64_t x;
+    if (!get(&x) || x > 0xFFFF) {
+      return false;
+    }
+    *v = uint16_t(x);
+    return true;
+  }
+
+  bool get(uint8_t* v) {
+    uint64_t x;
+    if (!get(&x) || x > 0xFF) {
+      return false;
+    }
+    *v = uint8_t(x);
+    return true;
+  }
+
+  bool get(bool* v) {
+    uint64_t x;
+    if (!get(&x) || x > 1) {
+      return false;
+    }
+    *v = x != 0;
+    return true;
+  }
+
+  // An integer scaled by 10^OBSERVATION_DECIMALS, a single-precision float, or null.
+  bool get(float* v) {
+    uint8_t major, info;
+    uint64_t x;
+    if (!head(&major, &info, &x)) {
+      return false;
+    }
+    if (major == CBOR_UNSIGNED) {
+      *v = float(double(x) / pow(10, OBSERVATION_DECIMALS));
+    } else if (major == CBOR_NEGATIVE) {
+      *v = float((-1 - double(x)) / pow(10, OBSERVATION_DECIMALS));
+    } else if (major == CBOR_SIMPLE && info == 26) {
+      uint32_t bits = uint32_t(x);
+      memcpy(v, &bits, sizeof(*v));
+    } else if (major == CBOR_SIMPLE && info == CBOR_NULL) {
+      *v = NAN;
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  bool get(std::string* v) {
+    uint8_t major, info;
+    uint64_t len;
+    if (!head(&major, &info, &len) || major != CBOR_TEXT || uint64_t(lim - p) < len) {
+      return false;
+    }
+    v->assign(reinterpret_cast<const char*>(p), len);
+    p += len;
+    return true;
+  }
+
+  // Skip a field this decoder does not know.
+  bool skip() {
+    uint8_t major, info;
+    uint64_t arg;
+    if (!head(&major, &info, &arg)) {
+      return false;
+    }
+    switch (major) {
+      case CBOR_UNSIGNED:
+      case CBOR_NEGATIVE:
+      case CBOR_SIMPLE:
+        return true;
+      case CBOR_TEXT:
+        if (uint64_t(lim - p) < arg) {
+          return false;
+        }
+        p += arg;
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  static const uint8_t CBOR_UNSIGNED = 0;
+  static const uint8_t CBOR_NEGATIVE = 1;
+  static const uint8_t CBOR_TEXT = 3;
+  static const uint8_t CBOR_MAP = 5;
+  static const uint8_t CBOR_SIMPLE = 7;
+  static const uint8_t CBOR_NULL = 22;
+
+  const uint8_t* p;
+  const uint8_t* lim;
+};
+
+// Decode a CBOR payload into `data` and `version`.  Returns false if it is malformed.
+static bool decode_observation_cbor(const uint8_t* buf, size_t len, SnappySenseData* data,
+                                    std::string* version) {
+  CborReader r(buf, len);
+  uint8_t major, info;
+  uint64_t fields;
+  if (!r.head(&major, &info, &fields) || major != CborReader::CBOR_MAP) {
+    return false;
+  }
+  *data = SnappySenseData();
+  version->clear();
+  bool have_sent = false;
+  for ( uint64_t i = 0; i < fields; i++ ) {
+    uint64_t key;
+    if (!r.get(&key)) {
+      return false;
+    }
+    bool ok;
+    switch (key) {
+      case OBSERVATION_KEY_VERSION:
+        ok = r.get(version);
+        break;
+      case OBSERVATION_KEY_SENT: {
+        uint64_t t = 0;
+        ok = have_sent = r.get(&t);
+        data->time = time_t(t);
+        break;
+      }
+      case OBSERVATION_KEY_SEQUENCENO:
+        ok = r.get(&data->sequence_number);
+        break;
+#define FACTOR(FLAG, field, type, key, id, ...) \
+      case id:                                  \
+        ok = r.get(&data->field);               \
+        data->set_valid(FACTOR_##FLAG, true);   \
+        break;
+#define FACTOR_FIELD FACTOR
+#include "sensor_factors.h"
+      default:
+        ok = r.skip();
+        break;
+    }
+    if (!ok) {
+      return false;
+    }
+  }
+  // The version and sent fields are mandatory, and there is nothing after the map.
+  return !version->empty() && have_sent && r.p == r.lim;
+}
+
+static SnappySenseData observation() {
+  SnappySenseData d;
+  d.sequence_number = 1234;
+  d.time = 1792195528;
+  d.temperature = 21.4375f;
+  d.humidity = 38.25f;
+  d.uv = 0.0212f;
+  d.lux = 312.5f;
+  d.hpa = 1008;
+  d.air_sensor_status = 0;
+  d.aqi = 2;
+  d.tvoc = 120;
+  d.eco2 = 550;
+  d.motion_detected = true;
+  d.occupancy = 33.333332f;
+  d.motion_onsets = 2;
+  d.noise = 48.216f;
+  d.valid = (1u << NUM_FACTORS) - 1;
+  return d;
+}
+
+template<typename F>
+static void measure(const char* name, F encode, const SnappySenseData& d) {
+  const size_t n = 200000;
+  size_t bytes = encode(d).length();
+  size_t a0 = allocations;
+  auto t0 = std::chrono::steady_clock::now();
+#ifdef HAVE_RDTSC
+  uint64_t c0 = __rdtsc();
+#endif
+  size_t sink = 0;
+  for ( size_t i = 0; i < n; i++ ) {
+    sink += encode(d).length();
+  }
+#ifdef HAVE_RDTSC
+  uint64_t c1 = __rdtsc();
+#endif
+  auto t1 = std::chrono::steady_clock::now();
+  double ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+  printf("%-4s %5zu bytes, %5.2f allocations, %7.1f ns", name, bytes,
+         double(allocations - a0) / n, ns / n);
+#ifdef HAVE_RDTSC
+  printf(", %7.0f TSC cycles", double(c1 - c0) / n);
+#endif
+  printf(" per observation\n");
+  if (sink != bytes * n) {
+    printf("Inconsistent lengths\n");
+  }
+}
+
+int main(int argc, char** argv) {
+  SnappySenseData d = observation();
+  printf("old: %s\nnew: %s\ncbor:", old_encode(d).c_str(), new_encode(d).c_str());
+  String cbor = cbor_encode(d);
+  for ( unsigned i = 0; i < cbor.length(); i++ ) {
+    printf(" %02x", uint8_t(cbor[i]));
+  }
+  printf("\n\nOBSERVATION_JSON_MAX = %zu, OBSERVATION_CBOR_MAX = %zu\n\n", OBSERVATION_JSON_MAX,
+         OBSERVATION_CBOR_MAX);
+  measure("old", old_encode, d);
+  measure("new", new_encode, d);
+  measure("cbor", cbor_encode, d);
+
+  // The float formatter against printf, over a spread of magnitudes.
+  uint32_t x = 12345;
+  unsigned mismatches = 0;
+  const unsigned trials = 1000000;
+  for ( unsigned i = 0; i < trials; i++ ) {
+    x = x * 1103515245 + 12345;
+    float v = float(int32_t(x) / 2147483648.0 * pow(10, int(i % 10) - 2));
+    char mine[OBSERVATION_FLOAT_MAX + 1];
+    char theirs[64];
+    format_observation_float(v, mine, sizeof(mine));
+    snprintf(theirs, sizeof(theirs), "%.3f", v);
+    if (strcmp(theirs, "-0.000") == 0) {
+      strcpy(theirs, "0.000");
+    }
+    if (strcmp(mine, theirs) != 0) {
+      if (mismatches++ < 5) {
+        printf("mismatch: %.9g: %s vs %s\n", v, mine, theirs);
+      }
+    }
+  }
+  printf("\n%u of %u floats formatted differently from %%.3f\n", mismatches, trials);
+
+  // CBOR round trips of random observations, with random factors valid, values of any sign and
+  // magnitude, and some that are not numbers.
+  unsigned failures = 0;
+  size_t json_bytes = 0, cbor_bytes = 0;
+  const unsigned observations = 100000;
+  auto next = [&]() {
+    x = x * 1103515245 + 12345;
+    return x;
+  };
+  auto random_float = [&]() {
+    uint32_t r = next();
+    if (r % 50 == 0) {
+      return r % 100 == 0 ? NAN : INFINITY;
+    }
+    return float(int32_t(next()) / 2147483648.0 * pow(10, int(r % 22) - 6));
+  };
+  for ( unsigned i = 0; i < observations; i++ ) {
+    SnappySenseData in;
+    in.sequence_number = next() >> (next() % 32);
+    in.time = time_t(uint64_t(next()) << (next() % 8));
+    in.valid = next() & ((1u << NUM_FACTORS) - 1);
+#define FACTOR(FLAG, field, type, ...) \
+    in.field = std::is_floating_point<type>::value ? type(random_float()) : type(next());
+#define FACTOR_FIELD FACTOR
+#include "sensor_factors.h"
+    char json_in[OBSERVATION_JSON_MAX], json_out[OBSERVATION_JSON_MAX];
+    uint8_t body[OBSERVATION_CBOR_MAX];
+    json_bytes += format_observation_json(in, json_in, sizeof(json_in));
+    size_t len = format_observation_cbor(in, body, sizeof(body));
+    cbor_bytes += len;
+    SnappySenseData out;
+    std::string version;
+    bool decoded = len > 0 && decode_observation_cbor(body, len, &out, &version);
+    if (decoded) {
+      format_observation_json(out, json_out, sizeof(json_out));
+    }
+    bool ok = decoded && version == OBSERVATION_CBOR_VERSION && out.valid == in.valid &&
+              strcmp(json_in, json_out) == 0;
+    if (!ok && failures++ < 5) {
+      printf("round trip failed:\n  in:  %s\n  out: %s\n", json_in,
+             decoded ? json_out : "(malformed)");
+    }
+  }
+  printf("%u of %u observations failed the CBOR round trip; on average %.1f bytes as JSON, "
+         "%.1f bytes as CBOR\n", failures, observations, double(json_bytes) / observations,
+         double(cbor_bytes) / observations);
+  return mismatches > 0 || failures > 0;
+}
@@ -0,0 +1,117 @@
+// Check and benchmark for the streaming statistics in ../src/running_stats.cpp, see README.md.
+//
+// Feeds RunningStats series of readings with wild outliers in them, as a glitch on the bus or a
+// flash of light on the sensor would produce, and checks that estimate() rejects a single outlier
+// and stays close to the true value, while mean() is pulled away by it.  Also checks the cases
+// with fewer than three samples, where the estimate is the plain mean, and reset().  Exits with a
+// nonzero status if any check fails.  Then prints the time per sample.
+
+#include "running_stats.h"
+
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static bool ok = true;
+
+static void check(bool cond, const char* what, float got, float want) {
+  if (!cond) {
+    fprintf(stderr, "FAIL: %s: got %g, want %g\n", what, got, want);
+    ok = false;
+  }
+}
+
+static void check_near(const char* what, float got, float want, float tolerance) {
+  check(fabsf(got - want) <= tolerance, what, got, want);
+}
+
+// A reading of `base` with a little noise, and every `every`th reading replaced by `spike`.
+static float reading(unsigned i, float base, float noise, unsigned every, float spike) {
+  if (every > 0 && i % every == every - 1) {
+    return spike;
+  }
+  return base + noise * (float(random() % 2001) / 1000 - 1);
+}
+
+int main(int argc, char** argv) {
+  RunningStats s;
+
+  check(s.count() == 0, "count when empty", s.count(), 0);
+  check(s.estimate() == 0, "estimate when empty", s.estimate(), 0);
+
+  // Fewer than three samples: the plain mean.
+  s.add(10);
+  check(s.estimate() == 10, "estimate of one sample", s.estimate(), 10);
+  s.add(20);
+  check(s.estimate() == 15, "estimate of two samples", s.estimate(), 15);
+  check(s.count() == 2, "count of two samples", s.count(), 2);
+
+  s.reset();
+  check(s.count() == 0, "count after reset", s.count(), 0);
+  check(s.estimate() == 0, "estimate after reset", s.estimate(), 0);
+
+  // Steady readings with one huge spike in the middle: the spike is rejected outright.
+  for ( unsigned i = 0; i < 9; i++ ) {
+    s.add(i == 4 ? 5000 : 21.5f);
+  }
+  check(s.estimate() == 21.5f, "estimate with one spike", s.estimate(), 21.5f);
+  check(s.mean() > 500, "mean with one spike", s.mean(), 5000 / 9.0f);
+
+  // A spike in the first or the last sample is one of three in the median's window only once.
+  s.reset();
+  s.add(-40);
+  for ( unsigned i = 0; i < 8; i++ ) {
+    s.add(1013);
+  }
+  check(s.estimate() == 1013, "estimate with a spike first", s.estimate(), 1013);
+  s.reset();
+  for ( unsigned i = 0; i < 8; i++ ) {
+    s.add(1013);
+  }
+  s.add(65535);
+  check(s.estimate() == 1013, "estimate with a spike last", s.estimate(), 1013);
+
+  // Noisy readings, as many as a sampling window has, with isolated spikes both ways.
+  for ( float spike : { 0.0f, 1000.0f } ) {
+    s.reset();
+    srandom(1);
+    for ( unsigned i = 0; i < 16; i++ ) {
+      s.add(reading(i, 400, 5, 5, spike));
+    }
+    check_near("estimate of noisy readings with spikes", s.estimate(), 400, 5);
+    check(fabsf(s.mean() - 400) > 50, "mean of noisy readings with spikes", s.mean(), 400);
+  }
+
+  // A slow ramp, with no outliers, is followed by the estimate as by the mean: each median is the
+  // middle sample of three.
+  s.reset();
+  for ( unsigned i = 0; i < 16; i++ ) {
+    s.add(20 + i * 0.1f);
+  }
+  check_near("estimate of a ramp", s.estimate(), 20.75f, 0.01f);
+  check_near("mean of a ramp", s.mean(), 20.75f, 0.01f);
+
+  if (!ok) {
+    return 1;
+  }
+
+  const unsigned N = 10000000;
+  srandom(2);
+  float* xs = new float[1024];
+  for ( unsigned i = 0; i < 1024; i++ ) {
+    xs[i] = reading(i, 400, 5, 7, 5000);
+  }
+  s.reset();
+  auto start = std::chrono::steady_clock::now();
+  for ( unsigned i = 0; i < N; i++ ) {
+    s.add(xs[i % 1024]);
+  }
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - start).count();
+  printf("%u samples, %.2f ns/sample (estimate %.1f, mean %.1f)\n", N, double(ns) / N, s.estimate(),
+         s.mean());
+  delete[] xs;
+  printf("OK\n");
+  return 0;
+}
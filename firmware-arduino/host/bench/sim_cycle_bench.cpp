@@ -0,0 +1,152 @@
+// Check the main loop's cycle in virtual time, see README.md.
+//
+// Runs the whole firmware on the simulator for a day, once in slideshow mode and once in monitoring
+// mode, and follows the state machine in main.cpp through the firmware's log.  Every monitoring
+// window must be closed by the sensor task with the sensor readings, before main's backstop would
+// close it and before the next one opens; the next window must not open until the device has slept for the mode's sleep time, also
+// after the first window; in monitoring mode every sleep must power the peripherals down and up
+// again; and the day must hold as many cycles as the timeouts allow.  Exits with a nonzero status
+// if not.
+
+#include "../sim/host.h"
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "main.h"
+
+static const uint64_t HOUR_US = 3600ull * 1000000;
+static const uint64_t RUN_US = 24 * HOUR_US;
+
+static const char* mode_name;
+static bool in_slideshow_mode;
+static char log_path[] = "/tmp/sim_cycle_bench.XXXXXX";
+
+// The firmware's log lines start with the virtual time, "hh:mm:ss.mmm > ".
+static bool parse_line(const char* line, uint64_t* ms, const char** text) {
+  unsigned h, m, s, frac;
+  int n = 0;
+  if (sscanf(line, "%u:%u:%u.%u > %n", &h, &m, &s, &frac, &n) != 4 || n == 0) {
+    return false;
+  }
+  *ms = ((h * 60ull + m) * 60 + s) * 1000 + frac;
+  *text = line + n;
+  return true;
+}
+
+static bool starts_with(const char* s, const char* prefix) {
+  return strncmp(s, prefix, strlen(prefix)) == 0;
+}
+
+static bool check_log(FILE* log) {
+  uint64_t window_ms = monitoring_window_s() * 1000;
+  uint64_t sleep_ms =
+    (in_slideshow_mode ? slideshow_mode_sleep_s() : monitoring_mode_sleep_s()) * 1000;
+  uint64_t cycle_ms = window_ms + sleep_ms;
+#ifdef SNAPPY_WIFI
+  cycle_ms += comm_relaxation_timeout_s() * 1000;
+#endif
+
+  bool ok = true;
+  unsigned windows = 0;
+  bool in_window = false, have_data = false, napping = false, woken = false;
+  uint64_t opened_ms = 0, closed_ms = 0;
+  char line[512];
+  while (fgets(line, sizeof(line), log) != nullptr) {
+    uint64_t ms;
+    const char* text;
+    if (!parse_line(line, &ms, &text)) {
+      continue;
+    }
+    if (starts_with(text, "Monitoring window opens")) {
+      if (in_window) {
+        fprintf(stderr, "%s mode: window opened at %llu ms inside another\n", mode_name,
+                (unsigned long long)ms);
+        ok = false;
+      }
+      if (windows > 0 && ms - closed_ms < sleep_ms) {
+        fprintf(stderr, "%s mode: window opened at %llu ms, %llu ms after the last closed\n",
+                mode_name, (unsigned long long)ms, (unsigned long long)(ms - closed_ms));
+        ok = false;
+      }
+      if (windows > 0 && !in_slideshow_mode && !(napping && woken)) {
+        fprintf(stderr, "%s mode: window opened at %llu ms without a sleep\n", mode_name,
+                (unsigned long long)ms);
+        ok = false;
+      }
+      windows++;
+      in_window = true;
+      have_data = napping = woken = false;
+      opened_ms = ms;
+    } else if (starts_with(text, "Monitor data received")) {
+      have_data = true;
+    } else if (starts_with(text, "Monitoring window closes")) {
+      if (!in_window || !have_data || ms - opened_ms >= window_ms) {
+        fprintf(stderr, "%s mode: window closed at %llu ms after %llu ms\n",
+                mode_name, (unsigned long long)ms, (unsigned long long)(ms - opened_ms));
+        ok = false;
+      }
+      in_window = false;
+      closed_ms = ms;
+    } else if (starts_with(text, "Nap time")) {
+      napping = !in_window;
+    } else if (starts_with(text, "Is anyone there?")) {
+      woken = napping;
+    }
+  }
+
+  unsigned expected = RUN_US / 1000 / cycle_ms;
+  if (windows < expected) {
+    fprintf(stderr, "%s mode: %u monitoring windows, expected at least %u\n", mode_name, windows,
+            expected);
+    ok = false;
+  }
+  fprintf(stderr, "%s mode: %u monitoring windows in %llu hours\n", mode_name, windows,
+          (unsigned long long)(RUN_US / HOUR_US));
+  return ok;
+}
+
+namespace host {
+
+void finish(int status) {
+  fflush(stdout);
+  rewind(stdout);
+  bool ok = check_log(stdout);
+  unlink(log_path);
+  fflush(stderr);
+  _exit(status != 0 ? status : !ok);
+}
+
+}
+
+static bool run_day(bool slideshow) {
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    // The firmware's log goes to the serial port, which is stdout.  Keep it to check at the end.
+    int fd = mkstemp(log_path);
+    if (fd < 0 || freopen(log_path, "w+", stdout) == nullptr) {
+      _exit(2);
+    }
+    close(fd);
+    setenv("SNAPPY_HOST_PREFS", "/dev/null", 1);
+    mode_name = slideshow ? "slideshow" : "monitoring";
+    in_slideshow_mode = slideshow_mode = slideshow;
+    host::run_for_us = RUN_US;
+    host::run();
+  }
+  int status;
+  return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+         WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char** argv) {
+  bool ok = run_day(true);
+  ok = run_day(false) && ok;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,102 @@
+// Check that the firmware's steady state does not allocate, see README.md.
+//
+// Runs the whole firmware on the simulator for a day, once in slideshow mode and once in monitoring
+// mode, and counts the heap allocations the firmware makes after the first hour.  By then every
+// module has been set up and every kind of event has been through the main loop, so the events,
+// their payload pools, the timers and the sensor readings must all be in static storage.  Exits with
+// a nonzero status if anything was allocated, and prints where.
+//
+// Memory that the simulator allocates for itself, for example for the items of a FreeRTOS queue, is
+// not counted, see host::in_kernel().  No network is configured: uploads are queued as Strings and
+// are not covered.
+
+#include "../sim/host.h"
+
+#include <Arduino.h>
+#include <atomic>
+#include <execinfo.h>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "main.h"
+
+static const uint64_t HOUR_US = 3600ull * 1000000;
+static const uint64_t SETTLE_US = HOUR_US;
+static const uint64_t RUN_US = 25 * HOUR_US;
+
+// The number of backtraces printed.
+static const unsigned MAX_REPORTS = 5;
+
+static const char* mode_name;
+static std::atomic<unsigned> allocations;
+static thread_local bool reporting;
+
+static void count_allocation() {
+  if (host::now_us() < SETTLE_US || host::in_kernel() || reporting) {
+    return;
+  }
+  if (allocations++ < MAX_REPORTS) {
+    reporting = true;
+    void* frames[16];
+    int n = backtrace(frames, 16);
+    fprintf(stderr, "%s mode: allocation at %.3f h:\n", mode_name, host::now_us() / double(HOUR_US));
+    backtrace_symbols_fd(frames, n, 2);
+    reporting = false;
+  }
+}
+
+void* operator new(size_t n) {
+  count_allocation();
+  void* p = malloc(n == 0 ? 1 : n);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+namespace host {
+
+void finish(int status) {
+  unsigned n = allocations;
+  fprintf(stderr, "%s mode: %u allocations after the first hour\n", mode_name, n);
+  fflush(stderr);
+  _exit(status != 0 ? status : n > 0);
+}
+
+}
+
+static bool run_day(bool slideshow) {
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    // The firmware's log goes to the serial port, which is stdout.
+    if (freopen("/dev/null", "w", stdout) == nullptr) {
+      _exit(2);
+    }
+    setenv("SNAPPY_HOST_PREFS", "/dev/null", 1);
+    mode_name = slideshow ? "slideshow" : "monitoring";
+    slideshow_mode = slideshow;
+    host::run_for_us = RUN_US;
+    host::run();
+  }
+  int status;
+  return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+         WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char** argv) {
+  bool ok = run_day(true);
+  ok = run_day(false) && ok;
+  return ok ? 0 : 1;
+}
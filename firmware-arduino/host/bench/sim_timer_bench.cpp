@@ -0,0 +1,81 @@
+// Check that the event timers coalesce their wakeups, see README.md.
+//
+// Runs the whole firmware on the simulator for a day, once in slideshow mode and once in monitoring
+// mode, and compares the number of times the timer scheduler woke up with the number of timer
+// expirations.  Each wakeup should expire at least one timer, give or take the few wakeups caused by
+// stopping a timer, so the run fails if there are noticeably more wakeups than expirations.  Restarting
+// a timer before the scheduler's next wakeup costs a wakeup of its own, which is what this catches.
+//
+// It also fails unless the scheduler wakes up less often than the per-module FreeRTOS software
+// timers it replaced would have over the same day.  Their daemon task wakes up once for every
+// expiration and once for every start and stop, which are commands sent to it through a queue.
+
+#include "../sim/host.h"
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "metrics.h"
+
+static const uint64_t HOUR_US = 3600ull * 1000000;
+static const uint64_t RUN_US = 24 * HOUR_US;
+
+// Wakeups allowed per 100 expirations.
+static const unsigned MAX_WAKEUP_PERCENT = 105;
+
+static const char* mode_name;
+
+static unsigned counter_value(const char* snapshot, const char* name) {
+  char key[64];
+  snprintf(key, sizeof(key), "\"%s\":", name);
+  const char* p = strstr(snapshot, key);
+  return p == nullptr ? 0 : unsigned(strtoul(p + strlen(key), nullptr, 10));
+}
+
+namespace host {
+
+void finish(int status) {
+  static char snapshot[8192];
+  metrics_snapshot(snapshot, snapshot + sizeof(snapshot));
+  unsigned wakeups = counter_value(snapshot, "timer.wakeups");
+  unsigned expirations = counter_value(snapshot, "timer.expirations");
+  unsigned baseline = expirations + counter_value(snapshot, "timer.commands");
+  bool ok = expirations > 0 && wakeups * 100 <= expirations * MAX_WAKEUP_PERCENT &&
+            wakeups < baseline;
+  fprintf(stderr, "%s mode: %u timer wakeups for %u expirations, %u with FreeRTOS timers%s\n",
+          mode_name, wakeups, expirations, baseline, ok ? "" : " - too many wakeups");
+  fflush(stderr);
+  _exit(status != 0 ? status : !ok);
+}
+
+}
+
+static bool run_day(bool slideshow) {
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    // The firmware's log goes to the serial port, which is stdout.
+    if (freopen("/dev/null", "w", stdout) == nullptr) {
+      _exit(2);
+    }
+    setenv("SNAPPY_HOST_PREFS", "/dev/null", 1);
+    mode_name = slideshow ? "slideshow" : "monitoring";
+    slideshow_mode = slideshow;
+    host::run_for_us = RUN_US;
+    host::run();
+  }
+  int status;
+  return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+         WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char** argv) {
+  bool ok = run_day(true);
+  ok = run_day(false) && ok;
+  return ok ? 0 : 1;
+}
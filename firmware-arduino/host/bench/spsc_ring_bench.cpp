@@ -0,0 +1,130 @@
+// Stress test for SpscRing in ../src/util.h, see README.md.
+//
+// A producer thread pushes numbered elements into a small ring and rings a doorbell only when
+// push() says the ring was empty, the way device.cpp and net_task.cpp notify their consumers.  The
+// consumer thread drains the ring and then waits for the doorbell, the way net_task.cpp waits with
+// ulTaskNotifyTake().  The test fails if an element is lost, duplicated, reordered or torn, or if the
+// consumer is left waiting with elements in the ring, ie the `was_empty` result was wrong.  Both
+// threads yield at random points so that the ring runs both full and empty.
+//
+// Build with `make SANITIZE=thread` to have the memory ordering checked as well.
+
+#include "util.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <random>
+#include <stdio.h>
+#include <thread>
+
+static const uint64_t ITEMS = 1000000;
+
+struct Item {
+  uint64_t seq;
+  uint64_t check[3];
+};
+
+static Item make_item(uint64_t seq) {
+  return Item { seq, { seq * 0x9E3779B97F4A7C15ull, ~seq, seq ^ 0x5555555555555555ull } };
+}
+
+// A binary semaphore, like a FreeRTOS task notification taken with pdTRUE.
+class Doorbell {
+  std::mutex lock;
+  std::condition_variable cv;
+  bool rung = false;
+
+public:
+  void ring() {
+    std::lock_guard<std::mutex> g(lock);
+    rung = true;
+    cv.notify_one();
+  }
+
+  bool wait(std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> g(lock);
+    bool got = cv.wait_for(g, timeout, [this] { return rung; });
+    rung = false;
+    return got;
+  }
+};
+
+static SpscRing<Item, 16> ring;
+static Doorbell doorbell;
+// Set when the consumer gives up, so that the producer does not wait for it forever.
+static std::atomic<bool> failed;
+
+static void produce(uint64_t* doorbells, uint64_t* full) {
+  std::minstd_rand rng(1);
+  for ( uint64_t seq = 0; seq < ITEMS; seq++ ) {
+    bool was_empty;
+    while (!ring.push(make_item(seq), &was_empty)) {
+      if (failed) {
+        return;
+      }
+      (*full)++;
+      std::this_thread::yield();
+    }
+    if (was_empty) {
+      (*doorbells)++;
+      doorbell.ring();
+    }
+    if (rng() % 64 == 0) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+static bool consume(uint64_t* waits) {
+  std::minstd_rand rng(2);
+  uint64_t expect = 0;
+  while (expect < ITEMS) {
+    Item item;
+    while (ring.pop(&item)) {
+      Item want = make_item(expect);
+      if (item.seq != expect || item.check[0] != want.check[0] || item.check[1] != want.check[1] ||
+          item.check[2] != want.check[2]) {
+        fprintf(stderr, "Expected element %llu, got %llu\n", (unsigned long long)expect,
+                (unsigned long long)item.seq);
+        return false;
+      }
+      expect++;
+      if (rng() % 64 == 0) {
+        std::this_thread::yield();
+      }
+    }
+    if (expect == ITEMS) {
+      break;
+    }
+    (*waits)++;
+    // The producer rings right after pushing, so a second timeout with elements in the ring means
+    // the doorbell was not rung.
+    if (!doorbell.wait(std::chrono::seconds(1)) && !doorbell.wait(std::chrono::seconds(1)) &&
+        ring.pop(&item)) {
+      fprintf(stderr, "Consumer not woken for element %llu\n", (unsigned long long)expect);
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  uint64_t doorbells = 0, full = 0, waits = 0;
+  bool ok = false;
+  auto start = std::chrono::steady_clock::now();
+  std::thread consumer([&] {
+    ok = consume(&waits);
+    failed = !ok;
+  });
+  std::thread producer([&] { produce(&doorbells, &full); });
+  producer.join();
+  consumer.join();
+  std::chrono::duration<double, std::nano> ns = std::chrono::steady_clock::now() - start;
+  printf("%llu elements, %.1f ns/element: %llu doorbells, %llu consumer waits, %llu full pushes\n",
+         (unsigned long long)ITEMS, ns.count() / ITEMS, (unsigned long long)doorbells,
+         (unsigned long long)waits, (unsigned long long)full);
+  printf("%s\n", ok ? "OK" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,3 @@
+// Host build: drawing is done by Adafruit_SSD1306, see Adafruit_SSD1306.h.
+
+#include "Arduino.h"
@@ -0,0 +1,35 @@
+// Host build: the OLED display.  Graphics are discarded; the text of each frame is echoed to stderr
+// if SNAPPY_HOST_OLED is set in the environment.
+
+#ifndef host_adafruit_ssd1306_h_included
+#define host_adafruit_ssd1306_h_included
+
+#include "Adafruit_GFX.h"
+#include "Wire.h"
+
+#define SSD1306_SWITCHCAPVCC 2
+#define SSD1306_WHITE 1
+#define SSD1306_BLACK 0
+#define SSD1306_DISPLAYOFF 0xAE
+#define SSD1306_DISPLAYON 0xAF
+
+class Adafruit_SSD1306 : public Print {
+  int w, h;
+  String text;
+public:
+  using Print::write;
+  Adafruit_SSD1306(int w, int h, TwoWire* wire) : w(w), h(h) {}
+  bool begin(int vcs, int addr) { return true; }
+  void clearDisplay() { text.clear(); }
+  void display();
+  int width() { return w; }
+  int height() { return h; }
+  void drawBitmap(int x, int y, const uint8_t* bitmap, int w, int h, int color) {}
+  void setTextSize(int s) {}
+  void setTextColor(int c) {}
+  void setCursor(int x, int y) {}
+  void ssd1306_command(uint8_t c) {}
+  size_t write(uint8_t c) override { text += char(c); return 1; }
+};
+
+#endif // !host_adafruit_ssd1306_h_included
@@ -0,0 +1,282 @@
+// Host build: the parts of the Arduino-ESP32 core and FreeRTOS that the firmware uses, implemented
+// on POSIX threads and a simulated clock.  See ../README.md.
+
+#ifndef host_arduino_h_included
+#define host_arduino_h_included
+
+#include <assert.h>
+#include <ctype.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+
+using std::max;
+using std::min;
+
+typedef bool boolean;
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Strings and streams
+
+class String {
+  std::string s;
+public:
+  String() {}
+  String(const char* p) : s(p == nullptr ? "" : p) {}
+  String(const char* p, unsigned n) : s(p, n) {}
+  String(const uint8_t* p, unsigned n) : s((const char*)p, n) {}
+  String(const String& other) = default;
+  String(String&& other) = default;
+  explicit String(char c) : s(1, c) {}
+  explicit String(int v) : s(std::to_string(v)) {}
+  explicit String(unsigned v) : s(std::to_string(v)) {}
+  explicit String(long v) : s(std::to_string(v)) {}
+  explicit String(unsigned long v) : s(std::to_string(v)) {}
+
+  String& operator=(const String& other) = default;
+  String& operator=(String&& other) = default;
+  String& operator=(const char* p) { s = p == nullptr ? "" : p; return *this; }
+
+  String& operator+=(const String& other) { s += other.s; return *this; }
+  String& operator+=(const char* p) { s += p; return *this; }
+  String& operator+=(char c) { s += c; return *this; }
+  String& operator+=(int v) { s += std::to_string(v); return *this; }
+  String& operator+=(unsigned v) { s += std::to_string(v); return *this; }
+  String& operator+=(long v) { s += std::to_string(v); return *this; }
+  String& operator+=(unsigned long v) { s += std::to_string(v); return *this; }
+  bool concat(const char* p, unsigned n) { s.append(p, n); return true; }
+
+  bool operator==(const char* p) const { return s == p; }
+  bool operator==(const String& other) const { return s == other.s; }
+  bool operator!=(const char* p) const { return s != p; }
+  bool operator!=(const String& other) const { return s != other.s; }
+  char operator[](unsigned i) const { return i < s.length() ? s[i] : 0; }
+  char& operator[](unsigned i) { return s[i]; }
+
+  const char* c_str() const { return s.c_str(); }
+  unsigned length() const { return s.length(); }
+  bool isEmpty() const { return s.empty(); }
+  void clear() { s.clear(); }
+  bool reserve(unsigned n) { s.reserve(n); return true; }
+
+  String substring(unsigned from) const { return substring(from, s.length()); }
+  String substring(unsigned from, unsigned to) const;
+  bool startsWith(const char* p) const { return s.compare(0, strlen(p), p) == 0; }
+  bool startsWith(const String& other) const { return startsWith(other.c_str()); }
+  int indexOf(char c, unsigned from = 0) const;
+  int indexOf(const char* p) const;
+  void trim();
+  long toInt() const { return strtol(s.c_str(), nullptr, 10); }
+};
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buf, size_t n);
+  size_t write(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+  size_t printf(const char* fmt, ...) __attribute__ ((format (printf, 2, 3)));
+  size_t print(const char* s) { return write(s); }
+  size_t print(const String& s) { return write(s.c_str()); }
+  size_t print(char c) { return write(uint8_t(c)); }
+  size_t print(int v) { return printf("%d", v); }
+  size_t print(unsigned v) { return printf("%u", v); }
+  size_t print(long v) { return printf("%ld", v); }
+  size_t print(unsigned long v) { return printf("%lu", v); }
+  size_t print(double v) { return printf("%.2f", v); }
+  size_t println() { return write("\r\n"); }
+  template<typename T> size_t println(const T& v) { size_t n = print(v); return n + println(); }
+};
+
+class Stream : public Print {
+protected:
+  unsigned long timeout_ms = 1000;
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  virtual void flush() {}
+  void setTimeout(unsigned long ms) { timeout_ms = ms; }
+  size_t readBytes(char* buf, size_t n);
+  size_t readBytes(uint8_t* buf, size_t n) { return readBytes((char*)buf, n); }
+};
+
+// The serial port is the process's stdin and stdout.  Each output line is prefixed with the
+// simulated time, as the `time` filter of the PlatformIO serial monitor does for the device.
+class HardwareSerial : public Stream {
+public:
+  using Print::write;
+  void begin(unsigned long baud) {}
+  int available() override;
+  int read() override;
+  int peek() override;
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t* buf, size_t n) override;
+  void flush() override;
+};
+
+extern HardwareSerial Serial;
+
+class IPAddress {
+  uint8_t bytes[4];
+public:
+  IPAddress(uint8_t a = 0, uint8_t b = 0, uint8_t c = 0, uint8_t d = 0) : bytes{a, b, c, d} {}
+  String toString() const;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Pins, time, and the rest of the core
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 1
+#define OUTPUT 2
+#define CHANGE 3
+#define RISING 4
+#define FALLING 5
+
+// Feather ESP32 pin assignments
+#define A0 26
+#define A1 25
+#define A2 34
+#define A3 39
+#define A4 36
+#define A5 4
+#define T8 33
+#define SDA 23
+#define SCL 22
+
+#define IRAM_ATTR
+#define digitalPinToInterrupt(p) (p)
+
+void pinMode(uint8_t pin, uint8_t mode);
+int digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t val);
+int analogRead(uint8_t pin);
+void attachInterrupt(uint8_t pin, void (*handler)(), int mode);
+void detachInterrupt(uint8_t pin);
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(uint32_t us);
+
+void randomSeed(unsigned long seed);
+long random(long limit);
+long random(long lo, long hi);
+
+struct EspClass {
+  uint32_t getFreeHeap();
+  uint32_t getMinFreeHeap();
+  uint32_t getCpuFreqMHz() { return 240; }
+  uint32_t getCycleCount();
+};
+
+extern EspClass ESP;
+
+typedef int gpio_num_t;
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_TIMEOUT 0x107
+
+esp_err_t gpio_pullup_dis(gpio_num_t pin);
+esp_err_t gpio_pulldown_en(gpio_num_t pin);
+int64_t esp_timer_get_time();
+void esp_restart() __attribute__((noreturn));
+
+// The sketch
+void setup();
+void loop();
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//
+// FreeRTOS.  One tick is one millisecond, as on the device.  Task priorities, stack sizes and core
+// affinity are ignored; tasks are threads.
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef struct HostTask* TaskHandle_t;
+typedef struct HostQueue* QueueHandle_t;
+typedef struct HostQueue* SemaphoreHandle_t;
+typedef void (*TaskFunction_t)(void*);
+
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define pdTICKS_TO_MS(ticks) ((TickType_t)(ticks))
+#define portTICK_PERIOD_MS 1
+#define portMAX_DELAY ((TickType_t)0xffffffff)
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define tskIDLE_PRIORITY 0
+#define tskNO_AFFINITY 0x7fffffff
+#define configMAX_PRIORITIES 25
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char* name, uint32_t stack_size, void* arg,
+                       UBaseType_t priority, TaskHandle_t* handle);
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stack_size, void* arg,
+                                   UBaseType_t priority, TaskHandle_t* handle, BaseType_t core);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount();
+TickType_t xTaskGetTickCountFromISR();
+TaskHandle_t xTaskGetCurrentTaskHandle();
+BaseType_t xPortGetCoreID();
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* woken);
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t timeout);
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+BaseType_t xQueueSend(QueueHandle_t q, const void* item, TickType_t timeout);
+BaseType_t xQueueSendToFront(QueueHandle_t q, const void* item, TickType_t timeout);
+BaseType_t xQueueSendFromISR(QueueHandle_t q, const void* item, BaseType_t* woken);
+BaseType_t xQueueReceive(QueueHandle_t q, void* item, TickType_t timeout);
+BaseType_t xQueuePeek(QueueHandle_t q, void* item, TickType_t timeout);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q);
+UBaseType_t uxQueueMessagesWaitingFromISR(QueueHandle_t q);
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count);
+SemaphoreHandle_t xSemaphoreCreateMutex();
+SemaphoreHandle_t xSemaphoreCreateBinary();
+BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t timeout);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t s);
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t s, BaseType_t* woken);
+#define uxSemaphoreGetCount(s) uxQueueMessagesWaiting(s)
+
+// All critical sections share one lock, which is at least as strong as the device's spinlocks.
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+void portENTER_CRITICAL(portMUX_TYPE* mux);
+void portEXIT_CRITICAL(portMUX_TYPE* mux);
+#define portENTER_CRITICAL_ISR(mux) portENTER_CRITICAL(mux)
+#define portEXIT_CRITICAL_ISR(mux) portEXIT_CRITICAL(mux)
+#define portYIELD_FROM_ISR(...) ((void)0)
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//
+// The device's time of day starts at the epoch at boot and follows the simulated clock; setting it
+// must not touch the host's clock.
+
+time_t host_time(time_t* t);
+int host_gettimeofday(struct timeval* tv, void* tz);
+int host_settimeofday(const struct timeval* tv, const void* tz);
+
+#define time(t) host_time(t)
+#define gettimeofday(tv, tz) host_gettimeofday(tv, tz)
+#define settimeofday(tv, tz) host_settimeofday(tv, tz)
+
+#endif // !host_arduino_h_included
@@ -0,0 +1,67 @@
+// Host build: an MQTT 3.1.1 client with the ArduinoMqttClient API, enough of it for the firmware:
+// QoS 0/1 publish, subscribe, and delivery of incoming PUBLISH packets from poll().  Network waits
+// are in real time.
+
+#ifndef host_arduinomqttclient_h_included
+#define host_arduinomqttclient_h_included
+
+#include "WiFi.h"
+#include <vector>
+
+#define MQTT_CONNECTION_REFUSED -2
+#define MQTT_CONNECTION_TIMEOUT -1
+#define MQTT_SUCCESS 0
+
+class MqttClient : public Stream {
+  WiFiClient* client;
+  std::string id;
+  std::string username;
+  std::string password;
+  bool clean_session = true;
+  size_t tx_payload_size = 256;
+  int connect_error = MQTT_SUCCESS;
+  uint16_t next_packet_id = 1;
+  uint64_t last_tx_ms = 0;
+  void (*on_message)(int) = nullptr;
+
+  // The outgoing message
+  std::string tx_topic;
+  int tx_qos = 0;
+  bool tx_retain = false;
+  std::string tx_payload;
+
+  // The incoming message
+  String rx_topic;
+  std::vector<uint8_t> rx_payload;
+  size_t rx_pos = 0;
+
+  bool send_packet(uint8_t type, const std::string& body);
+  bool receive_packet(uint8_t* type, std::string* body, int timeout_ms);
+  uint16_t packet_id();
+public:
+  using Print::write;
+  MqttClient(WiFiClient* client) : client(client) {}
+  void setClient(WiFiClient& c) { client = &c; }
+  void setTxPayloadSize(size_t n) { tx_payload_size = n; }
+  void setCleanSession(bool flag) { clean_session = flag; }
+  void setId(const char* s) { id = s; }
+  void setUsernamePassword(const char* user, const char* pass) { username = user; password = pass; }
+  int connect(const char* host, uint16_t port);
+  int connectError() { return connect_error; }
+  int connected() { return client != nullptr && client->connected(); }
+  void stop();
+  void poll();
+  void onMessage(void (*callback)(int)) { on_message = callback; }
+  String messageTopic() { return rx_topic; }
+  int subscribe(const String& topic, int qos);
+  int beginMessage(const char* topic, bool retain = false, int qos = 0, bool dup = false);
+  int endMessage();
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t* buf, size_t n) override;
+  int read(uint8_t* buf, size_t n);
+  int available() override { return rx_payload.size() - rx_pos; }
+  int read() override { return rx_pos < rx_payload.size() ? rx_payload[rx_pos++] : -1; }
+  int peek() override { return rx_pos < rx_payload.size() ? rx_payload[rx_pos] : -1; }
+};
+
+#endif // !host_arduinomqttclient_h_included
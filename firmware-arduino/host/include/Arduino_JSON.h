@@ -0,0 +1,27 @@
+// Host build: JSON parsing, for the flat objects of numbers and strings that the server sends.
+
+#ifndef host_arduino_json_h_included
+#define host_arduino_json_h_included
+
+#include "Arduino.h"
+#include <map>
+
+class JSONVar {
+  friend struct JSONClass;
+  std::map<std::string, JSONVar> fields;
+  std::string text;     // Scalar value, as written
+public:
+  bool hasOwnProperty(const char* key) const { return fields.count(key) > 0; }
+  JSONVar operator[](const char* key) const;
+  operator unsigned() const { return strtoul(text.c_str(), nullptr, 10); }
+  operator int() const { return strtol(text.c_str(), nullptr, 10); }
+};
+
+struct JSONClass {
+  // Returns an empty object if `s` is not a JSON object.
+  JSONVar parse(const char* s);
+};
+
+extern JSONClass JSON;
+
+#endif // !host_arduino_json_h_included
@@ -0,0 +1,42 @@
+// Host build: the DFRobot SEN0514 (ENS160) air quality sensor.  Readings are generated, see
+// sim/devices.cpp.
+
+#ifndef host_dfrobot_ens160_h_included
+#define host_dfrobot_ens160_h_included
+
+#include "Wire.h"
+
+#define ENS160_SLEEP_MODE 0
+#define ENS160_IDLE_MODE 1
+#define ENS160_STANDARD_MODE 2
+
+#define eINTDataDrdyEN (1<<1)
+#define eINTDataDrdyDIS (0<<1)
+#define eINTGPRDrdyEN (1<<3)
+#define eINTGPRDrdyDIS (0<<3)
+#define eINTModeEN 1
+#define eINTModeDIS 0
+#define eINTPinPP (1<<5)
+#define eINTPinOD (0<<5)
+#define eINTPinActiveHigh (1<<6)
+#define eINTPinActiveLow (0<<6)
+
+class DFRobot_ENS160_I2C {
+  uint8_t addr;
+public:
+  DFRobot_ENS160_I2C(TwoWire* wire, uint8_t addr) : addr(addr) {}
+  virtual ~DFRobot_ENS160_I2C() {}
+  int begin();
+  void setPWRMode(uint8_t mode);
+  void setINTMode(uint8_t mode);
+  void setTempAndHum(float ambient_temp, float relative_humidity);
+  uint8_t getENS160Status();
+  uint8_t getAQI();
+  uint16_t getTVOC();
+  uint16_t getECO2();
+protected:
+  virtual void writeReg(uint8_t reg, const void* buf, size_t n);
+  virtual int16_t readReg(uint8_t reg, void* buf, size_t n);
+};
+
+#endif // !host_dfrobot_ens160_h_included
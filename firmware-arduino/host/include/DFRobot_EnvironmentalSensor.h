@@ -0,0 +1,29 @@
+// Host build: the DFRobot SEN0500 environmental sensor.  Readings are generated, see
+// sim/devices.cpp.
+
+#ifndef host_dfrobot_environmentalsensor_h_included
+#define host_dfrobot_environmentalsensor_h_included
+
+#include "Wire.h"
+
+#define TEMP_C 1
+#define TEMP_F 2
+#define HPA 1
+#define KPA 2
+
+class DFRobot_EnvironmentalSensor {
+  uint8_t addr;
+public:
+  DFRobot_EnvironmentalSensor(uint8_t addr, TwoWire* wire) : addr(addr) {}
+  int8_t begin();
+  float getTemperature(uint8_t units);
+  float getHumidity();
+  float getUltravioletIntensity();
+  float getLuminousIntensity();
+  uint16_t getAtmospherePressure(uint8_t units);
+  float getElevation();
+protected:
+  uint8_t readReg(uint8_t reg, void* buf, uint8_t n);
+};
+
+#endif // !host_dfrobot_environmentalsensor_h_included
@@ -0,0 +1,19 @@
+// Host build: the NTP client.  The host's clock is already synchronized, so the "server" time is
+// the host's time of day.
+
+#ifndef host_ntpclient_h_included
+#define host_ntpclient_h_included
+
+#include "WiFiUdp.h"
+
+class NTPClient {
+  unsigned long epoch = 0;
+public:
+  NTPClient(WiFiUDP& udp) {}
+  void begin() {}
+  bool update() { return forceUpdate(); }
+  bool forceUpdate();
+  unsigned long getEpochTime() { return epoch; }
+};
+
+#endif // !host_ntpclient_h_included
@@ -0,0 +1,25 @@
+// Host build: nonvolatile storage.  All namespaces are kept in the text file named by
+// SNAPPY_HOST_PREFS (default snappysense-prefs.txt), one `<short-key> <value>` per line, with
+// newlines in values written as \n, so keys must be unique across namespaces.  See ../README.md.
+
+#ifndef host_preferences_h_included
+#define host_preferences_h_included
+
+#include "Arduino.h"
+#include <map>
+
+class Preferences {
+  std::map<std::string, std::string> values;
+  bool dirty = false;
+  bool open = false;
+public:
+  bool begin(const char* ns, bool read_only = false);
+  void end();
+  bool isKey(const char* key);
+  String getString(const char* key, const String& dflt = String());
+  int getInt(const char* key, int dflt = 0);
+  size_t putString(const char* key, const String& value);
+  size_t putInt(const char* key, int value);
+};
+
+#endif // !host_preferences_h_included
@@ -0,0 +1,3 @@
+// Host build: Stream is part of the core, see Arduino.h.
+
+#include "Arduino.h"
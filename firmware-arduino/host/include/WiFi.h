@@ -0,0 +1,66 @@
+// Host build: WiFi.  Joining a network always succeeds at once, and the device is the host.
+// Clients are plain TCP sockets on the host; there is no TLS, and the server never has a caller.
+
+#ifndef host_wifi_h_included
+#define host_wifi_h_included
+
+#include "Arduino.h"
+
+#define WL_IDLE_STATUS 0
+#define WL_CONNECTED 3
+#define WL_DISCONNECTED 6
+
+class WiFiClient : public Stream {
+protected:
+  int fd = -1;
+public:
+  using Print::write;
+  WiFiClient() {}
+  WiFiClient(const WiFiClient&) = delete;
+  WiFiClient(WiFiClient&& other) : fd(other.fd) { other.fd = -1; }
+  WiFiClient& operator=(const WiFiClient&) = delete;
+  WiFiClient& operator=(WiFiClient&& other);
+  ~WiFiClient() { stop(); }
+  virtual int connect(const char* host, uint16_t port);
+  bool connected();
+  operator bool() { return connected(); }
+  void stop();
+  int available() override;
+  int read() override;
+  int peek() override;
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t* buf, size_t n) override;
+
+  // Host only: read exactly `n` bytes, waiting at most `timeout_ms` (real time) for each chunk.
+  bool host_read_fully(uint8_t* buf, size_t n, int timeout_ms);
+};
+
+class WiFiClientSecure : public WiFiClient {
+public:
+  void setCACert(const char* cert) {}
+  void setCertificate(const char* cert) {}
+  void setPrivateKey(const char* key) {}
+  int connect(const char* host, uint16_t port) override;
+};
+
+class WiFiServer {
+public:
+  WiFiServer(int port) {}
+  void begin() {}
+  WiFiClient available() { return WiFiClient(); }
+};
+
+class WiFiClass {
+  int wifi_status = WL_IDLE_STATUS;
+public:
+  int begin(const char* ssid, const char* password);
+  int status() { return wifi_status; }
+  bool disconnect(bool wifi_off = false);
+  IPAddress localIP() { return IPAddress(127, 0, 0, 1); }
+  bool softAP(const char* ssid, const char* password);
+  IPAddress softAPIP() { return IPAddress(127, 0, 0, 1); }
+};
+
+extern WiFiClass WiFi;
+
+#endif // !host_wifi_h_included
@@ -0,0 +1,3 @@
+// Host build: see WiFi.h.
+
+#include "WiFi.h"
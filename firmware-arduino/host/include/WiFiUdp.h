@@ -0,0 +1,10 @@
+// Host build: UDP is only used by the NTP client, which does not need it, see NTPClient.h.
+
+#ifndef host_wifiudp_h_included
+#define host_wifiudp_h_included
+
+#include "WiFi.h"
+
+class WiFiUDP {};
+
+#endif // !host_wifiudp_h_included
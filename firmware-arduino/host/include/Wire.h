@@ -0,0 +1,35 @@
+// Host build: the I2C bus.  The simulated devices are faked at the library level, and answer only
+// register reads on the bus itself, see sim/devices.cpp.
+
+#ifndef host_wire_h_included
+#define host_wire_h_included
+
+#include "Arduino.h"
+
+class TwoWire : public Stream {
+  uint8_t tx_addr = 0;
+  uint8_t tx_buf[128];
+  size_t tx_len = 0;
+  uint8_t rx_buf[128];
+  size_t rx_len = 0;
+  size_t rx_pos = 0;
+  int reg_addr = -1;            // Register address written by the last transaction, or -1
+  bool running = false;
+public:
+  using Print::write;
+  bool begin(int sda = -1, int scl = -1, uint32_t freq = 0);
+  bool end();
+  bool setClock(uint32_t freq) { return true; }
+  void beginTransmission(uint8_t addr);
+  uint8_t endTransmission(bool send_stop = true);
+  uint8_t requestFrom(uint8_t addr, uint8_t n, bool send_stop = true);
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t* buf, size_t n) override;
+  int available() override;
+  int read() override;
+  int peek() override;
+};
+
+extern TwoWire Wire;
+
+#endif // !host_wire_h_included
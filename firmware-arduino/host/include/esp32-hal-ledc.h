@@ -0,0 +1,10 @@
+// Host build: the LEDC peripheral that drives the piezo.  Silent.
+
+#ifndef host_esp32_hal_ledc_h_included
+#define host_esp32_hal_ledc_h_included
+
+static inline void ledcAttachPin(int pin, int chan) {}
+static inline void ledcWriteTone(int chan, int freq) {}
+static inline void ledcWrite(int chan, int duty) {}
+
+#endif // !host_esp32_hal_ledc_h_included
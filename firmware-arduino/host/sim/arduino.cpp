@@ -0,0 +1,248 @@
+// Host build: strings, streams, the serial port, pins, and time.
+
+#include "host.h"
+
+#include <Arduino.h>
+#include <poll.h>
+#include <unistd.h>
+#include <atomic>
+#include <mutex>
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//
+// String
+
+String String::substring(unsigned from, unsigned to) const {
+  if (to > s.length()) {
+    to = s.length();
+  }
+  if (from >= to) {
+    return String();
+  }
+  return String(s.c_str() + from, to - from);
+}
+
+int String::indexOf(char c, unsigned from) const {
+  size_t i = s.find(c, from);
+  return i == std::string::npos ? -1 : int(i);
+}
+
+int String::indexOf(const char* p) const {
+  size_t i = s.find(p);
+  return i == std::string::npos ? -1 : int(i);
+}
+
+void String::trim() {
+  size_t first = 0;
+  while (first < s.length() && isspace((unsigned char)s[first])) {
+    first++;
+  }
+  size_t last = s.length();
+  while (last > first && isspace((unsigned char)s[last-1])) {
+    last--;
+  }
+  s = s.substr(first, last - first);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Print and Stream
+
+size_t Print::write(const uint8_t* buf, size_t n) {
+  size_t k = 0;
+  while (k < n && write(buf[k])) {
+    k++;
+  }
+  return k;
+}
+
+size_t Print::printf(const char* fmt, ...) {
+  char small[256];
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(small, sizeof(small), fmt, args);
+  va_end(args);
+  if (n < 0) {
+    return 0;
+  }
+  if (size_t(n) < sizeof(small)) {
+    return write((const uint8_t*)small, n);
+  }
+  std::string big(n + 1, 0);
+  va_start(args, fmt);
+  vsnprintf(&big[0], n + 1, fmt, args);
+  va_end(args);
+  return write((const uint8_t*)big.data(), n);
+}
+
+size_t Stream::readBytes(char* buf, size_t n) {
+  size_t k = 0;
+  unsigned long start = millis();
+  while (k < n) {
+    int c = read();
+    if (c >= 0) {
+      buf[k++] = c;
+    } else if (millis() - start >= timeout_ms) {
+      break;
+    } else {
+      delay(1);
+    }
+  }
+  return k;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Serial port
+
+HardwareSerial Serial;
+
+static std::mutex serial_lock;
+static bool at_line_start = true;
+static int stdin_peek = -1;
+
+static bool stdin_ready() {
+  struct pollfd p = { 0, POLLIN, 0 };
+  return poll(&p, 1, 0) == 1 && (p.revents & POLLIN);
+}
+
+int HardwareSerial::available() {
+  std::lock_guard<std::mutex> g(serial_lock);
+  if (stdin_peek < 0 && stdin_ready()) {
+    unsigned char c;
+    if (::read(0, &c, 1) == 1) {
+      stdin_peek = c;
+    }
+  }
+  return stdin_peek >= 0 ? 1 : 0;
+}
+
+int HardwareSerial::peek() {
+  available();
+  return stdin_peek;
+}
+
+int HardwareSerial::read() {
+  available();
+  std::lock_guard<std::mutex> g(serial_lock);
+  int c = stdin_peek;
+  stdin_peek = -1;
+  return c;
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t* buf, size_t n) {
+  std::lock_guard<std::mutex> g(serial_lock);
+  for ( size_t i = 0; i < n; i++ ) {
+    if (buf[i] == '\r') {
+      continue;
+    }
+    if (at_line_start) {
+      uint64_t ms = host::now_us() / 1000;
+      fprintf(stdout, "%02u:%02u:%02u.%03u > ", unsigned(ms / 3600000), unsigned(ms / 60000 % 60),
+              unsigned(ms / 1000 % 60), unsigned(ms % 1000));
+    }
+    fputc(buf[i], stdout);
+    at_line_start = buf[i] == '\n';
+  }
+  fflush(stdout);
+  return n;
+}
+
+void HardwareSerial::flush() {
+  fflush(stdout);
+}
+
+String IPAddress::toString() const {
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%u.%u.%u.%u", bytes[0], bytes[1], bytes[2], bytes[3]);
+  return String(buf);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Time
+
+unsigned long millis() {
+  return host::now_us() / 1000;
+}
+
+unsigned long micros() {
+  return host::now_us();
+}
+
+void delay(unsigned long ms) {
+  vTaskDelay(pdMS_TO_TICKS(ms));
+}
+
+// On the device this spins; here the task blocks, so that the clock can move.
+void delayMicroseconds(uint32_t us) {
+  auto l = host::lock();
+  uint64_t deadline = host::now_us() + us;
+  while (host::block(l, deadline)) {}
+}
+
+int64_t esp_timer_get_time() {
+  return host::now_us();
+}
+
+// The device's clock is at the epoch when it boots, until NTP sets it.
+static std::atomic<int64_t> time_of_day_offset_us;
+
+time_t host_time(time_t* t) {
+  time_t now = (time_of_day_offset_us + int64_t(host::now_us())) / 1000000;
+  if (t != nullptr) {
+    *t = now;
+  }
+  return now;
+}
+
+int host_gettimeofday(struct timeval* tv, void* tz) {
+  int64_t now = time_of_day_offset_us + int64_t(host::now_us());
+  tv->tv_sec = now / 1000000;
+  tv->tv_usec = now % 1000000;
+  return 0;
+}
+
+int host_settimeofday(const struct timeval* tv, const void* tz) {
+  time_of_day_offset_us = int64_t(tv->tv_sec) * 1000000 + tv->tv_usec - int64_t(host::now_us());
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//
+// The rest of the core
+
+EspClass ESP;
+
+uint32_t EspClass::getFreeHeap() {
+  return 200000;
+}
+
+uint32_t EspClass::getMinFreeHeap() {
+  return 180000;
+}
+
+uint32_t EspClass::getCycleCount() {
+  return uint32_t(host::now_us() * getCpuFreqMHz());
+}
+
+void randomSeed(unsigned long seed) {
+  srandom(seed);
+}
+
+long random(long limit) {
+  return limit <= 0 ? 0 : ::random() % limit;
+}
+
+long random(long lo, long hi) {
+  return lo + random(hi - lo);
+}
+
+void esp_restart() {
+  Serial.println("host: restart requested");
+  host::finish(0);
+}
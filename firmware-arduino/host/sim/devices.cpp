@@ -0,0 +1,892 @@
+// Host build: the pins and peripherals of a SnappySense 1.1.0, and the environment they observe.
+//
+// The sensor libraries are faked at the register level, with the register layouts and conversions
+// of the real devices, so that code that reads registers directly sees the same values as the
+// library getters.  Peripherals lose their state when the peripheral power pin goes low.
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "host.h"
+
+#include <Arduino.h>
+#include <Adafruit_SSD1306.h>
+#include <DFRobot_ENS160.h>
+#include <DFRobot_EnvironmentalSensor.h>
+#include <Preferences.h>
+#include <Wire.h>
+#include <driver/adc.h>
+
+#define POWER_ENABLE_PIN A0
+#define BUTTON_PIN A1
+#define PIR_SENSOR_PIN A2
+#define MIC_PIN A3
+#define AIR_INT_PIN A4
+
+#define I2C_AIR_ADDRESS  0x53
+#define I2C_DHT_ADDRESS  0x22
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//
+// The environment, as a function of time since boot
+
+static double seconds() {
+  return host::now_us() / 1e6;
+}
+
+static double daily(double lo, double hi) {
+  return lo + (hi - lo) * (0.5 - 0.5 * cos(2 * M_PI * seconds() / 86400));
+}
+
+static bool motion_at(double t) {
+  // Someone walks by for half a minute every four minutes, and someone else twitches for half a
+  // second every twenty seconds.
+  return fmod(t, 240) < 30 || fmod(t, 20) < 0.5;
+}
+
+// The first time after `t` at which motion_at() may change.
+static double next_motion_change(double t) {
+  static const struct { double period; double offset; } edges[] = {
+    { 240, 0 }, { 240, 30 }, { 20, 0 }, { 20, 0.5 },
+  };
+  double next = HUGE_VAL;
+  for ( auto& e : edges ) {
+    double k = floor((t - e.offset) / e.period) + 1;
+    next = std::min(next, k * e.period + e.offset);
+  }
+  return next;
+}
+
+static bool motion_now() {
+  return motion_at(seconds());
+}
+
+// The microphone's output at time `t`, in ADC units: a bias of about 1.5V with some hiss, and a
+// 440Hz tone that gets louder while someone is walking by.
+static unsigned mic_at(double t) {
+  double amplitude = motion_at(t) ? 600 : 60;
+  double v = 1800 + amplitude * sin(2 * M_PI * 440 * t) + random(-40, 40);
+  return v < 0 ? 0 : v > 4095 ? 4095 : unsigned(v);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Pins
+
+static bool peripheral_power;
+static uint64_t peripheral_power_on_us;
+
+static bool ens160_int_level();
+static void ens160_power_changed(bool on);
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+
+int digitalRead(uint8_t pin) {
+  if (pin == PIR_SENSOR_PIN && peripheral_power) {
+    return motion_now() ? HIGH : LOW;
+  }
+  if (pin == AIR_INT_PIN && peripheral_power) {
+    return ens160_int_level() ? HIGH : LOW;
+  }
+  return LOW;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+  if (pin == POWER_ENABLE_PIN) {
+    if (val && !peripheral_power) {
+      peripheral_power_on_us = host::now_us();
+    }
+    if ((val != 0) != peripheral_power) {
+      ens160_power_changed(val != 0);
+    }
+    peripheral_power = val != 0;
+  }
+}
+
+int analogRead(uint8_t pin) {
+  if (!peripheral_power) {
+    return 0;
+  }
+  switch (pin) {
+    case PIR_SENSOR_PIN:
+      return motion_now() ? 4095 : 0;
+    case MIC_PIN:
+      return mic_at(seconds());
+    default:
+      return random(4096);
+  }
+}
+
+// The button is never pressed, so only the PIR's and the air sensor's interrupts fire.  A task
+// watches the PIR's level and calls its handler on every change, as if from the ISR; the air
+// sensor's task is with the sensor, below.
+
+static std::atomic<void (*)()> pir_handler;
+static std::atomic<void (*)()> air_handler;
+static void air_edges(void*);
+
+static void pir_edges(void*) {
+  bool level = peripheral_power && motion_now();
+  for (;;) {
+    double next = next_motion_change(seconds());
+    vTaskDelay(std::max<uint64_t>(1, uint64_t(ceil((next - seconds()) * 1000))));
+    bool now = peripheral_power && motion_now();
+    if (now != level) {
+      level = now;
+      void (*handler)() = pir_handler;
+      if (handler != nullptr) {
+        handler();
+      }
+    }
+  }
+}
+
+void attachInterrupt(uint8_t pin, void (*handler)(), int mode) {
+  static bool pir_started, air_started;
+  if (pin == PIR_SENSOR_PIN) {
+    pir_handler = handler;
+    if (!pir_started) {
+      pir_started = true;
+      xTaskCreate(pir_edges, "sim-pir", 2048, nullptr, 1, nullptr);
+    }
+  } else if (pin == AIR_INT_PIN) {
+    air_handler = handler;
+    if (!air_started) {
+      air_started = true;
+      xTaskCreate(air_edges, "sim-air", 2048, nullptr, 1, nullptr);
+    }
+  }
+}
+
+void detachInterrupt(uint8_t pin) {
+  if (pin == PIR_SENSOR_PIN) {
+    pir_handler = nullptr;
+  } else if (pin == AIR_INT_PIN) {
+    air_handler = nullptr;
+  }
+}
+
+esp_err_t gpio_pullup_dis(gpio_num_t pin) {
+  return ESP_OK;
+}
+
+esp_err_t gpio_pulldown_en(gpio_num_t pin) {
+  return ESP_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//
+// ADC in continuous mode.  Conversions come in whole DMA frames at the configured rate; if the
+// reader falls more than the store size behind, the oldest frames are dropped and the read that
+// notices reports ESP_ERR_INVALID_STATE, like the driver does.
+
+static const uint8_t ADC1_PINS[] = { 36, 37, 38, 39, 32, 33, 34, 35 };
+
+static struct {
+  bool initialized;
+  bool running;
+  uint32_t frame_conversions;
+  uint32_t store_conversions;
+  uint32_t rate_hz;
+  uint8_t channel;
+  uint64_t start_us;
+  uint64_t consumed;            // Conversions read or dropped since start
+} adc_dma;
+
+esp_err_t adc_digi_initialize(const adc_digi_init_config_t* init) {
+  if (adc_dma.initialized || init->conv_num_each_intr < SOC_ADC_DIGI_RESULT_BYTES) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  adc_dma.initialized = true;
+  adc_dma.frame_conversions = init->conv_num_each_intr / SOC_ADC_DIGI_RESULT_BYTES;
+  adc_dma.store_conversions = init->max_store_buf_size / SOC_ADC_DIGI_RESULT_BYTES;
+  return ESP_OK;
+}
+
+esp_err_t adc_digi_deinitialize() {
+  adc_dma.initialized = false;
+  adc_dma.running = false;
+  return ESP_OK;
+}
+
+esp_err_t adc_digi_controller_configure(const adc_digi_configuration_t* config) {
+  // Only a single-channel ADC1 pattern is simulated.
+  if (!adc_dma.initialized || config->pattern_num != 1 || config->adc_pattern[0].unit != 0 ||
+      config->adc_pattern[0].channel > 7 || config->sample_freq_hz < 20000) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  adc_dma.channel = config->adc_pattern[0].channel;
+  adc_dma.rate_hz = config->sample_freq_hz;
+  return ESP_OK;
+}
+
+esp_err_t adc_digi_start() {
+  if (!adc_dma.initialized || adc_dma.rate_hz == 0) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  adc_dma.running = true;
+  adc_dma.start_us = host::now_us();
+  adc_dma.consumed = 0;
+  return ESP_OK;
+}
+
+esp_err_t adc_digi_stop() {
+  adc_dma.running = false;
+  return ESP_OK;
+}
+
+static uint64_t adc_converted() {
+  uint64_t n = (host::now_us() - adc_dma.start_us) * adc_dma.rate_hz / 1000000;
+  return n - n % adc_dma.frame_conversions;
+}
+
+esp_err_t adc_digi_read_bytes(uint8_t* buf, uint32_t length_max, uint32_t* out_length,
+                              uint32_t timeout_ms) {
+  *out_length = 0;
+  if (!adc_dma.running) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  uint64_t deadline = host::now_us() + uint64_t(timeout_ms) * 1000;
+  while (adc_converted() <= adc_dma.consumed) {
+    uint64_t next_frame = adc_dma.consumed + adc_dma.frame_conversions;
+    uint64_t ready_us = adc_dma.start_us + (next_frame * 1000000 + adc_dma.rate_hz - 1) / adc_dma.rate_hz;
+    uint64_t wake_us = std::min(ready_us, deadline);
+    if (host::now_us() >= deadline) {
+      return ESP_ERR_TIMEOUT;
+    }
+    vTaskDelay(std::max<uint64_t>(1, (wake_us - host::now_us() + 999) / 1000));
+  }
+  esp_err_t res = ESP_OK;
+  uint64_t available = adc_converted() - adc_dma.consumed;
+  if (available > adc_dma.store_conversions) {
+    uint64_t keep = adc_dma.store_conversions - adc_dma.store_conversions % adc_dma.frame_conversions;
+    adc_dma.consumed += available - keep;
+    available = keep;
+    res = ESP_ERR_INVALID_STATE;
+  }
+  uint64_t n = std::min<uint64_t>(available, length_max / SOC_ADC_DIGI_RESULT_BYTES);
+  uint8_t pin = ADC1_PINS[adc_dma.channel];
+  for ( uint64_t i = 0; i < n; i++ ) {
+    double t = (adc_dma.start_us + (adc_dma.consumed + i) * 1000000.0 / adc_dma.rate_hz) / 1e6;
+    adc_digi_output_data_t d;
+    d.type1.data = !peripheral_power ? 0 : pin == MIC_PIN ? mic_at(t) : pin == PIR_SENSOR_PIN && motion_at(t) ? 4095 : 0;
+    d.type1.channel = adc_dma.channel;
+    memcpy(buf + i * SOC_ADC_DIGI_RESULT_BYTES, &d, SOC_ADC_DIGI_RESULT_BYTES);
+  }
+  adc_dma.consumed += n;
+  *out_length = n * SOC_ADC_DIGI_RESULT_BYTES;
+  return res;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//
+// I2C.  The simulated sensors are mostly faked at the library level, but they also answer register
+// reads on the bus: a write of the register address followed by requestFrom().  Every other
+// transaction is NAKed.
+
+TwoWire Wire;
+
+static bool bus_read(uint8_t addr, uint8_t reg, uint8_t* buf, size_t n);
+
+bool TwoWire::begin(int sda, int scl, uint32_t freq) {
+  running = true;
+  return true;
+}
+
+bool TwoWire::end() {
+  running = false;
+  return true;
+}
+
+void TwoWire::beginTransmission(uint8_t addr) {
+  tx_addr = addr;
+  tx_len = 0;
+}
+
+uint8_t TwoWire::endTransmission(bool send_stop) {
+  if (!running || tx_len != 1 || !bus_read(tx_addr, tx_buf[0], nullptr, 0)) {
+    reg_addr = -1;
+    return 2;
+  }
+  reg_addr = tx_buf[0];
+  return 0;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t addr, uint8_t n, bool send_stop) {
+  rx_len = rx_pos = 0;
+  if (!running || addr != tx_addr || reg_addr < 0 || n > sizeof(rx_buf) ||
+      !bus_read(addr, reg_addr, rx_buf, n)) {
+    return 0;
+  }
+  reg_addr = -1;
+  rx_len = n;
+  return n;
+}
+
+size_t TwoWire::write(uint8_t c) {
+  if (tx_len == sizeof(tx_buf)) {
+    return 0;
+  }
+  tx_buf[tx_len++] = c;
+  return 1;
+}
+
+size_t TwoWire::write(const uint8_t* buf, size_t n) {
+  return Print::write(buf, n);
+}
+
+int TwoWire::available() {
+  return rx_len - rx_pos;
+}
+
+int TwoWire::read() {
+  return rx_pos < rx_len ? rx_buf[rx_pos++] : -1;
+}
+
+int TwoWire::peek() {
+  return rx_pos < rx_len ? rx_buf[rx_pos] : -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//
+// OLED display
+
+void Adafruit_SSD1306::display() {
+  if (getenv("SNAPPY_HOST_OLED") != nullptr && peripheral_power) {
+    fprintf(stderr, "[oled] %s\n", text.c_str());
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//
+// SEN0500 environmental sensor: 16-bit big-endian registers
+
+static std::atomic<uint64_t> sen0500_transactions;
+
+
+#define SEN0500_REG_DEVICE_ADDR 0x02
+#define SEN0500_REG_UV          0x08
+#define SEN0500_REG_LUX         0x09
+#define SEN0500_REG_TEMP        0x0A
+#define SEN0500_REG_HUMIDITY    0x0B
+#define SEN0500_REG_PRESSURE    0x0C
+
+static uint16_t sen0500_register(uint8_t addr, uint8_t reg) {
+  switch (reg) {
+    case SEN0500_REG_DEVICE_ADDR:
+      return addr;
+    case SEN0500_REG_UV: {
+      double uv = daily(0, 3);
+      return uint16_t((uv * (2.9 - 0.99) / 15 + 0.99) * 1024 / 3);
+    }
+    case SEN0500_REG_LUX:
+      return uint16_t(daily(5, 400));
+    case SEN0500_REG_TEMP:
+      return uint16_t((daily(19, 23) + 45) * 65536 / 175);
+    case SEN0500_REG_HUMIDITY:
+      return uint16_t(daily(45, 35) * 65536 / 100);
+    case SEN0500_REG_PRESSURE:
+      return uint16_t(daily(1008, 1016));
+    default:
+      return 0;
+  }
+}
+
+// The device sits behind a protocol adapter: on the bus, register `reg` is at byte address 2*reg.
+static void sen0500_read(uint8_t addr, unsigned byte_addr, uint8_t* buf, size_t n) {
+  sen0500_transactions++;
+  for ( size_t i = 0; i < n; i++ ) {
+    unsigned b = byte_addr + i;
+    uint16_t v = sen0500_register(addr, b / 2);
+    buf[i] = b % 2 == 0 ? v >> 8 : v & 255;
+  }
+}
+
+uint8_t DFRobot_EnvironmentalSensor::readReg(uint8_t reg, void* buf, uint8_t n) {
+  sen0500_read(addr, reg * 2, (uint8_t*)buf, n);
+  return n;
+}
+
+static uint16_t read16(DFRobot_EnvironmentalSensor* s, uint8_t reg,
+                       uint8_t (DFRobot_EnvironmentalSensor::*rd)(uint8_t, void*, uint8_t)) {
+  uint8_t buf[2];
+  (s->*rd)(reg, buf, 2);
+  return (buf[0] << 8) | buf[1];
+}
+
+#define REG(r) read16(this, r, &DFRobot_EnvironmentalSensor::readReg)
+
+int8_t DFRobot_EnvironmentalSensor::begin() {
+  return peripheral_power && REG(SEN0500_REG_DEVICE_ADDR) == addr ? 0 : -1;
+}
+
+float DFRobot_EnvironmentalSensor::getTemperature(uint8_t units) {
+  float t = -45.0f + (REG(SEN0500_REG_TEMP) * 175.0f) / 1024.0f / 64.0f;
+  return units == TEMP_F ? t * 1.8f + 32.0f : t;
+}
+
+float DFRobot_EnvironmentalSensor::getHumidity() {
+  return REG(SEN0500_REG_HUMIDITY) * 100.0f / 65536.0f;
+}
+
+float DFRobot_EnvironmentalSensor::getUltravioletIntensity() {
+  float volts = 3.0f * REG(SEN0500_REG_UV) / 1024.0f;
+  return (volts - 0.99f) * 15.0f / (2.9f - 0.99f);
+}
+
+float DFRobot_EnvironmentalSensor::getLuminousIntensity() {
+  float lux = REG(SEN0500_REG_LUX);
+  return lux * (1.0023f + lux * (8.1488e-5f + lux * (-9.3924e-9f + lux * 6.0135e-13f)));
+}
+
+uint16_t DFRobot_EnvironmentalSensor::getAtmospherePressure(uint8_t units) {
+  uint16_t hpa = REG(SEN0500_REG_PRESSURE);
+  return units == KPA ? hpa / 10 : hpa;
+}
+
+float DFRobot_EnvironmentalSensor::getElevation() {
+  return 44330 * (1.0 - pow(getAtmospherePressure(HPA) / 1015.0f, 0.1903));
+}
+
+#undef REG
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//
+// SEN0514 (ENS160) air quality sensor: byte registers, multi-byte values little-endian.
+//
+// The sensor comes up in DEEP SLEEP when powered, and the firmware moves it between DEEP SLEEP,
+// IDLE and STANDARD with the OPMODE register.  Only in standard mode does it measure.  It is in
+// warm-up (validity 1) for the first three minutes in standard mode after power-up.  Once it has
+// warmed up it keeps its state until it loses power, and a later return to standard mode from one
+// of the low-power modes only needs a short warm-up (SNAPPY_HOST_ENS160_RESUME_S, default 3 s).
+// This resume time is not in the data sheet, it is an assumption.  The time spent in each mode,
+// the number of cold and warm starts and the wake latency (from entering standard mode until the
+// firmware first reads valid status) are printed at the end of the run.
+//
+// It takes a sample every second, which is flagged (NEWDAT) until the data are read.  If the data-ready
+// interrupt is enabled in CONFIG then INTn is asserted while NEWDAT is set.  The firmware accesses
+// the sensor from the main task and the INTn edges come from a task of their own, so the state is
+// under a lock.
+
+#define ENS160_PART_ID_REG     0x00
+#define ENS160_OPMODE_REG      0x10
+#define ENS160_CONFIG_REG      0x11
+#define ENS160_TEMP_IN_REG     0x13
+#define ENS160_RH_IN_REG       0x15
+#define ENS160_DATA_STATUS_REG 0x20
+#define ENS160_DATA_AQI_REG    0x21
+#define ENS160_DATA_TVOC_REG   0x22
+#define ENS160_DATA_ECO2_REG   0x24
+
+static std::atomic<uint64_t> ens160_transactions;
+
+static uint64_t ens160_warmup_us() {
+  static uint64_t warmup_us = [] {
+    const char* s = getenv("SNAPPY_HOST_ENS160_WARMUP_S");
+    return (s != nullptr ? strtoull(s, nullptr, 10) : 180) * 1000000ULL;
+  }();
+  return warmup_us;
+}
+
+static uint64_t ens160_resume_us() {
+  static uint64_t resume_us = [] {
+    const char* s = getenv("SNAPPY_HOST_ENS160_RESUME_S");
+    return (s != nullptr ? strtoull(s, nullptr, 10) : 3) * 1000000ULL;
+  }();
+  return resume_us;
+}
+
+static constexpr uint64_t ENS160_SAMPLE_US = 1000000;
+
+#define ENS160_CONFIG_INTEN    0x01
+#define ENS160_CONFIG_INTDAT   0x02
+#define ENS160_CONFIG_INTPOL   0x40
+
+static std::mutex ens160_lock;
+
+// Index into mode_us for the time without power.
+static constexpr int ENS160_OFF = 3;
+
+static struct {
+  uint64_t power_epoch_us;      // Value of peripheral_power_on_us when the state was valid
+  uint8_t opmode;
+  uint8_t config;
+  uint64_t standard_since_us;
+  uint64_t warmup_us;           // Warm-up needed after standard_since_us
+  bool warmed_up;               // Has completed a warm-up since power-up
+  bool warm_start;              // Entered standard mode after a completed warm-up
+  bool awaiting_valid;          // The firmware has not seen valid status since standard_since_us
+  uint64_t data_read_us;
+  uint8_t regs[0x40];
+
+  // Statistics
+  int mode = ENS160_OFF;        // opmode, or ENS160_OFF
+  uint64_t mode_since_us;
+  uint64_t mode_us[4];
+  uint64_t cold_starts;
+  uint64_t warm_starts;
+  uint64_t warm_latency_sum_us;
+  uint64_t warm_latency_max_us;
+  uint64_t cold_latency_max_us;
+} ens160;
+
+static void ens160_set_mode(int mode) {
+  uint64_t now = host::now_us();
+  ens160.mode_us[ens160.mode] += now - ens160.mode_since_us;
+  ens160.mode = mode;
+  ens160.mode_since_us = now;
+}
+
+static void ens160_power_changed(bool on) {
+  std::lock_guard<std::mutex> l(ens160_lock);
+  ens160_set_mode(on ? ENS160_SLEEP_MODE : ENS160_OFF);
+}
+
+// The time of the latest sample at `t`, or 0 if there has been none.
+static uint64_t ens160_sample_us(uint64_t t) {
+  if (ens160.opmode != ENS160_STANDARD_MODE || t < ens160.standard_since_us + ENS160_SAMPLE_US) {
+    return 0;
+  }
+  return t - (t - ens160.standard_since_us) % ENS160_SAMPLE_US;
+}
+
+// Whether a sample taken at `sample_us` is new, ie, has not been read.
+static bool ens160_is_new(uint64_t sample_us) {
+  return sample_us != 0 && sample_us > ens160.data_read_us;
+}
+
+static bool ens160_int_enabled() {
+  return (ens160.config & (ENS160_CONFIG_INTEN | ENS160_CONFIG_INTDAT)) ==
+         (ENS160_CONFIG_INTEN | ENS160_CONFIG_INTDAT);
+}
+
+static void ens160_sync() {
+  if (ens160.power_epoch_us != peripheral_power_on_us) {
+    // Power was cycled, the device has been reset.
+    ens160.power_epoch_us = peripheral_power_on_us;
+    ens160.opmode = ENS160_SLEEP_MODE;
+    ens160.config = 0;
+    ens160.data_read_us = 0;
+    ens160.warmed_up = false;
+    ens160.awaiting_valid = false;
+  }
+  memset(ens160.regs, 0, sizeof(ens160.regs));
+  ens160.regs[ENS160_PART_ID_REG] = 0x60;
+  ens160.regs[ENS160_PART_ID_REG+1] = 0x01;
+  ens160.regs[ENS160_OPMODE_REG] = ens160.opmode;
+  ens160.regs[ENS160_CONFIG_REG] = ens160.config;
+  if (ens160.opmode != ENS160_STANDARD_MODE) {
+    return;
+  }
+  uint64_t now = host::now_us();
+  unsigned validity = now - ens160.standard_since_us < ens160.warmup_us ? 1 : 0;
+  if (validity == 0) {
+    ens160.warmed_up = true;
+  }
+  bool newdat = ens160_is_new(ens160_sample_us(now));
+  ens160.regs[ENS160_DATA_STATUS_REG] = 0x80 | (validity << 2) | (newdat ? 2 : 0);
+  unsigned tvoc = motion_now() ? 400 : 120;
+  unsigned eco2 = motion_now() ? 900 : 550;
+  ens160.regs[ENS160_DATA_AQI_REG] = motion_now() ? 3 : 2;
+  ens160.regs[ENS160_DATA_TVOC_REG] = tvoc & 255;
+  ens160.regs[ENS160_DATA_TVOC_REG+1] = tvoc >> 8;
+  ens160.regs[ENS160_DATA_ECO2_REG] = eco2 & 255;
+  ens160.regs[ENS160_DATA_ECO2_REG+1] = eco2 >> 8;
+}
+
+// The physical level of INTn, taking the polarity into account.
+static bool ens160_int_level() {
+  std::lock_guard<std::mutex> l(ens160_lock);
+  ens160_sync();
+  bool asserted = ens160_int_enabled() && ens160_is_new(ens160_sample_us(host::now_us()));
+  return asserted == ((ens160.config & ENS160_CONFIG_INTPOL) != 0);
+}
+
+// INTn is asserted when a sample is taken while the previous one has been read (or there was
+// none), and is deasserted by reading the data.  Only the assertion is reported, the firmware
+// listens for nothing else.  (The polarity is not modelled here.)
+static void air_edges(void*) {
+  for (;;) {
+    uint64_t wait_us;
+    {
+      std::lock_guard<std::mutex> l(ens160_lock);
+      uint64_t now = host::now_us();
+      if (peripheral_power && ens160.opmode == ENS160_STANDARD_MODE) {
+        uint64_t since = now - ens160.standard_since_us;
+        wait_us = ENS160_SAMPLE_US - since % ENS160_SAMPLE_US;
+      } else {
+        wait_us = ENS160_SAMPLE_US;
+      }
+    }
+    vTaskDelay(std::max<uint64_t>(1, (wait_us + 999) / 1000));
+    bool edge;
+    {
+      std::lock_guard<std::mutex> l(ens160_lock);
+      if (!peripheral_power) {
+        continue;
+      }
+      ens160_sync();
+      uint64_t sample = ens160_sample_us(host::now_us());
+      edge = ens160_int_enabled() && ens160_is_new(sample) &&
+             !ens160_is_new(ens160_sample_us(sample - 1));
+    }
+    void (*handler)() = air_handler;
+    if (edge && handler != nullptr) {
+      handler();
+    }
+  }
+}
+
+static bool ens160_read(uint8_t reg, uint8_t* buf, size_t n) {
+  ens160_transactions++;
+  if (!peripheral_power) {
+    return false;
+  }
+  std::lock_guard<std::mutex> l(ens160_lock);
+  ens160_sync();
+  for ( size_t i = 0; i < n; i++ ) {
+    buf[i] = reg + i < sizeof(ens160.regs) ? ens160.regs[reg + i] : 0;
+  }
+  if (reg <= ENS160_DATA_ECO2_REG + 1 && reg + n > ENS160_DATA_AQI_REG) {
+    ens160.data_read_us = host::now_us();
+  }
+  if (reg <= ENS160_DATA_STATUS_REG && reg + n > ENS160_DATA_STATUS_REG &&
+      ens160.opmode == ENS160_STANDARD_MODE && ens160.awaiting_valid && (ens160.regs[ENS160_DATA_STATUS_REG] & 0x0C) == 0) {
+    ens160.awaiting_valid = false;
+    uint64_t latency = host::now_us() - ens160.standard_since_us;
+    if (ens160.warm_start) {
+      ens160.warm_latency_sum_us += latency;
+      ens160.warm_latency_max_us = std::max(ens160.warm_latency_max_us, latency);
+    } else {
+      ens160.cold_latency_max_us = std::max(ens160.cold_latency_max_us, latency);
+    }
+  }
+  return true;
+}
+
+int16_t DFRobot_ENS160_I2C::readReg(uint8_t reg, void* buf, size_t n) {
+  return ens160_read(reg, (uint8_t*)buf, n) ? 0 : -1;
+}
+
+void DFRobot_ENS160_I2C::writeReg(uint8_t reg, const void* buf, size_t n) {
+  ens160_transactions++;
+  if (!peripheral_power || n == 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> l(ens160_lock);
+  ens160_sync();
+  uint8_t v = *(const uint8_t*)buf;
+  switch (reg) {
+    case ENS160_OPMODE_REG:
+      if (v == ENS160_STANDARD_MODE && ens160.opmode != ENS160_STANDARD_MODE) {
+        ens160.standard_since_us = host::now_us();
+        ens160.warm_start = ens160.warmed_up;
+        ens160.warmup_us = ens160.warm_start ? ens160_resume_us() : ens160_warmup_us();
+        ens160.awaiting_valid = true;
+        if (ens160.warm_start) {
+          ens160.warm_starts++;
+        } else {
+          ens160.cold_starts++;
+        }
+      }
+      if (v <= ENS160_STANDARD_MODE) {
+        ens160.opmode = v;
+        ens160_set_mode(v);
+      }
+      break;
+    case ENS160_CONFIG_REG:
+      ens160.config = v;
+      break;
+  }
+}
+
+int DFRobot_ENS160_I2C::begin() {
+  uint8_t id[2];
+  if (readReg(ENS160_PART_ID_REG, id, 2) != 0 || (id[0] | (id[1] << 8)) != 0x160) {
+    return -1;
+  }
+  setPWRMode(ENS160_STANDARD_MODE);
+  setINTMode(0);
+  return 0;
+}
+
+void DFRobot_ENS160_I2C::setPWRMode(uint8_t mode) {
+  writeReg(ENS160_OPMODE_REG, &mode, 1);
+}
+
+void DFRobot_ENS160_I2C::setINTMode(uint8_t mode) {
+  writeReg(ENS160_CONFIG_REG, &mode, 1);
+}
+
+void DFRobot_ENS160_I2C::setTempAndHum(float ambient_temp, float relative_humidity) {
+  uint16_t t = uint16_t((ambient_temp + 273.15f) * 64);
+  uint16_t h = uint16_t(relative_humidity * 512);
+  uint8_t buf[4] = { uint8_t(t & 255), uint8_t(t >> 8), uint8_t(h & 255), uint8_t(h >> 8) };
+  writeReg(ENS160_TEMP_IN_REG, buf, 4);
+}
+
+uint8_t DFRobot_ENS160_I2C::getENS160Status() {
+  uint8_t v = 0;
+  readReg(ENS160_DATA_STATUS_REG, &v, 1);
+  return (v >> 2) & 3;
+}
+
+uint8_t DFRobot_ENS160_I2C::getAQI() {
+  uint8_t v = 0;
+  readReg(ENS160_DATA_AQI_REG, &v, 1);
+  return v & 7;
+}
+
+uint16_t DFRobot_ENS160_I2C::getTVOC() {
+  uint8_t buf[2] = {};
+  readReg(ENS160_DATA_TVOC_REG, buf, 2);
+  return buf[0] | (buf[1] << 8);
+}
+
+uint16_t DFRobot_ENS160_I2C::getECO2() {
+  uint8_t buf[2] = {};
+  readReg(ENS160_DATA_ECO2_REG, buf, 2);
+  return buf[0] | (buf[1] << 8);
+}
+
+// A read of `n` bytes from register `reg` of the device at `addr`; with n == 0 it only checks that
+// the device is there to answer.  This does not count as a transaction.
+static bool bus_read(uint8_t addr, uint8_t reg, uint8_t* buf, size_t n) {
+  if (!peripheral_power) {
+    return false;
+  }
+  if (n == 0) {
+    return addr == I2C_AIR_ADDRESS || addr == I2C_DHT_ADDRESS;
+  }
+  switch (addr) {
+    case I2C_AIR_ADDRESS:
+      return ens160_read(reg, buf, n);
+    case I2C_DHT_ADDRESS:
+      sen0500_read(addr, reg, buf, n);
+      return true;
+    default:
+      return false;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Nonvolatile storage
+//
+// The map and the file stand in for the flash, so they are the simulator's and are managed in the
+// kernel, see host::in_kernel().  That also keeps tasks that use the storage at the same time from
+// overwriting each other's file.
+
+static std::string prefs_file() {
+  const char* f = getenv("SNAPPY_HOST_PREFS");
+  return f != nullptr ? f : "snappysense-prefs.txt";
+}
+
+bool Preferences::begin(const char* ns, bool read_only) {
+  auto l = host::lock();
+  values.clear();
+  FILE* f = fopen(prefs_file().c_str(), "r");
+  if (f == nullptr) {
+    if (read_only) {
+      return false;
+    }
+  } else {
+    char line[4096];
+    while (fgets(line, sizeof(line), f) != nullptr) {
+      char* sp = strchr(line, ' ');
+      if (line[0] == '#' || sp == nullptr) {
+        continue;
+      }
+      std::string value;
+      for ( char* p = sp + 1; *p && *p != '\n'; p++ ) {
+        if (p[0] == '\\' && p[1] == 'n') {
+          value += '\n';
+          p++;
+        } else {
+          value += *p;
+        }
+      }
+      values[std::string(line, sp - line)] = value;
+    }
+    fclose(f);
+  }
+  open = true;
+  dirty = false;
+  return true;
+}
+
+void Preferences::end() {
+  auto l = host::lock();
+  if (open && dirty) {
+    FILE* f = fopen(prefs_file().c_str(), "w");
+    if (f != nullptr) {
+      for ( auto& kv : values ) {
+        fprintf(f, "%s ", kv.first.c_str());
+        for ( char c : kv.second ) {
+          if (c == '\n') {
+            fputs("\\n", f);
+          } else {
+            fputc(c, f);
+          }
+        }
+        fputc('\n', f);
+      }
+      fclose(f);
+    }
+  }
+  open = false;
+}
+
+bool Preferences::isKey(const char* key) {
+  return values.count(key) > 0;
+}
+
+String Preferences::getString(const char* key, const String& dflt) {
+  auto it = values.find(key);
+  return it == values.end() ? dflt : String(it->second.c_str());
+}
+
+int Preferences::getInt(const char* key, int dflt) {
+  auto it = values.find(key);
+  return it == values.end() ? dflt : atoi(it->second.c_str());
+}
+
+size_t Preferences::putString(const char* key, const String& value) {
+  auto l = host::lock();
+  values[key] = value.c_str();
+  dirty = true;
+  return value.length();
+}
+
+size_t Preferences::putInt(const char* key, int value) {
+  auto l = host::lock();
+  values[key] = std::to_string(value);
+  dirty = true;
+  return sizeof(int);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Statistics
+
+void host::print_device_stats() {
+  printf("host: i2c transactions: sen0500 %llu, ens160 %llu\n",
+         (unsigned long long)sen0500_transactions, (unsigned long long)ens160_transactions);
+  std::lock_guard<std::mutex> l(ens160_lock);
+  ens160_set_mode(ens160.mode);
+  printf("host: ens160 seconds: off %llu, deep sleep %llu, idle %llu, standard %llu\n",
+         (unsigned long long)(ens160.mode_us[ENS160_OFF] / 1000000),
+         (unsigned long long)(ens160.mode_us[ENS160_SLEEP_MODE] / 1000000),
+         (unsigned long long)(ens160.mode_us[ENS160_IDLE_MODE] / 1000000),
+         (unsigned long long)(ens160.mode_us[ENS160_STANDARD_MODE] / 1000000));
+  printf("host: ens160 starts: cold %llu (max latency %llu ms), warm %llu (avg latency %llu ms, "
+         "max %llu ms)\n",
+         (unsigned long long)ens160.cold_starts,
+         (unsigned long long)(ens160.cold_latency_max_us / 1000),
+         (unsigned long long)ens160.warm_starts,
+         (unsigned long long)(ens160.warm_starts == 0 ? 0 :
+                              ens160.warm_latency_sum_us / ens160.warm_starts / 1000),
+         (unsigned long long)(ens160.warm_latency_max_us / 1000));
+}
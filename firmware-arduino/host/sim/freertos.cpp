@@ -0,0 +1,366 @@
+// Host build: the scheduler, the simulated clock, and FreeRTOS tasks, queues, semaphores and
+// notifications on top of them.  See host.h.
+
+#include "host.h"
+
+#include <Arduino.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <set>
+#include <string>
+#include <thread>
+
+namespace host {
+
+bool realtime = false;
+uint64_t run_for_us = FOREVER;
+
+static std::mutex kernel_lock;
+static std::condition_variable kernel_cv;
+static std::chrono::steady_clock::time_point boot_time = std::chrono::steady_clock::now();
+
+// Virtual time state, protected by kernel_lock.  `running` is the number of tasks that are not
+// blocked; `blocked` the number that are; `deadlines` has one entry per blocked task.  A wakeup
+// bumps `generation` and makes every blocked task runnable.
+static std::atomic<uint64_t> virtual_now;
+static int running;
+static int blocked;
+static uint64_t generation;
+static std::multiset<uint64_t> deadlines;
+
+uint64_t now_us() {
+  if (realtime) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - boot_time).count();
+  }
+  return virtual_now;
+}
+
+static thread_local int kernel_depth;
+
+KernelLock::KernelLock() : std::unique_lock<std::mutex>(kernel_lock) {
+  kernel_depth++;
+}
+
+KernelLock::~KernelLock() {
+  kernel_depth--;
+}
+
+KernelLock lock() {
+  return KernelLock();
+}
+
+bool in_kernel() {
+  return kernel_depth > 0;
+}
+
+void wake_all() {
+  generation++;
+  running += blocked;
+  blocked = 0;
+  kernel_cv.notify_all();
+}
+
+// Every task is blocked: move the clock to the earliest deadline and let everyone recheck.
+static void advance() {
+  if (deadlines.empty() || *deadlines.begin() == FOREVER) {
+    fprintf(stderr, "host: every task is blocked forever\n");
+    finish(1);
+  }
+  uint64_t next = *deadlines.begin();
+  if (next >= run_for_us) {
+    virtual_now = run_for_us;
+    finish(0);
+  }
+  if (next > virtual_now) {
+    virtual_now = next;
+  }
+  wake_all();
+}
+
+bool block(std::unique_lock<std::mutex>& l, uint64_t deadline_us) {
+  if (now_us() >= deadline_us) {
+    return false;
+  }
+  uint64_t gen = generation;
+  if (realtime) {
+    while (gen == generation && now_us() < deadline_us) {
+      if (deadline_us == FOREVER) {
+        kernel_cv.wait(l);
+      } else {
+        kernel_cv.wait_until(l, boot_time + std::chrono::microseconds(deadline_us));
+      }
+    }
+    return now_us() < deadline_us;
+  }
+  auto it = deadlines.insert(deadline_us);
+  running--;
+  blocked++;
+  if (running == 0) {
+    advance();
+  }
+  while (gen == generation) {
+    kernel_cv.wait(l);
+  }
+  deadlines.erase(it);
+  return virtual_now < deadline_us;
+}
+
+uint64_t deadline_after(uint32_t ticks) {
+  if (ticks == portMAX_DELAY) {
+    return FOREVER;
+  }
+  return now_us() + uint64_t(ticks) * 1000;
+}
+
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Tasks
+
+struct HostTask {
+  const char* name;
+  TaskFunction_t fn;
+  void* arg;
+  uint32_t notify_value;
+};
+
+// Thrown by vTaskDelete(nullptr) to unwind the task's thread.
+struct TaskExit {};
+
+static thread_local HostTask* current_task;
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char* name, uint32_t stack_size, void* arg,
+                       UBaseType_t priority, TaskHandle_t* handle) {
+  HostTask* t = new HostTask { name, fn, arg, 0 };
+  {
+    // Count the task as running before it starts, or the clock could move before it gets going.
+    auto l = host::lock();
+    host::running++;
+  }
+  std::thread([t]() {
+    current_task = t;
+    try {
+      t->fn(t->arg);
+      fprintf(stderr, "host: task %s returned\n", t->name);
+      abort();
+    } catch (TaskExit&) {
+    }
+    auto l = host::lock();
+    host::running--;
+    if (host::running == 0 && host::blocked > 0) {
+      host::advance();
+    }
+  }).detach();
+  if (handle != nullptr) {
+    *handle = t;
+  }
+  return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stack_size, void* arg,
+                                   UBaseType_t priority, TaskHandle_t* handle, BaseType_t core) {
+  return xTaskCreate(fn, name, stack_size, arg, priority, handle);
+}
+
+void vTaskDelete(TaskHandle_t task) {
+  if (task != nullptr && task != current_task) {
+    fprintf(stderr, "host: deleting another task is not supported\n");
+    abort();
+  }
+  throw TaskExit();
+}
+
+void vTaskDelay(TickType_t ticks) {
+  auto l = host::lock();
+  uint64_t deadline = host::deadline_after(ticks);
+  while (host::block(l, deadline)) {}
+}
+
+TickType_t xTaskGetTickCount() {
+  return TickType_t(host::now_us() / 1000);
+}
+
+TickType_t xTaskGetTickCountFromISR() {
+  return xTaskGetTickCount();
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+  return current_task;
+}
+
+BaseType_t xPortGetCoreID() {
+  return 1;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+  auto l = host::lock();
+  task->notify_value++;
+  host::wake_all();
+  return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* woken) {
+  xTaskNotifyGive(task);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t timeout) {
+  auto l = host::lock();
+  HostTask* t = current_task;
+  uint64_t deadline = host::deadline_after(timeout);
+  while (t->notify_value == 0 && host::block(l, deadline)) {}
+  uint32_t value = t->notify_value;
+  if (value > 0) {
+    t->notify_value = clear ? 0 : value - 1;
+  }
+  return value;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Queues and semaphores.  A semaphore is a queue of zero-size items.
+
+struct HostQueue {
+  size_t length;
+  size_t item_size;
+  std::deque<std::string> items;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+  return new HostQueue { length, item_size, {} };
+}
+
+static BaseType_t queue_send(QueueHandle_t q, const void* item, TickType_t timeout, bool to_front) {
+  auto l = host::lock();
+  uint64_t deadline = host::deadline_after(timeout);
+  while (q->items.size() == q->length) {
+    if (!host::block(l, deadline)) {
+      return pdFALSE;
+    }
+  }
+  std::string data((const char*)item, q->item_size);
+  if (to_front) {
+    q->items.push_front(std::move(data));
+  } else {
+    q->items.push_back(std::move(data));
+  }
+  host::wake_all();
+  return pdTRUE;
+}
+
+static BaseType_t queue_receive(QueueHandle_t q, void* item, TickType_t timeout, bool peek) {
+  auto l = host::lock();
+  uint64_t deadline = host::deadline_after(timeout);
+  while (q->items.empty()) {
+    if (!host::block(l, deadline)) {
+      return pdFALSE;
+    }
+  }
+  if (q->item_size > 0) {
+    memcpy(item, q->items.front().data(), q->item_size);
+  }
+  if (!peek) {
+    q->items.pop_front();
+    host::wake_all();
+  }
+  return pdTRUE;
+}
+
+BaseType_t xQueueSend(QueueHandle_t q, const void* item, TickType_t timeout) {
+  return queue_send(q, item, timeout, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t q, const void* item, TickType_t timeout) {
+  return queue_send(q, item, timeout, true);
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t q, const void* item, BaseType_t* woken) {
+  return queue_send(q, item, 0, false);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void* item, TickType_t timeout) {
+  return queue_receive(q, item, timeout, false);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t q, void* item, TickType_t timeout) {
+  return queue_receive(q, item, timeout, true);
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q) {
+  auto l = host::lock();
+  return q->items.size();
+}
+
+UBaseType_t uxQueueMessagesWaitingFromISR(QueueHandle_t q) {
+  return uxQueueMessagesWaiting(q);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count) {
+  HostQueue* q = new HostQueue { max_count, 0, {} };
+  q->items.resize(initial_count);
+  return q;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+  return xSemaphoreCreateCounting(1, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary() {
+  return xSemaphoreCreateCounting(1, 0);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t timeout) {
+  return queue_receive(s, nullptr, timeout, false);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t s) {
+  return queue_send(s, nullptr, 0, false);
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t s, BaseType_t* woken) {
+  return xSemaphoreGive(s);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Critical sections
+
+static std::recursive_mutex critical_lock;
+
+void portENTER_CRITICAL(portMUX_TYPE* mux) {
+  critical_lock.lock();
+}
+
+void portEXIT_CRITICAL(portMUX_TYPE* mux) {
+  critical_lock.unlock();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//
+// The loop task, and the end of the simulation
+
+namespace host {
+
+static void loop_task(void*) {
+  ::setup();
+  for (;;) {
+    ::loop();
+  }
+}
+
+void run() {
+  xTaskCreate(loop_task, "loopTask", 8192, nullptr, 1, nullptr);
+  if (realtime && run_for_us != FOREVER) {
+    std::this_thread::sleep_for(std::chrono::microseconds(run_for_us));
+    auto l = lock();
+    finish(0);
+  }
+  for (;;) {
+    std::this_thread::sleep_for(std::chrono::hours(1));
+  }
+}
+
+}
@@ -0,0 +1,65 @@
+// Host build internals: the simulated clock, and the scheduler that every blocking operation goes
+// through.
+//
+// In virtual time (the default), the clock only moves when every task is blocked: it then jumps to
+// the earliest deadline that any task is waiting for.  Code runs in zero simulated time, so a day
+// of device activity takes seconds, and the run is as deterministic as the thread interleaving
+// allows.  In real time (--realtime), the clock is the host's monotonic clock, which is what you
+// want when typing at the serial console or talking to a real broker at human speed.
+//
+// All simulated kernel objects are protected by one lock.  A task that must wait calls block()
+// with the lock held and rechecks its condition when it returns; wakeups are broadcast.
+
+#ifndef host_h_included
+#define host_h_included
+
+#include <stdint.h>
+#include <mutex>
+
+namespace host {
+
+static constexpr uint64_t FOREVER = UINT64_MAX;
+
+// Options, set from the command line before the firmware starts.
+extern bool realtime;
+extern uint64_t run_for_us;     // FOREVER, or stop the simulation at this time
+
+// Microseconds since boot on the simulated clock.
+uint64_t now_us();
+
+// The kernel lock.  A task that holds it, or waits in block(), is in the kernel.
+class KernelLock : public std::unique_lock<std::mutex> {
+public:
+  KernelLock();
+  ~KernelLock();
+  KernelLock(const KernelLock&) = delete;
+};
+
+KernelLock lock();
+
+// True iff the calling thread is in the kernel.  Memory allocated there is the simulator's, not the
+// firmware's: a FreeRTOS queue, say, does not allocate on the device.
+bool in_kernel();
+
+// Block the calling task until wake_all() is called or the clock reaches `deadline_us`.  `l` must
+// hold the kernel lock.  Returns false iff the deadline has been reached.
+bool block(std::unique_lock<std::mutex>& l, uint64_t deadline_us);
+
+// Make every blocked task recheck its condition.  Call with the kernel lock held.
+void wake_all();
+
+// The absolute deadline for a FreeRTOS timeout in ticks.
+uint64_t deadline_after(uint32_t ticks);
+
+// Start the firmware's loop task and wait for the simulation to end.  Never returns.
+void run() __attribute__((noreturn));
+
+// Print what the simulated devices have counted, eg bus transactions.
+void print_device_stats();
+
+// End the simulation: print the metrics and exit.
+void finish(int status) __attribute__((noreturn));
+
+}
+
+#endif // !host_h_included
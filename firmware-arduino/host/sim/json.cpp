@@ -0,0 +1,102 @@
+// Host build: JSON parsing.  Nested objects and arrays are skipped over, not represented.
+
+#include <Arduino_JSON.h>
+
+JSONClass JSON;
+
+JSONVar JSONVar::operator[](const char* key) const {
+  auto it = fields.find(key);
+  return it == fields.end() ? JSONVar() : it->second;
+}
+
+static void skip_space(const char** p) {
+  while (isspace(**p)) {
+    (*p)++;
+  }
+}
+
+// Parse a string starting at the opening quote; leave *p after the closing quote.
+static bool parse_string(const char** p, std::string* out) {
+  (*p)++;
+  while (**p && **p != '"') {
+    if (**p == '\\' && (*p)[1]) {
+      (*p)++;
+    }
+    *out += *(*p)++;
+  }
+  if (**p != '"') {
+    return false;
+  }
+  (*p)++;
+  return true;
+}
+
+// Parse any value; leave *p after it.  Scalars are kept as text, strings without the quotes.
+static bool parse_value(const char** p, std::string* out) {
+  skip_space(p);
+  if (**p == '"') {
+    return parse_string(p, out);
+  }
+  if (**p == '{' || **p == '[') {
+    int depth = 0;
+    do {
+      if (**p == '"') {
+        std::string ignored;
+        if (!parse_string(p, &ignored)) {
+          return false;
+        }
+        continue;
+      }
+      if (**p == '{' || **p == '[') {
+        depth++;
+      } else if (**p == '}' || **p == ']') {
+        depth--;
+      } else if (**p == 0) {
+        return false;
+      }
+      (*p)++;
+    } while (depth > 0);
+    return true;
+  }
+  const char* start = *p;
+  while (**p && **p != ',' && **p != '}' && !isspace(**p)) {
+    (*p)++;
+  }
+  out->assign(start, *p - start);
+  return *p > start;
+}
+
+JSONVar JSONClass::parse(const char* s) {
+  JSONVar result;
+  const char* p = s;
+  skip_space(&p);
+  if (*p != '{') {
+    return result;
+  }
+  p++;
+  for (;;) {
+    skip_space(&p);
+    if (*p == '}') {
+      return result;
+    }
+    std::string key;
+    if (*p != '"' || !parse_string(&p, &key)) {
+      return JSONVar();
+    }
+    skip_space(&p);
+    if (*p++ != ':') {
+      return JSONVar();
+    }
+    JSONVar value;
+    if (!parse_value(&p, &value.text)) {
+      return JSONVar();
+    }
+    result.fields[key] = value;
+    skip_space(&p);
+    if (*p == ',') {
+      p++;
+    } else if (*p != '}') {
+      return JSONVar();
+    }
+  }
+}
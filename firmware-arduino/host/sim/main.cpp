@@ -0,0 +1,74 @@
+// Host build: the process entry point.  See ../README.md for the options.
+
+#include "host.h"
+
+#include <Arduino.h>
+#include <unistd.h>
+
+#include "../../src/metrics.h"
+#include "../../src/trace.h"
+
+static void usage(const char* prog) {
+  fprintf(stderr, "Usage: %s [--realtime] [--run-for=SECONDS]\n", prog);
+  exit(2);
+}
+
+int main(int argc, char** argv) {
+  const char* run_for = getenv("SNAPPY_HOST_RUN_FOR");
+  for ( int i = 1; i < argc; i++ ) {
+    if (strcmp(argv[i], "--realtime") == 0) {
+      host::realtime = true;
+    } else if (strncmp(argv[i], "--run-for=", 10) == 0) {
+      run_for = argv[i] + 10;
+    } else {
+      usage(argv[0]);
+    }
+  }
+  if (run_for != nullptr) {
+    char* end;
+    double s = strtod(run_for, &end);
+    if (*end != 0 || s <= 0) {
+      usage(argv[0]);
+    }
+    host::run_for_us = uint64_t(s * 1e6);
+  }
+  host::run();
+}
+
+#ifdef SNAPPY_TRACE
+class FileStream : public Stream {
+  FILE* f;
+public:
+  using Print::write;
+  FileStream(FILE* f) : f(f) {}
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+  size_t write(uint8_t c) override { return fputc(c, f) == EOF ? 0 : 1; }
+};
+#endif
+
+namespace host {
+
+void finish(int status) {
+#ifdef SNAPPY_TRACE
+  if (const char* trace_file = getenv("SNAPPY_HOST_TRACE")) {
+    if (FILE* f = fopen(trace_file, "w")) {
+      FileStream out(f);
+      trace_dump(out);
+      fclose(f);
+    }
+  }
+#endif
+#ifdef SNAPPY_METRICS
+  Serial.println();
+  metrics_print(Serial);
+#endif
+  Serial.flush();
+  print_device_stats();
+  fflush(stdout);
+  fflush(stderr);
+  _exit(status);
+}
+
+}
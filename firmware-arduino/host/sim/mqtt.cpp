@@ -0,0 +1,193 @@
+// Host build: the MQTT client.  See ../include/ArduinoMqttClient.h.
+
+#include <chrono>
+
+#include "host.h"
+
+#include <ArduinoMqttClient.h>
+
+enum {
+  CONNECT = 1,
+  CONNACK = 2,
+  PUBLISH = 3,
+  PUBACK = 4,
+  SUBSCRIBE = 8,
+  PINGREQ = 12,
+};
+
+static constexpr int KEEPALIVE_S = 60;
+static constexpr int TIMEOUT_MS = 10000;
+
+static uint64_t wallclock_ms() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void put16(std::string* s, unsigned v) {
+  *s += char(v >> 8);
+  *s += char(v & 255);
+}
+
+static void put_string(std::string* s, const std::string& v) {
+  put16(s, v.length());
+  *s += v;
+}
+
+uint16_t MqttClient::packet_id() {
+  uint16_t id = next_packet_id++;
+  if (next_packet_id == 0) {
+    next_packet_id = 1;
+  }
+  return id;
+}
+
+bool MqttClient::send_packet(uint8_t type, const std::string& body) {
+  std::string pkt(1, char(type));
+  size_t len = body.length();
+  do {
+    uint8_t b = len & 127;
+    len >>= 7;
+    pkt += char(len > 0 ? b | 128 : b);
+  } while (len > 0);
+  pkt += body;
+  last_tx_ms = wallclock_ms();
+  return client->write((const uint8_t*)pkt.data(), pkt.length()) == pkt.length();
+}
+
+bool MqttClient::receive_packet(uint8_t* type, std::string* body, int timeout_ms) {
+  uint8_t b;
+  if (!client->host_read_fully(type, 1, timeout_ms)) {
+    return false;
+  }
+  size_t len = 0;
+  int shift = 0;
+  do {
+    if (shift > 21 || !client->host_read_fully(&b, 1, TIMEOUT_MS)) {
+      return false;
+    }
+    len |= size_t(b & 127) << shift;
+    shift += 7;
+  } while (b & 128);
+  body->resize(len);
+  return len == 0 || client->host_read_fully((uint8_t*)&(*body)[0], len, TIMEOUT_MS);
+}
+
+int MqttClient::connect(const char* host, uint16_t port) {
+  if (!client->connect(host, port)) {
+    connect_error = MQTT_CONNECTION_REFUSED;
+    return 0;
+  }
+  std::string body;
+  put_string(&body, "MQTT");
+  body += char(4);
+  body += char((username.empty() ? 0 : 0xC0) | (clean_session ? 2 : 0));
+  put16(&body, KEEPALIVE_S);
+  put_string(&body, id);
+  if (!username.empty()) {
+    put_string(&body, username);
+    put_string(&body, password);
+  }
+  uint8_t type;
+  std::string reply;
+  if (!send_packet(CONNECT << 4, body) || !receive_packet(&type, &reply, TIMEOUT_MS)) {
+    client->stop();
+    connect_error = MQTT_CONNECTION_TIMEOUT;
+    return 0;
+  }
+  if (type >> 4 != CONNACK || reply.length() != 2) {
+    client->stop();
+    connect_error = MQTT_CONNECTION_REFUSED;
+    return 0;
+  }
+  connect_error = uint8_t(reply[1]);
+  if (connect_error != MQTT_SUCCESS) {
+    client->stop();
+    return 0;
+  }
+  return 1;
+}
+
+void MqttClient::stop() {
+  if (client != nullptr) {
+    client->stop();
+  }
+}
+
+int MqttClient::subscribe(const String& topic, int qos) {
+  std::string body;
+  put16(&body, packet_id());
+  put_string(&body, topic.c_str());
+  body += char(qos);
+  // The SUBACK is discarded by poll().
+  return connected() && send_packet((SUBSCRIBE << 4) | 2, body);
+}
+
+int MqttClient::beginMessage(const char* topic, bool retain, int qos, bool dup) {
+  tx_topic = topic;
+  tx_retain = retain;
+  tx_qos = qos;
+  tx_payload.clear();
+  return 1;
+}
+
+size_t MqttClient::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+size_t MqttClient::write(const uint8_t* buf, size_t n) {
+  if (tx_payload.length() + n > tx_payload_size) {
+    return 0;
+  }
+  tx_payload.append((const char*)buf, n);
+  return n;
+}
+
+int MqttClient::endMessage() {
+  std::string body;
+  put_string(&body, tx_topic);
+  if (tx_qos > 0) {
+    put16(&body, packet_id());
+  }
+  body += tx_payload;
+  // Any PUBACK is discarded by poll().
+  return connected() && send_packet((PUBLISH << 4) | (tx_qos << 1) | (tx_retain ? 1 : 0), body);
+}
+
+void MqttClient::poll() {
+  while (connected() && client->available() > 0) {
+    uint8_t type;
+    std::string body;
+    if (!receive_packet(&type, &body, TIMEOUT_MS)) {
+      client->stop();
+      return;
+    }
+    if (type >> 4 != PUBLISH || body.length() < 2) {
+      continue;
+    }
+    int qos = (type >> 1) & 3;
+    size_t topic_len = (uint8_t(body[0]) << 8) | uint8_t(body[1]);
+    size_t payload_at = 2 + topic_len + (qos > 0 ? 2 : 0);
+    if (payload_at > body.length()) {
+      continue;
+    }
+    rx_topic = String(body.c_str() + 2, topic_len);
+    rx_payload.assign(body.begin() + payload_at, body.end());
+    rx_pos = 0;
+    if (on_message != nullptr) {
+      on_message(rx_payload.size());
+    }
+    if (qos > 0) {
+      send_packet(PUBACK << 4, body.substr(2 + topic_len, 2));
+    }
+  }
+  if (connected() && wallclock_ms() - last_tx_ms > KEEPALIVE_S * 1000 / 2) {
+    send_packet(PINGREQ << 4, "");
+  }
+}
+
+int MqttClient::read(uint8_t* buf, size_t n) {
+  size_t k = std::min(n, rx_payload.size() - rx_pos);
+  memcpy(buf, rx_payload.data() + rx_pos, k);
+  rx_pos += k;
+  return k;
+}
@@ -0,0 +1,167 @@
+// Host build: WiFi, TCP clients, and NTP.
+
+#include <chrono>
+
+#include "host.h"
+
+#include <Arduino.h>
+#include <NTPClient.h>
+#include <WiFi.h>
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+WiFiClass WiFi;
+
+int WiFiClass::begin(const char* ssid, const char* password) {
+  wifi_status = WL_CONNECTED;
+  return wifi_status;
+}
+
+bool WiFiClass::disconnect(bool wifi_off) {
+  wifi_status = WL_DISCONNECTED;
+  return true;
+}
+
+bool WiFiClass::softAP(const char* ssid, const char* password) {
+  wifi_status = WL_CONNECTED;
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//
+// TCP client
+
+WiFiClient& WiFiClient::operator=(WiFiClient&& other) {
+  if (this != &other) {
+    stop();
+    fd = other.fd;
+    other.fd = -1;
+  }
+  return *this;
+}
+
+int WiFiClient::connect(const char* host, uint16_t port) {
+  stop();
+  struct addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo* addrs;
+  if (getaddrinfo(host, std::to_string(port).c_str(), &hints, &addrs) != 0) {
+    return 0;
+  }
+  for ( struct addrinfo* a = addrs; a != nullptr && fd < 0; a = a->ai_next ) {
+    fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if (fd < 0) {
+      continue;
+    }
+    // Bound the time a connect or a send can take.
+    struct timeval tv = { 10, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    if (::connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(addrs);
+  return fd >= 0;
+}
+
+int WiFiClientSecure::connect(const char* host, uint16_t port) {
+  fprintf(stderr, "[host] TLS is not supported, cannot connect to %s:%u\n", host, port);
+  return 0;
+}
+
+bool WiFiClient::connected() {
+  if (fd < 0) {
+    return false;
+  }
+  uint8_t c;
+  ssize_t n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+  if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+    stop();
+    return false;
+  }
+  return true;
+}
+
+void WiFiClient::stop() {
+  if (fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+}
+
+int WiFiClient::available() {
+  if (fd < 0) {
+    return 0;
+  }
+  uint8_t buf[1024];
+  ssize_t n = recv(fd, buf, sizeof(buf), MSG_PEEK | MSG_DONTWAIT);
+  return n > 0 ? n : 0;
+}
+
+int WiFiClient::read() {
+  uint8_t c;
+  if (fd < 0 || recv(fd, &c, 1, MSG_DONTWAIT) != 1) {
+    return -1;
+  }
+  return c;
+}
+
+int WiFiClient::peek() {
+  uint8_t c;
+  if (fd < 0 || recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) != 1) {
+    return -1;
+  }
+  return c;
+}
+
+size_t WiFiClient::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+size_t WiFiClient::write(const uint8_t* buf, size_t n) {
+  size_t k = 0;
+  while (fd >= 0 && k < n) {
+    ssize_t r = send(fd, buf + k, n - k, MSG_NOSIGNAL);
+    if (r <= 0) {
+      stop();
+      break;
+    }
+    k += r;
+  }
+  return k;
+}
+
+bool WiFiClient::host_read_fully(uint8_t* buf, size_t n, int timeout_ms) {
+  size_t k = 0;
+  while (k < n) {
+    if (fd < 0) {
+      return false;
+    }
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    if (::poll(&pfd, 1, timeout_ms) != 1) {
+      return false;
+    }
+    ssize_t r = recv(fd, buf + k, n - k, 0);
+    if (r <= 0) {
+      stop();
+      return false;
+    }
+    k += r;
+  }
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//
+// NTP
+
+bool NTPClient::forceUpdate() {
+  epoch = std::chrono::duration_cast<std::chrono::seconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+  return true;
+}
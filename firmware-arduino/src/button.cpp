@@ -2,47 +2,64 @@
 
 #include "button.h"
 
+#include "device.h"
+#include "event_timer.h"
+
 #define DEBOUNCE_MS 100
 #define SHORT_PRESS_MAX 1999
 #define LONG_PRESS_MIN 3000
 
+// How long after an edge to look at the button again, for an edge that the debouncer in the ISR
+// discarded.  This must be longer than its debounce window and shorter than DEBOUNCE_MS, so that a
+// spike with a lost release is still too short to be a press.
+#define SETTLE_MS 20
+
+// Payloads of BUTTON_TIMEOUT.
+#define LONG_PRESS_TIMEOUT 0
+#define SETTLE_TIMEOUT 1
+
 static bool button_is_down;
-static struct timeval button_down_time;
-static TimerHandle_t button_timer;
+static uint32_t button_down_cycles;
+static EventTimer* button_timer;
+static EventTimer* settle_timer;
 
 void button_init() {
-  button_timer = xTimerCreate("button",
-                              pdMS_TO_TICKS(LONG_PRESS_MIN),
-                              pdFALSE,
-                              nullptr,
-                              [](TimerHandle_t t) {
-                                if (button_is_down) {
-                                  button_is_down = false;
-                                  put_main_event(EvCode::BUTTON_LONG_PRESS);
-                                }
-                              });
+  button_timer = event_timer_create("button", EvCode::BUTTON_TIMEOUT, LONG_PRESS_TIMEOUT, 50);
+  settle_timer = event_timer_create("button-settle", EvCode::BUTTON_TIMEOUT, SETTLE_TIMEOUT, 5);
+}
+
+void button_timeout(uint32_t payload) {
+  if (payload == SETTLE_TIMEOUT) {
+    device_resample_button();
+    return;
+  }
+  if (button_is_down) {
+    button_is_down = false;
+    put_main_event(EvCode::BUTTON_LONG_PRESS);
+  }
 }
 
-void button_down() {
+void button_down(uint32_t cycles) {
   if (button_timer == nullptr) {
     return;
   }
-  // ISR is signaling that the button is down. `button_down_time` is the time we pressed it.
+  // ISR is signaling that the button is down. `button_down_cycles` is the time we pressed it.
+  // The press is timed from the edge timestamps, not from when the main task got around to them.
+  // The long-press timer ends any press long before the cycle counter can wrap.
   button_is_down = true;
-  gettimeofday(&button_down_time, nullptr);
-  xTimerReset(button_timer, portMAX_DELAY);
+  button_down_cycles = cycles;
+  event_timer_start(button_timer, LONG_PRESS_MIN);
+  event_timer_start(settle_timer, SETTLE_MS);
 }
 
-void button_up() {
+void button_up(uint32_t cycles) {
   if (!button_is_down) {
     return;
   }
-  xTimerStop(button_timer, portMAX_DELAY);
+  event_timer_stop(button_timer);
+  event_timer_start(settle_timer, SETTLE_MS);
   button_is_down = false;
-  struct timeval now;
-  gettimeofday(&now, nullptr);
-  uint64_t press_ms = ((uint64_t(now.tv_sec) * 1000000 + now.tv_usec) -
-                       (uint64_t(button_down_time.tv_sec) * 1000000 + button_down_time.tv_usec)) / 1000;
+  uint32_t press_ms = (cycles - button_down_cycles) / (ESP.getCpuFreqMHz() * 1000);
   if (press_ms > DEBOUNCE_MS && press_ms <= SHORT_PRESS_MAX) {
     put_main_event(EvCode::BUTTON_PRESS);
   } else if (press_ms >= LONG_PRESS_MIN) {
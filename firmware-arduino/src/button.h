@@ -8,10 +8,13 @@
 // Initialize the button subsystem.  Call this early.
 void button_init();
 
-// Call this when the button is pressed.
-void button_down();
+// Call this when the button is pressed.  `cycles` is the cycle counter at the time of the edge.
+void button_down(uint32_t cycles);
 
-// Call this when the button is released.
-void button_up();
+// Call this when the button is released.  `cycles` is the cycle counter at the time of the edge.
+void button_up(uint32_t cycles);
+
+// Call this when one of the button's timers posts BUTTON_TIMEOUT, with the event's payload.
+void button_timeout(uint32_t payload);
 
 #endif // !button_h_included
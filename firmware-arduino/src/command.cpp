@@ -5,6 +5,8 @@
 #ifdef SNAPPY_COMMAND_PROCESSOR
 
 #include "config.h"
+#include "metrics.h"
+#include "trace.h"
 #include "util.h"
 
 static void cmd_hello(const String& cmd, const SnappySenseData&, Stream& out);
@@ -13,6 +15,12 @@ static void cmd_get(const String& cmd, const SnappySenseData&, Stream& out);
 static void cmd_view(const String& cmd, const SnappySenseData&, Stream& out);
 static void cmd_inet(const String& cmd, const SnappySenseData&, Stream& out);
 static void cmd_config(const String& cmd, const SnappySenseData&, Stream& out);
+#ifdef SNAPPY_METRICS
+static void cmd_stats(const String& cmd, const SnappySenseData&, Stream& out);
+#endif
+#ifdef SNAPPY_TRACE
+static void cmd_trace(const String& cmd, const SnappySenseData&, Stream& out);
+#endif
 
 struct Command {
   const char* command;
@@ -28,6 +36,12 @@ static Command commands[] = {
   {"view",     "View all the current sensor readings",               cmd_view},
   {"inet",     "Internet connectivity details",                      cmd_inet},
   {"config",   "Show device configuration",                          cmd_config},
+#ifdef SNAPPY_METRICS
+  {"stats",    "Show runtime metrics; `stats json` for compact form", cmd_stats},
+#endif
+#ifdef SNAPPY_TRACE
+  {"trace",    "Dump the event trace, see util/trace2chrome",        cmd_trace},
+#endif
   {nullptr,    nullptr,                                              nullptr}
 };
 
@@ -69,8 +83,7 @@ static void cmd_view(const String& cmd, const SnappySenseData& data, Stream& out
   out.println("----------------");
   for ( SnappyMetaDatum* m = snappy_metadata; m->json_key != nullptr; m++ ) {
     // Skip data that are not valid
-    if (m->flag_offset > 0 &&
-        !*reinterpret_cast<const bool*>(reinterpret_cast<const char*>(&data) + m->flag_offset)) {
+    if (!m->is_valid(data)) {
       continue;
     }
     // This ignores m->display on purpose
@@ -93,8 +106,7 @@ static void cmd_get(const String& cmd, const SnappySenseData& data, Stream& out)
   for ( SnappyMetaDatum* m = snappy_metadata; m->json_key != nullptr; m++ ) {
     if (strcmp(m->json_key, arg.c_str()) == 0) {
       // Skip data that are not valid
-      if (m->flag_offset > 0 &&
-          !*reinterpret_cast<const bool*>(reinterpret_cast<const char*>(&data) + m->flag_offset)) {
+      if (!m->is_valid(data)) {
         out.printf("%s: data not valid\n", m->json_key);
       } else {
         char buf[32];
@@ -123,4 +135,32 @@ static void cmd_config(const String& cmd, const SnappySenseData&, Stream& out) {
   show_configuration(&out);
 }
 
+#ifdef SNAPPY_METRICS
+static void cmd_stats(const String& cmd, const SnappySenseData&, Stream& out) {
+  if (get_word(cmd, 1) == "json") {
+    char buf[1024];
+    if (!metrics_snapshot(buf, buf+sizeof(buf))) {
+      out.println("Too many metrics for the buffer, use `stats` instead");
+      return;
+    }
+    out.println(buf);
+  } else {
+    metrics_print(out);
+    out.printf("events.coalesced: %u\n", main_event_coalesced());
+    for ( int i = 0; i < int(EvCode::NUM_CODES); i++ ) {
+      unsigned n = main_event_drops(EvCode(i));
+      if (n > 0) {
+        out.printf("events.dropped.%s: %u\n", main_event_name(EvCode(i)), n);
+      }
+    }
+  }
+}
+#endif
+
+#ifdef SNAPPY_TRACE
+static void cmd_trace(const String& cmd, const SnappySenseData&, Stream& out) {
+  trace_dump(out);
+}
+#endif
+
 #endif // SNAPPY_COMMAND_PROCESSOR
@@ -55,6 +55,7 @@ static Pref factory_prefs[] = {
   {"mqtt-private-key",        "akey",  Pref::Str|Pref::Cert,   0, IF_MQTT_UP(MQTT_DEVICE_KEY, ""),  "MQTT private key (eg XXXXXXXXXX-private.pem.key"},
   {"mqtt-username",           "unm",   Pref::Str,              0, IF_MQTT_UP(MQTT_USER, ""),        "MQTT username, for user/pass connection"},
   {"mqtt-password",           "pwd",   Pref::Str|Pref::Passwd, 0, IF_MQTT_UP(MQTT_PASS, ""),        "MQTT password, for user/pass connection"},
+  {"mqtt-observation-cbor",   "acbor", Pref::Int,              0, "",                               "MQTT observations sent as CBOR (1) rather than JSON (0)"},
   { nullptr }
 };
 
@@ -208,9 +209,14 @@ void show_configuration(Stream* out) {
 //     mqtt-root-cert        // short name "aroot" - previously known as aws-iot-root-ca
 //     mqtt-device-cert      // short name "acert" - previously known as aws-iot-device-cert, the device cert for "x509" authentication
 //     mqtt-private-key      // short name "akey" - previously known as aws-iot-private-key, the private key for "x509" authentication
+//
+// Config version 2.1
+//
+//   Introduced these new settings
+//     mqtt-observation-cbor // short name "acbor" - a flag, whether to send observations as CBOR rather than JSON
 
 #define MAJOR_VERSION 2
-#define MINOR_VERSION 0
+#define MINOR_VERSION 1
 #define BUGFIX_VERSION 0
 
 // evaluate_config() evaluates a configuration program, using the `read_line` parameter
@@ -418,9 +424,10 @@ unsigned long mqtt_max_unconnected_time_s() {
 // The monitoring window *must* be longer than the value returned here.
 unsigned long sensor_warmup_time_s() {
 #if defined(SENSE_AIR_QUALITY_INDEX) || defined(SENSE_TVOC) || defined(SENSE_CO2)
-  // The documentation for the AIR sensor says that it needs "less than 3 minutes"
-  // to warm up.  So as an experiment, let's do 3 minutes of warmup always.
-  return 3*60;
+  // The documentation for the AIR sensor says that it needs "less than 3 minutes" to warm up.  The
+  // warmup ends as soon as the sensor reports valid data, so this is only the upper bound.  The
+  // margin lets a sensor that takes all of the three minutes be seen to be ready.
+  return 3*60 + 10;
 #else
   if (slideshow_mode) {
     return 1;  // We're powered up, but zero is an invalid value
@@ -430,11 +437,15 @@ unsigned long sensor_warmup_time_s() {
 #endif
 }
 
+unsigned long sensor_sampling_time_s() {
+  // Long enough to get good readings from the PIR and MEMS after warmup
+  return 15;
+}
+
 unsigned long monitoring_window_s() {
-  // Constraints:
-  // - longer than the warmup time
-  // - long enough to get good readings from the PIR and MEMS after warmup
-  return sensor_warmup_time_s() + 15;
+  // The sensor task closes the window; this is main's backstop.  The margin is for the final
+  // reading and for timers that fire late, so that the backstop does not race the task.
+  return sensor_warmup_time_s() + sensor_sampling_time_s() + 5;
 }
 
 #ifdef SNAPPY_NTP
@@ -564,6 +575,10 @@ const char* mqtt_device_class() {
   return get_string_pref("mqtt-class");
 }
 
+bool mqtt_observation_cbor() {
+  return get_int_pref("mqtt-observation-cbor") != 0;
+}
+
 const char* mqtt_root_ca_cert() {
   return get_string_pref("mqtt-root-cert");
 }
@@ -77,16 +77,24 @@ const char* mqtt_device_id();
 
 // The name of the device class to which this device belongs
 const char* mqtt_device_class();
+
+// True if observations are to be sent as CBOR rather than JSON, see MQTT-PROTOCOL.md
+bool mqtt_observation_cbor();
 #endif
 
 /////////////////////////////////////////////////////////////////////////////////
 //
 // Sensors, monitoring, data capture
 
-// How long does it take for sensors to warm up at the beginning of the monitoring window?
+// How long may it take for sensors to warm up at the beginning of the monitoring window?  The
+// warmup ends earlier if the air sensor reports that it is ready.
 unsigned long sensor_warmup_time_s();
 
-// How long is the monitoring window overall (including warmup)?
+// How long are the sensors sampled after the warmup?
+unsigned long sensor_sampling_time_s();
+
+// How long is the monitoring window at most (including warmup)?  The sensor task closes the window
+// when the sampling time after the warmup is up, before this.
 unsigned long monitoring_window_s();
 
 // How often readings are captured and enqueued for upload.
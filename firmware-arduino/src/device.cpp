@@ -53,13 +53,16 @@
 //   https://www.dfrobot.com/product-2357.html
 //   https://wiki.dfrobot.com/Fermion_MEMS_Microphone_Sensor_SKU_SEN0487
 //
-//   TODO: Document the use of the specific ADC on the ESP32 for this.
+//   The MEMS is sampled continuously by ADC1 under DMA control, see start_mems_sampler() below.
+//   While that runs, the digital controller owns ADC1 and analogRead() must not be used on any
+//   ADC1 pin; this is why the PIR is read digitally.
 //
-//   HW 1.1.0: The MEMS is connected to pin A3.
+//   HW 1.1.0: The MEMS is connected to pin A3 (GPIO39, ADC1 channel 3).
 //
 //   HW 1.0.0: The MEMS is connected to pin A5, but this is a bug because the ADC2 configured
 //   for the MEMS conflicts with its hardwired use for WiFi, as a consequence, they can't be
-//   used at the same time.  In practice the Mic functionality is unavailable in this rev.
+//   used at the same time.  In practice the Mic functionality is unavailable in this rev with
+//   WiFi.  ADC2 can't be driven by DMA either, so without WiFi the MEMS is read with analogRead().
 //
 // Hardware v1.1.0:
 //
@@ -72,8 +75,10 @@
 #include "config.h"
 #include "icons.h"
 #include "log.h"
+#include "metrics.h"
 #include "sensor.h"
 #include "time_server.h"
+#include "util.h"
 #include "Wire.h"
 #include <Arduino.h>
 #include <Adafruit_GFX.h>
@@ -81,6 +86,10 @@
 #include <DFRobot_ENS160.h>
 #include <DFRobot_EnvironmentalSensor.h>
 #include <esp32-hal-ledc.h>
+#ifdef SENSE_NOISE
+# include <driver/adc.h>
+# include "sound_level.h"
+#endif
 
 // SnappySense 1.x.y device definition
 
@@ -92,9 +101,16 @@
 #if defined(SNAPPY_HARDWARE_1_0_0)
 # define PIR_SENSOR_PIN A4
 # define MIC_PIN A5
+# ifdef SENSE_AIR_INTERRUPT
+#  error "No pin for the air sensor's interrupt"
+# endif
 #elif defined(SNAPPY_HARDWARE_1_1_0)
 # define PIR_SENSOR_PIN A2
 # define MIC_PIN A3
+# define MIC_ADC_CHANNEL ADC1_CHANNEL_3
+// INTn is not connected on 1.1.0 or 1.2.0, but A4 is free on those boards.  It is input-only and
+// has no pullup, which is fine because INTn is configured as a push-pull output.
+# define AIR_INT_PIN A4
 #else
 # error "Fix your hardware definitions"
 #endif
@@ -117,22 +133,240 @@
 #define LOGO_WIDTH    128
 
 static Adafruit_SSD1306 display(128, 32, &Wire);
-static DFRobot_ENS160_I2C ENS160(&Wire, I2C_AIR_ADDRESS);
-static DFRobot_EnvironmentalSensor environment(I2C_DHT_ADDRESS, /*pWire = */&Wire);
-static bool peripherals_powered_on = false;
+
+// Read `n` bytes starting at byte address `reg` of the device at `addr`, in one transaction with a
+// repeated start.  Returns false if the device did not deliver all of them.
+//
+// The batched sensor reads below use this rather than the DFRobot libraries' readReg(), which is
+// not their public API: its access, return value and register addressing are implementation
+// details of the pinned library versions.
+static bool i2c_read(uint8_t addr, uint8_t reg, uint8_t* buf, uint8_t n) {
+  Wire.beginTransmission(addr);
+  Wire.write(reg);
+  if (Wire.endTransmission(false) != 0) {
+    return false;
+  }
+  if (Wire.requestFrom(addr, n) != n) {
+    return false;
+  }
+  for ( uint8_t i = 0; i < n; i++ ) {
+    buf[i] = Wire.read();
+  }
+  return true;
+}
+
+// The DFRobot library reads the ENS160's status, AQI, TVOC and eCO2 registers in a transaction
+// each, so a reading costs four address phases and the values can come from two different
+// measurement cycles if the device updates them in between.  The registers are contiguous
+// (0x20-0x25), so read_all() fetches them in one transaction instead.
+struct AirReadings {
+  uint8_t status;               // Validity flag, as getENS160Status()
+  uint8_t aqi;
+  uint16_t tvoc;
+  uint16_t eco2;
+};
+
+class AirSensor : public DFRobot_ENS160_I2C {
+public:
+  AirSensor(TwoWire* wire, uint8_t addr) : DFRobot_ENS160_I2C(wire, addr) {}
+
+  // Returns false, leaving *r untouched, if the transaction failed.
+  bool read_all(AirReadings* r) {
+    uint8_t buf[6];
+    if (!i2c_read(I2C_AIR_ADDRESS, 0x20, buf, sizeof(buf))) {
+      return false;
+    }
+    r->status = (buf[0] >> 2) & 3;
+    r->aqi = buf[1] & 7;
+    r->tvoc = buf[2] | (buf[3] << 8);
+    r->eco2 = buf[4] | (buf[5] << 8);
+    return true;
+  }
+
+  // Just the validity flag, for polling.
+  bool read_status(uint8_t* status) {
+    uint8_t b;
+    if (!i2c_read(I2C_AIR_ADDRESS, 0x20, &b, 1)) {
+      return false;
+    }
+    *status = (b >> 2) & 3;
+    return true;
+  }
+
+#ifdef SENSE_AIR_INTERRUPT
+  // INTn is driven high when new data are available in the data registers and goes low again
+  // when they are read.
+  void enable_data_ready_interrupt(bool enable) {
+    if (enable) {
+      setINTMode(eINTModeEN | eINTDataDrdyEN | eINTGPRDrdyDIS | eINTPinPP | eINTPinActiveHigh);
+    } else {
+      setINTMode(eINTModeDIS);
+    }
+  }
+#endif
+};
+
+static AirSensor ENS160(&Wire, I2C_AIR_ADDRESS);
+
+// Likewise, the DFRobot library reads each of the SEN0500's measurement registers (UV 0x08, light
+// 0x09, temperature 0x0A, humidity 0x0B, pressure 0x0C) in a transaction of its own.  read_raw()
+// reads all five in one, and the conversions, which are the library's, are applied afterwards.
+// The device sits behind a protocol adapter that puts register `reg` at byte address 2*reg on the
+// bus, as in the IDF driver (firmware-idf/main/dfrobot_sen0500.c).
+struct EnvironmentReadings {
+  uint16_t uv;
+  uint16_t lux;
+  uint16_t temperature;
+  uint16_t humidity;
+  uint16_t pressure;            // hPa
+};
+
+class EnvironmentSensor : public DFRobot_EnvironmentalSensor {
+public:
+  EnvironmentSensor(uint8_t addr, TwoWire* wire) : DFRobot_EnvironmentalSensor(addr, wire) {}
+
+  // Returns false, leaving *r untouched, if the transaction failed.
+  bool read_raw(EnvironmentReadings* r) {
+    // The registers are 16-bit big-endian.
+    uint8_t buf[10];
+    if (!i2c_read(I2C_DHT_ADDRESS, 0x08 << 1, buf, sizeof(buf))) {
+      return false;
+    }
+    r->uv = (buf[0] << 8) | buf[1];
+    r->lux = (buf[2] << 8) | buf[3];
+    r->temperature = (buf[4] << 8) | buf[5];
+    r->humidity = (buf[6] << 8) | buf[7];
+    r->pressure = (buf[8] << 8) | buf[9];
+    return true;
+  }
+
+  static float temperature_c(const EnvironmentReadings& r) {
+    return -45.0f + (int16_t(r.temperature) * 175.0f) / 1024.0f / 64.0f;
+  }
+
+  static float humidity(const EnvironmentReadings& r) {
+    return r.humidity * 100.0f / 65536.0f;
+  }
+
+  static float uv(const EnvironmentReadings& r) {
+    float volts = 3.0f * r.uv / 1024.0f;
+    return (volts - 0.99f) * 15.0f / (2.9f - 0.99f);
+  }
+
+  static float lux(const EnvironmentReadings& r) {
+    float lux = r.lux;
+    return lux * (1.0023f + lux * (8.1488e-5f + lux * (-9.3924e-9f + lux * 6.0135e-13f)));
+  }
+
+  static float elevation(const EnvironmentReadings& r) {
+    return 44330 * (1.0 - pow(r.pressure / 1015.0f, 0.1903));
+  }
+};
+
+static EnvironmentSensor environment(I2C_DHT_ADDRESS, /*pWire = */&Wire);
+static std::atomic<bool> peripherals_powered_on;
+// Bumped by power_peripherals_on(), see sensors_ready().
+static std::atomic<unsigned> power_epoch;
+static unsigned sensors_epoch;
 static bool have_environment;
 static bool have_air;
 static bool air_is_primed;
+#ifdef SNAPPY_AIR_SENSOR_STANDBY
+static bool air_in_standby;
+#endif
+#ifdef SENSE_AIR_INTERRUPT
+static AirReadings air_sample;
+static bool have_air_sample;
+static Counter air_samples("air.samples");
+#endif
 static unsigned sequence_number;
-static unsigned pir_value;
-static unsigned mems_value;
+#ifdef SENSE_MOTION
+static bool pir_motion;
+static float pir_occupancy;
+static unsigned pir_onsets;
+#endif
+static float mems_dba;
+static bool have_mems_dba;
+#ifdef SENSE_NOISE
+static void mems_setup();
+#endif
+
+// Pin interrupts record edges in a ring that the main task drains in batches; the ISR posts a
+// single GPIO_EDGES event when the ring goes from empty to nonempty.  This keeps a chattering input
+// from flooding the main queue.  If that event is dropped the ring is not stranded, because the
+// main task also looks for edges every time it goes for an event, see device_has_edges().  If the
+// ring is full the edge is dropped and counted.
+//
+// The button is debounced in the ISR: an edge that does not change the level, or that follows the
+// previous accepted edge within BUTTON_DEBOUNCE_US, is ignored.  So when a spike is taken for a
+// press, its release is lost and the button would look held.  The button logic therefore calls
+// device_resample_button() once the debounce window is over, which records the lost edge.  The
+// button's state is shared between the ISR and that call under button_lock.
+
+#define BUTTON_DEBOUNCE_US 5000
+
+static SpscRing<GpioEdge, 32> gpio_edges;
+static Counter gpio_edge_overflows("gpio.edge_overflow");
+
+// Returns true if the main task must be told about the edge.  The caller is the ring's only
+// producer.
+static bool record_edge(InputPin pin, uint8_t level, uint32_t cycles) {
+  bool was_empty;
+  if (!gpio_edges.push(GpioEdge { pin, level, cycles }, &was_empty)) {
+    gpio_edge_overflows.inc();
+    return false;
+  }
+  return was_empty;
+}
+
+bool device_next_edge(GpioEdge* edge) {
+  return gpio_edges.pop(edge);
+}
+
+bool device_has_edges() {
+  return !gpio_edges.is_empty();
+}
 
 #ifndef DISABLE_BUTTON
+static portMUX_TYPE button_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t button_level;
+static uint32_t button_edge_cycles;
+
 static void button_handler() {
-  put_main_event_from_isr(digitalRead(BUTTON_PIN) ? EvCode::BUTTON_DOWN : EvCode::BUTTON_UP);
+  uint32_t now = ESP.getCycleCount();
+  uint8_t level = digitalRead(BUTTON_PIN) ? 1 : 0;
+  bool wake = false;
+  portENTER_CRITICAL_ISR(&button_lock);
+  if (level != button_level && now - button_edge_cycles >= BUTTON_DEBOUNCE_US * ESP.getCpuFreqMHz()) {
+    button_level = level;
+    button_edge_cycles = now;
+    wake = record_edge(InputPin::BUTTON, level, now);
+  }
+  portEXIT_CRITICAL_ISR(&button_lock);
+  if (wake) {
+    put_main_event_from_isr(EvCode::GPIO_EDGES);
+  }
 }
 #endif
 
+void device_resample_button() {
+#ifndef DISABLE_BUTTON
+  uint32_t now = ESP.getCycleCount();
+  uint8_t level = digitalRead(BUTTON_PIN) ? 1 : 0;
+  bool wake = false;
+  portENTER_CRITICAL(&button_lock);
+  if (level != button_level) {
+    button_level = level;
+    button_edge_cycles = now;
+    wake = record_edge(InputPin::BUTTON, level, now);
+  }
+  portEXIT_CRITICAL(&button_lock);
+  if (wake) {
+    put_main_event(EvCode::GPIO_EDGES);
+  }
+#endif
+}
+
 // This must NOT depend on the configuration because the configuration may not
 // have been read at this point, see main.cpp.
 
@@ -150,6 +384,9 @@ void device_setup() {
   pinMode(POWER_ENABLE_PIN, OUTPUT);
   pinMode(PIR_SENSOR_PIN, INPUT);
   pinMode(MIC_PIN, INPUT);
+#ifdef SENSE_AIR_INTERRUPT
+  pinMode(AIR_INT_PIN, INPUT);
+#endif
 #ifndef DISABLE_BUTTON
   pinMode(BUTTON_PIN, INPUT);
 #endif
@@ -160,18 +397,18 @@ void device_setup() {
   log("Device initialized\n");
 
 #ifndef DISABLE_BUTTON
+  button_level = digitalRead(BUTTON_PIN) ? 1 : 0;
+  button_edge_cycles = ESP.getCycleCount() - BUTTON_DEBOUNCE_US * ESP.getCpuFreqMHz();
   attachInterrupt(BUTTON_PIN, button_handler, CHANGE);
 #endif
+
+#ifdef SENSE_NOISE
+  mems_setup();
+#endif
 }
 
 void power_peripherals_on() {
   if (!peripherals_powered_on) {
-    // Initialize state variables
-    have_air = false;
-    have_environment = false;
-    air_is_primed = false;
-    reset_pir_and_mems();
-
     // Turn on peripheral power, must be on for i2c to work!
     digitalWrite(POWER_ENABLE_PIN, HIGH);
     // Wait until peripherals are stable.  100ms is not enough (issue #14), and 1000ms does not
@@ -188,8 +425,8 @@ void power_peripherals_on() {
     // https://github.com/espressif/arduino-esp32/issues/6616#issuecomment-1184167285
     Wire.begin((int) I2C_SDA, I2C_SCL);
 
-    have_environment = environment.begin() == 0;
-    have_air = ENS160.begin() == 0;
+    // The sensors are initialized by the sensor task, see sensors_ready().
+    power_epoch++;
 
     // init oled display
     // SSD1306_SWITCHCAPVCC = generate display voltage from 3.3V internally
@@ -222,25 +459,384 @@ void power_peripherals_off() {
   peripherals_powered_on = false;
 }
 
+void peripherals_sleep() {
+#ifdef SNAPPY_AIR_SENSOR_STANDBY
+  if (peripherals_powered_on) {
+    display.ssd1306_command(SSD1306_DISPLAYOFF);
+  }
+#else
+  power_peripherals_off();
+#endif
+}
+
+void peripherals_wake() {
+#ifdef SNAPPY_AIR_SENSOR_STANDBY
+  if (peripherals_powered_on) {
+    display.ssd1306_command(SSD1306_DISPLAYON);
+    return;
+  }
+#endif
+  power_peripherals_on();
+}
+
+// The I2C sensors are (re)initialized on the sensor task when it first uses them after power-up, so
+// that power_peripherals_on() does not hold up the main task with their begin() transactions.
+// Returns false if the peripherals are powered off.
+static bool sensors_ready() {
+  if (!peripherals_powered_on) {
+    return false;
+  }
+  unsigned epoch = power_epoch;
+  if (sensors_epoch != epoch) {
+    sensors_epoch = epoch;
+    air_is_primed = false;
+#ifdef SNAPPY_AIR_SENSOR_STANDBY
+    air_in_standby = false;
+#endif
+#ifdef SENSE_AIR_INTERRUPT
+    have_air_sample = false;
+#endif
+    reset_pir_and_mems();
+    have_environment = environment.begin() == 0;
+    have_air = ENS160.begin() == 0;
+  }
+  return true;
+}
+
 void reset_pir_and_mems() {
-  pir_value = 0;
-  mems_value = 0;
+#ifdef SENSE_MOTION
+  pir_motion = false;
+  pir_occupancy = 0;
+  pir_onsets = 0;
+#endif
+  mems_dba = 0;
+  have_mems_dba = false;
+}
+
+#ifdef SENSE_MOTION
+// The PIR holds its output high for as long as it sees motion, plus a hold time.  Rather than poll
+// it, which misses triggers shorter than the polling interval, its interrupt handler accounts for
+// every edge: a rising edge is an onset and starts the clock, a falling edge adds the time since the
+// rising edge to the total.  The sensor task is not involved until the window closes.  The handler's
+// state is shared with the sensor task under pir_lock.
+
+static portMUX_TYPE pir_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool pir_high;
+static int64_t pir_high_since_us;
+static int64_t pir_high_us;
+static unsigned pir_edge_onsets;
+static int64_t pir_window_start_us;
+
+static void pir_handler() {
+  int64_t now = esp_timer_get_time();
+  bool level = digitalRead(PIR_SENSOR_PIN) != 0;
+  portENTER_CRITICAL_ISR(&pir_lock);
+  if (level != pir_high) {
+    pir_high = level;
+    if (level) {
+      pir_edge_onsets++;
+      pir_high_since_us = now;
+    } else {
+      pir_high_us += now - pir_high_since_us;
+    }
+  }
+  portEXIT_CRITICAL_ISR(&pir_lock);
 }
+#endif
 
-void sample_pir() {
+void start_pir_sampler() {
 #ifdef SENSE_MOTION
-  pir_value |= analogRead(PIR_SENSOR_PIN);
+  int64_t now = esp_timer_get_time();
+  bool level = digitalRead(PIR_SENSOR_PIN) != 0;
+  portENTER_CRITICAL(&pir_lock);
+  // If the PIR is already high then motion is in progress; count it as an onset at the start of the
+  // window.
+  pir_high = level;
+  pir_high_since_us = now;
+  pir_high_us = 0;
+  pir_edge_onsets = level ? 1 : 0;
+  pir_window_start_us = now;
+  portEXIT_CRITICAL(&pir_lock);
+  attachInterrupt(PIR_SENSOR_PIN, pir_handler, CHANGE);
+#endif
+}
+
+void stop_pir_sampler() {
+#ifdef SENSE_MOTION
+  detachInterrupt(PIR_SENSOR_PIN);
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&pir_lock);
+  int64_t high_us = pir_high_us + (pir_high ? now - pir_high_since_us : 0);
+  unsigned onsets = pir_edge_onsets;
+  int64_t window_us = now - pir_window_start_us;
+  portEXIT_CRITICAL(&pir_lock);
+  pir_onsets = onsets;
+  pir_motion = onsets > 0;
+  pir_occupancy = window_us > 0 ? 100.0f * high_us / window_us : 0;
+#endif
+}
+
+#ifdef SENSE_NOISE
+// Rather than reading the MEMS with analogRead() from a 10ms timer, which costs a trip through the
+// main queue per sample, the ADC's DMA controller converts continuously into a ring of frames, and
+// the sampler task wakes up once per frame to fold the frame into an A-weighted sound level (see
+// sound_level.h).  The sensor task only sees the level, once per window, in get_sensor_values().
+//
+// The ESP32's controller can't convert slower than 20kHz, which is also the rate the A-weighting
+// filter is designed for, so every conversion is used.
+//
+// On HW 1.0.0 the MEMS is on ADC2, which the controller can't drive, so the sampler task reads the
+// frames with analogRead() instead, see mems_read_frame().
+
+static constexpr unsigned MEMS_FRAME_CONVERSIONS = 256; // About 13ms per frame
+static constexpr unsigned MEMS_READ_TIMEOUT_MS = 100;
+
+static TaskHandle_t mems_task;
+static SemaphoreHandle_t mems_parked;
+static std::atomic<bool> mems_running;
+
+// The dB(A) SPL for an RMS signal of one ADC count.  This is nominal, not measured: it assumes the
+// module's amplifier puts 94dB SPL (1Pa) at about 500mV RMS, which is about 630 counts at 11dB
+// attenuation.  Calibrate against a sound level meter with a 1kHz tone.
+static constexpr float MEMS_DBA_AT_ONE_COUNT = 38.0f;
+
+// Updated by the sampler task only.
+static Counter mems_frames("mems.frames");
+static Counter mems_overruns("mems.overrun");
+static Counter mems_errors("mems.error");
+static Histogram mems_frame_time("mems.frame_us");
+
+#ifdef MIC_ADC_CHANNEL
+static bool mems_adc_start() {
+  adc_digi_init_config_t init = {
+    .max_store_buf_size = 4 * MEMS_FRAME_CONVERSIONS * SOC_ADC_DIGI_RESULT_BYTES,
+    .conv_num_each_intr = MEMS_FRAME_CONVERSIONS * SOC_ADC_DIGI_RESULT_BYTES,
+    .adc1_chan_mask = 1u << MIC_ADC_CHANNEL,
+    .adc2_chan_mask = 0,
+  };
+  adc_digi_pattern_config_t pattern = {
+    .atten = ADC_ATTEN_DB_11,           // Same as analogRead()
+    .channel = MIC_ADC_CHANNEL,
+    .unit = 0,                          // ADC1
+    .bit_width = SOC_ADC_DIGI_MAX_BITWIDTH,
+  };
+  adc_digi_configuration_t config = {
+    .conv_limit_en = true,              // Required on the ESP32
+    .conv_limit_num = 250,
+    .pattern_num = 1,
+    .adc_pattern = &pattern,
+    .sample_freq_hz = SOUND_LEVEL_HZ,
+    .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+    .format = ADC_DIGI_OUTPUT_FORMAT_TYPE1,
+  };
+  if (adc_digi_initialize(&init) != ESP_OK) {
+    return false;
+  }
+  if (adc_digi_controller_configure(&config) != ESP_OK || adc_digi_start() != ESP_OK) {
+    adc_digi_deinitialize();
+    return false;
+  }
+  return true;
+}
+
+static void mems_adc_stop() {
+  adc_digi_stop();
+  // Give ADC1 back to analogRead().
+  adc_digi_deinitialize();
+}
+
+// Wait for the next frame of conversions and store the MEMS samples in `samples`, setting `*n` to
+// their number, which is 0 on a timeout.  Returns false on a hard error.
+static bool mems_read_frame(uint16_t* samples, size_t* n) {
+  static uint8_t frame[MEMS_FRAME_CONVERSIONS * SOC_ADC_DIGI_RESULT_BYTES];
+  uint32_t len = 0;
+  *n = 0;
+  esp_err_t res = adc_digi_read_bytes(frame, sizeof(frame), &len, MEMS_READ_TIMEOUT_MS);
+  if (res == ESP_ERR_TIMEOUT) {
+    return true;
+  }
+  if (res == ESP_ERR_INVALID_STATE) {
+    // The ring overflowed because we fell behind; what we got is still good.
+    mems_overruns.inc();
+  } else if (res != ESP_OK) {
+    return false;
+  }
+  for ( uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= len; i += SOC_ADC_DIGI_RESULT_BYTES ) {
+    const adc_digi_output_data_t* d = reinterpret_cast<const adc_digi_output_data_t*>(frame + i);
+    if (d->type1.channel == MIC_ADC_CHANNEL) {
+      samples[(*n)++] = d->type1.data;
+    }
+  }
+  return true;
+}
+#else
+static bool mems_adc_start() {
+  return true;
+}
+
+static void mems_adc_stop() {}
+
+// Read a frame with analogRead() at the filter's rate.  That keeps the CPU busy for the length of
+// the frame, so the task then sleeps for a tick to let the idle task run.  The level is the
+// average over the frames that were read, which for all but very short sounds is the same as over
+// the whole window.
+static bool mems_read_frame(uint16_t* samples, size_t* n) {
+  const uint32_t period_us = 1000000 / SOUND_LEVEL_HZ;
+  uint32_t next_us = micros();
+  for ( unsigned i = 0; i < MEMS_FRAME_CONVERSIONS; i++ ) {
+    int32_t wait_us = int32_t(next_us - micros());
+    if (wait_us > 0) {
+      delayMicroseconds(wait_us);
+    }
+    samples[i] = analogRead(MIC_PIN);
+    next_us += period_us;
+  }
+  *n = MEMS_FRAME_CONVERSIONS;
+  vTaskDelay(1);
+  return true;
+}
+#endif // MIC_ADC_CHANNEL
+
+static void mems_sampler(void*) {
+  static uint16_t samples[MEMS_FRAME_CONVERSIONS];
+  static SoundLevel meter;
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    meter.reset();
+    bool ok = mems_adc_start();
+    if (!ok) {
+      mems_errors.inc();
+    }
+    while (ok && mems_running) {
+      size_t n;
+      if (!mems_read_frame(samples, &n)) {
+        mems_errors.inc();
+        break;
+      }
+      if (n == 0) {
+        continue;
+      }
+      mems_frames.inc();
+      MetricTimer t(mems_frame_time);
+      meter.add(samples, n);
+    }
+    if (ok) {
+      mems_adc_stop();
+    }
+    // The semaphore orders these stores before the sensor task's reads.
+    have_mems_dba = meter.samples() > 0;
+    mems_dba = meter.level() + MEMS_DBA_AT_ONE_COUNT;
+    xSemaphoreGive(mems_parked);
+  }
+}
+
+static void mems_setup() {
+  mems_parked = xSemaphoreCreateBinary();
+  if (mems_parked == nullptr) {
+    panic("Could not create semaphore");
+  }
+#ifdef SNAPPY_DUAL_CORE
+  // Keep the sampler on the main task's core, away from the network task.
+  BaseType_t res = xTaskCreatePinnedToCore(mems_sampler, "mems", 2048, nullptr, tskIDLE_PRIORITY+1,
+                                           &mems_task, xPortGetCoreID());
+#else
+  BaseType_t res = xTaskCreate(mems_sampler, "mems", 2048, nullptr, tskIDLE_PRIORITY+1, &mems_task);
 #endif
+  if (res != pdPASS) {
+    panic("Could not create task");
+  }
 }
+#endif // SENSE_NOISE
 
-void sample_mems() {
+void start_mems_sampler() {
 #ifdef SENSE_NOISE
-  mems_value = max(mems_value, unsigned(analogRead(MIC_PIN)));
+  if (!mems_running) {
+    mems_running = true;
+    xTaskNotifyGive(mems_task);
+  }
+#endif
+}
+
+void stop_mems_sampler() {
+#ifdef SENSE_NOISE
+  if (mems_running) {
+    mems_running = false;
+    // This waits for at most one frame or one read timeout.
+    xSemaphoreTake(mems_parked, portMAX_DELAY);
+  }
+#endif
+}
+
+#ifdef SENSE_AIR_INTERRUPT
+// The air sensor holds INTn high until its data are read, so the handler only has to pass the
+// news on; the sample is read when the sensor task gets around to it.
+
+static void (*air_data_ready)();
+
+static void air_handler() {
+  air_data_ready();
+}
+
+void start_air_sampler(void (*data_ready)()) {
+  if (!sensors_ready() || !have_air) {
+    return;
+  }
+  have_air_sample = false;
+  air_data_ready = data_ready;
+  ENS160.enable_data_ready_interrupt(true);
+  attachInterrupt(AIR_INT_PIN, air_handler, RISING);
+  // If a sample was already pending then INTn went high before the handler was attached, and there
+  // will be no edge until the sample has been read.
+  if (digitalRead(AIR_INT_PIN)) {
+    take_air_sample();
+  }
+}
+
+void stop_air_sampler() {
+  detachInterrupt(AIR_INT_PIN);
+  if (peripherals_powered_on && have_air) {
+    ENS160.enable_data_ready_interrupt(false);
+  }
+}
+
+void take_air_sample() {
+  if (!sensors_ready() || !have_air) {
+    return;
+  }
+  if (ENS160.read_all(&air_sample)) {
+    have_air_sample = true;
+    air_samples.inc();
+  }
+}
 #endif
+
+#ifdef SNAPPY_AIR_SENSOR_STANDBY
+bool set_air_sensor_standby(bool standby) {
+  if (!sensors_ready() || !have_air || standby == air_in_standby) {
+    return false;
+  }
+  ENS160.setPWRMode(standby ? ENS160_SLEEP_MODE : ENS160_STANDARD_MODE);
+  air_in_standby = standby;
+  air_is_primed = false;
+  return true;
+}
+#endif
+
+bool poll_air_sensor_status(uint8_t* status) {
+  if (!sensors_ready() || !have_air || !air_is_primed) {
+    return false;
+  }
+#ifdef SENSE_AIR_INTERRUPT
+  if (have_air_sample) {
+    *status = air_sample.status;
+    return true;
+  }
+#endif
+  return ENS160.read_status(status);
 }
 
 void get_sensor_values(SnappySenseData* data) {
-  if (!peripherals_powered_on) {
+  if (!sensors_ready()) {
     return;
   }
 
@@ -248,40 +844,42 @@ void get_sensor_values(SnappySenseData* data) {
 
   data->time = time(nullptr);
 
+  EnvironmentReadings env;
+  bool have_env = have_environment && environment.read_raw(&env);
 #ifdef SENSE_TEMPERATURE
-  if (have_environment) {
-    data->temperature = environment.getTemperature(TEMP_C);
-    data->have_temperature = data->temperature != -45.0;
+  if (have_env) {
+    data->temperature = EnvironmentSensor::temperature_c(env);
+    data->set_valid(FACTOR_TEMPERATURE, data->temperature != -45.0);
   }
 #endif
 #ifdef SENSE_HUMIDITY
-  if (have_environment) {
-    data->humidity = environment.getHumidity();
-    data->have_humidity = data->humidity != 0;
+  if (have_env) {
+    data->humidity = EnvironmentSensor::humidity(env);
+    data->set_valid(FACTOR_HUMIDITY, data->humidity != 0);
   }
 #endif
 #ifdef SENSE_UV
-  if (have_environment) {
-    data->uv = environment.getUltravioletIntensity();
-    data->have_uv = true;
+  if (have_env) {
+    data->uv = EnvironmentSensor::uv(env);
+    data->set_valid(FACTOR_UV, true);
   }
 #endif
 #ifdef SENSE_LIGHT
-  if (have_environment) {
-    data->lux = environment.getLuminousIntensity();
-    data->have_lux = true;
+  if (have_env) {
+    data->lux = EnvironmentSensor::lux(env);
+    data->set_valid(FACTOR_LUX, true);
   }
 #endif
 #ifdef SENSE_PRESSURE
-  if (have_environment) {
-    data->hpa = environment.getAtmospherePressure(HPA);
-    data->have_hpa = data->hpa > 0;
+  if (have_env) {
+    data->hpa = env.pressure;
+    data->set_valid(FACTOR_HPA, data->hpa > 0);
   }
 #endif
 #ifdef SENSE_ALTITUDE
-  if (have_environment) {
-    data->elevation = environment.getElevation();
-    data->have_elevation = true;
+  if (have_env) {
+    data->elevation = EnvironmentSensor::elevation(env);
+    data->set_valid(FACTOR_ELEVATION, true);
   }
 #endif
 
@@ -290,49 +888,63 @@ void get_sensor_values(SnappySenseData* data) {
 #  error "Humidity and temperature required for air quality"
 # endif
 
-  if (!air_is_primed && data->have_humidity && data->have_temperature) {
+  if (!air_is_primed && data->is_valid(FACTOR_HUMIDITY) && data->is_valid(FACTOR_TEMPERATURE)) {
     ENS160.setTempAndHum(data->temperature, data->humidity / 100);
     air_is_primed = true;
   }
-  if (air_is_primed) {
-    data->air_sensor_status = ENS160.getENS160Status();
-    data->have_air_sensor_status = true;
+  AirReadings air;
+  bool have_air_readings = false;
+#ifdef SENSE_AIR_INTERRUPT
+  // The latest sample from the data-ready interrupt is as fresh as the device can provide.
+  if (have_air_sample) {
+    air = air_sample;
+    have_air_readings = true;
+  }
+#endif
+  if (!have_air_readings && air_is_primed) {
+    have_air_readings = ENS160.read_all(&air);
+  }
+  if (have_air_readings) {
+    data->air_sensor_status = air.status;
+    data->set_valid(FACTOR_AIR_SENSOR_STATUS, true);
     if (data->air_sensor_status != 3) {
 #ifdef SENSE_AIR_QUALITY_INDEX
-      data->aqi = ENS160.getAQI();
-      data->have_aqi = data->aqi >= 1 && data->aqi <= 5;
+      data->aqi = air.aqi;
+      data->set_valid(FACTOR_AQI, data->aqi >= 1 && data->aqi <= 5);
 #endif
 #ifdef SENSE_TVOC
-      data->tvoc = ENS160.getTVOC();
-      data->have_tvoc = data->tvoc > 0 && data->tvoc <= 65000;
+      data->tvoc = air.tvoc;
+      data->set_valid(FACTOR_TVOC, data->tvoc > 0 && data->tvoc <= 65000);
 #endif
 #ifdef SENSE_CO2
-      data->eco2 = ENS160.getECO2();
-      data->have_eco2 = data->eco2 > 400;
+      data->eco2 = air.eco2;
+      data->set_valid(FACTOR_ECO2, data->eco2 > 400);
 #endif
     }
   } else {
-    data->have_air_sensor_status = false;
+    data->set_valid(FACTOR_AIR_SENSOR_STATUS, false);
 #ifdef SENSE_AIR_QUALITY_INDEX
-    data->have_aqi = false;
+    data->set_valid(FACTOR_AQI, false);
 #endif
 #ifdef SENSE_TVOC
-    data->have_tvoc = false;
+    data->set_valid(FACTOR_TVOC, false);
 #endif
 #ifdef SENSE_CO2
-    data->have_eco2 = false;
+    data->set_valid(FACTOR_ECO2, false);
 #endif
   }
 #endif
 
 #ifdef SENSE_MOTION
-  data->motion_detected = pir_value != 0;
-  data->have_motion = true;
+  data->motion_detected = pir_motion;
+  data->set_valid(FACTOR_MOTION, true);
+  data->occupancy = pir_occupancy;
+  data->motion_onsets = pir_onsets;
 #endif
 
 #ifdef SENSE_NOISE
-  data->noise = mems_value;
-  data->have_noise = true;
+  data->noise = mems_dba;
+  data->set_valid(FACTOR_NOISE, have_mems_dba);
 #endif
 }
 
@@ -20,6 +20,14 @@ void power_peripherals_on();
 // as the PIR.  Note that the WAKE/BTN1 button and serial lines are not affected.
 void power_peripherals_off();
 
+// Enter the low-power state for the sleep window.  With SNAPPY_AIR_SENSOR_STANDBY this turns the
+// display off, and the air sensor is put into standby separately, see monitoring_standby();
+// otherwise it powers the peripherals off.
+void peripherals_sleep();
+
+// Leave the low-power state: turn the display back on, or power the peripherals on.
+void peripherals_wake();
+
 // The following methods will have limited or no functionality if the peripherals have been
 // powered off.  Some will report this fact on the log or on their output stream.
 // Some will just do nothing.
@@ -36,18 +44,85 @@ unsigned long entropy();
 // Print a reading on the display with the accompanying bitmap and unit description.
 void render_oled_view(const uint8_t *bitmap, const char* value, const char *units);
 
+// The functions that access the I2C sensors, and the PIR and MEMS sampler controls, must only be
+// called from the sensor task (see sensor.cpp).  The sensors are initialized on first use after
+// power_peripherals_on().
+
 // Read the sensors and store the readings in `*data`.  Transfer PIR and MEMS sampling
 // data into `data` at this point.
 void get_sensor_values(SnappySenseData* data);
 
+#ifdef SNAPPY_AIR_SENSOR_STANDBY
+// Put the air sensor into DEEP SLEEP, or back into standard operation.  The sensor keeps its state
+// in DEEP SLEEP but needs to warm up again briefly, and it has to be primed again by
+// get_sensor_values().  Returns true if the sensor's mode was changed.
+bool set_air_sensor_standby(bool standby);
+#endif
+
+// Get the air sensor's validity status, as for SnappySenseData::air_sensor_status.  With
+// SENSE_AIR_INTERRUPT this is the status of the latest sample, if there is one; otherwise it is a
+// one-byte read.  Returns false if there is no air sensor, or it has not yet been primed by
+// get_sensor_values(), or it could not be read.
+bool poll_air_sensor_status(uint8_t* status);
+
+// Interrupt-driven input pins.
+enum class InputPin : uint8_t {
+  BUTTON,
+};
+
+// A level change on an input pin, timestamped with the CPU cycle counter at the time of the
+// interrupt.  The cycle counter wraps every 18s or so at 240MHz, so only short intervals between
+// edges are meaningful.
+struct GpioEdge {
+  InputPin pin;
+  uint8_t level;
+  uint32_t cycles;
+};
+
+// Take the oldest edge recorded by the pin interrupt handlers, returning false if there are none.
+// EvCode::GPIO_EDGES is posted when edges become available; the main task should then call this
+// until it returns false.  Call this from the main task only.
+bool device_next_edge(GpioEdge* edge);
+
+// Returns true if device_next_edge() has an edge to return.  Call this from the main task only.
+bool device_has_edges();
+
+// Record a button edge that the debouncer discarded, if the button's level is no longer the level
+// of the last edge.  Call this from the main task, after the debounce window of that edge.
+void device_resample_button();
+
 // Reset private sampler data for PIR and MEMS
 void reset_pir_and_mems();
 
-// Sample the PIR and incorporate the result into the PIR sampling data
-void sample_pir();
+// Start recording PIR edges by interrupt, replacing the previous PIR sampling data.
+void start_pir_sampler();
+
+// Stop recording PIR edges.  The motion data for the period since start_pir_sampler() are then
+// transferred by get_sensor_values().
+void stop_pir_sampler();
+
+#ifdef SENSE_AIR_INTERRUPT
+// Enable the air sensor's data-ready interrupt.  From now on `data_ready` is called from the
+// interrupt handler whenever the sensor has a new sample, and take_air_sample() should then be
+// called.  The sensor should have been primed with temperature and humidity by get_sensor_values()
+// first.
+void start_air_sampler(void (*data_ready)());
+
+// Disable the data-ready interrupt.  The last sample is transferred by get_sensor_values().
+void stop_air_sampler();
+
+// Read the air sensor's new sample, which deasserts its interrupt line, and keep it for
+// get_sensor_values().
+void take_air_sample();
+#endif
+
+// Start sampling the MEMS continuously in the background, replacing the previous MEMS sampling
+// data.  Does nothing if the sampler is running.
+void start_mems_sampler();
 
-// Sample the MEMS and incorporate the result into the MEMS sampling data
-void sample_mems();
+// Stop the MEMS sampler, if it is running, and wait for it to finish its last block.  The peak
+// reading is then transferred by get_sensor_values().
+void stop_mems_sampler();
 
 // Go into a state where `msg` is displayed on all available surfaces and the
 // device hangs.  If `is_error` is true then an additional error indication
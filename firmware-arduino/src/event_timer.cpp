@@ -0,0 +1,160 @@
+// Event timers - timeouts that post events to the main task.
+
+#include "event_timer.h"
+
+#include "metrics.h"
+#include "util.h"
+
+// There are about a dozen timers in the firmware, so a linear scan of a fixed table is as fast as
+// anything fancier would be, and it never allocates.
+static constexpr int MAX_EVENT_TIMERS = 16;
+
+struct EventTimer {
+  const char* name;
+  EvCode code;
+  uint32_t payload;
+  TickType_t tolerance;
+  TickType_t deadline;
+  TickType_t period;    // 0 for one-shot timers
+  bool armed;
+};
+
+static EventTimer event_timers[MAX_EVENT_TIMERS];
+static int num_event_timers;
+
+// Protects the timer table, and `next_wakeup`, which is the tick at which the scheduler task will
+// next wake up on its own if `have_wakeup`; otherwise it sleeps until it is notified.
+static portMUX_TYPE timer_lock = portMUX_INITIALIZER_UNLOCKED;
+static TickType_t next_wakeup;
+static bool have_wakeup;
+static TaskHandle_t scheduler_task;
+
+static Counter wakeups("timer.wakeups");
+static Counter expirations("timer.expirations");
+// Starts and stops.  With a FreeRTOS software timer each of these is a command that wakes the timer
+// daemon, on top of the wakeup for each expiration; this is the baseline for `wakeups`.
+static Counter commands("timer.commands");
+
+// Tick arithmetic must be wraparound-safe.
+static inline bool tick_before(TickType_t a, TickType_t b) {
+  return int32_t(a - b) < 0;
+}
+
+static void scheduler(void*) {
+  struct Expired {
+    EvCode code;
+    uint32_t payload;
+  };
+  Expired expired[MAX_EVENT_TIMERS];
+
+  for (;;) {
+    int num_expired = 0;
+    TickType_t delay = portMAX_DELAY;
+
+    portENTER_CRITICAL(&timer_lock);
+    TickType_t now = xTaskGetTickCount();
+
+    // Expire every timer whose deadline has passed.  Since we wake up when the first timer runs
+    // out of tolerance, this includes every timer that could share the wakeup.
+    for ( int i = 0; i < num_event_timers; i++ ) {
+      EventTimer* t = &event_timers[i];
+      if (!t->armed || tick_before(now, t->deadline)) {
+        continue;
+      }
+      expired[num_expired++] = Expired { t->code, t->payload };
+      if (t->period == 0) {
+        t->armed = false;
+      } else {
+        // Stay on the original schedule unless we've fallen a whole period behind.
+        t->deadline += t->period;
+        if (!tick_before(now, t->deadline)) {
+          t->deadline = now + t->period;
+        }
+      }
+    }
+    // The next wakeup is the earliest time at which some timer runs out of tolerance.
+    have_wakeup = false;
+    TickType_t wakeup = 0;
+    for ( int i = 0; i < num_event_timers; i++ ) {
+      EventTimer* t = &event_timers[i];
+      if (t->armed && (!have_wakeup || tick_before(t->deadline + t->tolerance, wakeup))) {
+        wakeup = t->deadline + t->tolerance;
+        have_wakeup = true;
+      }
+    }
+    if (have_wakeup) {
+      delay = tick_before(now, wakeup) ? wakeup - now : 0;
+      next_wakeup = wakeup;
+    }
+    portEXIT_CRITICAL(&timer_lock);
+
+    for ( int i = 0; i < num_expired; i++ ) {
+      put_main_event(expired[i].code, expired[i].payload);
+    }
+    expirations.inc(num_expired);
+
+    // A notification means a timer was started that must expire before `next_wakeup`.
+    ulTaskNotifyTake(pdTRUE, delay);
+    wakeups.inc();
+  }
+}
+
+void event_timers_init() {
+#ifdef SNAPPY_DUAL_CORE
+  // Keep the scheduler on the main task's core, away from the network task.
+  BaseType_t res = xTaskCreatePinnedToCore(scheduler, "timers", 2048, nullptr, tskIDLE_PRIORITY+1,
+                                           &scheduler_task, xPortGetCoreID());
+#else
+  BaseType_t res = xTaskCreate(scheduler, "timers", 2048, nullptr, tskIDLE_PRIORITY+1, &scheduler_task);
+#endif
+  if (res != pdPASS) {
+    panic("Could not create task");
+  }
+}
+
+EventTimer* event_timer_create(const char* name, EvCode code, uint32_t payload, unsigned tolerance_ms) {
+  portENTER_CRITICAL(&timer_lock);
+  if (num_event_timers == MAX_EVENT_TIMERS) {
+    portEXIT_CRITICAL(&timer_lock);
+    panic("Too many event timers");
+  }
+  EventTimer* t = &event_timers[num_event_timers++];
+  *t = EventTimer { name, code, payload, pdMS_TO_TICKS(tolerance_ms), 0, 0, false };
+  portEXIT_CRITICAL(&timer_lock);
+  return t;
+}
+
+void event_timer_start(EventTimer* t, unsigned delay_ms, unsigned period_ms) {
+  portENTER_CRITICAL(&timer_lock);
+  t->deadline = xTaskGetTickCount() + pdMS_TO_TICKS(delay_ms);
+  t->period = pdMS_TO_TICKS(period_ms);
+  t->armed = true;
+  // Wake the scheduler only if it would otherwise sleep past the time the timer runs out of
+  // tolerance.  Until the scheduler has recomputed its wakeup, that time is the one to beat.
+  TickType_t wakeup = t->deadline + t->tolerance;
+  bool must_wake = !have_wakeup || tick_before(wakeup, next_wakeup);
+  if (must_wake) {
+    next_wakeup = wakeup;
+    have_wakeup = true;
+  }
+  portEXIT_CRITICAL(&timer_lock);
+  if (must_wake) {
+    xTaskNotifyGive(scheduler_task);
+  }
+  commands.inc();
+}
+
+void event_timer_set_event(EventTimer* t, EvCode code, uint32_t payload) {
+  portENTER_CRITICAL(&timer_lock);
+  t->code = code;
+  t->payload = payload;
+  portEXIT_CRITICAL(&timer_lock);
+}
+
+void event_timer_stop(EventTimer* t) {
+  // The scheduler may wake up for nothing, but that's harmless.
+  portENTER_CRITICAL(&timer_lock);
+  t->armed = false;
+  portEXIT_CRITICAL(&timer_lock);
+  commands.inc();
+}
@@ -0,0 +1,41 @@
+// Event timers - timeouts that post events to the main task.
+
+#ifndef event_timer_h_included
+#define event_timer_h_included
+
+#include "main.h"
+
+// Every periodic or one-shot timeout in the firmware ends up posting an event to the main task.
+// Rather than having one FreeRTOS software timer per timeout, each of which wakes the timer daemon
+// on its own schedule, all of them are managed by a single scheduler task that sleeps until the
+// next deadline.
+//
+// Each timer has a tolerance: it may expire up to that many milliseconds after its deadline.  The
+// scheduler uses this slack to expire several timers in a single wakeup, so timers that are not
+// time-critical should be given a generous tolerance.
+//
+// Starting a timer that must expire before the scheduler's next wakeup costs an extra wakeup, so a
+// timer that would be restarted every time it expires should be made periodic instead.
+//
+// The API may be used from any task, but not from an ISR.
+
+struct EventTimer;
+
+// Start the scheduler.  This must be called from the main task before any timer is started.
+void event_timers_init();
+
+// Create a timer that will post `code` with `payload` when it expires.  It is created stopped.
+// Timers live forever; creating more than the scheduler has room for is a fatal error.
+EventTimer* event_timer_create(const char* name, EvCode code, uint32_t payload, unsigned tolerance_ms);
+
+// Arm the timer to expire after `delay_ms` and then, if `period_ms` is nonzero, every `period_ms`
+// thereafter.  Restarting an armed timer replaces its deadline and period.
+void event_timer_start(EventTimer* t, unsigned delay_ms, unsigned period_ms = 0);
+
+// Change the event that is posted when the timer expires.
+void event_timer_set_event(EventTimer* t, EvCode code, uint32_t payload = 0);
+
+// Disarm the timer.  An event that has already been posted is not retracted.
+void event_timer_stop(EventTimer* t);
+
+#endif // !event_timer_h_included
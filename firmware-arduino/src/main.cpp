@@ -10,8 +10,8 @@
 // is one global event queue, and many timers feeding it.  See below for a better description.
 //
 // The system will sleep when there's no work to be done.  If the time to sleep is long
-// enough, it will power down peripherals while it's sleeping.  All of this is managed
-// in loop(), below.
+// enough, it will power down peripherals (or put them in standby, see SNAPPY_AIR_SENSOR_STANDBY)
+// while it's sleeping.  All of this is managed in loop(), below.
 //
 //
 // LAYERS.
@@ -105,13 +105,23 @@
 // The music player task
 // (And more, depending on configuration)
 //
-// All but the music player are integrated into the main loop, driven by several timers.
-// The music player is an actual FreeRTOS concurrent task with a higher priority.  They could all
-// have been different FreeRTOS tasks but this would not have been a simplification, as we want
-// to be able to react to button presses and other interrupts and that means controlling the
-// other tasks from the main task; also, with other tasks come issues of concurrency and mutual
+// All but the music player are integrated into the main loop, driven by several timers (see
+// event_timer.h).  The music player is an actual FreeRTOS concurrent task with a higher priority.
+// They could all have been different FreeRTOS tasks but this would not have been a simplification,
+// as we want to be able to react to button presses and other interrupts and that means controlling
+// the other tasks from the main task; also, with other tasks come issues of concurrency and mutual
 // exclusion.
 //
+// The exception is network operations that block (MQTT connect and traffic, NTP).  The wifi and
+// mqtt tasks' state machines run in the main loop, but they hand the blocking operations to the
+// network task as jobs and get completion events back, see net_task.h.  With SNAPPY_DUAL_CORE the
+// network task runs on the other core.
+//
+// Likewise the sensors: the monitoring task's state machine runs on a sensor task that owns the I2C
+// sensors, so that slow sensor transactions never hold up the display or the button.  The main loop
+// opens and closes the monitoring window by sending it commands, and the readings come back through
+// a double buffer that the slideshow reads in place, see sensor.h.
+//
 // The MAIN LOOP goes through a number of states as follows:
 //
 //        Boot
@@ -120,7 +130,7 @@
 //        Start button listeners
 //        Start serial port listener, if applicable
 //
-//    L1  Open the communications window
+//    L1  Open the communications window, if there is anything to communicate
 //          bring up wifi
 //          configure time, if not already done
 //          unless upload is disabled
@@ -130,10 +140,19 @@
 //          while the timeout not expired
 //            await notifications about comms activity
 //            reset the comms timeout every time there is activity
-//
 //        Close the communication window
 //          bring down wifi
 //
+//        Concurrently with the communication window, open the monitoring window
+//          (takes a while to monitor, most of it sensor warmup)
+//        Close the monitoring window
+//
+//        Monitoring data arrive, they are distributed to slideshow and comms
+//
+//        When both windows are closed, go to L2.  The windows overlap because they are both
+//        long (wifi activity timeout, sensor warmup) but mostly idle, and the device should be
+//        awake for as short a time as possible.
+//
 //    L2  Play the slideshow for a little while
 //
 //    L3  If device is in monitoring mode & we don't have a serial listener, go to sleep for a while
@@ -142,7 +161,7 @@
 //          If while sleeping, the button is pressed
 //            Wake up
 //            Flash "Monitoring mode" on the screen for a couple seconds
-//            Go to L2 (a second press during L2 will bring us into slideshow mode,
+//            Go to L1 (a second press during L1 will bring us into slideshow mode,
 //              see button tasks below)
 //        Otherwise
 //          Let the slide show play for a while without doing anything else
@@ -151,12 +170,6 @@
 //          Power up
 //          Start slideshow task
 //
-//        Open the monitoring window
-//          (takes a while to monitor)
-//        Close the monitoring window
-//
-//        Monitoring data arrive, they are distributed to slideshow and comms
-//
 //        Goto L1
 //
 // The SHORT-PRESS BUTTON LISTENER task:
@@ -182,9 +195,12 @@
 #include "config.h"
 #include "command.h"
 #include "device.h"
+#include "event_timer.h"
 #include "icons.h"
 #include "log.h"
+#include "metrics.h"
 #include "mqtt.h"
+#include "net_task.h"
 #include "network_lora.h"
 #include "network_wifi.h"
 #include "piezo.h"
@@ -192,6 +208,8 @@
 #include "serial_server.h"
 #include "slideshow.h"
 #include "time_server.h"
+#include "trace.h"
+#include "util.h"
 #include "web_config.h"
 #include "web_server.h"
 
@@ -201,10 +219,24 @@
 bool slideshow_mode = true;
 
 // The timer used for timing out the major sections of the main loop.
-static TimerHandle_t master_timeout_timer;
+static EventTimer* master_timeout_timer;
 
-// The event queue that drives all activity except within the music player task
-static QueueHandle_t/*<SnappyEvent>*/ main_event_queue;
+// The event queues that drive all activity except within the music player task.
+//
+// There are two lanes.  Periodic work from the polling, network and display timers goes into the
+// bulk lane; everything else, which is what drives the state machines, goes into the control lane,
+// which is always drained first.  That way a burst of periodic work can neither delay a state
+// transition or a button press nor crowd it out of the queue.  The counting semaphore counts the
+// events in both lanes, it's what the main task blocks on.
+//
+// A bulk event that is posted while another with the same code is queued is merged into it, see
+// is_bulk_event(), so the bulk lane never holds more than one event per bulk event code and a
+// producer that gets ahead of the main task is throttled rather than dropped.
+static constexpr unsigned CONTROL_QUEUE_LENGTH = 50;
+static constexpr unsigned BULK_QUEUE_LENGTH = 8;
+static QueueHandle_t/*<SnappyEvent>*/ control_queue;
+static QueueHandle_t/*<SnappyEvent>*/ bulk_queue;
+static SemaphoreHandle_t queued_events;
 
 #if defined(SNAPPY_HARDWARE_1_1_0)
 # define HARDWARE_NAME "1.1"
@@ -215,7 +247,10 @@ static QueueHandle_t/*<SnappyEvent>*/ main_event_queue;
 #endif
 
 void setup() {
-  main_event_queue = xQueueCreate(100, sizeof(SnappyEvent));
+  control_queue = xQueueCreate(CONTROL_QUEUE_LENGTH, sizeof(SnappyEvent));
+  bulk_queue = xQueueCreate(BULK_QUEUE_LENGTH, sizeof(SnappyEvent));
+  queued_events = xSemaphoreCreateCounting(CONTROL_QUEUE_LENGTH + BULK_QUEUE_LENGTH, 0);
+  event_timers_init();
 
   // Power up the device.
   device_setup();
@@ -240,47 +275,246 @@ void setup() {
 #endif
 }
 
-void put_main_event(EvCode code) {
-  // This (and the ones below) can be called from timer callbacks, so use a delay of 0.
-  // The queue should anyway be large enough for us never to have to block on insert.
-  SnappyEvent ev(code);
-  xQueueSend(main_event_queue, &ev, 0);
+// Pool for event payloads.  Web requests are only used in AP mode.
+static Pool<WebRequest, 4> web_request_pool;
+
+WebRequest* alloc_web_request(const String& request, Stream& client) {
+  return web_request_pool.alloc(request, client);
+}
+
+void free_web_request(WebRequest* r) {
+  web_request_pool.release(r);
 }
 
-void put_main_event(EvCode code, void* data) {
-  SnappyEvent ev(code, data);
-  xQueueSend(main_event_queue, &ev, 0);
+unsigned web_request_pool_exhausted() {
+  return web_request_pool.exhausted_count();
+}
+
+// Bulk events only say "there is work to do", so one that is posted while another is still queued
+// is merged into it.  The handlers check their own state and tolerate spurious and merged calls.
+// There must be no more bulk event codes than BULK_QUEUE_LENGTH.
+static bool is_bulk_event(EvCode code) {
+  switch (code) {
+    case EvCode::COMM_MQTT_WORK:
+    case EvCode::COMM_NTP_WORK:
+    case EvCode::SLIDESHOW_WORK:
+    case EvCode::SERIAL_SERVER_POLL:
+    case EvCode::WEB_SERVER_POLL:
+      return true;
+    default:
+      return false;
+  }
+}
+
+static std::atomic<bool> event_queued[size_t(EvCode::NUM_CODES)];
+static std::atomic<uint32_t> event_drops[size_t(EvCode::NUM_CODES)];
+static std::atomic<uint32_t> events_coalesced;
+
+// Returns true if the event need not be queued because an identical one is already queued.
+static bool coalesce_event(EvCode code) {
+  if (is_bulk_event(code) && event_queued[size_t(code)].exchange(true)) {
+    events_coalesced++;
+    return true;
+  }
+  return false;
+}
+
+// Only control events can be dropped, since the bulk lane has room for one of each bulk event.
+static void count_dropped_event(EvCode code) {
+  if (is_bulk_event(code)) {
+    event_queued[size_t(code)] = false;
+  }
+  event_drops[size_t(code)]++;
+}
+
+unsigned main_event_drops(EvCode code) {
+  return event_drops[size_t(code)];
+}
+
+unsigned main_event_coalesced() {
+  return events_coalesced;
+}
+
+const char* main_event_name(EvCode code) {
+#define EVENT_NAME(name) case EvCode::name: return #name;
+  switch (code) {
+    EVENT_NAME(NONE)
+    EVENT_NAME(START_CYCLE)
+    EVENT_NAME(COMM_START)
+    EVENT_NAME(COMM_WIFI_CLIENT_RETRY)
+    EVENT_NAME(COMM_WIFI_CLIENT_FAILED)
+    EVENT_NAME(COMM_WIFI_CLIENT_UP)
+    EVENT_NAME(COMM_ACTIVITY_EXPIRED)
+    EVENT_NAME(POST_COMM)
+    EVENT_NAME(POST_WINDOWS)
+    EVENT_NAME(SLEEP_START)
+    EVENT_NAME(POST_SLEEP)
+    EVENT_NAME(MONITOR_START)
+    EVENT_NAME(MONITOR_STOP)
+    EVENT_NAME(MONITOR_ABANDON)
+    EVENT_NAME(COMM_ACTIVITY)
+    EVENT_NAME(MONITOR_DATA)
+    EVENT_NAME(BUTTON_PRESS)
+    EVENT_NAME(BUTTON_LONG_PRESS)
+    EVENT_NAME(ENABLE_DEVICE)
+    EVENT_NAME(DISABLE_DEVICE)
+    EVENT_NAME(SET_INTERVAL)
+    EVENT_NAME(PERFORM)
+    EVENT_NAME(WEB_REQUEST)
+    EVENT_NAME(WEB_REQUEST_FAILED)
+    EVENT_NAME(COMM_NET_DONE)
+    EVENT_NAME(COMM_MQTT_WORK)
+    EVENT_NAME(COMM_MQTT_DONE)
+    EVENT_NAME(COMM_NTP_WORK)
+    EVENT_NAME(COMM_NTP_DONE)
+    EVENT_NAME(MESSAGE)
+    EVENT_NAME(SLIDESHOW_START)
+    EVENT_NAME(SLIDESHOW_RESET)
+    EVENT_NAME(SLIDESHOW_STOP)
+    EVENT_NAME(SLIDESHOW_WORK)
+    EVENT_NAME(GPIO_EDGES)
+    EVENT_NAME(BUTTON_TIMEOUT)
+    EVENT_NAME(SERIAL_SERVER_POLL)
+    EVENT_NAME(WEB_SERVER_POLL)
+    EVENT_NAME(NUM_CODES)
+  }
+#undef EVENT_NAME
+  return "?";
+}
+
+// These (and the ones below) can be called from timer callbacks, so use a delay of 0.
+// The queues should anyway be large enough for us never to have to block on insert.
+static bool send_main_event(const SnappyEvent& ev) {
+  if (coalesce_event(ev.code)) {
+    return true;
+  }
+  if (xQueueSend(is_bulk_event(ev.code) ? bulk_queue : control_queue, &ev, 0) != pdTRUE) {
+    count_dropped_event(ev.code);
+    return false;
+  }
+  xSemaphoreGive(queued_events);
+  return true;
+}
+
+void put_main_event(EvCode code) {
+  send_main_event(SnappyEvent(code));
 }
 
 void put_main_event(EvCode code, uint32_t data) {
-  SnappyEvent ev(code, data);
-  xQueueSend(main_event_queue, &ev, 0);
+  send_main_event(SnappyEvent(code, data));
+}
+
+void put_main_event(EvCode code, const char* text) {
+  send_main_event(SnappyEvent(code, text));
+}
+
+void put_main_event(EvCode code, WebRequest* r) {
+  if (!send_main_event(SnappyEvent(code, r))) {
+    free_web_request(r);
+  }
+}
+
+void put_main_event(EvCode code, String* s) {
+  if (!send_main_event(SnappyEvent(code, s))) {
+    delete s;
+  }
 }
 
 void put_main_event_from_isr(EvCode code) {
   SnappyEvent ev(code);
-  xQueueSendFromISR(main_event_queue, &ev, nullptr);
+  if (coalesce_event(code)) {
+    return;
+  }
+  if (xQueueSendFromISR(is_bulk_event(code) ? bulk_queue : control_queue, &ev, nullptr) != pdTRUE) {
+    count_dropped_event(code);
+    return;
+  }
+  xSemaphoreGiveFromISR(queued_events, nullptr);
+}
+
+// Block until there is an event for the main task.  Completions from the network task are
+// collected here, so that the main loop sees them as ordinary events.
+static void get_main_event(SnappyEvent* ev) {
+  for (;;) {
+    // The ISR posts GPIO_EDGES only when the edge ring becomes nonempty; if that event was dropped
+    // the edges would otherwise wait forever.
+    if (device_has_edges()) {
+      *ev = SnappyEvent(EvCode::GPIO_EDGES);
+      return;
+    }
+#ifdef SNAPPY_WIFI
+    if (net_task_completion(ev)) {
+      return;
+    }
+#endif
+    while (xSemaphoreTake(queued_events, portMAX_DELAY) != pdTRUE) {}
+    // Every count on the semaphore was given after an event was queued, so one of these succeeds.
+    if (xQueueReceive(control_queue, ev, 0) != pdTRUE) {
+      xQueueReceive(bulk_queue, ev, 0);
+    }
+    if (is_bulk_event(ev->code)) {
+      event_queued[size_t(ev->code)] = false;
+    }
+    if (ev->code != EvCode::COMM_NET_DONE) {
+      return;
+    }
+  }
 }
 
+// Dispatch the edges recorded by the pin interrupts, in order.
+static void handle_gpio_edges() {
+  GpioEdge edge;
+  while (device_next_edge(&edge)) {
+    switch (edge.pin) {
+      case InputPin::BUTTON:
+        if (edge.level) {
+          button_down(edge.cycles);
+        } else {
+          button_up(edge.cycles);
+        }
+        break;
+    }
+  }
+}
+
+// How long the sensor task has to answer MONITOR_STOP with MONITOR_DATA before main closes the
+// window without it.  The data can be lost if the control lane is full, and the task can hang on
+// the bus; either way the cycle must go on.
+static const unsigned MONITOR_STOP_GRACE_MS = 5000;
+
+static Counter windows_abandoned("main.windows_abandoned");
+
 static void init_master_timeout() {
-  master_timeout_timer = xTimerCreate("main",
-                                      1,
-                                      pdFALSE,
-                                      nullptr,
-                                      [](TimerHandle_t t) {
-                                        put_main_event(EvCode((uint32_t)pvTimerGetTimerID(t)));
-                                      });
+  master_timeout_timer = event_timer_create("main", EvCode::NONE, 0, 250);
 }
 
 static void set_master_timeout(unsigned timeout_ms, EvCode payload) {
-  vTimerSetTimerID(master_timeout_timer, (void*)payload);
-  xTimerChangePeriod(master_timeout_timer, pdMS_TO_TICKS(timeout_ms), portMAX_DELAY);
+  event_timer_set_event(master_timeout_timer, payload);
+  event_timer_start(master_timeout_timer, timeout_ms);
 }
 
 static void cancel_master_timeout() {
-  xTimerStop(master_timeout_timer, portMAX_DELAY);
+  event_timer_stop(master_timeout_timer);
 }
 
+#ifdef SNAPPY_WIFI
+// The communication window is open concurrently with the monitoring window, whose end is timed by
+// the master timeout, so the comm activity timeout needs a timer of its own.
+static EventTimer* comm_timeout_timer;
+
+static void init_comm_timeout() {
+  comm_timeout_timer = event_timer_create("comm", EvCode::COMM_ACTIVITY_EXPIRED, 0, 250);
+}
+
+static void set_comm_timeout(unsigned timeout_ms) {
+  event_timer_start(comm_timeout_timer, timeout_ms);
+}
+
+static void cancel_comm_timeout() {
+  event_timer_stop(comm_timeout_timer);
+}
+#endif
+
 #ifdef SNAPPY_WEBCONFIG
 static void ap_mode_loop() NO_RETURN;
 #endif
@@ -305,6 +539,11 @@ void loop() {
   // True iff the main loop is in the monitoring window, between MONITOR_START and MONITOR_STOP.
   bool in_monitoring_window = false;
 
+  // True iff the main loop is between COMM_START and POST_COMM.  The cycle proceeds to
+  // POST_WINDOWS when both this and in_monitoring_window are false.  Always false without
+  // SNAPPY_WIFI.
+  bool in_comm_phase = false;
+
   // True when the peripherals have been powered down and we are between SLEEP_START and
   // POST_SLEEP.
   bool in_sleep_window = false;
@@ -313,8 +552,9 @@ void loop() {
   // and is acted upon at a specific point in the state machine
   bool slideshow_next_mode = slideshow_mode;
 
-  // This is used to improve the UX.  It shortens the comm window the first time around and
-  // skips the relaxation / sleep before we read the sensors.
+  // This is used to improve the UX.  It shortens the comm window the first time around.  The
+  // first cycle reads the sensors at once, and every cycle after it follows the relaxation and
+  // sleep as usual, so that the first two monitoring windows are not run back to back.
   bool first_time = true;
 
   // This is used to improve the UX.  It is set by the button press handler when the button is
@@ -334,6 +574,9 @@ void loop() {
   // Slideshow / display task's state state
 
   init_master_timeout();
+#ifdef SNAPPY_WIFI
+  init_comm_timeout();
+#endif
 
   // The slideshow task starts whether we're in slideshow mode or not, since slideshow
   // mode only affects what happens between communication and monitoring, and for how long.
@@ -347,6 +590,7 @@ void loop() {
 
   // Start concurrent tasks.
 #ifdef SNAPPY_WIFI
+  net_task_init();
   wifi_init();
 #endif
 #ifdef SNAPPY_NTP
@@ -367,29 +611,18 @@ void loop() {
   (void)in_monitoring_window;
 
 #ifdef SIMULATE_LONG_PRESS
-  TimerHandle_t simulated_long_press = xTimerCreate("long",
-                                                    pdMS_TO_TICKS(SIMULATE_LONG_PRESS*1000),
-                                                    pdFALSE,
-                                                    nullptr,
-                                                    [](TimerHandle_t) {
-                                                      put_main_event(EvCode::BUTTON_LONG_PRESS);
-                                                    });
-  xTimerStart(simulated_long_press, portMAX_DELAY);
+  EventTimer* simulated_long_press = event_timer_create("long", EvCode::BUTTON_LONG_PRESS, 0, 0);
+  event_timer_start(simulated_long_press, SIMULATE_LONG_PRESS*1000);
 #endif
 #ifdef SIMULATE_SHORT_PRESS
-  TimerHandle_t simulated_short_press = xTimerCreate("short",
-                                                     pdMS_TO_TICKS(SIMULATE_SHORT_PRESS*1000),
-                                                     pdFALSE,
-                                                     nullptr,
-                                                     [](TimerHandle_t) {
-                                                       put_main_event(EvCode::BUTTON_PRESS);
-                                                     });
-  xTimerStart(simulated_short_press, portMAX_DELAY);
+  EventTimer* simulated_short_press = event_timer_create("short", EvCode::BUTTON_PRESS, 0, 0);
+  event_timer_start(simulated_short_press, SIMULATE_SHORT_PRESS*1000);
 #endif
 
   for (;;) {
     SnappyEvent ev;
-    while (xQueueReceive(main_event_queue, &ev, portMAX_DELAY) != pdTRUE) {}
+    get_main_event(&ev);
+    TraceScope trace(TraceSpan::EVENT, uint8_t(ev.code), uxSemaphoreGetCount(queued_events));
     //log("Event %d\n", (int)ev.code);
     switch (ev.code) {
 
@@ -398,6 +631,10 @@ void loop() {
       // Main task
 
       case EvCode::START_CYCLE: {
+        // The communication window, if any, and the monitoring window are opened together, so
+        // that the network traffic overlaps the sensor warmup and the device is awake for about
+        // the longer of the two rather than their sum.
+        //
         // We communicate only if we have to.  Note that the predicates for comm work have the
         // ability to reduce the frequency of communication if they want; for example, the
         // mqtt task could decide not to communicate often, or if it doesn't have a lot of
@@ -411,13 +648,11 @@ void loop() {
         comm_work = comm_work || mqtt_have_work(explicitly_awoken);
 # endif
         if (comm_work) {
+          in_comm_phase = true;
           put_main_event(EvCode::COMM_START);
-        } else {
-          put_main_event(EvCode::POST_COMM);
         }
-#else
-        put_main_event(EvCode::SLEEP_START);
 #endif
+        put_main_event(EvCode::MONITOR_START);
         break;
       }
 
@@ -436,13 +671,13 @@ void loop() {
 
       case EvCode::COMM_WIFI_CLIENT_FAILED:
         // Could not bring up WiFi.
-        put_main_event(EvCode::MESSAGE, new String("No WiFi"));
+        put_main_event(EvCode::MESSAGE, "No WiFi");
         in_wifi_window = false;
         put_main_event(EvCode::POST_COMM);
         break;
 
       case EvCode::COMM_WIFI_CLIENT_UP: {
-        put_main_event(EvCode::MESSAGE, new String("WiFi connected"));
+        put_main_event(EvCode::MESSAGE, "WiFi connected");
         in_communication_window = true;
 #ifdef SNAPPY_NTP
         if (ntp_have_work()) {
@@ -458,7 +693,7 @@ void loop() {
         if (first_time) {
           timeout_ms /= 2;
         }
-        set_master_timeout(timeout_ms, EvCode::COMM_ACTIVITY_EXPIRED);
+        set_comm_timeout(timeout_ms);
         break;
       }
 
@@ -470,7 +705,7 @@ void loop() {
           if (first_time) {
             timeout_ms /= 2;
           }
-          set_master_timeout(timeout_ms, EvCode::COMM_ACTIVITY_EXPIRED);
+          set_comm_timeout(timeout_ms);
         }
         break;
 
@@ -499,41 +734,45 @@ void loop() {
       case EvCode::POST_COMM:
         // The process that started in COMM_START task always ends up here, via some of the states
         // above.
-        //
-        // The comm window is closed.  Let the slideshow continue for a bit before deciding
-        // what mode we're going to be in.
+        assert(!in_communication_window && !in_wifi_window);
+        in_comm_phase = false;
+        if (!in_monitoring_window) {
+          put_main_event(EvCode::POST_WINDOWS);
+        }
+        break;
+#endif
+
+      case EvCode::POST_WINDOWS:
+        // The comm and monitoring windows are both closed.  Let the slideshow continue for a bit
+        // before deciding what mode we're going to be in.
         //
         // TODO: In an ideal world, the commencement of sleep would coincide with the end of the
         // slidehow cycle.  We could implement this by having SLEEP_START set a flag and have
         // a message from the slideshow at the end of the cycle see that flag and actually
         // enter sleep mode.  But this adds more complexity.
-        assert(!in_communication_window && !in_wifi_window);
-        if (first_time) {
-          put_main_event(EvCode::SLEEP_START);
-        } else {
-          set_master_timeout(comm_relaxation_timeout_s() * 1000, EvCode::SLEEP_START);
-        }
-        break;
+        first_time = false;
+#ifdef SNAPPY_WIFI
+        set_master_timeout(comm_relaxation_timeout_s() * 1000, EvCode::SLEEP_START);
+#else
+        put_main_event(EvCode::SLEEP_START);
 #endif
+        break;
 
       case EvCode::SLEEP_START:
         explicitly_awoken = false;
         // Figure out what mode we're in.  In monitoring mode, we turn off the screen and go
         // into low-power state.  In slideshow mode, we continue on as we were, for a while.
-        if (first_time) {
-          put_main_event(EvCode::POST_SLEEP);
+        slideshow_mode = slideshow_next_mode;
+        log("New mode: %s\n", slideshow_mode ? "slideshow" : "monitoring");
+        if (slideshow_mode) {
+          set_master_timeout(slideshow_mode_sleep_s() * 1000, EvCode::POST_SLEEP);
         } else {
-          slideshow_mode = slideshow_next_mode;
-          log("New mode: %s\n", slideshow_mode ? "slideshow" : "monitoring");
-          if (slideshow_mode) {
-            set_master_timeout(slideshow_mode_sleep_s() * 1000, EvCode::POST_SLEEP);
-          } else {
-            put_main_event(EvCode::SLIDESHOW_STOP);
-            set_master_timeout(monitoring_mode_sleep_s() * 1000, EvCode::POST_SLEEP);
-            log("Nap time.  Sleep mode activated.\n");
-            power_peripherals_off();
-            in_sleep_window = true;
-          }
+          put_main_event(EvCode::SLIDESHOW_STOP);
+          set_master_timeout(monitoring_mode_sleep_s() * 1000, EvCode::POST_SLEEP);
+          log("Nap time.  Sleep mode activated.\n");
+          monitoring_standby();
+          peripherals_sleep();
+          in_sleep_window = true;
         }
         break;
 
@@ -541,28 +780,39 @@ void loop() {
         if (in_sleep_window) {
           // We can come to POST_SLEEP from either the timeout or from a button press.
           cancel_master_timeout();
-          power_peripherals_on();
+          peripherals_wake();
           log("Is anyone there?\n");
           in_sleep_window = false;
           put_main_event(EvCode::SLIDESHOW_RESET);
           put_main_event(EvCode::SLIDESHOW_START);
         }
-        put_main_event(EvCode::MONITOR_START);
-        first_time = false;
+        put_main_event(EvCode::START_CYCLE);
         break;
 
       case EvCode::MONITOR_START:
         log("Monitoring window opens\n");
         in_monitoring_window = true;
         monitoring_start();
+        // The sensor task closes the window when the sensors are done, this is the backstop.
         set_master_timeout(monitoring_window_s() * 1000, EvCode::MONITOR_STOP);
         break;
 
       case EvCode::MONITOR_STOP:
+        // The sensor task reads the sensors and answers with MONITOR_DATA, which closes the window.
+        // If it does not, MONITOR_ABANDON closes it.
         monitoring_stop();
-        put_main_event(EvCode::START_CYCLE);
-        log("Monitoring window closes\n");
-        in_monitoring_window = false;
+        set_master_timeout(MONITOR_STOP_GRACE_MS, EvCode::MONITOR_ABANDON);
+        break;
+
+      case EvCode::MONITOR_ABANDON:
+        if (in_monitoring_window) {
+          log("Monitoring window closes without data\n");
+          windows_abandoned.inc();
+          in_monitoring_window = false;
+          if (!in_comm_phase) {
+            put_main_event(EvCode::POST_WINDOWS);
+          }
+        }
         break;
 
       /////////////////////////////////////////////////////////////////////////////////////
@@ -571,17 +821,38 @@ void loop() {
 
       case EvCode::MONITOR_DATA: {
         log("Monitor data received\n");
-        // monitor data arrived after closing the monitoring window
-        SnappySenseData* new_data = (SnappySenseData*)ev.pointer_data;
-        assert(new_data != nullptr);
-#ifdef SNAPPY_UPLOAD
-        upload_add_data(new SnappySenseData(*new_data));
-#endif
-#ifdef SNAPPY_COMMAND_PROCESSOR
-        command_data = *new_data;
+        // The data may come after main has abandoned the window, and the master timeout is then
+        // timing something else.
+        if (in_monitoring_window) {
+          log("Monitoring window closes\n");
+          in_monitoring_window = false;
+          cancel_master_timeout();
+          if (!in_comm_phase) {
+            put_main_event(EvCode::POST_WINDOWS);
+          }
+        }
+        // The slideshow picks up the new readings by itself.  The upload queue and the command
+        // processor keep the readings, so they need a copy.
+#if defined(SNAPPY_UPLOAD) || defined(SNAPPY_COMMAND_PROCESSOR)
+        SnappySenseData new_data;
+        if (sensor_latest(&new_data)) {
+# ifdef SNAPPY_UPLOAD
+          upload_add_data(new_data);
+#  ifdef SNAPPY_MQTT
+          // The comm window opened with the monitoring window and has usually closed by now, and
+          // the readings then wait for the next cycle's window.  If it is still open, upload them
+          // in this one.
+          if (in_communication_window) {
+            put_main_event(EvCode::COMM_ACTIVITY);
+            put_main_event(EvCode::COMM_MQTT_WORK);
+          }
+#  endif
+# endif
+# ifdef SNAPPY_COMMAND_PROCESSOR
+          command_data = new_data;
+# endif
+        }
 #endif
-        // slideshow_new_data takes over the ownership of the new_data.
-        slideshow_new_data(new_data);
         break;
       }
 
@@ -590,13 +861,13 @@ void loop() {
           // Wake up and move the state machine along.  POST_SLEEP will cancel any pending timeout.
           explicitly_awoken = true;
           put_main_event(EvCode::POST_SLEEP);
-          put_main_event(EvCode::MESSAGE, new String(slideshow_mode ? "Slideshow mode" : "Monitoring mode"));
+          put_main_event(EvCode::MESSAGE, slideshow_mode ? "Slideshow mode" : "Monitoring mode");
           break;
         }
 
         slideshow_next_mode = !slideshow_next_mode;
         put_main_event(EvCode::SLIDESHOW_RESET);
-        put_main_event(EvCode::MESSAGE, new String(slideshow_next_mode ? "Slideshow mode" : "Monitoring mode"));
+        put_main_event(EvCode::MESSAGE, slideshow_next_mode ? "Slideshow mode" : "Monitoring mode");
         put_main_event(EvCode::SLIDESHOW_START);
         break;
 
@@ -614,7 +885,7 @@ void loop() {
 
 #ifdef SNAPPY_COMMAND_PROCESSOR
       case EvCode::PERFORM: {
-        String* cmd = (String*)ev.pointer_data;
+        String* cmd = ev.string_data;
         command_evaluate(*cmd, command_data, Serial);
         delete cmd;
         break;
@@ -630,12 +901,15 @@ void loop() {
 #if defined(SNAPPY_WEBCONFIG) || defined(SNAPPY_I2CCONFIG)
         // We're in the end times.
         cancel_master_timeout();
+# ifdef SNAPPY_WIFI
+        cancel_comm_timeout();
+# endif
         slideshow_stop();
 
-        // We need the screen, so power up i2c if we're powered down.
+        // We need the screen, so wake the peripherals if we're sleeping.
         if (in_sleep_window) {
           log("Powered up for AP mode\n");
-          power_peripherals_on();
+          peripherals_wake();
           in_sleep_window = false;
         }
 
@@ -687,14 +961,6 @@ void loop() {
         break;
 #endif
 
-      /////////////////////////////////////////////////////////////////////////////////////
-      //
-      // Monitor task
-
-      case EvCode::MONITOR_WORK:
-        monitoring_work(ev.scalar_data);
-        break;
-
       /////////////////////////////////////////////////////////////////////////////////////
       //
       // Communication task
@@ -703,11 +969,19 @@ void loop() {
       case EvCode::COMM_MQTT_WORK:
         mqtt_work();
         break;
+
+      case EvCode::COMM_MQTT_DONE:
+        mqtt_job_done(ev.scalar_data);
+        break;
 #endif
 #ifdef SNAPPY_NTP
       case EvCode::COMM_NTP_WORK:
         ntp_work();
         break;
+
+      case EvCode::COMM_NTP_DONE:
+        ntp_update_done(ev.scalar_data);
+        break;
 #endif
 
       /////////////////////////////////////////////////////////////////////////////////////
@@ -717,7 +991,7 @@ void loop() {
       // that they are executed after any operations that may already be in the queue.
 
       case EvCode::MESSAGE:
-        slideshow_show_message_once((String*)ev.pointer_data);
+        slideshow_show_message_once(ev.text_data);
         break;
 
       case EvCode::SLIDESHOW_RESET:
@@ -740,12 +1014,12 @@ void loop() {
       //
       // Button monitor task
 
-      case EvCode::BUTTON_DOWN:
-        button_down();
+      case EvCode::GPIO_EDGES:
+        handle_gpio_edges();
         break;
 
-      case EvCode::BUTTON_UP:
-        button_up();
+      case EvCode::BUTTON_TIMEOUT:
+        button_timeout(ev.scalar_data);
         break;
 
       /////////////////////////////////////////////////////////////////////////////////////
@@ -787,7 +1061,8 @@ static void ap_mode_loop() {
   // Handle web + buttons until we reboot
   for (;;) {
     SnappyEvent ev;
-    while (xQueueReceive(main_event_queue, &ev, portMAX_DELAY) != pdTRUE) {}
+    get_main_event(&ev);
+    TraceScope trace(TraceSpan::EVENT, uint8_t(ev.code), uxSemaphoreGetCount(queued_events));
     //log("AP event %d\n", (int)ev.code);
     switch (ev.code) {
 
@@ -796,14 +1071,14 @@ static void ap_mode_loop() {
         break;
 
       case EvCode::WEB_REQUEST: {
-        WebRequest* r = (WebRequest*)ev.pointer_data;
+        WebRequest* r = ev.web_request;
         webcfg_process_request(r->client, r->request);
         web_server_request_completed(r);
         break;
       }
 
       case EvCode::WEB_REQUEST_FAILED: {
-        WebRequest* r = (WebRequest*)ev.pointer_data;
+        WebRequest* r = ev.web_request;
         webcfg_failed_request(r->client, r->request);
         web_server_request_completed(r);
         break;
@@ -812,16 +1087,21 @@ static void ap_mode_loop() {
       case EvCode::BUTTON_LONG_PRESS:
         esp_restart();
 
+      case EvCode::MONITOR_DATA:
+      case EvCode::MONITOR_ABANDON:
+        // Late data from the monitoring window, ignore it.
+        break;
+
       /////////////////////////////////////////////////////////////////////////////////////
       //
       // Button monitor tasks
 
-      case EvCode::BUTTON_DOWN:
-        button_down();
+      case EvCode::GPIO_EDGES:
+        handle_gpio_edges();
         break;
 
-      case EvCode::BUTTON_UP:
-        button_up();
+      case EvCode::BUTTON_TIMEOUT:
+        button_timeout(ev.scalar_data);
         break;
 
       default:
@@ -103,6 +103,33 @@
 #define SENSE_MOTION
 #define SENSE_NOISE
 
+// With SENSE_AIR_INTERRUPT, the air sensor's INTn output is taken as a data-ready interrupt and
+// the sensor is read each time it has a new sample, instead of blindly on the warmup timer.  INTn
+// is not connected on HW 1.0.0 - 1.2.0, so this needs a board with a wire to AIR_INT_PIN (see
+// device.cpp).  The host build simulates the line, see host/README.md.
+//#define SENSE_AIR_INTERRUPT
+
+// With SNAPPY_AIR_SENSOR_STANDBY, the peripherals are not powered off in the sleep window.  The air
+// sensor is put into its DEEP SLEEP mode instead and the display is turned off, so the air sensor
+// keeps its state and is ready again within seconds rather than after a cold warmup of several
+// minutes.  The peripherals share one power switch on HW 1.0.0 - 1.2.0, so the other sensors stay
+// powered as well; they draw little when idle.
+#define SNAPPY_AIR_SENSOR_STANDBY
+
+// With SNAPPY_DUAL_CORE, the network task (and with it TLS) is pinned to core 0 along with the
+// WiFi stack, while the main loop (sensors, slideshow, button) and the timers that drive it run on
+// the other core.  See net_task.h.
+#define SNAPPY_DUAL_CORE
+
+// With SNAPPY_METRICS, modules keep counters, gauges and timing histograms that can be
+// inspected with the `stats` command and are uploaded with MQTT.  See metrics.h.
+#define SNAPPY_METRICS
+
+// With SNAPPY_TRACE, the main loop and the network task record the start and duration of every
+// event and job in a ring in RAM, which the `trace` command prints.  See trace.h.  It costs RAM and
+// a little time on every event, so it is off unless a problem is being chased.
+//#define SNAPPY_TRACE
+
 // ----------------------------------------------------------------------------
 // The following are mostly useful during development and would not normally be
 // enabled in production.
@@ -170,6 +197,10 @@
 # define SNAPPY_WEB_SERVER
 #endif
 
+#if defined(SNAPPY_DUAL_CORE) && !defined(SNAPPY_WIFI)
+# undef SNAPPY_DUAL_CORE
+#endif
+
 #if !defined(SNAPPY_HARDWARE_1_0_0)
 # define SNAPPY_PIEZO
 #endif
@@ -180,7 +211,8 @@
 # endif
 #endif
 
-// In V1.0.0, there's a resource conflict between WiFi and the noise sensor / mic.
+// In V1.0.0, the mic is on ADC2, which conflicts with WiFi.  Without WiFi it is read with
+// analogRead(), since the ESP32 can't sample ADC2 with DMA, see device.cpp.
 #if defined(SNAPPY_HARDWARE_1_0_0) && defined(SNAPPY_WIFI)
 # undef SENSE_NOISE
 #endif
@@ -214,15 +246,17 @@ enum class EvCode {
   COMM_WIFI_CLIENT_UP,
   COMM_ACTIVITY_EXPIRED,
   POST_COMM,
+  POST_WINDOWS,
   SLEEP_START,
   POST_SLEEP,
   MONITOR_START,
   MONITOR_STOP,
+  MONITOR_ABANDON,
 
   // External events being handled in the main task, orthogonally to its
   // state machine.
   COMM_ACTIVITY,      // Communication activity, from comm task
-  MONITOR_DATA,       // Observation data, from monitor task; transfers a SnappySenseData object
+  MONITOR_DATA,       // New readings have been published, from sensor task; see sensor_snapshot()
   BUTTON_PRESS,       // Short press, from button listener
   BUTTON_LONG_PRESS,  // Long press, from button listener
   ENABLE_DEVICE,      // Enable monitoring, from comm task
@@ -232,12 +266,12 @@ enum class EvCode {
   WEB_REQUEST,        // Successful request, transfers a WebRequest object
   WEB_REQUEST_FAILED, // Failed request, transfers a WebRequest object
 
-  // Monitoring task state machine (timer-driven)
-  MONITOR_WORK,       // Payload: integer code
-
-  // Communication task state machine (timer-driven)
+  // Communication task state machine (timer-driven, and completions from the network task)
+  COMM_NET_DONE,      // Completions are available from net_task_completion()
   COMM_MQTT_WORK,
+  COMM_MQTT_DONE,     // Payload: result code of the network job, see mqtt.cpp
   COMM_NTP_WORK,
+  COMM_NTP_DONE,      // Payload: the time obtained, or 0 on failure
 
   // Slideshow/display task state machine (timer-driven)
   MESSAGE,
@@ -247,37 +281,74 @@ enum class EvCode {
   SLIDESHOW_WORK,
 
   // Button listener task state machine (interrupt-driven)
-  BUTTON_DOWN,
-  BUTTON_UP,
+  GPIO_EDGES,         // Edges are available from device_next_edge()
+  BUTTON_TIMEOUT,
 
   // Serial listener task state machine (timer-driven)
   SERIAL_SERVER_POLL,
 
   // Web listener task state machine (timer-driven)
   WEB_SERVER_POLL,
+
+  // Not an event code: the number of event codes
+  NUM_CODES
 };
 
+struct WebRequest;
+
+// Events are passed by value through the queue.  Payloads are scalars, strings with static
+// extent (typically literals for EvCode::MESSAGE, never copied or freed), or objects allocated
+// from the fixed-size pools below.  The receiver of a pooled payload owns it and must return it to
+// its pool.  The exception is the PERFORM payload, which is heap-allocated (development only).
 struct SnappyEvent {
-  SnappyEvent() : code(EvCode::NONE), pointer_data(nullptr) {}
-  SnappyEvent(EvCode code) : code(code), pointer_data(nullptr) {}
-  SnappyEvent(EvCode code, void* data) : code(code), pointer_data(data) { assert(data != nullptr); }
+  SnappyEvent() : code(EvCode::NONE), scalar_data(0) {}
+  SnappyEvent(EvCode code) : code(code), scalar_data(0) {}
   SnappyEvent(EvCode code, uint32_t data) : code(code), scalar_data(data) {}
+  SnappyEvent(EvCode code, const char* text) : code(code), text_data(text) { assert(text != nullptr); }
+  SnappyEvent(EvCode code, WebRequest* r) : code(code), web_request(r) { assert(r != nullptr); }
+  SnappyEvent(EvCode code, String* s) : code(code), string_data(s) { assert(s != nullptr); }
   EvCode code;
   union {
-    void* pointer_data;
     uint32_t scalar_data;
+    const char* text_data;
+    WebRequest* web_request;
+    String* string_data;
   };
 };
 
 void put_main_event(EvCode code);
 void put_main_event_from_isr(EvCode code);
-void put_main_event(EvCode code, void* data);
 void put_main_event(EvCode code, uint32_t payload);
 
+// `text` must have static extent, it is not copied.
+void put_main_event(EvCode code, const char* text);
+
+// These take ownership of the payload.  If the event cannot be queued then the payload is
+// returned to its pool (or deleted) at once.
+void put_main_event(EvCode code, WebRequest* r);
+void put_main_event(EvCode code, String* s);
+
 struct WebRequest {
-  WebRequest(String request, Stream& client) : request(request), client(client) {}
+  WebRequest(const String& request, Stream& client) : request(request), client(client) {}
   String request;
   Stream& client;
 };
 
+// Fixed-size pools for event payloads, so that the steady-state event loop does not touch the heap.
+// The alloc functions return nullptr if the pool is exhausted; the caller should then drop whatever
+// it was going to send.  Pools must only be used from the main task.
+WebRequest* alloc_web_request(const String& request, Stream& client);
+void free_web_request(WebRequest* r);
+
+// The number of events with the given code that were dropped because the queue was full, and the
+// number of work events that were merged into an identical queued event, since boot.
+unsigned main_event_drops(EvCode code);
+unsigned main_event_coalesced();
+
+// The name of the event code, as it is spelled in EvCode.
+const char* main_event_name(EvCode code);
+
+// The number of allocation requests that failed because a pool was exhausted, since boot.
+unsigned web_request_pool_exhausted();
+
 #endif // !main_h_included
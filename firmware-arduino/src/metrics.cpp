@@ -0,0 +1,88 @@
+// Runtime metrics
+
+#include "metrics.h"
+
+#ifdef SNAPPY_METRICS
+
+// Constant-initialized, so it is valid before any Metric constructor runs.
+static Metric* metrics_list = nullptr;
+
+static const uint32_t HISTOGRAM_BOUNDS_US[HISTOGRAM_BUCKETS-1] = {
+  64, 256, 1024, 4096, 16384, 65536, 262144
+};
+
+Metric::Metric(const char* name, MetricKind kind) : name(name), kind(kind), next(metrics_list) {
+  metrics_list = this;
+}
+
+void metrics_print(Stream& out) {
+  for ( Metric* m = metrics_list; m != nullptr; m = m->next ) {
+    switch (m->kind) {
+      case MetricKind::COUNTER:
+        out.printf("%s: %u\n", m->name, static_cast<Counter*>(m)->value);
+        break;
+      case MetricKind::GAUGE:
+        out.printf("%s: %d\n", m->name, static_cast<Gauge*>(m)->value);
+        break;
+      case MetricKind::HISTOGRAM: {
+        Histogram* h = static_cast<Histogram*>(m);
+        out.printf("%s: n=%u", m->name, h->count);
+        if (h->count > 0) {
+          out.printf(" avg=%uus max=%uus", (unsigned)(h->sum_us / h->count), h->max_us);
+        }
+        out.println();
+        for ( int i = 0; i < HISTOGRAM_BUCKETS; i++ ) {
+          if (h->buckets[i] == 0) {
+            continue;
+          }
+          if (i < HISTOGRAM_BUCKETS-1) {
+            out.printf("  <%uus: %u\n", HISTOGRAM_BOUNDS_US[i], h->buckets[i]);
+          } else {
+            out.printf("  >=%uus: %u\n", HISTOGRAM_BOUNDS_US[i-1], h->buckets[i]);
+          }
+        }
+        break;
+      }
+    }
+  }
+}
+
+bool metrics_snapshot(char* buf, char* buflim) {
+  size_t bufsiz = buflim - buf;
+  size_t k = 0;
+  // snprintf returns the length it wanted to write, so `k` may run past the end of the buffer; the
+  // remaining space is then computed as zero and nothing more is written.
+#define EMIT(...) k += snprintf(buf + (k < bufsiz ? k : bufsiz), k < bufsiz ? bufsiz - k : 0, __VA_ARGS__)
+  EMIT("{");
+  for ( Metric* m = metrics_list; m != nullptr; m = m->next ) {
+    EMIT("%s\"%s\":", m == metrics_list ? "" : ",", m->name);
+    switch (m->kind) {
+      case MetricKind::COUNTER:
+        EMIT("%u", static_cast<Counter*>(m)->value);
+        break;
+      case MetricKind::GAUGE:
+        EMIT("%d", static_cast<Gauge*>(m)->value);
+        break;
+      case MetricKind::HISTOGRAM: {
+        Histogram* h = static_cast<Histogram*>(m);
+        EMIT("[%u,%llu,%u", h->count, (unsigned long long)h->sum_us, h->max_us);
+        for ( int i = 0; i < HISTOGRAM_BUCKETS; i++ ) {
+          EMIT(",%u", h->buckets[i]);
+        }
+        EMIT("]");
+        break;
+      }
+    }
+  }
+  EMIT("}");
+#undef EMIT
+  if (k >= bufsiz) {
+    if (bufsiz > 0) {
+      buf[0] = 0;
+    }
+    return false;
+  }
+  return true;
+}
+
+#endif // SNAPPY_METRICS
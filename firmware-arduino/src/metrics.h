@@ -0,0 +1,129 @@
+// Runtime metrics: counters, gauges, and latency histograms.
+//
+// A metric is a static object in the module that owns it, eg
+//
+//   static Counter sends("mqtt.sent");
+//   static Histogram connect_time("mqtt.connect_us");
+//   ...
+//   sends.inc();
+//   { MetricTimer t(connect_time); mqtt_client.connect(...); }
+//
+// Metrics link themselves into a global registry during static initialization, so there is no
+// central table to maintain and nothing is allocated.  Updating a metric is a plain add or store,
+// which is cheap enough to do on any path in the main task.  Updates are not synchronized; a
+// metric should be updated from one task only.
+//
+// Without SNAPPY_METRICS, the classes remain but are empty and their methods do nothing, so client
+// code needs no ifdefs.
+
+#ifndef metrics_h_included
+#define metrics_h_included
+
+#include "main.h"
+
+#ifdef SNAPPY_METRICS
+
+enum class MetricKind {
+  COUNTER,
+  GAUGE,
+  HISTOGRAM,
+};
+
+class Metric {
+public:
+  Metric(const char* name, MetricKind kind);
+
+  const char* const name;
+  const MetricKind kind;
+  Metric* next;
+};
+
+// A monotonically increasing count of events since boot.
+class Counter : public Metric {
+public:
+  explicit Counter(const char* name) : Metric(name, MetricKind::COUNTER) {}
+  void inc(uint32_t n = 1) { value += n; }
+
+  uint32_t value = 0;
+};
+
+// The most recently observed value of some quantity.
+class Gauge : public Metric {
+public:
+  explicit Gauge(const char* name) : Metric(name, MetricKind::GAUGE) {}
+  void set(int32_t v) { value = v; }
+
+  int32_t value = 0;
+};
+
+// Durations in microseconds, sorted into fixed buckets whose upper bounds are powers of 4 from
+// 64us to 262ms (see HISTOGRAM_BOUNDS_US in metrics.cpp); the last bucket is unbounded.  We also
+// keep the count, the sum and the max.
+static constexpr int HISTOGRAM_BUCKETS = 8;
+
+class Histogram : public Metric {
+public:
+  explicit Histogram(const char* name) : Metric(name, MetricKind::HISTOGRAM) {}
+  void record_us(uint32_t us) {
+    unsigned bits = us == 0 ? 0 : 32 - __builtin_clz(us);
+    unsigned b = bits <= 6 ? 0 : (bits - 5) / 2;
+    buckets[b < HISTOGRAM_BUCKETS ? b : HISTOGRAM_BUCKETS - 1]++;
+    count++;
+    sum_us += us;
+    if (us > max_us) {
+      max_us = us;
+    }
+  }
+
+  uint32_t buckets[HISTOGRAM_BUCKETS] = {};
+  uint32_t count = 0;
+  uint64_t sum_us = 0;
+  uint32_t max_us = 0;
+};
+
+// Records the lifetime of the timer object into the histogram.
+class MetricTimer {
+  Histogram& h;
+  uint32_t start;
+public:
+  explicit MetricTimer(Histogram& h) : h(h), start(micros()) {}
+  ~MetricTimer() { h.record_us(micros() - start); }
+};
+
+// Print all metrics in human-readable form.
+void metrics_print(Stream& out);
+
+// Format all metrics as a compact JSON object: counters and gauges as "name":value, histograms as
+// "name":[count,sum_us,max_us,bucket0,...,bucket7].  `buflim` points to the address beyond the
+// buffer.  Returns false if the buffer is too small, and then leaves an empty string in it rather
+// than truncated JSON.
+bool metrics_snapshot(char* buf, char* buflim);
+
+#else
+
+class Counter {
+public:
+  explicit Counter(const char*) {}
+  void inc(uint32_t = 1) {}
+};
+
+class Gauge {
+public:
+  explicit Gauge(const char*) {}
+  void set(int32_t) {}
+};
+
+class Histogram {
+public:
+  explicit Histogram(const char*) {}
+  void record_us(uint32_t) {}
+};
+
+class MetricTimer {
+public:
+  explicit MetricTimer(Histogram&) {}
+};
+
+#endif // SNAPPY_METRICS
+
+#endif // !metrics_h_included
@@ -36,9 +36,14 @@
 #include <WiFiClientSecure.h>
 #include <Arduino_JSON.h>
 #include "config.h"
+#include "event_timer.h"
 #include "log.h"
+#include "metrics.h"
+#include "net_task.h"
+#include "observation.h"
 #include "sensor.h"
 #include "time_server.h"
+#include "trace.h"
 
 // This version string identifies the snappy/startup/ JSON package and is sent as
 // the "version" property of the package.
@@ -56,8 +61,10 @@
 //
 // Every field in the code for generate_startup_message() needs to be annotated with
 // its version number.
+//
+// 1.1.0: Added the optional "observation" field.
 
-#define STARTUP_VERSION "1.0.0"
+#define STARTUP_VERSION "1.1.0"
 
 // The default buffer size is 256 bytes on most devices.  That's too short for the
 // sensor package, sometimes.  1K is OK - though may also be too short for some messages.
@@ -81,7 +88,6 @@ struct MqttMessage {
 };
 
 enum class MqttState {
-  STARTING,
   CONNECTING,
   CONNECTED,
   RUNNING,
@@ -89,13 +95,38 @@ enum class MqttState {
   STOPPED,
 };
 
+// All operations on mqtt_client that may block are run as jobs on the network task, see
+// net_task.h.  The main task does not touch mqtt_client while a job is pending.  A job reports
+// back with COMM_MQTT_DONE, whose payload is one of the MQTT_ result codes, and
+// mqtt_job_done() then moves the state machine along.
+
+enum class MqttJob {
+  NONE,
+  CONNECT,
+  SUBSCRIBE,
+  SEND,
+  POLL,
+};
+
+enum {
+  MQTT_OK,            // Success; for POLL, there was incoming traffic
+  MQTT_IDLE,          // POLL: there was no incoming traffic
+  MQTT_RETRY,         // CONNECT, SEND: failed, try again later
+  MQTT_REJECTED,      // CONNECT: configuration error, give up
+  MQTT_DROP,          // SEND: the message can't be sent, discard it
+  MQTT_DISCONNECTED,  // SUBSCRIBE, SEND, POLL: the connection was lost
+};
+
 static MqttState mqtt_state;
+static MqttJob pending_job = MqttJob::NONE;
+// Number of completions still to arrive for jobs that were pending when mqtt_stop() was called.
+static unsigned stale_jobs = 0;
 static WiFiClient wifi_client;
 static WiFiClientSecure wifi_client_secure;
 static MqttClient mqtt_client(nullptr);
 static int num_retries = 0;
 static bool work_done;
-static TimerHandle_t mqtt_timer;
+static EventTimer* mqtt_timer;
 static time_t last_connect;
 static time_t last_capture;
 static bool early_times = true;
@@ -105,22 +136,30 @@ static List<MqttMessage> mqtt_queue;
 // first datum, and always after time has been configured, if we have timestamps.
 static bool send_startup_message = true;
 #ifdef SNAPPY_TIMESTAMPS
-static List<SnappySenseData> delayed_data_queue;
+static Ring<SnappySenseData, MAX_QUEUED> delayed_data_queue;
 #endif
 
 static void subscribe();
-static void connect();
-static bool poll();
-static void send();
+static void start_job(MqttJob job, void* arg = nullptr);
+static void trim_queue();
 static void generate_startup_message();
 static void mqtt_handle_message(int payload_size);
 static void mqtt_enqueue(String&& topic, String&& body);
 static void put_delayed_work();
 static void enqueue_data(const SnappySenseData& data);
+static void enqueue_stats();
+
+static Histogram connect_time("mqtt.connect_us");
+static Counter connect_failures("mqtt.connect_fail");
+static Histogram send_time("mqtt.send_us");
+static Counter messages_sent("mqtt.sent");
+static Counter send_failures("mqtt.send_fail");
+static Counter messages_dropped("mqtt.dropped");
+static Counter messages_received("mqtt.received");
+static Gauge queue_length("mqtt.queue_len");
 
 void mqtt_init() {
-  mqtt_timer = xTimerCreate("mqtt", pdMS_TO_TICKS(500), pdFALSE, nullptr,
-                            [](TimerHandle_t) { put_main_event(EvCode::COMM_MQTT_WORK); });
+  mqtt_timer = event_timer_create("mqtt", EvCode::COMM_MQTT_WORK, 0, 100);
 }
 
 static bool should_send_delayed_data() {
@@ -132,13 +171,11 @@ static bool should_send_delayed_data() {
 }
 
 #ifdef SNAPPY_TIMESTAMPS
-static void add_delayed_data(SnappySenseData* data) {
-  SnappySenseData d = *data;
-  delayed_data_queue.add_back(std::move(d));
-  if (delayed_data_queue.length() > MAX_QUEUED) {
+static void add_delayed_data(const SnappySenseData& data) {
+  if (delayed_data_queue.is_full()) {
     delayed_data_queue.pop_front();
   }
-  delete data;
+  delayed_data_queue.add_back(data);
 }
 
 static void maybe_drain_delayed_data() {
@@ -198,7 +235,7 @@ bool mqtt_have_work(bool always_if_work) {
 }
 
 void mqtt_start() {
-  mqtt_state = MqttState::STARTING;
+  mqtt_state = MqttState::CONNECTING;
   num_retries = 0;
   if (early_times) {
     num_times++;
@@ -206,79 +243,157 @@ void mqtt_start() {
       early_times = false;
     }
   }
-  // connect() moves the state machine into CONNECTING or CONNECTED (with a COMM_MQTT_WORK
-  // message to drive the state machine) or FAILED (without a work message), work picks
-  // up in mqtt_work().
-  connect();
+  // The connect job moves the state machine into CONNECTED (with a COMM_MQTT_WORK message to
+  // drive the state machine) or FAILED (without a work message), or stays in CONNECTING and
+  // retries after a delay.  See mqtt_job_done().
+  //
+  // Jobs from a previous window may still be running, but jobs run in order so the client is
+  // not shared, and their completions are discarded.
+  start_job(MqttJob::CONNECT);
 }
 
-void mqtt_stop() {
+static uint32_t stop_job(void*) {
   mqtt_client.stop();
+  return 0;
+}
+
+void mqtt_stop() {
+  if (pending_job != MqttJob::NONE) {
+    stale_jobs++;
+    pending_job = MqttJob::NONE;
+  }
   mqtt_state = MqttState::STOPPED;
+  net_task_run(stop_job, nullptr, EvCode::NONE);
 }
 
 void mqtt_work() {
-  if (mqtt_state == MqttState::CONNECTING) {
-    // This takes us back to CONNECTING, CONNECTED, or FAILED, see
-    // comment in mqtt_start()
-    connect();
+  if (pending_job != MqttJob::NONE) {
+    // The job's completion will drive the state machine.
     return;
   }
-  if (mqtt_state == MqttState::CONNECTED) {
-    if (!mqtt_client.connected()) {
-      mqtt_stop();
-      return;
+  switch (mqtt_state) {
+    case MqttState::CONNECTING:
+      start_job(MqttJob::CONNECT);
+      break;
+    case MqttState::CONNECTED:
+      start_job(MqttJob::SUBSCRIBE);
+      break;
+    case MqttState::RUNNING: {
+      maybe_drain_delayed_data();
+      if (mqtt_queue.is_empty()) {
+        start_job(MqttJob::POLL);
+        break;
+      }
+      MqttMessage& first = mqtt_queue.peek_front();
+      if (first.message.length() > MQTT_BUFFER_SIZE) {
+        log("Mqtt: Message too long: %u!\n", (unsigned)first.message.length());
+        mqtt_queue.pop_front();
+        messages_dropped.inc();
+        queue_length.set(mqtt_queue.length());
+        put_main_event(EvCode::COMM_ACTIVITY);
+        put_delayed_work();
+        break;
+      }
+      // The message stays at the front of the queue until the job is done.
+      start_job(MqttJob::SEND, &first);
+      break;
     }
-    subscribe();
-    mqtt_state = MqttState::RUNNING;
-    put_main_event(EvCode::COMM_ACTIVITY);
-    put_main_event(EvCode::COMM_MQTT_WORK);
+    default:
+      /* FAILED, STOPPED - ignore these for now */
+      break;
+  }
+}
+
+void mqtt_job_done(uint32_t result) {
+  if (stale_jobs > 0) {
+    stale_jobs--;
     return;
   }
-  if (mqtt_state == MqttState::RUNNING) {
-    if (!mqtt_client.connected()) {
-      mqtt_stop();
-      return;
-    }
-    maybe_drain_delayed_data();
-    if (!mqtt_queue.is_empty()) {
-      send();
+  MqttJob job = pending_job;
+  pending_job = MqttJob::NONE;
+  if (mqtt_state == MqttState::STOPPED) {
+    return;
+  }
+  if (result == MQTT_DISCONNECTED) {
+    mqtt_stop();
+    return;
+  }
+  switch (job) {
+    case MqttJob::CONNECT:
       put_main_event(EvCode::COMM_ACTIVITY);
-    } else if (poll()) {
-      // The normal case is that there's very little incoming traffic.  There may be
-      // few actuators and the server should definitely limit the update frequency
-      // for those.  There will be few instances of wishing to disable/enable devices
-      // and changing their report frequencies.
+      if (result == MQTT_OK) {
+        log("Mqtt: Accepted\n");
+        mqtt_state = MqttState::CONNECTED;
+        last_connect = time(nullptr);
+        put_main_event(EvCode::COMM_MQTT_WORK);
+      } else if (result == MQTT_RETRY && ++num_retries < 10) {
+        connect_failures.inc();
+        put_delayed_work();
+      } else {
+        log("Mqtt: Rejected\n");
+        mqtt_state = MqttState::FAILED;
+      }
+      break;
+    case MqttJob::SUBSCRIBE:
+      enqueue_stats();
+      mqtt_state = MqttState::RUNNING;
       put_main_event(EvCode::COMM_ACTIVITY);
-    }
-    put_delayed_work();
-    return;
+      put_main_event(EvCode::COMM_MQTT_WORK);
+      break;
+    case MqttJob::SEND:
+      if (result == MQTT_OK) {
+        mqtt_queue.pop_front();
+        messages_sent.inc();
+      } else if (result == MQTT_DROP) {
+        mqtt_queue.pop_front();
+        messages_dropped.inc();
+      } else {
+        send_failures.inc();
+      }
+      trim_queue();
+      put_main_event(EvCode::COMM_ACTIVITY);
+      put_delayed_work();
+      break;
+    case MqttJob::POLL:
+      if (result == MQTT_OK) {
+        // The normal case is that there's very little incoming traffic.  There may be
+        // few actuators and the server should definitely limit the update frequency
+        // for those.  There will be few instances of wishing to disable/enable devices
+        // and changing their report frequencies.
+        put_main_event(EvCode::COMM_ACTIVITY);
+      }
+      put_delayed_work();
+      break;
+    default:
+      break;
   }
-  /* STARTING, FAILED, STOPPED - ignore these for now */
 }
 
 static void enqueue_data(const SnappySenseData& data) {
   String topic;
-  String body;
 
-  // The topic string and JSON data format are defined by MQTT-PROTOCOL.md
+  // The topic string and the JSON and CBOR data formats are defined by MQTT-PROTOCOL.md
   topic += "snappy/observation/";
   topic += mqtt_device_class();
   topic += "/";
   topic += mqtt_device_id();
 
-  body = format_readings_as_json(data);
-
-  mqtt_enqueue(std::move(topic), std::move(body));
+  if (mqtt_observation_cbor()) {
+    uint8_t body[OBSERVATION_CBOR_MAX];
+    size_t len = format_observation_cbor(data, body, sizeof(body));
+    mqtt_enqueue(std::move(topic), String(body, len));
+  } else {
+    char body[OBSERVATION_JSON_MAX];
+    format_observation_json(data, body, sizeof(body));
+    mqtt_enqueue(std::move(topic), String(body));
+  }
 }
 
-void upload_add_data(SnappySenseData* data) {
+void upload_add_data(const SnappySenseData& data) {
   if (!device_enabled()) {
-    delete data;
     return;
   }
   if (last_capture > 0 && time(nullptr) - last_capture < capture_interval_for_upload_s()) {
-    delete data;
     return;
   }
 
@@ -297,87 +412,158 @@ void upload_add_data(SnappySenseData* data) {
   // Drain the queue before adding the new datum.
   maybe_drain_delayed_data();
 
-  enqueue_data(*data);
-  delete data;
+  enqueue_data(data);
 }
 
 static void mqtt_enqueue(String&& topic, String&& body) {
   mqtt_queue.add_back(std::move(MqttMessage(std::move(topic), std::move(body))));
-  if (mqtt_queue.length() > MAX_QUEUED) {
+  trim_queue();
+}
+
+// Discard the oldest messages if the queue is too long, but never the one being sent.  The queue
+// is trimmed when the send job completes.
+static void trim_queue() {
+  while (mqtt_queue.length() > MAX_QUEUED && pending_job != MqttJob::SEND) {
     mqtt_queue.pop_front();
+    messages_dropped.inc();
+  }
+  queue_length.set(mqtt_queue.length());
+}
+
+// The stats message carries a snapshot of the metrics (see metrics.h) and is sent every time we
+// connect, so that the values cover the time up to the previous communication window.
+static void enqueue_stats() {
+#ifdef SNAPPY_METRICS
+  String topic;
+
+  // The topic string and JSON data format are defined by MQTT-PROTOCOL.md
+  topic += "snappy/stats/";
+  topic += mqtt_device_class();
+  topic += "/";
+  topic += mqtt_device_id();
+
+  char buf[MQTT_BUFFER_SIZE];
+  if (!metrics_snapshot(buf, buf+sizeof(buf))) {
+    log("Mqtt: stats message too long\n");
+    messages_dropped.inc();
+    return;
   }
+  mqtt_enqueue(std::move(topic), String(buf));
+#endif
 }
 
 static void put_delayed_work() {
-  xTimerStart(mqtt_timer, portMAX_DELAY);
+  event_timer_start(mqtt_timer, 500);
 }
 
-static void connect() {
-again:
-  switch (mqtt_state) {
-    case MqttState::STARTING: {
-      if (mqtt_tls()) {
-        wifi_client_secure.setCACert(mqtt_root_ca_cert());
-      }
-      if (mqtt_auth_type() == MqttAuth::CERT_BASED && mqtt_device_cert() != nullptr && mqtt_device_private_key() != nullptr) {
-        if (!mqtt_tls()) {
-          panic("Secure client required for cert-based authentication\n");
-        }
-        wifi_client_secure.setCertificate(mqtt_device_cert());
-        wifi_client_secure.setPrivateKey(mqtt_device_private_key());
-      } else if (mqtt_auth_type() == MqttAuth::USER_AND_PASS && mqtt_username() != nullptr && mqtt_password() != nullptr) {
-        // do nothing yet
-      } else {
-        log("Mqtt: Bad auth setting, possibly missing data?\n");
-        mqtt_state = MqttState::FAILED;
-        return;
-      }
+// The jobs run on the network task.
 
-      if (mqtt_tls()) {
-        mqtt_client.setClient(wifi_client_secure);
-      } else {
-        mqtt_client.setClient(wifi_client);
-      }
-      mqtt_client.setTxPayloadSize(MQTT_BUFFER_SIZE);
-      mqtt_client.setCleanSession(false);
+static uint32_t connect_job(void*) {
+  TraceScope trace(TraceSpan::MQTT_JOB, uint8_t(MqttJob::CONNECT), 0);
+  if (mqtt_tls()) {
+    wifi_client_secure.setCACert(mqtt_root_ca_cert());
+  }
+  if (mqtt_auth_type() == MqttAuth::CERT_BASED && mqtt_device_cert() != nullptr && mqtt_device_private_key() != nullptr) {
+    if (!mqtt_tls()) {
+      panic("Secure client required for cert-based authentication\n");
+    }
+    wifi_client_secure.setCertificate(mqtt_device_cert());
+    wifi_client_secure.setPrivateKey(mqtt_device_private_key());
+  } else if (mqtt_auth_type() == MqttAuth::USER_AND_PASS && mqtt_username() != nullptr && mqtt_password() != nullptr) {
+    // do nothing yet
+  } else {
+    log("Mqtt: Bad auth setting, possibly missing data?\n");
+    return MQTT_REJECTED;
+  }
 
-      mqtt_client.setId(mqtt_device_id());
-      if (mqtt_auth_type() == MqttAuth::USER_AND_PASS) {
-        mqtt_client.setUsernamePassword(mqtt_username(), mqtt_password());
-      }
+  if (mqtt_tls()) {
+    mqtt_client.setClient(wifi_client_secure);
+  } else {
+    mqtt_client.setClient(wifi_client);
+  }
+  mqtt_client.setTxPayloadSize(MQTT_BUFFER_SIZE);
+  mqtt_client.setCleanSession(false);
 
-      log("Mqtt: Connecting to MQTT broker\n");
-      mqtt_state = MqttState::CONNECTING;
-      goto again;
-    }
+  mqtt_client.setId(mqtt_device_id());
+  if (mqtt_auth_type() == MqttAuth::USER_AND_PASS) {
+    mqtt_client.setUsernamePassword(mqtt_username(), mqtt_password());
+  }
 
-    case MqttState::CONNECTING: {
-      log("Mqtt: %s %d : %s\n", mqtt_endpoint_host(), mqtt_endpoint_port(), mqtt_device_id());
-      bool ok = mqtt_client.connect(mqtt_endpoint_host(), mqtt_endpoint_port());
-      put_main_event(EvCode::COMM_ACTIVITY);
-      if (!ok) {
-        // Positive error codes are basically fatal configuration errors and should
-        // perhaps cause the mqtt component to be disabled.
-        int res = mqtt_client.connectError();
-        log("Mqtt: Failed %d\n", res);
-        if (++num_retries < 10) {
-          put_delayed_work();
-          return;
-        }
-        log("Mqtt: Rejected\n");
-        mqtt_state = MqttState::FAILED;
-        return;
-      }
-      log("Mqtt: Accepted\n");
-      mqtt_state = MqttState::CONNECTED;
-      last_connect = time(nullptr);
-      put_main_event(EvCode::COMM_MQTT_WORK);
-      return;
-    }
+  log("Mqtt: Connecting to MQTT broker\n");
+  log("Mqtt: %s %d : %s\n", mqtt_endpoint_host(), mqtt_endpoint_port(), mqtt_device_id());
+  bool ok;
+  {
+    MetricTimer t(connect_time);
+    ok = mqtt_client.connect(mqtt_endpoint_host(), mqtt_endpoint_port());
+  }
+  if (!ok) {
+    // Positive error codes are basically fatal configuration errors and should
+    // perhaps cause the mqtt component to be disabled.
+    int res = mqtt_client.connectError();
+    log("Mqtt: Failed %d\n", res);
+    return MQTT_RETRY;
+  }
+  return MQTT_OK;
+}
 
-    default:
-      return;
+static uint32_t subscribe_job(void*) {
+  TraceScope trace(TraceSpan::MQTT_JOB, uint8_t(MqttJob::SUBSCRIBE), 0);
+  if (!mqtt_client.connected()) {
+    return MQTT_DISCONNECTED;
+  }
+  subscribe();
+  return MQTT_OK;
+}
+
+static uint32_t poll_job(void*) {
+  TraceScope trace(TraceSpan::MQTT_JOB, uint8_t(MqttJob::POLL), 0);
+  if (!mqtt_client.connected()) {
+    return MQTT_DISCONNECTED;
+  }
+  work_done = false;
+  mqtt_client.onMessage(mqtt_handle_message);
+  mqtt_client.poll();
+  mqtt_client.onMessage(nullptr);
+  return work_done ? MQTT_OK : MQTT_IDLE;
+}
+
+static uint32_t send_job(void* arg) {
+  TraceScope trace(TraceSpan::MQTT_JOB, uint8_t(MqttJob::SEND), 0);
+  MqttMessage* msg = static_cast<MqttMessage*>(arg);
+  size_t msg_len = msg->message.length();
+
+  if (!mqtt_client.connected()) {
+    return MQTT_DISCONNECTED;
+  }
+  MetricTimer t(send_time);
+  if (!mqtt_client.beginMessage(msg->topic.c_str(), false, 1, 0)) {
+    log("Mqtt: failed to setup connection\n");
+    return MQTT_RETRY;
+  }
+  if (mqtt_client.write((uint8_t*)msg->message.c_str(), msg_len) != msg_len) {
+    log("Mqtt: Message was chopped by mqtt layer!\n");
+    // More than likely, the message will fail the next time too, so just discard it
+    return MQTT_DROP;
+  }
+  if (!mqtt_client.endMessage()) {
+    log("Mqtt: Sending failed\n");
+    return MQTT_RETRY;
+  }
+  log("Mqtt: Sent one datum\n");
+  return MQTT_OK;
+}
+
+static void start_job(MqttJob job, void* arg) {
+  NetJob fn = nullptr;
+  switch (job) {
+    case MqttJob::CONNECT:   fn = connect_job; break;
+    case MqttJob::SUBSCRIBE: fn = subscribe_job; break;
+    case MqttJob::SEND:      fn = send_job; break;
+    case MqttJob::POLL:      fn = poll_job; break;
+    default:                 panic("Bad mqtt job");
   }
+  pending_job = job;
+  net_task_run(fn, arg, EvCode::COMM_MQTT_DONE);
 }
 
 static void subscribe() {
@@ -428,51 +614,17 @@ static void generate_startup_message() {
   body += ",\"interval\":";
   body += capture_interval_for_upload_s();
 
+  // "observation": optional, semver string, the version of the observation packages the device
+  // sends and hence whether they are JSON or CBOR, from version 1.1.0
+  body += ",\"observation\":\"";
+  body += mqtt_observation_cbor() ? OBSERVATION_CBOR_VERSION : OBSERVATION_VERSION;
+  body += '"';
+
   body += '}';
 
   mqtt_enqueue(std::move(topic), std::move(body));
 }
 
-static bool poll() {
-  work_done = false;
-  mqtt_client.onMessage(mqtt_handle_message);
-  mqtt_client.poll();
-  mqtt_client.onMessage(nullptr);
-  return work_done;
-}
-
-static void send() {
-  if (mqtt_queue.is_empty()) {
-    return;
-  }
-
-  MqttMessage& first = mqtt_queue.peek_front();
-  size_t msg_len = first.message.length();
-  if (msg_len > MQTT_BUFFER_SIZE) {
-    log("Mqtt: Message too long: %d!\n", msg_len);
-    mqtt_queue.pop_front();
-    return;
-  }
-
-  if (!mqtt_client.beginMessage(first.topic.c_str(), false, 1, 0)) {
-    log("Mqtt: failed to setup connection\n");
-    return;
-  }
-  if (mqtt_client.write((uint8_t*)first.message.c_str(), msg_len) != msg_len) {
-    log("Mqtt: Message was chopped by mqtt layer!\n");
-    // More than likely, the message will fail the next time too, so just discard it
-    mqtt_queue.pop_front();
-    return;
-  }
-  if (!mqtt_client.endMessage()) {
-    log("Mqtt: Sending failed\n");
-    return;
-  }
-
-  mqtt_queue.pop_front();
-  log("Mqtt: Sent one datum\n");
-}
-
 static void mqtt_handle_message(int payload_size) {
   static const size_t MAX_INCOMING_MESSAGE_SIZE = 1023;
   uint8_t buf[MAX_INCOMING_MESSAGE_SIZE+1];
@@ -487,6 +639,7 @@ static void mqtt_handle_message(int payload_size) {
     return;
   }
   buf[payload_size] = 0;
+  messages_received.inc();
 
   // Technically we should check that there are no unknown fields here.
   // Not sure if we care that much.
@@ -12,8 +12,8 @@
 
 void mqtt_init();
 
-// Takes ownership of the data
-void upload_add_data(SnappySenseData* new_data);
+// Copies whatever it needs from the data
+void upload_add_data(const SnappySenseData& new_data);
 
 // The wifi must be up.  Connect to the MQTT server, and ...
 void mqtt_start();
@@ -25,8 +25,12 @@ bool mqtt_have_work(bool always_if_work);
 // Can be called without start having been called first.
 void mqtt_stop();
 
+// Called from the main loop in response to COMM_MQTT_WORK messages.
 void mqtt_work();
 
+// Called from the main loop in response to COMM_MQTT_DONE messages, with the event payload.
+void mqtt_job_done(uint32_t result);
+
 #endif // SNAPPY_MQTT
 
 #endif // !mqtt_h_included
@@ -0,0 +1,74 @@
+// The network task runs blocking network operations on behalf of the main task.
+
+#include "net_task.h"
+
+#ifdef SNAPPY_WIFI
+
+#include "trace.h"
+#include "util.h"
+
+struct NetCommand {
+  NetJob job;
+  void* arg;
+  EvCode done;
+};
+
+// Jobs flow from the main task to the network task, and completions flow back, through lock-free
+// rings, so that neither side ever waits for a lock held by the other.  The network task sleeps on
+// its task notification when it has nothing to do; the main task is woken up by a COMM_NET_DONE
+// doorbell in its event queue, which is posted only when the completion ring goes from empty to
+// nonempty.  There are only ever a few jobs in flight.
+static SpscRing<NetCommand, 16> jobs;
+static SpscRing<SnappyEvent, 16> completions;
+static TaskHandle_t net_task_handle;
+
+static void net_task(void*) {
+  for (;;) {
+    NetCommand cmd;
+    while (!jobs.pop(&cmd)) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+    uint32_t result;
+    {
+      TraceScope trace(TraceSpan::NET_JOB, uint8_t(cmd.done), 0);
+      result = cmd.job(cmd.arg);
+    }
+    if (cmd.done != EvCode::NONE) {
+      bool was_empty;
+      while (!completions.push(SnappyEvent(cmd.done, result), &was_empty)) {
+        // The main task is not keeping up; it will drain the ring eventually.
+        vTaskDelay(1);
+      }
+      if (was_empty) {
+        put_main_event(EvCode::COMM_NET_DONE);
+      }
+    }
+  }
+}
+
+void net_task_init() {
+  // TLS needs a deep stack.
+#ifdef SNAPPY_DUAL_CORE
+  // Pinned to the core that also runs the WiFi stack, away from the main task.
+  BaseType_t res = xTaskCreatePinnedToCore(net_task, "net", 8192, nullptr, tskIDLE_PRIORITY+1,
+                                           &net_task_handle, NET_TASK_CORE);
+#else
+  BaseType_t res = xTaskCreate(net_task, "net", 8192, nullptr, tskIDLE_PRIORITY+1, &net_task_handle);
+#endif
+  if (res != pdPASS) {
+    panic("Could not create task");
+  }
+}
+
+void net_task_run(NetJob job, void* arg, EvCode done) {
+  while (!jobs.push(NetCommand { job, arg, done })) {
+    vTaskDelay(1);
+  }
+  xTaskNotifyGive(net_task_handle);
+}
+
+bool net_task_completion(SnappyEvent* ev) {
+  return completions.pop(ev);
+}
+
+#endif // SNAPPY_WIFI
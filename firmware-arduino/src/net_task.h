@@ -0,0 +1,39 @@
+// The network task runs blocking network operations on behalf of the main task.
+
+#ifndef net_task_h_included
+#define net_task_h_included
+
+#include "main.h"
+
+#ifdef SNAPPY_WIFI
+
+// Network libraries block for the duration of eg a TCP+TLS handshake or an NTP round trip, which
+// would stall the main task (and thus the button and the display) for seconds.  Instead, the
+// main task packages such operations as jobs for the network task.  A job is a function that
+// returns a result code; when it completes, the network task posts the `done` event to the main
+// queue with the result as its payload.  Jobs run one at a time in the order they were
+// submitted, so a module can hand its network client back and forth without locking: it must
+// not touch the client while it has a job pending.
+
+typedef uint32_t (*NetJob)(void* arg);
+
+#ifdef SNAPPY_DUAL_CORE
+// The core that the network task is pinned to.  This is where the WiFi stack runs.
+static constexpr BaseType_t NET_TASK_CORE = 0;
+#endif
+
+// Call this before anything else.
+void net_task_init();
+
+// Submit `job(arg)` to the network task.  If `done` is EvCode::NONE then no event is posted when
+// the job completes.  Must only be called from the main task.
+void net_task_run(NetJob job, void* arg, EvCode done);
+
+// Completion events are not posted directly on the main event queue.  Instead, a COMM_NET_DONE
+// event signals that there are completions to collect with this function, which returns false
+// when there are no more.  Must only be called from the main task.
+bool net_task_completion(SnappyEvent* ev);
+
+#endif // SNAPPY_WIFI
+
+#endif // !net_task_h_included
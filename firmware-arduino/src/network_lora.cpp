@@ -2,8 +2,7 @@
 
 #ifdef SNAPPY_LORA
 
-void upload_add_data(SnappySenseData* new_data) {
-  delete new_data;
+void upload_add_data(const SnappySenseData& new_data) {
 }
 
 #endif
@@ -8,7 +8,9 @@
 #include <WiFiAP.h>
 #include "config.h"
 #include "device.h"
+#include "event_timer.h"
 #include "log.h"
+#include "metrics.h"
 #include "slideshow.h"
 
 /* Server/Client wifi state machine is basically similar to the Unix stack:
@@ -41,10 +43,16 @@ enum class WiFiState {
 };
 static WiFiState wifi_state = WiFiState::STARTING;
 
-static TimerHandle_t retry_timer;
+static EventTimer* retry_timer;
+
+// Time from wifi_enable_start() until we're connected, across all retries and access points.
+static uint32_t connect_start_us;
+static Histogram connect_time("wifi.connect_us");
+static Counter connect_failures("wifi.connect_fail");
+static Counter ap_timeouts("wifi.ap_timeout");
 
 static void put_delayed_retry() {
-  xTimerStart(retry_timer, portMAX_DELAY);
+  event_timer_start(retry_timer, wifi_retry_ms());
 }
 
 static void connect_to_wifi() {
@@ -54,6 +62,7 @@ again:
       // We're in STARTING every time we try a new AP.  Once we've tried all APs we're done.
       if (num_access_points_tried == 3) {
         wifi_state = WiFiState::FAILED;
+        connect_failures.inc();
         put_main_event(EvCode::COMM_WIFI_CLIENT_FAILED);
         WiFi.disconnect(true);
         log("WiFi: Failed to connect to any access point\n");
@@ -80,11 +89,13 @@ again:
       if (WiFi.status() == WL_CONNECTED) {
         last_successful_access_point = current_access_point;
         wifi_state = WiFiState::CONNECTED;
+        connect_time.record_us(micros() - connect_start_us);
         put_main_event(EvCode::COMM_WIFI_CLIENT_UP);
         log("WiFi: Connected. Device IP address: %s\n", wifi_local_ip().c_str());
         return;
       }
       if (num_timeouts == MAX_TIMEOUTS) {
+        ap_timeouts.inc();
         current_access_point = (current_access_point + 1) % 3;
         wifi_state = WiFiState::STARTING;
         goto again;
@@ -103,14 +114,14 @@ again:
 }
 
 void wifi_init() {
-  retry_timer = xTimerCreate("wifi retry", pdMS_TO_TICKS(wifi_retry_ms()), pdFALSE, nullptr,
-                             [](TimerHandle_t) { put_main_event(EvCode::COMM_WIFI_CLIENT_RETRY); });
+  retry_timer = event_timer_create("wifi retry", EvCode::COMM_WIFI_CLIENT_RETRY, 0, 100);
 }
 
 void wifi_enable_start() {
   num_access_points_tried = 0;
   current_access_point = last_successful_access_point;
   wifi_state = WiFiState::STARTING;
+  connect_start_us = micros();
   connect_to_wifi();
 }
 
@@ -0,0 +1,278 @@
+// Observation payload encoders, see observation.h.
+
+#include "observation.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+static constexpr uint32_t pow10(unsigned n) {
+  return n == 0 ? 1 : 10 * pow10(n - 1);
+}
+
+static constexpr uint32_t DECIMAL_SCALE = pow10(OBSERVATION_DECIMALS);
+
+// Scaled values at or beyond this are not printed as integers, see put_float().  It keeps the
+// integer part to 13 digits.
+static constexpr double MAX_SCALED = 9.0e15;
+
+// Appends to a buffer, and notes if it runs out of room.  The room for the NUL is kept back.
+struct Writer {
+  Writer(char* buf, size_t size)
+    : start(buf), p(buf), lim(buf + (size > 0 ? size - 1 : 0)), overflow(size == 0) {}
+
+  void put(const char* s, size_t n) {
+    if (size_t(lim - p) < n) {
+      overflow = true;
+      return;
+    }
+    memcpy(p, s, n);
+    p += n;
+  }
+
+  // For string literals, whose length is known at compile time.
+  template<size_t N>
+  void put(const char (&s)[N]) {
+    put(s, N - 1);
+  }
+
+  void put(char c) {
+    put(&c, 1);
+  }
+
+  // The length written, NUL-terminated, or 0 if something did not fit.
+  size_t finish() {
+    if (overflow) {
+      return 0;
+    }
+    *p = 0;
+    return p - start;
+  }
+
+  char* start;
+  char* p;
+  char* lim;
+  bool overflow;
+};
+
+static void put_unsigned(Writer& w, uint64_t v) {
+  char tmp[20];
+  char* q = tmp + sizeof(tmp);
+  do {
+    *--q = char('0' + v % 10);
+    v /= 10;
+  } while (v != 0);
+  w.put(q, tmp + sizeof(tmp) - q);
+}
+
+static void put_float(Writer& w, float v) {
+  if (!isfinite(v)) {
+    w.put("null");
+    return;
+  }
+  double scaled = double(v) * DECIMAL_SCALE;
+  if (fabs(scaled) >= MAX_SCALED) {
+    // No sensor reads this high, but if it happens it is still a valid number.
+    char tmp[OBSERVATION_FLOAT_MAX + 1];
+    int n = snprintf(tmp, sizeof(tmp), "%.6g", v);
+    w.put(tmp, n);
+    return;
+  }
+  // A float has 24 significant bits and the scale needs 10, so `scaled` is exact and rounding it
+  // to even gives the same digits as printf.
+  uint64_t n = uint64_t(nearbyint(fabs(scaled)));
+  if (scaled < 0 && n != 0) {
+    w.put('-');
+  }
+  put_unsigned(w, n / DECIMAL_SCALE);
+  // The decimals, with leading zeroes.
+  char frac[OBSERVATION_DECIMALS + 1];
+  frac[0] = '.';
+  uint32_t f = uint32_t(n % DECIMAL_SCALE);
+  for ( unsigned i = OBSERVATION_DECIMALS; i > 0; i-- ) {
+    frac[i] = char('0' + f % 10);
+    f /= 10;
+  }
+  w.put(frac, sizeof(frac));
+}
+
+static void put_value(Writer& w, float v) {
+  put_float(w, v);
+}
+
+static void put_value(Writer& w, unsigned v) {
+  put_unsigned(w, v);
+}
+
+static void put_value(Writer& w, uint16_t v) {
+  put_unsigned(w, v);
+}
+
+static void put_value(Writer& w, uint8_t v) {
+  put_unsigned(w, v);
+}
+
+static void put_value(Writer& w, bool v) {
+  w.put(v ? '1' : '0');
+}
+
+// The JSON data format is defined by MQTT-PROTOCOL.md.  Factor names are prefixed by F# to avoid
+// name clashes with fields like sent and sequenceno.
+size_t format_observation_json(const SnappySenseData& data, char* buf, size_t size) {
+  Writer w(buf, size);
+  // Version field: mandatory, semver string, from version 1.0.0
+  w.put("{\"version\":\"" OBSERVATION_VERSION "\"");
+  // Optional, unsigned sequence number, from version 1.0.0
+  w.put(",\"sequenceno\":");
+  put_unsigned(w, data.sequence_number);
+  // Mandatory, unsigned seconds since Posix epoch, from version 1.0.0
+  w.put(",\"sent\":");
+  put_unsigned(w, (unsigned long long)data.time);
+#define FACTOR(FLAG, field, type, key, ...)     \
+  if (data.is_valid(FACTOR_##FLAG)) {           \
+    w.put(",\"F#" key "\":");                   \
+    put_value(w, data.field);                   \
+  }
+#define FACTOR_FIELD FACTOR
+#include "sensor_factors.h"
+  w.put('}');
+  return w.finish();
+}
+
+// The factors' CBOR keys are unique, clear of the other fields' keys, and fit in the map's one-byte
+// encoding that OBSERVATION_CBOR_MAX assumes.
+#define FACTOR(FLAG, field, type, key, id, ...) \
+  static_assert(id > OBSERVATION_KEY_SEQUENCENO && id < 24, "Bad CBOR key for " key);
+#define FACTOR_FIELD FACTOR
+#include "sensor_factors.h"
+
+static constexpr uint32_t CBOR_KEYS =
+#define FACTOR(FLAG, field, type, key, id, ...) (uint32_t(1) << id) |
+#define FACTOR_FIELD FACTOR
+#include "sensor_factors.h"
+  0;
+
+static constexpr unsigned NUM_CBOR_KEYS =
+#define FACTOR(...) 1 +
+#define FACTOR_FIELD FACTOR
+#include "sensor_factors.h"
+  0;
+
+static_assert(__builtin_popcount(CBOR_KEYS) == NUM_CBOR_KEYS, "Duplicate CBOR key");
+
+// CBOR major types, RFC 8949 section 3.1.
+enum CborMajor : uint8_t {
+  CBOR_UNSIGNED = 0,
+  CBOR_NEGATIVE = 1,
+  CBOR_TEXT = 3,
+  CBOR_MAP = 5,
+};
+
+static const char CBOR_FLOAT32 = char(0xFA);
+static const char CBOR_NULL = char(0xF6);
+
+// A data item's head: the major type and the argument, in as few bytes as possible, which is what
+// makes small integers small.
+static void put_cbor_head(Writer& w, CborMajor major, uint64_t v) {
+  char tmp[9];
+  size_t n;
+  if (v < 24) {
+    tmp[0] = char((major << 5) | v);
+    n = 1;
+  } else if (v <= 0xFF) {
+    tmp[0] = char((major << 5) | 24);
+    n = 2;
+  } else if (v <= 0xFFFF) {
+    tmp[0] = char((major << 5) | 25);
+    n = 3;
+  } else if (v <= 0xFFFFFFFF) {
+    tmp[0] = char((major << 5) | 26);
+    n = 5;
+  } else {
+    tmp[0] = char((major << 5) | 27);
+    n = 9;
+  }
+  // Big-endian.
+  for ( size_t i = n - 1; i > 0; i-- ) {
+    tmp[i] = char(v & 0xFF);
+    v >>= 8;
+  }
+  w.put(tmp, n);
+}
+
+static void put_cbor(Writer& w, float v) {
+  if (!isfinite(v)) {
+    w.put(CBOR_NULL);
+    return;
+  }
+  double scaled = double(v) * DECIMAL_SCALE;
+  if (fabs(scaled) >= MAX_SCALED) {
+    // As in put_float(), still a valid number.
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    w.put(CBOR_FLOAT32);
+    for ( int shift = 24; shift >= 0; shift -= 8 ) {
+      w.put(char((bits >> shift) & 0xFF));
+    }
+    return;
+  }
+  // Rounded like put_float(), so both payloads carry the same number.  The negative integer -1-n
+  // has the argument n.
+  uint64_t n = uint64_t(nearbyint(fabs(scaled)));
+  if (scaled < 0 && n != 0) {
+    put_cbor_head(w, CBOR_NEGATIVE, n - 1);
+  } else {
+    put_cbor_head(w, CBOR_UNSIGNED, n);
+  }
+}
+
+static void put_cbor(Writer& w, unsigned v) {
+  put_cbor_head(w, CBOR_UNSIGNED, v);
+}
+
+static void put_cbor(Writer& w, uint16_t v) {
+  put_cbor_head(w, CBOR_UNSIGNED, v);
+}
+
+static void put_cbor(Writer& w, uint8_t v) {
+  put_cbor_head(w, CBOR_UNSIGNED, v);
+}
+
+static void put_cbor(Writer& w, bool v) {
+  put_cbor_head(w, CBOR_UNSIGNED, v);
+}
+
+// The CBOR data format is defined by MQTT-PROTOCOL.md.  It has the fields of the JSON package,
+// keyed by small integers instead of names.
+size_t format_observation_cbor(const SnappySenseData& data, uint8_t* buf, size_t size) {
+  Writer w(reinterpret_cast<char*>(buf), size);
+  size_t fields = 3;
+#define FACTOR(FLAG, ...) fields += data.is_valid(FACTOR_##FLAG);
+#define FACTOR_FIELD FACTOR
+#include "sensor_factors.h"
+  put_cbor_head(w, CBOR_MAP, fields);
+  // Version field: mandatory, semver string, from version 2.0.0
+  put_cbor_head(w, CBOR_UNSIGNED, OBSERVATION_KEY_VERSION);
+  put_cbor_head(w, CBOR_TEXT, sizeof(OBSERVATION_CBOR_VERSION) - 1);
+  w.put(OBSERVATION_CBOR_VERSION);
+  // Mandatory, unsigned seconds since Posix epoch, from version 2.0.0
+  put_cbor_head(w, CBOR_UNSIGNED, OBSERVATION_KEY_SENT);
+  put_cbor_head(w, CBOR_UNSIGNED, (unsigned long long)data.time);
+  // Optional, unsigned sequence number, from version 2.0.0
+  put_cbor_head(w, CBOR_UNSIGNED, OBSERVATION_KEY_SEQUENCENO);
+  put_cbor_head(w, CBOR_UNSIGNED, data.sequence_number);
+#define FACTOR(FLAG, field, type, key, id, ...)         \
+  if (data.is_valid(FACTOR_##FLAG)) {                   \
+    put_cbor_head(w, CBOR_UNSIGNED, id);                \
+    put_cbor(w, data.field);                            \
+  }
+#define FACTOR_FIELD FACTOR
+#include "sensor_factors.h"
+  return w.finish();
+}
+
+size_t format_observation_float(float v, char* buf, size_t size) {
+  Writer w(buf, size);
+  put_float(w, v);
+  return w.finish();
+}
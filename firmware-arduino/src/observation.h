@@ -0,0 +1,126 @@
+// Encoders for the payload of the observation message, see MQTT-PROTOCOL.md: JSON, and a compact
+// binary form in CBOR (RFC 8949) that a device sends instead if so configured.
+//
+// The encoders write into a buffer provided by the caller and never allocate.  The factors are
+// written straight from sensor_factors.h, with their `"F#key":` prefixes built at compile time, and
+// the numbers are formatted with integer arithmetic: a float is scaled and rounded to
+// OBSERVATION_DECIMALS decimals and printed as two integers, which is much cheaper than printf's
+// "%f" and keeps only the digits the sensors can actually resolve.
+//
+// The CBOR payload is a map from the small integer keys in sensor_factors.h to integers: floats
+// are scaled by 10^OBSERVATION_DECIMALS and rounded, and the timestamp is a plain CBOR unsigned
+// integer, whose length varies with its value.  A typical observation is less than a quarter of
+// the JSON size.
+//
+// See host/bench for a benchmark against the String-based encoder this replaced, and for a decoder
+// of the CBOR payload that checks that it round-trips.
+
+#ifndef observation_h_included
+#define observation_h_included
+
+#include "main.h"
+#include "sensor.h"
+
+// This version string identifies the snappy/observation/ JSON package and is sent as
+// the "version" property of the package.
+//
+// The bugfix number is incremented if there's a compatible bugfix; for example, say we
+// change how a floating point number is rounded.  This will very rarely be the case.
+//
+// The minor version is incremented if the package format is changed in a compatible
+// manner, typically this will happen if we add or remove an optional field, or add
+// a new non-optional field.
+//
+// The major version is incremented if the package format is changed in an incompatible
+// way: the meaning of a field is changed in a nontrivial way, or a nonoptional field
+// is removed, or the package format itself changes.
+//
+// Every field needs to be annotated with its version number, see sensor_factors.h.
+//
+// 1.0.1: Floating-point factors have three decimals, not six.
+// 1.1.0: The sound level is reported as "noisedba", in dB(A), and "noise", the peak ADC reading,
+//        is no longer reported.
+// 1.2.0: The optional "occupancy" and "motiononsets" motion factors.
+
+#define OBSERVATION_VERSION "1.2.0"
+
+// The number of decimals of floating-point factors.
+static constexpr unsigned OBSERVATION_DECIMALS = 3;
+
+// The longest number format_observation_float() writes, not counting the NUL.
+static constexpr size_t OBSERVATION_FLOAT_MAX = 20;
+
+// The longest text of a value of each type in the payload.
+template<typename T> struct ObservationWidth;
+template<> struct ObservationWidth<float> { static constexpr size_t value = OBSERVATION_FLOAT_MAX; };
+template<> struct ObservationWidth<unsigned> { static constexpr size_t value = 10; };
+template<> struct ObservationWidth<uint16_t> { static constexpr size_t value = 5; };
+template<> struct ObservationWidth<uint8_t> { static constexpr size_t value = 3; };
+template<> struct ObservationWidth<bool> { static constexpr size_t value = 1; };
+
+// Room for the JSON payload of any observation, including the NUL.
+static constexpr size_t OBSERVATION_JSON_MAX =
+  sizeof("{\"version\":\"" OBSERVATION_VERSION "\"") - 1 +
+  sizeof(",\"sequenceno\":") - 1 + ObservationWidth<unsigned>::value +
+  sizeof(",\"sent\":") - 1 + 20 +
+#define FACTOR(FLAG, field, type, key, ...) \
+  sizeof(",\"F#" key "\":") - 1 + ObservationWidth<type>::value +
+#define FACTOR_FIELD FACTOR
+#include "sensor_factors.h"
+  sizeof("}");
+
+// This version string identifies the CBOR package and is sent as its version field.  It is
+// versioned like OBSERVATION_VERSION, from the next major version since the package format is
+// different; the fields and their meaning are the same.
+//
+// 2.0.0: The observation as a CBOR map with integer keys and integer-scaled floats.
+
+#define OBSERVATION_CBOR_VERSION "2.0.0"
+
+// The keys of the CBOR package's fields that are not factors; the factors' keys are their ids in
+// sensor_factors.h.
+enum ObservationKey : uint8_t {
+  OBSERVATION_KEY_VERSION = 0,
+  OBSERVATION_KEY_SENT = 1,
+  OBSERVATION_KEY_SEQUENCENO = 2,
+};
+
+// The longest CBOR encoding of a value of each type in the payload.  A float is an integer of up to
+// 8 bytes, a single-precision float or null, see format_observation_cbor().
+template<typename T> struct ObservationCborWidth;
+template<> struct ObservationCborWidth<float> { static constexpr size_t value = 9; };
+template<> struct ObservationCborWidth<unsigned> { static constexpr size_t value = 5; };
+template<> struct ObservationCborWidth<uint16_t> { static constexpr size_t value = 3; };
+template<> struct ObservationCborWidth<uint8_t> { static constexpr size_t value = 2; };
+template<> struct ObservationCborWidth<bool> { static constexpr size_t value = 1; };
+
+// Room for the CBOR payload of any observation, including a NUL.  The map's length and every key
+// fit in one byte.
+static constexpr size_t OBSERVATION_CBOR_MAX =
+  1 +
+  1 + 1 + sizeof(OBSERVATION_CBOR_VERSION) - 1 +
+  1 + 9 +
+  1 + ObservationCborWidth<unsigned>::value +
+#define FACTOR(FLAG, field, type, ...) \
+  1 + ObservationCborWidth<type>::value +
+#define FACTOR_FIELD FACTOR
+#include "sensor_factors.h"
+  1;
+
+// Encode `data` as the JSON payload of an observation message into `buf`, which has room for `size`
+// bytes.  Returns the length of the payload, which is NUL-terminated, or 0 if it does not fit; it
+// always fits in OBSERVATION_JSON_MAX bytes.
+size_t format_observation_json(const SnappySenseData& data, char* buf, size_t size);
+
+// Encode `data` as the CBOR payload of an observation message into `buf`, which has room for `size`
+// bytes.  Returns the length of the payload, or 0 if it does not fit; it always fits in
+// OBSERVATION_CBOR_MAX bytes.  The payload is followed by a NUL that is not part of it, so that it
+// can be copied like a string of known length.
+size_t format_observation_cbor(const SnappySenseData& data, uint8_t* buf, size_t size);
+
+// Format `v` as a JSON number with OBSERVATION_DECIMALS decimals into `buf`, which has room for
+// `size` bytes, as the encoder does.  NaN and infinity are written as null.  Returns the length,
+// or 0 if it does not fit.
+size_t format_observation_float(float v, char* buf, size_t size);
+
+#endif // !observation_h_included
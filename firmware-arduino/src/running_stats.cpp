@@ -0,0 +1,38 @@
+// Streaming statistics, see running_stats.h.
+
+#include "running_stats.h"
+
+static float median3(float a, float b, float c) {
+  if (a > b) {
+    float t = a; a = b; b = t;
+  }
+  // Now a <= b.
+  if (c <= a) {
+    return a;
+  }
+  return c < b ? c : b;
+}
+
+void RunningStats::reset() {
+  num_samples = 0;
+  raw_mean = 0;
+  prev[0] = prev[1] = 0;
+  num_medians = 0;
+  median_mean = 0;
+}
+
+void RunningStats::add(float x) {
+  num_samples++;
+  raw_mean += (x - raw_mean) / num_samples;
+
+  if (num_samples >= 3) {
+    num_medians++;
+    median_mean += (median3(x, prev[0], prev[1]) - median_mean) / num_medians;
+  }
+  prev[1] = prev[0];
+  prev[0] = x;
+}
+
+float RunningStats::estimate() const {
+  return num_medians > 0 ? median_mean : raw_mean;
+}
@@ -0,0 +1,42 @@
+// Streaming statistics for repeated readings of one sensor factor.
+//
+// Samples are folded in one at a time in constant memory: count and running mean.  In addition
+// each sample is replaced by the median of itself and its two predecessors before it goes into a
+// second running mean, so that a single wild reading (a glitch on the bus, a flash of light on the
+// sensor) is rejected rather than averaged in.  estimate() is that median-filtered mean, which is
+// what we report for the factor.  Two wild readings in a row are averaged in.
+
+#ifndef running_stats_h_included
+#define running_stats_h_included
+
+#include "main.h"
+
+class RunningStats {
+public:
+  RunningStats() { reset(); }
+
+  // Forget all samples.
+  void reset();
+
+  // Fold one sample into the statistics.
+  void add(float x);
+
+  // The number of samples since the last reset.
+  unsigned count() const { return num_samples; }
+
+  // The mean of the samples, 0 if there are none.
+  float mean() const { return raw_mean; }
+
+  // The mean of the medians of each three consecutive samples, or the plain mean if there are
+  // fewer than three samples.
+  float estimate() const;
+
+private:
+  unsigned num_samples;
+  float raw_mean;
+  float prev[2];                // The two latest samples, latest first
+  unsigned num_medians;
+  float median_mean;
+};
+
+#endif // !running_stats_h_included
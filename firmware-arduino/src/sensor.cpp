@@ -5,114 +5,61 @@
 #include "device.h"
 #include "icons.h"
 #include "log.h"
+#include "metrics.h"
+#include "observation.h"
+#include "running_stats.h"
 #include "time_server.h"
 
-// This version string identifies the snappy/observation/ JSON package and is sent as
-// the "version" property of the package.
-//
-// The bugfix number is incremented if there's a compatible bugfix; for example, say we
-// change how a floating point number is rounded.  This will very rarely be the case.
-//
-// The minor version is incremented if the package format is changed in a compatible
-// manner, typically this will happen if we add or remove an optional field, or add
-// a new non-optional field.
-//
-// The major version is incremented if the package format is changed in an incompatible
-// way: the meaning of a field is changed in a nontrivial way, or a nonoptional field
-// is removed, or the package format itself changes.
-//
-// Every field below needs to be annotated with its version number.
-
-#define OBSERVATION_VERSION "1.0.0"
+#include <Preferences.h>
+#include <atomic>
+#include <math.h>
 
 // The "formatters" format the various members of SnappySenseData into a buffer.  In all
 // cases, `buflim` points to the address beyond the buffer.  No error is returned
 // if the buffer is too small, but the operation is guaranteed not to write beyond
 // the end of the buffer.
 
-static void format_sequenceno(const SnappySenseData& data, char* buf, char* buflim) {
-  snprintf(buf, buflim - buf, "%u", data.sequence_number);
-}
-
-static void format_timestamp(const SnappySenseData& data, char* buf, char* buflim) {
-  snprintf(buf, buflim-buf, "%s", format_timestamp(data.time).c_str());
-}
-
-#ifdef SENSE_TEMPERATURE
-static void format_temp(const SnappySenseData& data, char* buf, char* buflim) {
-  snprintf(buf, buflim - buf, "%f", data.temperature);
-}
-#endif
-
-#ifdef SENSE_HUMIDITY
-static void format_humidity(const SnappySenseData& data, char* buf, char* buflim) {
-  snprintf(buf, buflim - buf, "%f", data.humidity);
-}
-#endif
-
-#ifdef SENSE_UV
-static void format_uv(const SnappySenseData& data, char* buf, char* buflim) {
-  snprintf(buf, buflim - buf, "%f", data.uv);
-}
-#endif
-
-#ifdef SENSE_LIGHT
-static void format_light(const SnappySenseData& data, char* buf, char* buflim) {
-  snprintf(buf, buflim - buf, "%f", data.lux);
+static void format_value(float v, char* buf, char* buflim) {
+  // As in the observation message.
+  if (format_observation_float(v, buf, buflim - buf) == 0 && buflim > buf) {
+    *buf = 0;
+  }
 }
-#endif
 
-#ifdef SENSE_PRESSURE
-static void format_pressure(const SnappySenseData& data, char* buf, char* buflim) {
-  snprintf(buf, buflim - buf, "%u", data.hpa);
+static void format_value(unsigned v, char* buf, char* buflim) {
+  snprintf(buf, buflim - buf, "%u", v);
 }
-#endif
 
-#ifdef SENSE_ALTITUDE
-void format_altitude(const SnappySenseData& data, char* buf, char* buflim) {
-  snprintf(buf, buflim - buf, "%f", data.elevation);
+static void format_value(uint16_t v, char* buf, char* buflim) {
+  format_value(unsigned(v), buf, buflim);
 }
-#endif
 
-void format_air_sensor_status(const SnappySenseData& data, char* buf, char* buflim) {
-  snprintf(buf, buflim - buf, "%d", data.air_sensor_status);
+static void format_value(uint8_t v, char* buf, char* buflim) {
+  format_value(unsigned(v), buf, buflim);
 }
 
-#ifdef SENSE_AIR_QUALITY_INDEX
-static void format_air_quality(const SnappySenseData& data, char* buf, char* buflim) {
-  snprintf(buf, buflim - buf, "%d", data.aqi);
+static void format_value(bool v, char* buf, char* buflim) {
+  format_value(unsigned(v), buf, buflim);
 }
-#endif
 
-#ifdef SENSE_TVOC
-static void format_tvoc(const SnappySenseData& data, char* buf, char* buflim) {
-  snprintf(buf, buflim - buf, "%d", data.tvoc);
-}
-#endif
-
-#ifdef SENSE_CO2
-static void format_co2(const SnappySenseData& data, char* buf, char* buflim) {
-  snprintf(buf, buflim - buf, "%d", data.eco2);
+static void format_sequenceno(const SnappySenseData& data, char* buf, char* buflim) {
+  format_value(data.sequence_number, buf, buflim);
 }
-#endif
 
-#ifdef SENSE_MOTION
-static void format_motion(const SnappySenseData& data, char* buf, char* buflim) {
-  snprintf(buf, buflim - buf, "%d", data.motion_detected);
+static void format_timestamp(const SnappySenseData& data, char* buf, char* buflim) {
+  snprintf(buf, buflim-buf, "%s", format_timestamp(data.time).c_str());
 }
-#endif
 
-#ifdef SENSE_NOISE
-static void format_noise(const SnappySenseData& data, char* buf, char* buflim) {
-  snprintf(buf, buflim - buf, "%d", data.noise);
-}
-#endif
+#define FACTOR(FLAG, field, ...)                                                \
+  static void format_##field(const SnappySenseData& data, char* buf, char* buflim) { \
+    format_value(data.field, buf, buflim);                                      \
+  }
+#define FACTOR_FIELD(FLAG, field, ...) FACTOR(FLAG, field)
+#include "sensor_factors.h"
 
 // The "displayers" format the data so that they can be shown on the unit's
 // display.  There may be some information loss.  Where there's a formatter
-// that would produce the same string, we use that.
-// "Displayers" display for slideshow use, if the "formatted" display has too much
-// information.
+// that would produce the same string, sensor_factors.h uses that.
 
 #ifdef SENSE_TEMPERATURE
 static void display_temp(const SnappySenseData& data, char* buf, char* buflim) {
@@ -138,6 +85,18 @@ static void display_altitude(const SnappySenseData& data, char* buf, char* bufli
 }
 #endif
 
+#ifdef SENSE_MOTION
+static void display_occupancy(const SnappySenseData& data, char* buf, char* buflim) {
+  snprintf(buf, buflim - buf, "%d", (int)data.occupancy);
+}
+#endif
+
+#ifdef SENSE_NOISE
+static void display_noise(const SnappySenseData& data, char* buf, char* buflim) {
+  snprintf(buf, buflim - buf, "%d", (int)data.noise);
+}
+#endif
+
 SnappyMetaDatum snappy_metadata[] = {
   // Optional, unsigned sequence number, from version 1.0.0
   {.json_key         = "sequenceno",
@@ -145,8 +104,8 @@ SnappyMetaDatum snappy_metadata[] = {
    .display_unit     = "",
    .unit_text        = "",
    .icon             = nullptr,
-   .flag_offset      = 0,
-   .display         = nullptr,
+   .factor           = NO_FACTOR,
+   .display          = nullptr,
    .format           = format_sequenceno },
   // Mandatory, unsigned seconds since Posix epoch, from version 1.0.0
   {.json_key         = "sent",
@@ -154,292 +113,492 @@ SnappyMetaDatum snappy_metadata[] = {
    .display_unit     = "",
    .unit_text        = "",
    .icon             = nullptr,
-   .flag_offset      = 0,
-   .display         = nullptr,
-   .format           = format_timestamp},
-#ifdef SENSE_TEMPERATURE
-  // Optional, float temperature degrees C, from version 1.0.0
-  {.json_key         = "temperature",
-   .explanatory_text = "Temperature",
-   .display_unit     = "C",
-   .unit_text        = "C",
-   .icon             = temperature_icon,
-   .flag_offset      = offsetof(SnappySenseData, have_temperature),
-   .display         = display_temp,
-   .format           = format_temp},
-#endif
-#ifdef SENSE_HUMIDITY
-  // Optional, float relative humidity, from version 1.0.0
-  {.json_key         = "humidity",
-   .explanatory_text = "Humidity",
-   .display_unit     = "%",
-   .unit_text        = "%",
-   .icon             = humidity_icon,
-   .flag_offset      = offsetof(SnappySenseData, have_humidity),
-   .display          = display_humidity,
-   .format           = format_humidity},
-#endif
-#ifdef SENSE_UV
-  // Optional, version 1.0.0
-  {.json_key         = "uv",
-   .explanatory_text = "Ultraviolet intensity",
-   .display_unit     = "",
-   .unit_text        = "mW/cm^2",
-   .icon             = uv_icon,
-   .flag_offset      = offsetof(SnappySenseData, have_uv),
-   .display          = format_uv,
-   .format           = format_uv},
-#endif
-#ifdef SENSE_LIGHT
-  // Optional, version 1.0.0
-  {.json_key         = "light",
-   .explanatory_text = "Luminous intensity",
-   .display_unit     = "lx",
-   .unit_text        = "lx",
-   .icon             = lux_icon,
-   .flag_offset      = offsetof(SnappySenseData, have_lux),
-   .display          = display_light,
-   .format           = format_light},
-#endif
-#ifdef SENSE_PRESSURE
-  // Optional, version 1.0.0
-  {.json_key         = "pressure",
-   .explanatory_text = "Atmospheric pressure",
-   .display_unit     = "hpa",
-   .unit_text        = "hpa",
-   .icon             = hpa_icon,
-   .flag_offset      = offsetof(SnappySenseData, have_hpa),
-   .display          = format_pressure,
-   .format           = format_pressure},
-#endif
-#ifdef SENSE_ALTITUDE
-  // Optional, version 1.0.0
-  {.json_key         = "altitude",
-   .explanatory_text = "Altitude",
-   .display_unit     = "m",
-   .unit_text        = "m",
-   .icon             = elevation_icon,
-   .flag_offset      = offsetof(SnappySenseData, have_altitude),
-   .display          = display_altitude,
-   .format           = format_altitude},
-#endif
-  // Optional, version 1.0.0
-  {.json_key         = "airsensor",
-   .explanatory_text = "Air sensor status",
-   .display_unit     = "",
-   .unit_text        = "",
-   .icon             = nullptr,
-   .flag_offset      = offsetof(SnappySenseData, have_air_sensor_status),
+   .factor           = NO_FACTOR,
    .display          = nullptr,
-   .format           = format_air_sensor_status},
-#ifdef SENSE_AIR_QUALITY_INDEX
-  // Optional, version 1.0.0
-  {.json_key         = "airquality",
-   .explanatory_text = "Air quality index",
-   .display_unit     = "",
-   .unit_text        = "",
-   .icon             = aqi_icon,
-   .flag_offset      = offsetof(SnappySenseData, have_aqi),
-   .display          = format_air_quality,
-   .format           = format_air_quality},
-#endif
-#ifdef SENSE_TVOC
-  // Optional, version 1.0.0
-  {.json_key         = "tvoc",
-   .explanatory_text = "Concentration of total volatile organic compounds",
-   .display_unit     = "ppb",
-   .unit_text        = "ppb",
-   .icon             = aqi_icon,
-   .flag_offset      = offsetof(SnappySenseData, have_tvoc),
-   .display          = format_tvoc,
-   .format           = format_tvoc},
-#endif
-#ifdef SENSE_CO2
-  // Optional, version 1.0.0
-  {.json_key         = "co2",
-   .explanatory_text = "Carbon dioxide equivalent concentration",
-   .display_unit     = "ppm",
-   .unit_text        = "ppm",
-   .icon             = co2_icon,
-   .flag_offset      = offsetof(SnappySenseData, have_eco2),
-   .display          = format_co2,
-   .format           = format_co2},
-#endif
-#ifdef SENSE_MOTION
-  // Optional, version 1.0.0
-  {.json_key         = "motion",
-   .explanatory_text = "Motion detected",
-   .display_unit     = "",
-   .unit_text        = "",
-   .icon             = motion_icon,
-   .flag_offset      = offsetof(SnappySenseData, have_motion),
-   .display          = format_motion,
-   .format           = format_motion},
-#endif
-#ifdef SENSE_NOISE
-  // Optional, version 1.0.0
-  {.json_key         = "noise",
-   .explanatory_text = "Noise value",
-   .display_unit     = "",
-   .unit_text        = "",
-   .icon             = noise_icon,
-   .flag_offset      = offsetof(SnappySenseData, have_noise),
-   .display          = format_noise,
-   .format           = format_noise},
-#endif
+   .format           = format_timestamp},
+#define FACTOR(FLAG, field, type, key, id, text, short_unit, unit, bitmap, displayer, ...) \
+  {.json_key         = key,                                                                \
+   .explanatory_text = text,                                                               \
+   .display_unit     = short_unit,                                                         \
+   .unit_text        = unit,                                                               \
+   .icon             = bitmap,                                                             \
+   .factor           = FACTOR_##FLAG,                                                      \
+   .display          = displayer,                                                          \
+   .format           = format_##field},
+#define FACTOR_FIELD FACTOR
+#include "sensor_factors.h"
   {.json_key         = nullptr,
    .explanatory_text = nullptr,
    .display_unit     = "",
    .unit_text        = "",
    .icon             = nullptr,
-   .flag_offset      = 0,
+   .factor           = NO_FACTOR,
    .display          = nullptr,
    .format           = nullptr}
 };
 
-// The JSON data format is defined by MQTT-PROTOCOL.md
-String format_readings_as_json(const SnappySenseData& data) {
-  String buf;
-  buf += '{';
-  // Version field: mandatory, semver string, from version 1.0.0
-  buf += "\"version\":\"";
-  buf += OBSERVATION_VERSION;
-  buf += '"';
-  for ( SnappyMetaDatum* r = snappy_metadata; r->json_key != nullptr; r++ ) {
-    // Skip data that are not valid
-    if (r->flag_offset > 0 &&
-        !*reinterpret_cast<const bool*>(reinterpret_cast<const char*>(&data) + r->flag_offset)) {
-      continue;
+// The latest readings, see sensor_snapshot() in sensor.h.
+//
+// The sensor task fills the buffer that does not hold the latest readings, so readers of the latest
+// readings are never disturbed by a publication; only the second publication after a snapshot can
+// overwrite it.  A buffer's sequence number is odd while it is being written and is bumped again
+// when it is complete, so a reader can tell that the buffer changed under it.  `publications` is
+// bumped last and tells readers which buffer is the latest.  Only the sensor task writes.
+
+static SnappySenseData published[2];
+static std::atomic<uint32_t> published_seq[2];
+static std::atomic<uint32_t> publications;
+
+static SnappySenseData* begin_publication() {
+  unsigned b = publications.load(std::memory_order_relaxed) & 1;
+  published_seq[b].store(published_seq[b].load(std::memory_order_relaxed) + 1,
+                         std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  published[b] = SnappySenseData();
+  return &published[b];
+}
+
+static void end_publication() {
+  uint32_t n = publications.load(std::memory_order_relaxed);
+  unsigned b = n & 1;
+  published_seq[b].store(published_seq[b].load(std::memory_order_relaxed) + 1,
+                         std::memory_order_release);
+  publications.store(n + 1, std::memory_order_release);
+}
+
+bool sensor_snapshot(SensorSnapshot* s) {
+  for (;;) {
+    uint32_t n = publications.load(std::memory_order_acquire);
+    if (n == 0) {
+      return false;
     }
-    buf += ',';
-    buf += '"';
-    // This is a hack.  Factor names are prefixed by F# to avoid name clashes, while fields like
-    // sent and sequenceno should not be prefixed.  The hack is that flag_offset doubles as an
-    // indicator for whether the prefix is needed.
-    if (r->flag_offset > 0) {
-      buf += "F#";
+    unsigned b = (n - 1) & 1;
+    uint32_t seq = published_seq[b].load(std::memory_order_acquire);
+    // If the buffer is being written then a newer publication has completed since `n` was read,
+    // and the retry will find it.
+    if ((seq & 1) == 0) {
+      s->data = &published[b];
+      s->seq = seq;
+      return true;
     }
-    buf += r->json_key;
-    buf += '"';
-    buf += ':';
-    char tmp[256];
-    r->format(data, tmp, tmp+sizeof(tmp));
-    buf += tmp;
   }
-  buf += '}';
-  return buf;
 }
 
-static TimerHandle_t warmup_timer;
-static TimerHandle_t pir_timer;
-static TimerHandle_t mems_timer;
-static bool is_running;
-static TickType_t warmup_count;
-
-enum {
-  WARMUP_WORK,
-  GO_TO_WORK,
-  SAMPLE_PIR,
-  SAMPLE_MEMS
-};
-
-// It appears to be important to read the sensors multiple times throughout the
-// warmup window, to activate them.
+bool sensor_snapshot_valid(const SensorSnapshot& s) {
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return published_seq[s.data - published].load(std::memory_order_relaxed) == s.seq;
+}
 
-static constexpr TickType_t WARMUP_ITERATIONS = 5;
+bool sensor_latest(SnappySenseData* data) {
+  SensorSnapshot s;
+  do {
+    if (!sensor_snapshot(&s)) {
+      return false;
+    }
+    *data = *s.data;
+  } while (!sensor_snapshot_valid(s));
+  return true;
+}
 
-// We have three timers.
+// The sensor task owns the I2C sensors: all reading, priming and (re)initialization of them happens
+// on it, so the main task, which drives the display and handles the button, never waits for a
+// sensor transaction.  The display is on the same bus but the Wire library serializes transactions
+// from different tasks.
 //
-// One is driving the PIR: check every second throughout the window, the final reading is 1
-// if the sensor was ever read as 1.
+// The main task controls the task with commands.  Within the monitoring window the task runs the
+// warmup on timeouts of its own, reading the sensors a little and waiting for things to stabilize,
+// and then starts the PIR and MEMS samplers.  During the sampling time it reads the sensors
+// SAMPLE_READS times at even intervals, and when the sampling time is up it reads them once more,
+// publishes the readings, and posts MONITOR_DATA.  The published value of each environment and air
+// factor is the robust estimate over all those readings (see running_stats.h), not just the last
+// one.  (The stabilization thing is a little experimental but seems to work.  It appears to be
+// important to read the sensors multiple times throughout the warmup window, to activate them.)
 //
-// The other is driving the MEMS (on HW1.1 and newer): sample every n milliseconds throughout
-// the window.  The final reading is the max of any reading in the window.  (This is probably
-// a little aggressive.)  This will require rethinking how the noise sensor is represented in
-// sensor data, and it will invalidate some current sensor data.
+// The air sensor reports its own warmup state, so the warmup ends as soon as that reports valid
+// data, with sensor_warmup_time_s() as the upper bound.  If the sensor stayed powered since the
+// last window this is at once.  Otherwise the status is polled once a second from half the typical
+// warmup time seen so far, which is learned per device as a running average and kept in nonvolatile
+// storage so that it survives a reset.  With SNAPPY_AIR_SENSOR_STANDBY the sensor sleeps between
+// windows and is woken at the start of the window; it is ready much sooner after that than after
+// being powered up, so the two cases are learned separately.  Main's timeout for the window is a
+// backstop only; the task normally closes the window before it.
 //
-// The last is driving the warmup work, when we read the sensors a little and wait for things
-// to stabilize.  (The stabilization thing is a little experimental but seems to work.)
+// The PIR and the MEMS are not driven by the task.  After the warmup, the PIR's edges are recorded
+// by its interrupt handler (see start_pir_sampler()) and the MEMS (on HW1.1 and newer) is sampled
+// continuously by a task of its own (see start_mems_sampler()), until the window closes.  With
+// SENSE_AIR_INTERRUPT, the air sensor's interrupt sends the task a command whenever the sensor has
+// a new sample, from the start of the warmup (see start_air_sampler()), and the task looks at the
+// sample's status instead of polling.
+
+enum class SensorCommand : uint8_t {
+  START,
+  STOP,
+  AIR_SAMPLE,
+  STANDBY,
+};
 
-void monitoring_init() {
-  unsigned long warmup_ticks_per_iter = pdMS_TO_TICKS(sensor_warmup_time_s() * 1000) / WARMUP_ITERATIONS;
-  warmup_timer = xTimerCreate("warmup",
-                              warmup_ticks_per_iter,
-                              pdFALSE,
-                              nullptr,
-                              [](TimerHandle_t t) {
-                                if (++warmup_count < WARMUP_ITERATIONS) {
-                                  put_main_event(EvCode::MONITOR_WORK, WARMUP_WORK);
-                                } else {
-                                  put_main_event(EvCode::MONITOR_WORK, GO_TO_WORK);
-                                }
-                              });
-  pir_timer = xTimerCreate("pir",
-                           pdMS_TO_TICKS(1000),
-                           pdTRUE,
-                           nullptr,
-                           [](TimerHandle_t t) {
-                             put_main_event(EvCode::MONITOR_WORK, SAMPLE_PIR);
-                           });
-  mems_timer = xTimerCreate("mems",
-                            pdMS_TO_TICKS(10),
-                            pdTRUE,
-                            nullptr,
-                            [](TimerHandle_t t) {
-                             put_main_event(EvCode::MONITOR_WORK, SAMPLE_MEMS);
-                            });
+static QueueHandle_t/*<SensorCommand>*/ sensor_commands;
+static bool is_running;
+static bool warming_up;
+static uint32_t window_start_ms;
+static unsigned warmup_reads;
+static uint32_t next_read_ms;
+static uint32_t next_poll_ms;
+static uint32_t sampling_end_ms;
+static unsigned sample_reads;
+static uint32_t next_sample_ms;
+// Indexed by whether the air sensor was woken from standby rather than powered up.  0 until a
+// warmup has ended on the sensor's say-so.
+static uint32_t typical_warmup_ms[2];
+static bool woken_from_standby;
+
+// The typical warmup times are learned, not configured, so they are kept apart from the
+// configuration.  They are saved only when they have moved by WARMUP_SAVE_DELTA_MS, to spare the
+// flash.
+static const char* const WARMUP_PREFS_NAMESPACE = "snappylearned";
+static const char* const WARMUP_PREFS_KEYS[2] = { "warm", "warmsb" };
+static constexpr uint32_t WARMUP_SAVE_DELTA_MS = 1000;
+static uint32_t saved_warmup_ms[2];
+static unsigned warmup_ms_per_read;
+
+// get_sensor_values() is dominated by I2C transfers.
+static Histogram read_time("sensor.read_us");
+static Counter readings("sensor.readings");
+static Gauge warmup_time("sensor.warmup_ms");
+static Counter warmup_timeouts("sensor.warmup_timeout");
+
+#ifdef SENSE_AIR_INTERRUPT
+// With the data-ready interrupt the air sensor is read every time it has a new sample, so there
+// are no timed reads during the warmup, and no polling.
+static constexpr unsigned WARMUP_READS = 0;
+#else
+static constexpr unsigned WARMUP_READS = 4;
+#endif
+
+// Readings in the sampling time before the final one.  The sensors produce a new value about once a
+// second, so this spreads the readings out over the default sampling time.
+static constexpr unsigned SAMPLE_READS = 5;
+
+// The air sensor has a new sample every second.
+#if (defined(SENSE_AIR_QUALITY_INDEX) || defined(SENSE_TVOC) || defined(SENSE_CO2)) && \
+    !defined(SENSE_AIR_INTERRUPT)
+# define POLL_AIR_STATUS
+static constexpr uint32_t AIR_POLL_MS = 1000;
+#endif
+
+static bool is_due(uint32_t t, uint32_t now) {
+  return int32_t(now - t) >= 0;
 }
 
-void monitoring_start() {
-  if (!is_running) {
-    assert(monitoring_window_s() > sensor_warmup_time_s());
-    is_running = true;
-    warmup_count = 0;
-    xTimerStart(warmup_timer, portMAX_DELAY);
+static uint32_t earliest(uint32_t a, uint32_t b) {
+  return int32_t(a - b) < 0 ? a : b;
+}
+
+#ifdef SENSE_AIR_INTERRUPT
+static void air_data_ready() {
+  SensorCommand cmd = SensorCommand::AIR_SAMPLE;
+  xQueueSendFromISR(sensor_commands, &cmd, nullptr);
+}
+#endif
+
+static void read_and_discard() {
+  SnappySenseData dummy;
+  MetricTimer t(read_time);
+  get_sensor_values(&dummy);
+}
+
+// The readings of the factors in the sampling time, for the factors that sensor_factors.h says are
+// sampled.  IF_SAMPLED_<sampling> expands its arguments only for those, and SAMPLE_WHEN_<sampling>
+// is the condition for a reading to be folded in.
+
+#define IF_SAMPLED_NOT_SAMPLED(...)
+#define IF_SAMPLED_SAMPLED(...) __VA_ARGS__
+#define IF_SAMPLED_SAMPLED_AIR(...) __VA_ARGS__
+#define SAMPLE_WHEN_SAMPLED(data) true
+#define SAMPLE_WHEN_SAMPLED_AIR(data) \
+  ((data).is_valid(FACTOR_AIR_SENSOR_STATUS) && (data).air_sensor_status == 0)
+
+static struct {
+#define FACTOR(FLAG, field, type, key, id, text, short_unit, unit, bitmap, displayer, sampling) \
+  IF_SAMPLED_##sampling(RunningStats field;)
+#define FACTOR_FIELD FACTOR
+#include "sensor_factors.h"
+} samples;
+
+static void reset_samples() {
+#define FACTOR(FLAG, field, type, key, id, text, short_unit, unit, bitmap, displayer, sampling) \
+  IF_SAMPLED_##sampling(samples.field.reset();)
+#define FACTOR_FIELD FACTOR
+#include "sensor_factors.h"
+}
+
+static void fold_sample(const SnappySenseData& data) {
+#define FACTOR(FLAG, field, type, key, id, text, short_unit, unit, bitmap, displayer, sampling) \
+  IF_SAMPLED_##sampling(                                                                        \
+    if (data.is_valid(FACTOR_##FLAG) && SAMPLE_WHEN_##sampling(data)) {                         \
+      samples.field.add(data.field);                                                            \
+    })
+#define FACTOR_FIELD FACTOR
+#include "sensor_factors.h"
+}
+
+// Replace the reading of a factor with the estimate, if there were samples of it.  Integer factors
+// are rounded.
+
+static void use_estimate(const RunningStats& stats, SnappySenseData* data, Factor f, float* value) {
+  if (stats.count() > 0) {
+    *value = stats.estimate();
+    data->set_valid(f, true);
+  }
+}
+
+template<typename T>
+static void use_estimate(const RunningStats& stats, SnappySenseData* data, Factor f, T* value) {
+  if (stats.count() > 0) {
+    *value = T(lroundf(stats.estimate()));
+    data->set_valid(f, true);
   }
 }
 
-static void monitoring_report() {
-  SnappySenseData* data = new SnappySenseData();
-  get_sensor_values(data);
-  put_main_event(EvCode::MONITOR_DATA, data);
+static void use_estimates(SnappySenseData* data) {
+#define FACTOR(FLAG, field, type, key, id, text, short_unit, unit, bitmap, displayer, sampling) \
+  IF_SAMPLED_##sampling(use_estimate(samples.field, data, FACTOR_##FLAG, &data->field);)
+#define FACTOR_FIELD FACTOR
+#include "sensor_factors.h"
 }
 
-void monitoring_work(uint32_t which) {
-  if (is_running) {
-    switch (which) {
-      case WARMUP_WORK: {
-        // Read the sensors to let them know we care, but discard the readings.
-        SnappySenseData dummy;
-        get_sensor_values(&dummy);
-        sample_pir();
-        sample_mems();
-        xTimerStart(warmup_timer, portMAX_DELAY);
-        break;
+static void read_and_fold() {
+  SnappySenseData data;
+  {
+    MetricTimer t(read_time);
+    get_sensor_values(&data);
+  }
+  fold_sample(data);
+}
+
+static void window_start() {
+  is_running = true;
+  warming_up = true;
+  window_start_ms = millis();
+  warmup_reads = 0;
+  next_read_ms = window_start_ms + warmup_ms_per_read;
+  next_poll_ms = window_start_ms;
+  reset_samples();
+#ifdef SNAPPY_AIR_SENSOR_STANDBY
+  woken_from_standby = set_air_sensor_standby(false);
+#endif
+  // Read the environment once to prime the air sensor with temperature and humidity.
+  read_and_discard();
+#ifdef SENSE_AIR_INTERRUPT
+  start_air_sampler(air_data_ready);
+#endif
+}
+
+static void go_to_work(uint32_t now) {
+  warming_up = false;
+  warmup_time.set(now - window_start_ms);
+  sampling_end_ms = now + sensor_sampling_time_s() * 1000;
+  sample_reads = 0;
+  next_sample_ms = now;
+  reset_pir_and_mems();
+  start_pir_sampler();
+  start_mems_sampler();
+}
+
+static void load_typical_warmup() {
+  Preferences nvr_prefs;
+  if (nvr_prefs.begin(WARMUP_PREFS_NAMESPACE, /* readOnly= */ true)) {
+    for ( int i = 0; i < 2; i++ ) {
+      typical_warmup_ms[i] = saved_warmup_ms[i] = nvr_prefs.getInt(WARMUP_PREFS_KEYS[i], 0);
+    }
+    nvr_prefs.end();
+  }
+}
+
+#if defined(SENSE_AIR_QUALITY_INDEX) || defined(SENSE_TVOC) || defined(SENSE_CO2)
+static void save_typical_warmup(int i) {
+  if (abs(int(typical_warmup_ms[i] - saved_warmup_ms[i])) < int(WARMUP_SAVE_DELTA_MS)) {
+    return;
+  }
+  Preferences nvr_prefs;
+  if (nvr_prefs.begin(WARMUP_PREFS_NAMESPACE)) {
+    nvr_prefs.putInt(WARMUP_PREFS_KEYS[i], typical_warmup_ms[i]);
+    nvr_prefs.end();
+    saved_warmup_ms[i] = typical_warmup_ms[i];
+  }
+}
+#endif
+
+// If the air sensor says it is warm, go to work and learn from it.
+static bool air_sensor_is_warm(uint32_t now) {
+#if defined(SENSE_AIR_QUALITY_INDEX) || defined(SENSE_TVOC) || defined(SENSE_CO2)
+  uint8_t status;
+  if (poll_air_sensor_status(&status) && status == 0) {
+    uint32_t elapsed = now - window_start_ms;
+    uint32_t& typical = typical_warmup_ms[woken_from_standby];
+    typical = typical == 0 ? elapsed : (3 * typical + elapsed) / 4;
+    save_typical_warmup(woken_from_standby);
+    go_to_work(now);
+    return true;
+  }
+#endif
+  return false;
+}
+
+static void warmup_step(uint32_t now) {
+  if (now - window_start_ms >= sensor_warmup_time_s() * 1000) {
+    warmup_timeouts.inc();
+    go_to_work(now);
+    return;
+  }
+#ifdef POLL_AIR_STATUS
+  if (is_due(next_poll_ms, now)) {
+    if (air_sensor_is_warm(now)) {
+      return;
+    }
+    // The sensor is cold, so it will probably take about as long as it usually does.
+    uint32_t typical_half_ms = window_start_ms + typical_warmup_ms[woken_from_standby] / 2;
+    next_poll_ms = now + AIR_POLL_MS;
+    if (!is_due(typical_half_ms, next_poll_ms)) {
+      next_poll_ms = typical_half_ms;
+    }
+  }
+#endif
+  if (warmup_reads < WARMUP_READS && is_due(next_read_ms, now)) {
+    // Read the sensors to let them know we care, but discard the readings.
+    read_and_discard();
+    warmup_reads++;
+    next_read_ms += warmup_ms_per_read;
+  }
+}
+
+static void window_stop() {
+  is_running = false;
+  warming_up = false;
+#ifdef SENSE_AIR_INTERRUPT
+  stop_air_sampler();
+#endif
+  stop_pir_sampler();
+  stop_mems_sampler();
+  SnappySenseData* data = begin_publication();
+  {
+    MetricTimer t(read_time);
+    get_sensor_values(data);
+  }
+  fold_sample(*data);
+  use_estimates(data);
+  end_publication();
+  readings.inc();
+  put_main_event(EvCode::MONITOR_DATA);
+}
+
+// The time of the next thing the task has to do in the monitoring window.
+static uint32_t next_step_ms() {
+  if (!warming_up) {
+    if (sample_reads < SAMPLE_READS) {
+      return earliest(sampling_end_ms, next_sample_ms);
+    }
+    return sampling_end_ms;
+  }
+  uint32_t t = window_start_ms + sensor_warmup_time_s() * 1000;
+#ifdef POLL_AIR_STATUS
+  t = earliest(t, next_poll_ms);
+#endif
+  if (warmup_reads < WARMUP_READS) {
+    t = earliest(t, next_read_ms);
+  }
+  return t;
+}
+
+static void sensor_task(void*) {
+  for (;;) {
+    TickType_t timeout = portMAX_DELAY;
+    if (is_running) {
+      int32_t remaining_ms = int32_t(next_step_ms() - millis());
+      timeout = pdMS_TO_TICKS(remaining_ms > 0 ? remaining_ms : 0);
+    }
+    SensorCommand cmd;
+    if (xQueueReceive(sensor_commands, &cmd, timeout) != pdTRUE) {
+      uint32_t now = millis();
+      if (warming_up) {
+        warmup_step(now);
+      } else if (is_due(sampling_end_ms, now)) {
+        window_stop();
+      } else if (sample_reads < SAMPLE_READS && is_due(next_sample_ms, now)) {
+        read_and_fold();
+        sample_reads++;
+        next_sample_ms += sensor_sampling_time_s() * 1000 / SAMPLE_READS;
       }
-      case GO_TO_WORK:
-        reset_pir_and_mems();
-        sample_pir();
-        sample_mems();
-        xTimerStart(pir_timer, portMAX_DELAY);
-        xTimerStart(mems_timer, portMAX_DELAY);
+      continue;
+    }
+    switch (cmd) {
+      case SensorCommand::START:
+        if (!is_running) {
+          window_start();
+        }
         break;
-      case SAMPLE_PIR:
-        sample_pir();
+      case SensorCommand::STOP:
+        // The window may have been closed by the task already.
+        if (is_running) {
+          window_stop();
+        }
         break;
-      case SAMPLE_MEMS:
-        sample_mems();
+      case SensorCommand::AIR_SAMPLE:
+#ifdef SENSE_AIR_INTERRUPT
+        if (is_running) {
+          take_air_sample();
+          if (warming_up) {
+            air_sensor_is_warm(millis());
+          }
+        }
+#endif
+        break;
+      case SensorCommand::STANDBY:
+#ifdef SNAPPY_AIR_SENSOR_STANDBY
+        if (!is_running) {
+          set_air_sensor_standby(true);
+        }
+#endif
         break;
     }
   }
 }
 
-void monitoring_stop() {
-  if (is_running) {
-    is_running = false;
-    xTimerStop(warmup_timer, portMAX_DELAY);
-    xTimerStop(pir_timer, portMAX_DELAY);
-    xTimerStop(mems_timer, portMAX_DELAY);
-    monitoring_report();
+static void send_command(SensorCommand cmd) {
+  // The queue is long enough for this never to block for long; the task drains it promptly.
+  xQueueSend(sensor_commands, &cmd, portMAX_DELAY);
+}
+
+void monitoring_init() {
+  warmup_ms_per_read = sensor_warmup_time_s() * 1000 / (WARMUP_READS + 1);
+  load_typical_warmup();
+  sensor_commands = xQueueCreate(8, sizeof(SensorCommand));
+  if (sensor_commands == nullptr) {
+    panic("Could not create queue");
   }
+#ifdef SNAPPY_DUAL_CORE
+  // Keep the task on the main task's core, away from the network task.
+  BaseType_t res = xTaskCreatePinnedToCore(sensor_task, "sensor", 4096, nullptr,
+                                           tskIDLE_PRIORITY+1, nullptr, xPortGetCoreID());
+#else
+  BaseType_t res = xTaskCreate(sensor_task, "sensor", 4096, nullptr, tskIDLE_PRIORITY+1, nullptr);
+#endif
+  if (res != pdPASS) {
+    panic("Could not create task");
+  }
+}
+
+void monitoring_start() {
+  assert(monitoring_window_s() > sensor_warmup_time_s());
+  send_command(SensorCommand::START);
+}
+
+void monitoring_stop() {
+  send_command(SensorCommand::STOP);
+}
+
+void monitoring_standby() {
+#ifdef SNAPPY_AIR_SENSOR_STANDBY
+  send_command(SensorCommand::STANDBY);
+#endif
 }
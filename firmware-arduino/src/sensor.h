@@ -5,100 +5,47 @@
 
 #include "main.h"
 
-// This is the model of the sensor unit.
+// This is the model of the sensor unit.  The readings are defined by sensor_factors.h.
+
+// The validity bits of the factors.
+enum Factor : uint8_t {
+#define FACTOR(FLAG, ...) FACTOR_##FLAG,
+#define FACTOR_FIELD(...)
+#include "sensor_factors.h"
+  NUM_FACTORS,
+  NO_FACTOR = 0xFF
+};
+
+static_assert(NUM_FACTORS <= 32, "Too many factors for the validity mask");
 
 struct SnappySenseData {
   // The sequence number is useful for calibration, bug fixing, etc.  It is
   // set from a global variable when a reading is obtained.  It will wrap
   // around silently.
-  //
-  // This member shall be at offset 0, so that offsetof() of a flag variable
-  // is never 0.
   unsigned sequence_number = 0;
 
   // Current device timestamp (seconds since epoch, UTC) when the reading was taken
   time_t time = 0;
 
-#ifdef SENSE_ALTITUDE
-  // Altitude of device, meters above (below) sea level
-  float elevation = 0.0f;
-  bool have_elevation = false;
-#endif
-
-#ifdef SENSE_HUMIDITY
-  // Relative humidity, percent
-  float humidity = 0.0f;
-  bool have_humidity = false;
-#endif
-
-#ifdef SENSE_TEMPERATURE
-  // Degrees Celsius
-  float temperature = 0.0f;
-  bool have_temperature = false;
-#endif
-
-#ifdef SENSE_PRESSURE
-  // Air pressure, in 10^2 Pascal
-  uint16_t hpa = 0;
-  bool have_hpa = false;
-#endif
-
-#ifdef SENSE_LIGHT
-  // Illumninance, in lux
-  float lux = 0.0f;
-  bool have_lux = false;
-#endif
-
-#ifdef SENSE_UV
-  // Ultraviolet radiation, in mW / cm^2
-  float uv = 0.0f;
-  bool have_uv = false;
-#endif
-
-  // Status code from the device: 0=normal, 1=warmup, 2=startup, 3=invalid
-  uint8_t air_sensor_status = 0;
-  bool have_air_sensor_status = false;
-
-#ifdef SENSE_AIR_QUALITY_INDEX
-  // AQI: 1-Excellent, 2-Good, 3-Moderate, 4-Poor, 5-Unhealthy
-  uint8_t aqi = 0;
-  bool have_aqi = false;
-#endif
-
-#ifdef SENSE_TVOC
-  // Total volatile organic compounds, 0–65000, ppb
-  uint16_t tvoc = 0;
-  bool have_tvoc = false;
-#endif
-
-#ifdef SENSE_CO2
-  // CO2, 400–65000, ppm
-  // Five levels: Excellent(400 - 600), Good(600 - 800), Moderate(800 - 1000),
-  //              Poor(1000 - 1500), Unhealthy(> 1500)
-  uint16_t eco2 = 0;
-  bool have_eco2 = false;
-#endif
-
-#ifdef SENSE_NOISE
-  // The value looks like it's the voltage reading times 1000: the lower limit is
-  // about 1500, which is what the data sheet says corresponds to the quiescent
-  // state at 1.5V.  As the environment becomes noisier, the numbers become
-  // higher, reaching into the 2200 range.  Some readings were seen around 900
-  // and 4100, but not clear what these were.
-  uint16_t noise = 0;
-  bool have_noise = false;
-#endif
-
-#ifdef SENSE_MOTION
-  // Passive motion sensor.  Unit: no movement / movement.
-  bool motion_detected = false;
-  bool have_motion = false;
-#endif
+  // Bit FACTOR_X is set iff the readings of factor X are valid.
+  uint32_t valid = 0;
+
+#define FACTOR(FLAG, field, type, ...) type field = type();
+#define FACTOR_FIELD(FLAG, field, type, ...) type field = type();
+#include "sensor_factors.h"
+
+  bool is_valid(Factor f) const {
+    return (valid >> f) & 1;
+  }
+
+  void set_valid(Factor f, bool is_valid) {
+    valid = is_valid ? valid | (1u << f) : valid & ~(1u << f);
+  }
 };
 
-// Sensor metadata.  There is one row in the metadata table for each field in the model
-// (though not necessarily in the same order).  The metadata can be used to format
-// and describe the fields in various ways.
+// Sensor metadata.  There is one row in the metadata table for each field in the model, in the
+// order of sensor_factors.h after the sequence number and the time.  The metadata can be used to
+// format and describe the fields in various ways.
 
 struct SnappyMetaDatum {
   // The json key is unique, and must be simple alphanumeric, no punctuation.
@@ -117,8 +64,9 @@ struct SnappyMetaDatum {
   // The icon may be null, otherwise it's a pointer to a bitmap
   const unsigned char* icon;
 
-  // The offset within the structure of a bool that denotes whether the data is valid.
-  off_t flag_offset;
+  // The validity bit of the field, or NO_FACTOR for the fields that are always valid and are not
+  // factors (the sequence number and the time).
+  Factor factor;
 
   // `display` is for the unit's display when running the slide show; it loses some information.
   // This may be null, if it is it's because we don't want to display this.
@@ -127,16 +75,50 @@ struct SnappyMetaDatum {
   // `format` is for the view command, JSON data extraction, and so on - all information
   // is preserved.
   void (*format)(const SnappySenseData& data, char* buf, char* buflim);
+
+  // True if the field described by this row is valid in `data`.
+  bool is_valid(const SnappySenseData& data) const {
+    return factor == NO_FACTOR || data.is_valid(factor);
+  }
 };
 
 // The metadata table is terminated by a row where json_key == nullptr.
 extern SnappyMetaDatum snappy_metadata[];
 
-String format_readings_as_json(const SnappySenseData& data);
+// The latest readings, published by the sensor task at the end of each monitoring window.
+//
+// Readers neither block nor copy: take a snapshot, read the fields through `data` in place, and
+// then check that the snapshot is still valid.  If it is not, the buffer was reused for newer
+// readings while it was being read (this takes two publications), and whatever was read from it
+// must be discarded; take a new snapshot and start over.
+struct SensorSnapshot {
+  const SnappySenseData* data;
+  uint32_t seq;
+};
 
+// Take a snapshot of the latest readings.  Returns false if nothing has been published yet.
+bool sensor_snapshot(SensorSnapshot* s);
+
+// True if nothing read through `s` since it was taken can have been overwritten.
+bool sensor_snapshot_valid(const SensorSnapshot& s);
+
+// Copy the latest readings into `*data`, for readers that need to keep them.  Returns false if
+// nothing has been published yet.
+bool sensor_latest(SnappySenseData* data);
+
+// Create the sensor task.  The other functions below only send it commands and return at once.
 void monitoring_init();
+
+// Open the monitoring window: warm up the sensors and start the samplers.  The window closes by
+// itself sensor_sampling_time_s() after the warmup, as for monitoring_stop().
 void monitoring_start();
-void monitoring_work(uint32_t which);
+
+// Close the monitoring window now, if it has not closed by itself: stop the samplers, read the
+// sensors, publish the readings and post EvCode::MONITOR_DATA.
 void monitoring_stop();
 
+// Put the sensors into their low-power state until the next monitoring_start(), for the sleep
+// window.  Only the air sensor has one, with SNAPPY_AIR_SENSOR_STANDBY; otherwise this does nothing.
+void monitoring_standby();
+
 #endif // !sensor_h_included
@@ -0,0 +1,111 @@
+// The sensor factors: the schema from which sensor.h and sensor.cpp generate the fields and
+// validity bits of SnappySenseData, the metadata table, and the encoders.
+//
+// This file has no include guard.  It is included with the following macros defined to generate
+// one thing or another, and undefines them at the end:
+//
+//   FACTOR(FLAG, field, type, json_key, id, explanatory_text, display_unit, unit_text, icon,
+//          display, sampling)
+//     A reading `field` of `type` that has its own validity bit, FACTOR_FLAG.
+//
+//   FACTOR_FIELD(FLAG, field, type, json_key, id, explanatory_text, display_unit, unit_text, icon,
+//                display, sampling)
+//     A reading that has no validity bit of its own but is valid with FACTOR_FLAG.
+//
+// `json_key` is unique, and must be simple alphanumeric, no punctuation; `display` is the
+// slideshow's displayer (see SnappyMetaDatum), or nullptr if the reading is not shown there.
+//
+// `sampling` says what is reported for the reading at the end of the monitoring window (see
+// sensor.cpp): SAMPLED for the robust estimate over the valid readings taken in the sampling time;
+// SAMPLED_AIR for the same, but over only the readings the air sensor says are valid; NOT_SAMPLED
+// for the final reading, or whatever the reading's own sampler produced.
+//
+// `id` is the reading's key in the binary package (see OBSERVATION_CBOR_VERSION).  It is unique,
+// never changes and is never reused, whether or not the reading is compiled in.  Keys 0-2 are taken
+// by the package's version, sent and sequenceno fields, and keys below 24 are encoded in one byte.
+//
+// The readings are reported in this order.  They are all optional in the JSON package, and every
+// one needs to be annotated with the version it appeared in (see OBSERVATION_VERSION).
+
+#ifdef SENSE_TEMPERATURE
+// Degrees Celsius, version 1.0.0
+FACTOR(TEMPERATURE, temperature, float, "temperature", 3, "Temperature", "C", "C",
+       temperature_icon, display_temp, SAMPLED)
+#endif
+
+#ifdef SENSE_HUMIDITY
+// Relative humidity, percent, version 1.0.0
+FACTOR(HUMIDITY, humidity, float, "humidity", 4, "Humidity", "%", "%",
+       humidity_icon, display_humidity, SAMPLED)
+#endif
+
+#ifdef SENSE_UV
+// Ultraviolet radiation, in mW / cm^2, version 1.0.0
+FACTOR(UV, uv, float, "uv", 5, "Ultraviolet intensity", "", "mW/cm^2",
+       uv_icon, format_uv, SAMPLED)
+#endif
+
+#ifdef SENSE_LIGHT
+// Illuminance, in lux, version 1.0.0
+FACTOR(LUX, lux, float, "light", 6, "Luminous intensity", "lx", "lx",
+       lux_icon, display_light, SAMPLED)
+#endif
+
+#ifdef SENSE_PRESSURE
+// Air pressure, in 10^2 Pascal, version 1.0.0
+FACTOR(HPA, hpa, uint16_t, "pressure", 7, "Atmospheric pressure", "hpa", "hpa",
+       hpa_icon, format_hpa, SAMPLED)
+#endif
+
+#ifdef SENSE_ALTITUDE
+// Altitude of device, meters above (below) sea level, version 1.0.0
+FACTOR(ELEVATION, elevation, float, "altitude", 8, "Altitude", "m", "m",
+       elevation_icon, display_altitude, SAMPLED)
+#endif
+
+// Status code from the air sensor: 0=normal, 1=warmup, 2=startup, 3=invalid, version 1.0.0
+FACTOR(AIR_SENSOR_STATUS, air_sensor_status, uint8_t, "airsensor", 9, "Air sensor status", "", "",
+       nullptr, nullptr, NOT_SAMPLED)
+
+#ifdef SENSE_AIR_QUALITY_INDEX
+// AQI: 1-Excellent, 2-Good, 3-Moderate, 4-Poor, 5-Unhealthy, version 1.0.0
+FACTOR(AQI, aqi, uint8_t, "airquality", 10, "Air quality index", "", "",
+       aqi_icon, format_aqi, SAMPLED_AIR)
+#endif
+
+#ifdef SENSE_TVOC
+// Total volatile organic compounds, 0–65000, ppb, version 1.0.0
+FACTOR(TVOC, tvoc, uint16_t, "tvoc", 11, "Concentration of total volatile organic compounds",
+       "ppb", "ppb", aqi_icon, format_tvoc, SAMPLED_AIR)
+#endif
+
+#ifdef SENSE_CO2
+// CO2, 400–65000, ppm, version 1.0.0
+// Five levels: Excellent(400 - 600), Good(600 - 800), Moderate(800 - 1000),
+//              Poor(1000 - 1500), Unhealthy(> 1500)
+FACTOR(ECO2, eco2, uint16_t, "co2", 12, "Carbon dioxide equivalent concentration", "ppm", "ppm",
+       co2_icon, format_eco2, SAMPLED_AIR)
+#endif
+
+#ifdef SENSE_MOTION
+// Passive motion sensor.  Unit: no movement / movement, version 1.0.0
+FACTOR(MOTION, motion_detected, bool, "motion", 13, "Motion detected", "", "",
+       motion_icon, format_motion_detected, NOT_SAMPLED)
+// The percentage of the monitoring window during which the PIR saw motion, version 1.2.0
+FACTOR_FIELD(MOTION, occupancy, float, "occupancy", 14, "Time with motion", "%", "%",
+             motion_icon, display_occupancy, NOT_SAMPLED)
+// The number of times motion started in the monitoring window, version 1.2.0
+FACTOR_FIELD(MOTION, motion_onsets, unsigned, "motiononsets", 15, "Motion onsets", "", "",
+             motion_icon, format_motion_onsets, NOT_SAMPLED)
+#endif
+
+#ifdef SENSE_NOISE
+// A-weighted equivalent continuous sound level over the monitoring window, dB(A).  See
+// sound_level.h; the calibration is nominal.  Version 1.1.0, replacing version 1.0.0's "noise", the
+// peak ADC reading, which is no longer reported.
+FACTOR(NOISE, noise, float, "noisedba", 16, "A-weighted sound level", "dBA", "dB(A)",
+       noise_icon, display_noise, NOT_SAMPLED)
+#endif
+
+#undef FACTOR
+#undef FACTOR_FIELD
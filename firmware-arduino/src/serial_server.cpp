@@ -5,26 +5,22 @@
 #ifdef SNAPPY_SERIAL_INPUT
 
 #include "config.h"
+#include "event_timer.h"
 
 static String line;
-static TimerHandle_t serial_timer;
+static EventTimer* serial_timer;
 
 void serial_server_init() {
-  serial_timer = xTimerCreate("serial",
-                              pdMS_TO_TICKS(serial_server_poll_interval_ms()),
-                              pdTRUE,
-                              nullptr,
-                              [](TimerHandle_t t) {
-                                put_main_event(EvCode::SERIAL_SERVER_POLL);
-                              });
+  serial_timer = event_timer_create("serial", EvCode::SERIAL_SERVER_POLL, 0, 50);
 }
 
 void serial_server_start() {
-  xTimerStart(serial_timer, portMAX_DELAY);
+  unsigned interval = serial_server_poll_interval_ms();
+  event_timer_start(serial_timer, interval, interval);
 }
 
 void serial_server_stop() {
-  xTimerStop(serial_timer, portMAX_DELAY);
+  event_timer_stop(serial_timer);
 }
 
 void serial_server_poll() {
@@ -4,41 +4,43 @@
 
 #include "config.h"
 #include "device.h"
+#include "event_timer.h"
+#include "metrics.h"
 #include "sensor.h"
 #include "util.h"
 
 // -1 means the splash screen; values 0..whatever refer to the entries in the SnappyMetaData array.
 static int next_view = -1;
-static SnappySenseData* current_data;
-static SnappySenseData* next_data;
-static String* current_message;
-static TimerHandle_t slideshow_timer;
+// The readings shown in the current loop, taken at the splash.  They are read in place, see
+// sensor_snapshot().
+static SensorSnapshot current;
+static bool have_current;
+static const char* current_message;
+static EventTimer* slideshow_timer;
 static bool is_running;
 
+// Rendering time is dominated by the display flush.
+static Histogram render_time("slideshow.render_us");
+
 static void update_view();
 
-// The timer is reloaded after every display update rather than running constantly.
-// The main thing this does is to ensure that display updates are never squished
-// together - they are spaced at least as far apart as the update interval setting
-// says they should be.
+// The timer is periodic while the slideshow is running, rather than reloaded after every display
+// update, so that it does not wake the timer scheduler for every slide.  A message restarts it, so
+// that the message is shown at once and display updates are still never squished together - they
+// are spaced at least as far apart as the update interval setting says they should be.
 
 void slideshow_init() {
-  slideshow_timer = xTimerCreate("slideshow",
-                                 1,       // Irrelevant; this is changed every time we reset the timer
-                                 pdFALSE,
-                                 nullptr,
-                                 [](TimerHandle_t t) {
-                                   put_main_event(EvCode::SLIDESHOW_WORK);
-                                 });
+  slideshow_timer = event_timer_create("slideshow", EvCode::SLIDESHOW_WORK, 0, 100);
 }
 
-static void advance() {
-  xTimerChangePeriod(slideshow_timer, pdMS_TO_TICKS(slideshow_update_interval_s() * 1000), portMAX_DELAY);
+static void restart_timer() {
+  unsigned interval_ms = slideshow_update_interval_s() * 1000;
+  event_timer_start(slideshow_timer, 0, interval_ms);
 }
 
 void slideshow_start() {
   if (!is_running) {
-    put_main_event(EvCode::SLIDESHOW_WORK);
+    restart_timer();
     is_running = true;
   }
 }
@@ -46,16 +48,15 @@ void slideshow_start() {
 void slideshow_stop() {
   if (is_running) {
     is_running = false;
-    xTimerStop(slideshow_timer, portMAX_DELAY);
+    event_timer_stop(slideshow_timer);
   }
 }
 
-void slideshow_show_message_once(String* msg) {
+void slideshow_show_message_once(const char* msg) {
   assert(msg != nullptr);
-  delete current_message;  // Overwrite another one that wasn't shown yet (for now)
-  current_message = msg;
+  current_message = msg;  // Overwrite another one that wasn't shown yet (for now)
   if (is_running) {
-    put_main_event(EvCode::SLIDESHOW_WORK);
+    restart_timer();
   }
 }
 
@@ -63,28 +64,21 @@ void slideshow_reset() {
   next_view = -1;
 }
 
-void slideshow_new_data(SnappySenseData* new_data) {
-  assert(new_data != nullptr);
-  delete next_data;
-  next_data = new_data;
-  //log("Got data\n");
-  //log("%s\n", format_readings_as_json(*new_data).c_str());
-}
-
 void slideshow_next() {
   if (is_running) {
-    update_view();
-    advance();
+    {
+      MetricTimer t(render_time);
+      update_view();
+    }
   }
 }
 
 static void update_view() {
 again:
   if (current_message != nullptr) {
-    // Message pending.  Do not advance the pointer; deleting the message will
+    // Message pending.  Do not advance the pointer; clearing the message will
     // allow us to advance next time around
-    render_text(current_message->c_str());
-    delete current_message;
+    render_text(current_message);
     current_message = nullptr;
     return;
   }
@@ -92,16 +86,12 @@ again:
   if (next_view == -1) {
     // Display the splash, slot in new data, set error flags if needed
     show_splash();
-    if (next_data != nullptr) {
-      delete current_data;
-      current_data = next_data;
-      next_data = nullptr;
-    }
+    have_current = sensor_snapshot(&current);
     next_view++;
     return;
   }
 
-  if (current_data == nullptr) {
+  if (!have_current) {
     // No data, display a message and wrap around
     render_text("Warming up");
     next_view = -1;
@@ -120,8 +110,8 @@ again:
     goto again;
   }
 
-  if (snappy_metadata[next_view].flag_offset > 0 &&
-      !*reinterpret_cast<const bool*>(reinterpret_cast<const char*>(current_data) + snappy_metadata[next_view].flag_offset)) {
+  const SnappySenseData* data = current.data;
+  if (!snappy_metadata[next_view].is_valid(*data)) {
     // Field has invalid data, try the next one
     next_view++;
     goto again;
@@ -129,7 +119,12 @@ again:
 
   // Valid field, display it and advance the pointer
   char buf[32];
-  snappy_metadata[next_view].display(*current_data, buf, buf+sizeof(buf));
+  snappy_metadata[next_view].display(*data, buf, buf+sizeof(buf));
+  if (!sensor_snapshot_valid(current)) {
+    // The readings were replaced while we were looking at them; use the new ones.
+    have_current = sensor_snapshot(&current);
+    goto again;
+  }
   render_oled_view(snappy_metadata[next_view].icon, buf, snappy_metadata[next_view].display_unit);
   next_view++;
 }
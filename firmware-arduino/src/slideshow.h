@@ -21,11 +21,8 @@ void slideshow_stop();
 // Advance the display, showing whatever's next
 void slideshow_next();
 
-// Upload new measurement data for the slideshow to use
-void slideshow_new_data(SnappySenseData* new_data);
-
 // Set a message to be displayed immediately, for the normal period, and then erased.
-// If the slideshow is not running then this does nothing.
-void slideshow_show_message_once(String* msg);
+// If the slideshow is not running then this does nothing.  `msg` must have static extent.
+void slideshow_show_message_once(const char* msg);
 
 #endif // !slideshow_h_included
@@ -0,0 +1,92 @@
+// A-weighted sound level meter, see sound_level.h.
+
+#include "sound_level.h"
+
+#include <math.h>
+#include <string.h>
+
+// Filter coefficients in Q30; FB1 and FB2 are the feedback coefficients a1 and a2.  The first two
+// stages have their zeros at z=1 (numerator 1 -2 1) and the last at z=-1 (numerator 1 2 1) with
+// the gain folded in, so only the last stage multiplies in the numerator.  Derivation, with fs = 20kHz and the standard pole frequencies
+// 20.599Hz (double), 107.65Hz, 737.86Hz and 12194Hz (double):
+//
+//   p = (1 - pi f / fs) / (1 + pi f / fs) for each pole,
+//   a1 = -(p + p'), a2 = p p',
+//   gain = 1 / |H(e^(2 pi i 1kHz/fs))| for the product of the three stages.
+
+static constexpr int32_t FB1[3] = { -2133631318, -1888725377, 674315541 };
+static constexpr int32_t FB2[3] = { 1059934171, 822401617, 105868431 };
+static constexpr int32_t GAIN = 509383671;
+
+static constexpr int Q = 12;             // Fraction bits of samples
+static constexpr int QC = 30;            // Fraction bits of coefficients
+static constexpr int DC_SHIFT = 10;      // DC tracker time constant, 2^10 samples = 51ms
+static constexpr size_t CHUNK = 1024;    // Samples per partial sum of squares, see add()
+
+void SoundLevel::reset() {
+  dc = -1;
+  memset(stage, 0, sizeof(stage));
+  sum_squares = 0;
+  num_samples = 0;
+}
+
+// Subtract the feedback terms of stage `s` from the feedforward sum and round back to Q12.
+static inline int32_t feedback(int s, int64_t acc, int32_t y1, int32_t y2) {
+  acc -= int64_t(FB1[s]) * y1;
+  acc -= int64_t(FB2[s]) * y2;
+  return int32_t((acc + (int64_t(1) << (QC - 1))) >> QC);
+}
+
+void SoundLevel::add(const uint16_t* counts, size_t n) {
+  if (n == 0) {
+    return;
+  }
+  if (dc < 0) {
+    // Start at the signal's level rather than wait for the tracker to climb from zero.
+    dc = int32_t(counts[0]) << Q;
+  }
+  Biquad s0 = stage[0], s1 = stage[1], s2 = stage[2];
+  int32_t level = dc;
+  uint64_t total = 0;
+  while (n > 0) {
+    // A weighted sample is below 2^24 so its square is below 2^48, and CHUNK of them can be
+    // summed in 64 bits before dropping to Q12.
+    size_t m = n < CHUNK ? n : CHUNK;
+    uint64_t chunk = 0;
+    for ( size_t i = 0; i < m; i++ ) {
+      int32_t x = int32_t(counts[i]) << Q;
+      level += (x - level) >> DC_SHIFT;
+      x -= level;
+
+      int32_t y = feedback(0, int64_t(x - 2*s0.x1 + s0.x2) << QC, s0.y1, s0.y2);
+      s0.x2 = s0.x1; s0.x1 = x; s0.y2 = s0.y1; s0.y1 = y;
+
+      x = y;
+      y = feedback(1, int64_t(x - 2*s1.x1 + s1.x2) << QC, s1.y1, s1.y2);
+      s1.x2 = s1.x1; s1.x1 = x; s1.y2 = s1.y1; s1.y1 = y;
+
+      x = y;
+      y = feedback(2, int64_t(GAIN) * (x + 2*s2.x1 + s2.x2), s2.y1, s2.y2);
+      s2.x2 = s2.x1; s2.x1 = x; s2.y2 = s2.y1; s2.y1 = y;
+
+      chunk += uint64_t(int64_t(y) * y);
+    }
+    total += chunk >> Q;
+    counts += m;
+    n -= m;
+    num_samples += m;
+  }
+  stage[0] = s0; stage[1] = s1; stage[2] = s2;
+  dc = level;
+  sum_squares += total;
+}
+
+float SoundLevel::level() const {
+  if (num_samples == 0 || sum_squares == 0) {
+    return 0;
+  }
+  // sum_squares is in Q12 after the chunk shift and the samples were Q12, so the mean square in
+  // counts^2 is sum_squares / 2^12 / num_samples.
+  float mean_square = float(sum_squares) / float(1 << Q) / float(num_samples);
+  return 10 * log10f(mean_square);
+}
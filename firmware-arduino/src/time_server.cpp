@@ -8,7 +8,9 @@
 #include <NTPClient.h>
 #include <WiFiUdp.h>
 #include "config.h"
+#include "event_timer.h"
 #include "log.h"
+#include "net_task.h"
 
 struct TimeServerState {
   TimeServerState() : timeClient(ntpUDP) {}
@@ -17,8 +19,14 @@ struct TimeServerState {
   bool first_time = true;
 };
 
+// The state is used by the network task while an update is pending, and is deleted on the network
+// task as well, after any pending update.
 static TimeServerState* timeserver_state;
-static TimerHandle_t timeserver_timer;
+static EventTimer* timeserver_timer;
+static bool update_pending;
+// Number of COMM_NTP_DONE messages still to arrive for updates that were pending when ntp_stop()
+// was called.
+static unsigned stale_updates;
 
 // Set to true if we have received a time from the time server and have set the
 // system clock.
@@ -30,7 +38,7 @@ static bool time_configured;
 static time_t time_adjust;
 
 static void put_delayed_retry() {
-  xTimerStart(timeserver_timer, portMAX_DELAY);
+  event_timer_start(timeserver_timer, ntp_retry_s() * 1000);
 }
 
 static void configure_clock(time_t t) {
@@ -42,27 +50,28 @@ static void configure_clock(time_t t) {
   log("Time adjustment %u\n", (unsigned)time_adjust);
 }
 
-static bool maybe_configure_time() {
-  if (!timeserver_state->first_time) {
+// Runs on the network task, since update() blocks.  Returns the time, or 0 on failure.
+static uint32_t update_job(void* arg) {
+  TimeServerState* state = static_cast<TimeServerState*>(arg);
+  if (!state->first_time) {
     // FIXME: this function just discards the error code, no way to check
-    timeserver_state->timeClient.begin();
+    state->timeClient.begin();
   }
   put_main_event(EvCode::COMM_ACTIVITY);
-  // FIXME: update() blocks, this is not what we want.
-  if (timeserver_state->timeClient.update()) {
-    time_t t = timeserver_state->timeClient.getEpochTime();
-    // Bad if it is not between 28 March 2023 and 1 January 2038.
-    // Usually this is a spurious error so we will retry later.
-    if (t < 1680000000 || t > 2145916800) {
-      log("Time configuration error, will retry later\n");
-      return false;
-    }
-    log("Time configured\n");
-    configure_clock(t);
-  } else {
-    put_delayed_retry();
+  if (state->timeClient.update()) {
+    return state->timeClient.getEpochTime();
   }
-  return true;
+  return 0;
+}
+
+static uint32_t delete_job(void* arg) {
+  delete static_cast<TimeServerState*>(arg);
+  return 0;
+}
+
+static void start_update() {
+  update_pending = true;
+  net_task_run(update_job, timeserver_state, EvCode::COMM_NTP_DONE);
 }
 
 time_t time_adjustment() {
@@ -74,8 +83,7 @@ time_t time_adjustment() {
 
 void ntp_init() {
   // We retry every 10s through the comm window if we can't get a connection.
-  timeserver_timer = xTimerCreate("time server", pdMS_TO_TICKS(ntp_retry_s() * 1000), pdFALSE, nullptr,
-                                  [](TimerHandle_t){ put_main_event(EvCode::COMM_NTP_WORK); });
+  timeserver_timer = event_timer_create("time server", EvCode::COMM_NTP_WORK, 0, 1000);
 }
 
 bool ntp_have_work() {
@@ -95,10 +103,7 @@ void ntp_start() {
   log("Attempting to configure time\n");
   assert(timeserver_state == nullptr);
   timeserver_state = new TimeServerState;
-  if (!maybe_configure_time()) {
-    // We will retry during the next comm window
-    ntp_stop();
-  }
+  start_update();
 }
 
 // Called from the main loop in response to COMM_NTP_WORK messages.
@@ -110,17 +115,48 @@ void ntp_work() {
     // Comm window was closed already, this is just a spurious callback
     return;
   }
-  if (!maybe_configure_time()) {
+  if (!update_pending) {
+    start_update();
+  }
+}
+
+// Called from the main loop in response to COMM_NTP_DONE messages.
+void ntp_update_done(uint32_t t) {
+  if (stale_updates > 0) {
+    stale_updates--;
+    return;
+  }
+  update_pending = false;
+  if (time_configured || timeserver_state == nullptr) {
+    return;
+  }
+  if (t == 0) {
+    put_delayed_retry();
+    return;
+  }
+  // Bad if it is not between 28 March 2023 and 1 January 2038.
+  // Usually this is a spurious error so we will retry later.
+  if (t < 1680000000 || t > 2145916800) {
+    log("Time configuration error, will retry later\n");
     // We will retry during the next comm window
     ntp_stop();
+    return;
   }
+  log("Time configured\n");
+  configure_clock(t);
 }
 
 // Stop trying to connect to the time server, if that's still going on.
 void ntp_stop() {
-  delete timeserver_state;
-  timeserver_state = nullptr;
-  xTimerStop(timeserver_timer, portMAX_DELAY);
+  if (timeserver_state != nullptr) {
+    net_task_run(delete_job, timeserver_state, EvCode::NONE);
+    timeserver_state = nullptr;
+  }
+  if (update_pending) {
+    stale_updates++;
+    update_pending = false;
+  }
+  event_timer_stop(timeserver_timer);
 }
 
 #endif // SNAPPY_NTP
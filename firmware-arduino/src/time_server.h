@@ -14,13 +14,17 @@ void ntp_init();
 bool ntp_have_work();
 
 // WIFI must be up.  Try to connect to the time server, if the time has not been set
-// already.  This will result in COMM_NTP_WORK messages being posted on the
-// main queue every so often if retries are required.
+// already.  The request runs on the network task and completes with a COMM_NTP_DONE message.
+// This will result in COMM_NTP_WORK messages being posted on the main queue every so often
+// if retries are required.
 void ntp_start();
 
 // Called from the main loop in response to COMM_NTP_WORK messages.
 void ntp_work();
 
+// Called from the main loop in response to COMM_NTP_DONE messages, with the event payload.
+void ntp_update_done(uint32_t t);
+
 // Stop trying to connect to the time server, if that's still going on.  Can be called
 // without start having been called first.
 void ntp_stop();
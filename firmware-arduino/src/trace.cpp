@@ -0,0 +1,50 @@
+// Event trace
+
+#include "trace.h"
+
+#ifdef SNAPPY_TRACE
+
+#include <atomic>
+
+struct TraceRecord {
+  uint32_t start_us;
+  uint32_t duration_us;
+  uint8_t code;
+  TraceSpan span;
+  uint16_t depth;
+};
+
+// The main task and the network task both write to the ring, so a slot is claimed with an atomic
+// increment of `trace_next`; the slot is then written without synchronization.  A dump that races
+// with a writer may therefore print one torn record, which is good enough for a diagnostic.
+static TraceRecord trace_ring[TRACE_ENTRIES];
+static std::atomic<uint32_t> trace_next;
+
+TraceScope::~TraceScope() {
+  uint32_t now = micros();
+  TraceRecord* r = &trace_ring[trace_next.fetch_add(1, std::memory_order_relaxed) % TRACE_ENTRIES];
+  *r = TraceRecord { start, now - start, code, span, depth };
+}
+
+void trace_dump(Stream& out) {
+  uint32_t next = trace_next.load(std::memory_order_relaxed);
+  uint32_t count = next < TRACE_ENTRIES ? next : TRACE_ENTRIES;
+  out.printf("trace: begin 1 arduino %u %u\n", count, next - count);
+  for ( uint32_t i = next - count; i != next; i++ ) {
+    TraceRecord r = trace_ring[i % TRACE_ENTRIES];
+    uint8_t bytes[12] = {
+      uint8_t(r.start_us), uint8_t(r.start_us >> 8), uint8_t(r.start_us >> 16), uint8_t(r.start_us >> 24),
+      uint8_t(r.duration_us), uint8_t(r.duration_us >> 8), uint8_t(r.duration_us >> 16),
+      uint8_t(r.duration_us >> 24),
+      r.code, uint8_t(r.span), uint8_t(r.depth), uint8_t(r.depth >> 8)
+    };
+    char buf[sizeof(bytes)*2+1];
+    for ( size_t j = 0; j < sizeof(bytes); j++ ) {
+      sprintf(buf + j*2, "%02x", bytes[j]);
+    }
+    out.printf("trace: %s\n", buf);
+  }
+  out.println("trace: end");
+}
+
+#endif // SNAPPY_TRACE
@@ -0,0 +1,62 @@
+// Event trace: a record of where the time goes in the main loop and the network task.
+//
+// Every event that the main loop dispatches, and every job that the network task runs, leaves a
+// record of its start time, duration and kind in a ring in RAM, along with the number of events
+// that were still queued when it started.  The ring is always on: recording is a few stores into
+// the ring and two reads of the microsecond clock.  The ring holds the last TRACE_ENTRIES records.
+//
+// `trace_dump()` prints the ring as text that survives the serial monitor, and
+// util/trace2chrome converts that to the Chrome trace format (about://tracing, Perfetto), with one
+// track per task:
+//
+//   trace: begin 1 arduino <count> <dropped>
+//   trace: <24 hex digits per record>
+//   ...
+//   trace: end
+//
+// A record is 12 bytes little-endian: start_us u32, duration_us u32, code u8, span u8, depth u16.
+// The code's meaning depends on the span kind, see TraceSpan.
+//
+// Without SNAPPY_TRACE, the interface remains but does nothing, as for metrics.h.
+
+#ifndef trace_h_included
+#define trace_h_included
+
+#include "main.h"
+
+// The kind of a traced span.  Do not reorder, the converter knows these values.
+enum class TraceSpan : uint8_t {
+  EVENT,      // Main task: handling an event, code is the EvCode
+  NET_JOB,    // Network task: running a job, code is its `done` EvCode
+  MQTT_JOB,   // Network task: running an mqtt job, code is the MqttJob (see mqtt.cpp)
+};
+
+#ifdef SNAPPY_TRACE
+
+static constexpr unsigned TRACE_ENTRIES = 1024;  // 12KB; must be a power of 2
+
+// Records the lifetime of the object as a span in the trace.
+class TraceScope {
+  uint32_t start;
+  uint16_t depth;
+  uint8_t code;
+  TraceSpan span;
+public:
+  TraceScope(TraceSpan span, uint8_t code, unsigned depth)
+    : start(micros()), depth(depth > 0xFFFF ? 0xFFFF : depth), code(code), span(span) {}
+  ~TraceScope();
+};
+
+// Print the trace records, oldest first, in the format above.
+void trace_dump(Stream& out);
+
+#else
+
+class TraceScope {
+public:
+  TraceScope(TraceSpan, uint8_t, unsigned) {}
+};
+
+#endif // SNAPPY_TRACE
+
+#endif // !trace_h_included
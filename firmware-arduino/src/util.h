@@ -5,6 +5,8 @@
 
 #include "main.h"
 #include "log.h"
+#include <atomic>
+#include <new>
 
 // Return the nth blank or quote delimited word from the line, or "" if there is no such word.
 // If a word starts with '"' then it is assumed to be quoted, and we scan until the closing '"'
@@ -100,4 +102,135 @@ public:
   }
 };
 
+// Fixed-capacity queue of up to N T, in static storage.  Not thread-safe.
+
+template<typename T, size_t N>
+class Ring {
+  T slots[N];
+  size_t first = 0;
+  size_t len = 0;
+
+public:
+  bool is_empty() const {
+    return len == 0;
+  }
+
+  bool is_full() const {
+    return len == N;
+  }
+
+  size_t length() const {
+    return len;
+  }
+
+  void add_back(const T& value) {
+    if (len == N) {
+      panic("Full ring");
+    }
+    slots[(first + len) % N] = value;
+    len++;
+  }
+
+  T pop_front() {
+    if (len == 0) {
+      panic("Empty ring");
+    }
+    T value = slots[first];
+    first = (first + 1) % N;
+    len--;
+    return value;
+  }
+};
+
+// Fixed-capacity pool of T.  Objects are constructed in place in static storage, so allocation
+// never touches the heap.  alloc() returns nullptr if all N slots are in use, and counts the
+// failure.  Not thread-safe.
+
+template<typename T, size_t N>
+class Pool {
+  alignas(T) uint8_t storage[N][sizeof(T)];
+  bool in_use[N] = {};
+  unsigned exhausted = 0;
+
+public:
+  template<typename... Args>
+  T* alloc(Args&&... args) {
+    for (size_t i = 0; i < N; i++) {
+      if (!in_use[i]) {
+        in_use[i] = true;
+        return new (storage[i]) T(std::forward<Args>(args)...);
+      }
+    }
+    exhausted++;
+    return nullptr;
+  }
+
+  // `p` may be nullptr, otherwise it must have been returned by alloc() on this pool.
+  void release(T* p) {
+    if (p == nullptr) {
+      return;
+    }
+    size_t i = (reinterpret_cast<uint8_t*>(p) - storage[0]) / sizeof(T);
+    if (i >= N || !in_use[i]) {
+      panic("Bad pool release");
+    }
+    p->~T();
+    in_use[i] = false;
+  }
+
+  unsigned exhausted_count() const {
+    return exhausted;
+  }
+};
+
+// Lock-free ring buffer for one producer task and one consumer task, holding up to N elements.
+// N must be a power of 2.  The indices run freely and are reduced modulo N on access.
+//
+// The atomics use the default sequentially consistent ordering, which is what makes the
+// `was_empty` result of push() reliable: if push() reports that the ring was not empty, then a
+// consumer that subsequently finds the ring empty is guaranteed to see the new element.  This is
+// used to avoid redundant wakeups of the consumer.
+
+template<typename T, size_t N>
+class SpscRing {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "Ring size must be a power of 2");
+
+  T slots[N];
+  std::atomic<size_t> head{0};  // Next element to pop; written only by the consumer
+  std::atomic<size_t> tail{0};  // Next slot to push into; written only by the producer
+
+public:
+  // Producer only.  Returns false if the ring is full.  Otherwise, if `was_empty` is not
+  // nullptr, sets it to true iff the consumer had taken every earlier element, ie, it may need
+  // to be woken up to see this one.
+  bool push(const T& value, bool* was_empty = nullptr) {
+    size_t t = tail.load();
+    if (t - head.load() == N) {
+      return false;
+    }
+    slots[t & (N - 1)] = value;
+    tail.store(t + 1);
+    if (was_empty != nullptr) {
+      *was_empty = head.load() == t;
+    }
+    return true;
+  }
+
+  // Consumer only.  Returns false if the ring is empty.
+  bool pop(T* value) {
+    size_t h = head.load();
+    if (h == tail.load()) {
+      return false;
+    }
+    *value = slots[h & (N - 1)];
+    head.store(h + 1);
+    return true;
+  }
+
+  // Consumer only.
+  bool is_empty() const {
+    return head.load() == tail.load();
+  }
+};
+
 #endif // !util_h_included
@@ -7,7 +7,9 @@
 #include "command.h"
 #include "config.h"
 #include "device.h"
+#include "event_timer.h"
 #include "log.h"
+#include "metrics.h"
 #include "network_wifi.h"
 #include "util.h"
 
@@ -28,7 +30,7 @@ enum class RequestParseState {
 // this packages a WiFiClient with input parsing state and some bookkeeping.
 
 struct WebRequestHandler {
-  WebRequestHandler(WiFiClient&& client) : client(std::move(client)) {}
+  WebRequestHandler(WiFiClient&& client) : client(std::move(client)), start_us(micros()) {}
   ~WebRequestHandler() {}
 
   // The WiFi client for this web client
@@ -49,28 +51,36 @@ struct WebRequestHandler {
   // set to true once the request has been dispatched to the main thread and we
   // should no longer be listening
   bool complete = false;
+
+  // When the connection was accepted
+  uint32_t start_us;
 };
 
 static WebRequestHandler* request_handlers;
 static WiFiServer* web_server;
-static TimerHandle_t web_timer;
+static EventTimer* web_timer;
+
+// Time from accepting a connection until the response has been produced.
+static Histogram request_time("web.request_us");
+static Counter requests("web.requests");
+static Counter requests_failed("web.failed");
+static Counter requests_dropped("web.dropped");
 
 void web_server_init(int port) {
   if (web_server) {
     panic("Multiple web servers");
   }
-  web_timer = xTimerCreate("web", pdMS_TO_TICKS(1000), pdTRUE, nullptr,
-                           [](TimerHandle_t){ put_main_event(EvCode::WEB_SERVER_POLL); });
+  web_timer = event_timer_create("web", EvCode::WEB_SERVER_POLL, 0, 100);
   web_server = new WiFiServer(port);
   web_server->begin();
 }
 
 void web_server_start() {
-  xTimerStart(web_timer, portMAX_DELAY);
+  event_timer_start(web_timer, 1000, 1000);
 }
 
 void web_server_stop() {
-  xTimerStop(web_timer, portMAX_DELAY);
+  event_timer_stop(web_timer);
 }
 
 // Parse the input until it is terminated.  If the input was complete, invoke the processing
@@ -134,10 +144,20 @@ static void poll(WebRequestHandler* rh) {
 request_completed:
   log("Web: finished request, %d\n", (int)rh->state);
   rh->complete = true;
+  WebRequest* r = alloc_web_request(rh->request, rh->client);
+  if (r == nullptr) {
+    // Out of request slots, drop the client.
+    log("Web: request pool exhausted\n");
+    requests_dropped.inc();
+    rh->dead = true;
+    return;
+  }
   if (rh->state == RequestParseState::CRLFCRLF) {
-    put_main_event(EvCode::WEB_REQUEST, new WebRequest(rh->request, rh->client));
+    requests.inc();
+    put_main_event(EvCode::WEB_REQUEST, r);
   } else {
-    put_main_event(EvCode::WEB_REQUEST_FAILED, new WebRequest(rh->request, rh->client));
+    requests_failed.inc();
+    put_main_event(EvCode::WEB_REQUEST_FAILED, r);
   }
 }
 
@@ -199,11 +219,12 @@ void web_server_request_completed(WebRequest* r) {
   log("Reaping client\n");
   for ( WebRequestHandler* rh = request_handlers; rh != nullptr; rh = rh->next ) {
     if (&rh->client == &r->client) {
+      request_time.record_us(micros() - rh->start_us);
       rh->dead = true;
       break;
     }
   }
-  delete r;
+  free_web_request(r);
 }
 
 #endif // SNAPPY_WEB_SERVER
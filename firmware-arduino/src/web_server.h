@@ -23,7 +23,7 @@ void web_server_start();
 void web_server_stop();
 
 // The request `r` was sent from the server to the main thread for processing.  This is a callback
-// from the main thread that `r` has been processed and can be deleted.
+// from the main thread that `r` has been processed and can be returned to its pool.
 void web_server_request_completed(WebRequest* r);
 
 // Perform web polling work.
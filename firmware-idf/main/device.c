@@ -10,21 +10,29 @@
 #include "device.h"
 
 #include <stdarg.h>
+#include <stdatomic.h>
+#include "esp_cpu.h"
 #include "driver/gpio.h"
 #include "driver/i2c.h"
 #include "esp_sleep.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "nvs_flash.h"
 
 #include "dfrobot_sen0487.h"
 #include "dfrobot_sen0500.h"
 #include "dfrobot_sen0514.h"
 #include "ssd1306.h"
+#include "esp32_i2c.h"
 #include "esp32_ledc_piezo.h"
 
 #ifdef SNAPPY_HARDWARE_1_1_0
 # define POWER_PIN 26		/* GPIO26 aka A0 aka DAC2: peripheral power */
 # define BTN1_PIN 25		/* GPIO25 aka A1 aka DAC1: BTN1 aka WAKE */
 # define PIR_PIN 34		/* GPIO34 aka A2: PIR */
-# define MIC_PIN 4		/* GPIO4 aka A5: MEMS ADC */
+# define MIC_PIN 39		/* GPIO39 aka A3: MEMS ADC */
+# define SEN0514_INT_PIN 36	/* GPIO36 aka A4: Not connected on 1.1.0 and 1.2.0, see main.h */
+# define MIC_ADC1_CHANNEL 3	/* GPIO39 is ADC1 channel 3, which can be driven by DMA */
 # define I2C1_BUS 0		/* Everything is on I2C bus 0 */
 # define I2C_SCL_PIN 22		/* GPIO22: Standard I2C pin */
 # define I2C_SDA_PIN 23		/* GPIO23: Standard I2C pin */
@@ -36,12 +44,16 @@
 
 #define PERIPHERAL_POWERUP_MS 1000 /* Wait time, maybe too much */
 #define I2C_STABILIZE_MS      1000 /* Wait time, maybe too much */
+#define I2C_CLOCK_HZ          100000 /* Standard mode */
+
+#define NVS_NAMESPACE "snappysense"
 
 #ifdef SNAPPY_I2C_SSD1306
 # define SSD1306_BUS I2C1_BUS
 # define SSD1306_ADDRESS 0x3C /* Hardwired */
 bool have_ssd1306;
 SSD1306_Device_t ssd1306; /* If non-null then we have a device */
+static uint8_t ssd1306_flush_buffer[SSD1306_FLUSH_BUFFER_SIZE(SSD1306_WIDTH, SSD1306_HEIGHT)];
 #endif
 
 #ifdef SNAPPY_I2C_SEN0514
@@ -82,16 +94,89 @@ void disable_regulator() {
   regulator_on = false;
 }
 
+/* Pin interrupts record edges in a single-producer single-consumer ring that the main task drains
+   in batches.  The ISR posts EV_GPIO_EDGES only when the ring goes from empty to nonempty, so a
+   chattering input cannot flood the main queue.  If the ring is full the edge is dropped and
+   counted.
+
+   The button is debounced here: an edge that does not change the level, or that comes within
+   BUTTON_DEBOUNCE_US of the previous accepted edge, is ignored.  The debounce interval is measured
+   with esp_timer because the cycle counter runs at the current CPU frequency, which is scaled
+   dynamically.
+
+   The PIR is latched: after one edge has been recorded, further PIR edges are ignored until the
+   main task has taken that edge out of the ring.
+
+   The air sensor needs no such care, as its INTn stays high until the main task reads the data. */
+
+#define GPIO_EDGE_RING_SIZE 32  /* Must be a power of 2 */
+#define BUTTON_DEBOUNCE_US 5000
+
+static gpio_edge_t gpio_edge_ring[GPIO_EDGE_RING_SIZE];
+static atomic_uint gpio_edge_head;   /* Next edge to take; written by the consumer only */
+static atomic_uint gpio_edge_tail;   /* Next slot to fill; written by the ISR only */
+static atomic_uint gpio_edge_overflow_count;
+static atomic_bool pir_latched;
+static int button_level;
+static int64_t button_edge_us;
+
+static void IRAM_ATTR record_gpio_edge(edge_source_t source, int level) {
+  unsigned tail = atomic_load(&gpio_edge_tail);
+  if (tail - atomic_load(&gpio_edge_head) == GPIO_EDGE_RING_SIZE) {
+    atomic_fetch_add(&gpio_edge_overflow_count, 1);
+    return;
+  }
+  gpio_edge_t* e = &gpio_edge_ring[tail & (GPIO_EDGE_RING_SIZE - 1)];
+  e->source = source;
+  e->level = level;
+  e->cycles = esp_cpu_get_cycle_count();
+  atomic_store(&gpio_edge_tail, tail + 1);
+  if (atomic_load(&gpio_edge_head) == tail) {
+    put_main_event_from_isr(EV_GPIO_EDGES);
+  }
+}
+
 static void IRAM_ATTR gpio_isr_handler(void* arg) {
   uint32_t gpio_num = (uint32_t) arg;
   switch (gpio_num) {
-  case BTN1_PIN:
-    put_main_event_from_isr(gpio_get_level(BTN1_PIN) ? EV_BUTTON_DOWN : EV_BUTTON_UP);
+  case BTN1_PIN: {
+    int level = gpio_get_level(BTN1_PIN);
+    int64_t now = esp_timer_get_time();
+    if (level != button_level && now - button_edge_us >= BUTTON_DEBOUNCE_US) {
+      button_level = level;
+      button_edge_us = now;
+      record_gpio_edge(EDGE_SOURCE_BUTTON, level);
+    }
     break;
+  }
   case PIR_PIN:
-    put_main_event_from_isr(EV_MOTION_DETECTED);
+    if (!atomic_exchange(&pir_latched, true)) {
+      record_gpio_edge(EDGE_SOURCE_PIR, 1);
+    }
+    break;
+#ifdef SNAPPY_GPIO_SEN0514_INT
+  case SEN0514_INT_PIN:
+    record_gpio_edge(EDGE_SOURCE_SEN0514, 1);
     break;
+#endif
+  }
+}
+
+bool next_gpio_edge(gpio_edge_t* edge) {
+  unsigned head = atomic_load(&gpio_edge_head);
+  if (head == atomic_load(&gpio_edge_tail)) {
+    return false;
+  }
+  *edge = gpio_edge_ring[head & (GPIO_EDGE_RING_SIZE - 1)];
+  atomic_store(&gpio_edge_head, head + 1);
+  if (edge->source == EDGE_SOURCE_PIR) {
+    atomic_store(&pir_latched, false);
   }
+  return true;
+}
+
+unsigned gpio_edge_overflows() {
+  return atomic_load(&gpio_edge_overflow_count);
 }
 
 void install_interrupts() {
@@ -99,6 +184,41 @@ void install_interrupts() {
   gpio_install_isr_service(0);
 }
 
+bool initialize_nvs() {
+  esp_err_t err = nvs_flash_init();
+  if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+    /* The partition is full or in an unknown format.  It only holds learned state, which will be
+       learned again. */
+    err = nvs_flash_erase();
+    if (err == ESP_OK) {
+      err = nvs_flash_init();
+    }
+  }
+  return err == ESP_OK;
+}
+
+uint32_t get_nvs_u32(const char* key) {
+  nvs_handle_t handle;
+  uint32_t value = 0;
+  if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) == ESP_OK) {
+    if (nvs_get_u32(handle, key, &value) != ESP_OK) {
+      value = 0;
+    }
+    nvs_close(handle);
+  }
+  return value;
+}
+
+void put_nvs_u32(const char* key, uint32_t value) {
+  nvs_handle_t handle;
+  if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle) == ESP_OK) {
+    if (nvs_set_u32(handle, key, value) != ESP_OK || nvs_commit(handle) != ESP_OK) {
+      LOG("Could not save %s", key);
+    }
+    nvs_close(handle);
+  }
+}
+
 void initialize_onboard_buttons() {
   gpio_config_t btn_conf = {
     .intr_type = GPIO_INTR_ANYEDGE,
@@ -110,6 +230,9 @@ void initialize_onboard_buttons() {
 }
   
 void enable_onboard_buttons() {
+  /* The ISR reports changes relative to the current level. */
+  button_level = gpio_get_level(BTN1_PIN);
+  button_edge_us = esp_timer_get_time() - BUTTON_DEBOUNCE_US;
   /* TODO: Error code? */
   gpio_isr_handler_add(BTN1_PIN, gpio_isr_handler, (void*) BTN1_PIN);
 }
@@ -173,7 +296,7 @@ bool enable_i2c() {
     .sda_pullup_en = GPIO_PULLUP_ENABLE,
     .scl_io_num = I2C_SCL_PIN,
     .scl_pullup_en = GPIO_PULLUP_ENABLE,
-    .master.clk_speed = 100000, // 100KHz
+    .master.clk_speed = I2C_CLOCK_HZ,
   };
   if (i2c_param_config(I2C1_BUS, &i2c_conf) != ESP_OK) {
     return false;
@@ -187,13 +310,21 @@ bool enable_i2c() {
   }
   i2c_set_timeout((i2c_port_t)I2C1_BUS, 0xFFFFF);
 
+  /* All the drivers go through the bus manager. */
+  if (!i2c_bus_start(I2C1_BUS)) {
+    return false;
+  }
+
   /* Some of the i2c devices are slow to come up. */
   vTaskDelay(pdMS_TO_TICKS(I2C_STABILIZE_MS));
   return true;
 }
 
 bool disable_i2c() {
-  /* Remove the driver. */
+  /* Let the bus manager finish what has been submitted (an OLED flush may be in progress), then
+     remove the driver.  The bus manager stays, it's idle until the driver has been installed
+     again. */
+  i2c_bus_drain(I2C1_BUS);
   i2c_driver_delete(I2C1_BUS);
 
   /* Pull the I2C signals down.  This is different from just disabling pullup and setting the
@@ -225,7 +356,8 @@ bool initialize_i2c_sen0514() {
 bool initialize_i2c_ssd1306() {
   /* Check the OLED and initialize it */
   return (have_ssd1306 = ssd1306_Create(&ssd1306, SSD1306_BUS, SSD1306_ADDRESS,
-					SSD1306_WIDTH, SSD1306_HEIGHT, /* flags= */ 0));
+					SSD1306_WIDTH, SSD1306_HEIGHT, /* flags= */ 0,
+					ssd1306_flush_buffer));
 }
 #endif
 
@@ -255,6 +387,26 @@ void disable_gpio_sen0171() {
 }
 #endif
 
+#ifdef SNAPPY_GPIO_SEN0514_INT
+bool initialize_gpio_sen0514_int() {
+  /* GPIO36 has no pullup, but the driver configures INTn as push-pull. */
+  gpio_config_t int_conf = {
+    .intr_type = GPIO_INTR_POSEDGE,
+    .pin_bit_mask = (1ULL << SEN0514_INT_PIN),
+    .mode = GPIO_MODE_INPUT,
+  };
+  return gpio_config(&int_conf) == ESP_OK;
+}
+
+void enable_gpio_sen0514_int() {
+  gpio_isr_handler_add(SEN0514_INT_PIN, gpio_isr_handler, (void*) SEN0514_INT_PIN);
+}
+
+void disable_gpio_sen0514_int() {
+  gpio_isr_handler_remove(SEN0514_INT_PIN);
+}
+#endif
+
 #ifdef SNAPPY_ESP32_LEDC_PIEZO
 bool initialize_esp32_ledc_piezo() {
   /* TODO: Maybe this needs to setup some pins at least. */
@@ -264,7 +416,6 @@ bool initialize_esp32_ledc_piezo() {
 
 #ifdef SNAPPY_ADC_SEN0487
 bool initialize_adc_sen0487() {
-  /* FIXME: Almost certainly something to do */
-  return true;
+  return sen0487_begin(MIC_ADC1_CHANNEL);
 }
 #endif
@@ -15,8 +15,33 @@ void disable_regulator();
 
 void install_interrupts();
 void initialize_onboard_buttons();
+
+/* State that the device learns and that must survive a reset, such as how long the air sensor
+   usually takes to warm up, is kept in NVS.  It is not configuration.  A value that is missing or
+   can't be read reads as 0. */
+bool initialize_nvs() WARN_UNUSED;
+uint32_t get_nvs_u32(const char* key);
+void put_nvs_u32(const char* key, uint32_t value);
 void enable_onboard_buttons();
 bool btn1_is_pressed() WARN_UNUSED;
+
+/* Level changes on interrupt-driven pins, timestamped with the CPU cycle counter.  EV_GPIO_EDGES is
+   posted when edges become available; the main task should then call next_gpio_edge() until it
+   returns false.  Edges that could not be recorded because the buffer was full are counted. */
+typedef enum {
+  EDGE_SOURCE_BUTTON,
+  EDGE_SOURCE_PIR,
+  EDGE_SOURCE_SEN0514,          /* The air sensor has new data */
+} edge_source_t;
+
+typedef struct {
+  uint8_t source;               /* edge_source_t */
+  uint8_t level;
+  uint32_t cycles;
+} gpio_edge_t;
+
+bool next_gpio_edge(gpio_edge_t* edge) WARN_UNUSED;
+unsigned gpio_edge_overflows();
 #ifdef SNAPPY_LIGHT_SLEEP
 bool reconfigure_btn1_as_wakeup_source() WARN_UNUSED;
 bool deconfigure_btn1_as_wakeup_source() WARN_UNUSED;
@@ -28,9 +53,16 @@ void enable_gpio_sen0171();
 void disable_gpio_sen0171();
 #endif
 
+#ifdef SNAPPY_GPIO_SEN0514_INT
+/* The air sensor's data-ready line.  While enabled, every new sample is recorded as an edge; the
+   edges stop if a sample is not read. */
+bool initialize_gpio_sen0514_int() WARN_UNUSED;
+void enable_gpio_sen0514_int();
+void disable_gpio_sen0514_int();
+#endif
+
 #ifdef SNAPPY_ADC_SEN0487
 bool initialize_adc_sen0487() WARN_UNUSED;
-unsigned sen0487_sound_level();
 #endif
 
 #ifdef SNAPPY_I2C
@@ -4,29 +4,92 @@
 
 #ifdef SNAPPY_ADC_SEN0487
 
-/* FIXME: Include something from the ADC subsystem */
-/* This looks like an ADC oneshot mode situation */
-#include "esp_adc/adc_oneshot.h"
-/* Whether calibration is needed is TBD.  See app example */
-
-unsigned sen0487_sound_level() {
-  /* FIXME: analogRead is Arduino */
-  //  unsigned r = analogRead(MIC_PIN);
-  unsigned r = 0;
+#include "esp_adc/adc_continuous.h"
+
+#define ADC_HZ 20000
+#define DECIMATION (ADC_HZ / SEN0487_SAMPLE_HZ)
+#define FRAME_CONVERSIONS 256   /* About 13ms per frame */
+#define READ_TIMEOUT_MS 100
+
+static adc_continuous_handle_t adc;
+static uint8_t frame[FRAME_CONVERSIONS * SOC_ADC_DIGI_RESULT_BYTES];
+
+bool sen0487_begin(unsigned adc1_channel) {
+  adc_continuous_handle_cfg_t handle_cfg = {
+    .max_store_buf_size = 4 * sizeof(frame),
+    .conv_frame_size = sizeof(frame),
+  };
+  if (adc_continuous_new_handle(&handle_cfg, &adc) != ESP_OK) {
+    return false;
+  }
+  adc_digi_pattern_config_t pattern = {
+    .atten = ADC_ATTEN_DB_11,
+    .channel = adc1_channel,
+    .unit = ADC_UNIT_1,
+    .bit_width = SOC_ADC_DIGI_MAX_BITWIDTH,
+  };
+  adc_continuous_config_t cfg = {
+    .pattern_num = 1,
+    .adc_pattern = &pattern,
+    .sample_freq_hz = ADC_HZ,
+    .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+    .format = ADC_DIGI_OUTPUT_FORMAT_TYPE1,
+  };
+  if (adc_continuous_config(adc, &cfg) != ESP_OK) {
+    adc_continuous_deinit(adc);
+    adc = NULL;
+    return false;
+  }
+  return true;
+}
+
+bool sen0487_start() {
+  return adc != NULL && adc_continuous_start(adc) == ESP_OK;
+}
+
+void sen0487_stop() {
+  if (adc != NULL) {
+    adc_continuous_stop(adc);
+  }
+}
+
+bool sen0487_read_peak(unsigned* peak) {
+  uint32_t len = 0;
+  esp_err_t res = adc_continuous_read(adc, frame, sizeof(frame), &len, READ_TIMEOUT_MS);
+  if (res != ESP_OK) {
+    return false;
+  }
+  /* Boxcar-average runs of DECIMATION conversions.  This is also a crude low-pass filter, which
+     takes the edge off the ADC's noise. */
+  unsigned sum = 0, n = 0, max = 0;
+  for ( uint32_t i = 0 ; i + SOC_ADC_DIGI_RESULT_BYTES <= len ; i += SOC_ADC_DIGI_RESULT_BYTES ) {
+    adc_digi_output_data_t* d = (adc_digi_output_data_t*)&frame[i];
+    sum += d->type1.data;
+    if (++n == DECIMATION) {
+      unsigned v = sum / DECIMATION;
+      max = v > max ? v : max;
+      sum = n = 0;
+    }
+  }
+  *peak = max;
+  return true;
+}
+
+unsigned sen0487_sound_level(unsigned peak) {
   /* TODO - This scale is pretty arbitrary */
-  if (r < 1700) {
+  if (peak < 1700) {
     return 1;
   }
-  if (r < 2000) {
+  if (peak < 2000) {
     return 2;
   }
-  if (r < 2500) {
+  if (peak < 2500) {
     return 3;
   }
-  if (r < 3000) {
+  if (peak < 3000) {
     return 4;
   }
   return 5;
 }
 
-#endif
+#endif /* SNAPPY_ADC_SEN0487 */
@@ -5,9 +5,28 @@
 
 #include "main.h"
 
-#ifdef SNAPPY_GPIO_SEN0487
-/* Scale of 1 to 5, 0 means error of some sort. */
-unsigned sen0487_sound_level();
-#endif
+#ifdef SNAPPY_ADC_SEN0487
+
+/* The MEMS is sampled by ADC1 in continuous mode, ie, by the DMA controller, so that the CPU only
+   sees a block of conversions every few milliseconds.  The ADC can't convert slower than 20kHz;
+   the driver averages runs of conversions down to SEN0487_SAMPLE_HZ. */
+#define SEN0487_SAMPLE_HZ 4000
+
+/* Set up continuous conversion on the given ADC1 channel.  Call once. */
+bool sen0487_begin(unsigned adc1_channel) WARN_UNUSED;
+
+/* Start and stop conversion. */
+bool sen0487_start() WARN_UNUSED;
+void sen0487_stop();
+
+/* Wait for the next block of conversions and set *peak to the largest sample in it.  Returns false
+   on timeout or error, in which case *peak is unchanged.  Conversions that were dropped because
+   the caller did not keep up are not an error. */
+bool sen0487_read_peak(unsigned* peak) WARN_UNUSED;
+
+/* Scale of 1 to 5 for a peak reading. */
+unsigned sen0487_sound_level(unsigned peak);
+
+#endif /* SNAPPY_ADC_SEN0487 */
 
 #endif /* !dfrobot_sen0487_h_included */
@@ -24,23 +24,30 @@
 #define REG_HUMIDITY              0x000B ///< Register for protocol transition adapter
 #define REG_ATMOSPHERIC_PRESSURE  0x000C ///< Register for protocol transition adapter
 
-static bool read_reg16(dfrobot_sen0500_t* self, unsigned reg, unsigned* response) {
+#define MAX_REGS (REG_ATMOSPHERIC_PRESSURE - REG_ULTRAVIOLET_INTENSITY + 1)
+
+/* Read `n` consecutive registers starting at `reg`; the device advances the register address as it
+   sends. */
+static bool read_regs16(dfrobot_sen0500_t* self, unsigned reg, uint16_t* response, size_t n) {
   uint8_t msg = reg << 1;
-  uint8_t buf[2];
-  if (i2c_master_write_read_device(self->bus, self->address, &msg, sizeof(msg), buf, sizeof(buf),
-				   pdMS_TO_TICKS(self->timeout_ms)) != ESP_OK) {
+  uint8_t buf[2 * MAX_REGS];
+  if (n > MAX_REGS) {
+    return false;
+  }
+  if (i2c_write_read(self->bus, self->address, &msg, sizeof(msg), buf, 2 * n) != ESP_OK) {
     return false;
   }
-  *response = ((unsigned)buf[0] << 8) | buf[1];
+  for ( size_t i = 0 ; i < n ; i++ ) {
+    response[i] = ((uint16_t)buf[2*i] << 8) | buf[2*i + 1];
+  }
   return true;
 }
 
 bool dfrobot_sen0500_begin(dfrobot_sen0500_t* self, unsigned i2c_bus, unsigned i2c_addr) {
   self->bus = i2c_bus;
   self->address = i2c_addr;
-  self->timeout_ms = 200;
-  unsigned response = 0;
-  if (!read_reg16(self, REG_DEVICE_ADDR, &response)) {
+  uint16_t response = 0;
+  if (!read_regs16(self, REG_DEVICE_ADDR, &response, 1)) {
     LOG("SEN0500: Device init read failed");
     return false;
   }
@@ -51,44 +58,73 @@ bool dfrobot_sen0500_begin(dfrobot_sen0500_t* self, unsigned i2c_bus, unsigned i
   return true;
 }
 
+bool dfrobot_sen0500_read_raw(dfrobot_sen0500_t* self, dfrobot_sen0500_raw_t* result) {
+  uint16_t regs[MAX_REGS];
+  if (!read_regs16(self, REG_ULTRAVIOLET_INTENSITY, regs, MAX_REGS)) {
+    LOG("SEN0500: Measurement read failed");
+    return false;
+  }
+  result->ultraviolet_intensity = regs[REG_ULTRAVIOLET_INTENSITY - REG_ULTRAVIOLET_INTENSITY];
+  result->luminous_intensity = regs[REG_LUMINOUS_INTENSITY - REG_ULTRAVIOLET_INTENSITY];
+  result->temperature = regs[REG_TEMP - REG_ULTRAVIOLET_INTENSITY];
+  result->humidity = regs[REG_HUMIDITY - REG_ULTRAVIOLET_INTENSITY];
+  result->atmospheric_pressure = regs[REG_ATMOSPHERIC_PRESSURE - REG_ULTRAVIOLET_INTENSITY];
+  return true;
+}
+
 bool dfrobot_sen0500_get_temperature(dfrobot_sen0500_t* self, dfrobot_sen0500_temp_t tt,
 				     float* result) {
-  unsigned response = 0;
-  if (!read_reg16(self, REG_TEMP, &response)) {
+  dfrobot_sen0500_raw_t raw;
+  if (!read_regs16(self, REG_TEMP, &raw.temperature, 1)) {
     LOG("SEN0500: Temperature read failed");
     return false;
   }
-  float reading = (float)(int16_t)response;
+  *result = dfrobot_sen0500_temperature_from_raw(&raw, tt);
+  return true;
+}
+
+float dfrobot_sen0500_temperature_from_raw(const dfrobot_sen0500_raw_t* raw,
+                                           dfrobot_sen0500_temp_t tt) {
+  float reading = (float)(int16_t)raw->temperature;
   reading = -45.0f + (reading * 175.0f) / 1024.0f / 64.0f;
   if(tt == DFROBOT_SEN0500_TEMP_F) {
     reading = reading * 1.8f + 32.0f;
   }
-  *result = reading;
-  return true;
+  return reading;
 }
 
 bool dfrobot_sen0500_get_humidity(dfrobot_sen0500_t* self, float* result) {
-  unsigned response = 0;
-  if (!read_reg16(self, REG_HUMIDITY, &response)) {
+  dfrobot_sen0500_raw_t raw;
+  if (!read_regs16(self, REG_HUMIDITY, &raw.humidity, 1)) {
     LOG("SEN0500: Humidity read failed");
     return false;
   }
-  *result = (float)response * 100.0f / 65536.0f;
+  *result = dfrobot_sen0500_humidity_from_raw(&raw);
   return true;
 }
 
+float dfrobot_sen0500_humidity_from_raw(const dfrobot_sen0500_raw_t* raw) {
+  return (float)raw->humidity * 100.0f / 65536.0f;
+}
+
 bool dfrobot_sen0500_get_atmospheric_pressure(dfrobot_sen0500_t* self, dfrobot_sen0500_pressure_t pt,
 					      unsigned* result) {
-  unsigned response;
-  if (!read_reg16(self, REG_ATMOSPHERIC_PRESSURE, &response)) {
+  dfrobot_sen0500_raw_t raw;
+  if (!read_regs16(self, REG_ATMOSPHERIC_PRESSURE, &raw.atmospheric_pressure, 1)) {
     LOG("SEN0500: Pressure read failed");
     return false;
   }
+  *result = dfrobot_sen0500_atmospheric_pressure_from_raw(&raw, pt);
+  return true;
+}
+
+unsigned dfrobot_sen0500_atmospheric_pressure_from_raw(const dfrobot_sen0500_raw_t* raw,
+                                                       dfrobot_sen0500_pressure_t pt) {
+  unsigned response = raw->atmospheric_pressure;
   if (pt == DFROBOT_SEN0500_PRESSURE_KPA) {
     response /= 10;
   }
-  *result = response;
-  return true;
+  return response;
 }
 
 /* Map x that is within the interval [in_min,in_max) to its appropriate point in the interval
@@ -98,26 +134,34 @@ static float map_float(float x, float in_min, float in_max, float out_min, float
 }
 
 bool dfrobot_sen0500_get_ultraviolet_intensity(dfrobot_sen0500_t* self, float* result) {
-  unsigned response;
-  if (!read_reg16(self, REG_ULTRAVIOLET_INTENSITY, &response)) {
+  dfrobot_sen0500_raw_t raw;
+  if (!read_regs16(self, REG_ULTRAVIOLET_INTENSITY, &raw.ultraviolet_intensity, 1)) {
     LOG("SEN0500: UV read failed");
     return false;
   }
-  float outputVoltage = (3.0f * (float)response) / 1024.0f;
-  *result = map_float(outputVoltage, 0.99f, 2.9f, 0.0f, 15.0f);
+  *result = dfrobot_sen0500_ultraviolet_intensity_from_raw(&raw);
   return true;
 }
 
+float dfrobot_sen0500_ultraviolet_intensity_from_raw(const dfrobot_sen0500_raw_t* raw) {
+  float outputVoltage = (3.0f * (float)raw->ultraviolet_intensity) / 1024.0f;
+  return map_float(outputVoltage, 0.99f, 2.9f, 0.0f, 15.0f);
+}
+
 bool dfrobot_sen0500_get_luminous_intensity(dfrobot_sen0500_t* self, float* result) {
-  unsigned response;
-  if (!read_reg16(self, REG_LUMINOUS_INTENSITY, &response)) {
+  dfrobot_sen0500_raw_t raw;
+  if (!read_regs16(self, REG_LUMINOUS_INTENSITY, &raw.luminous_intensity, 1)) {
     LOG("SEN0500: Lux read failed");
     return false;
   }
-  float luminous = (float)response;
-  *result = luminous * (1.0023f +
-			luminous * (8.1488e-5f +
-				    luminous * (-9.3924e-9f +
-						luminous * 6.0135e-13f)));
+  *result = dfrobot_sen0500_luminous_intensity_from_raw(&raw);
   return true;
 }
+
+float dfrobot_sen0500_luminous_intensity_from_raw(const dfrobot_sen0500_raw_t* raw) {
+  float luminous = (float)raw->luminous_intensity;
+  return luminous * (1.0023f +
+                     luminous * (8.1488e-5f +
+                                 luminous * (-9.3924e-9f +
+                                             luminous * 6.0135e-13f)));
+}
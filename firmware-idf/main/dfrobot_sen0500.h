@@ -14,7 +14,6 @@
 typedef struct {
   unsigned bus;			/* Zero-based */
   unsigned address;		/* Unshifted bus address */
-  unsigned timeout_ms;
 } dfrobot_sen0500_t;
 
 /* Initialize the device, filling in the fields of `self`.  The I2C bus must already have been
@@ -25,6 +24,21 @@ typedef struct {
 bool dfrobot_sen0500_begin(dfrobot_sen0500_t* self, unsigned i2c_bus, unsigned i2c_addr)
   WARN_UNUSED;
 
+/* The raw contents of the measurement registers.  Read them with dfrobot_sen0500_read_raw() and
+   convert them with the dfrobot_sen0500_*_from_raw() functions. */
+typedef struct {
+  uint16_t ultraviolet_intensity;
+  uint16_t luminous_intensity;
+  uint16_t temperature;
+  uint16_t humidity;
+  uint16_t atmospheric_pressure;
+} dfrobot_sen0500_raw_t;
+
+/* Read all the measurement registers of the initialized device in a single transaction and return
+   true on success, updating *result; otherwise false.  Reading the registers one at a time costs
+   five transactions. */
+bool dfrobot_sen0500_read_raw(dfrobot_sen0500_t* self, dfrobot_sen0500_raw_t* result) WARN_UNUSED;
+
 /* Temperature representation */
 typedef enum {
   DFROBOT_SEN0500_TEMP_F,	/* Fahrenheit */
@@ -35,11 +49,14 @@ typedef enum {
    *result; otherwise false. */
 bool dfrobot_sen0500_get_temperature(dfrobot_sen0500_t* self, dfrobot_sen0500_temp_t tt,
 				     float* result) WARN_UNUSED;
+float dfrobot_sen0500_temperature_from_raw(const dfrobot_sen0500_raw_t* raw,
+                                           dfrobot_sen0500_temp_t tt);
 
 /* Read the humidity register of the initialized device and return true on success, updating
   *result; otherwise false.  The unit of the output is relative humidity in percent; 50.0 is the
   middle of the range. */
 bool dfrobot_sen0500_get_humidity(dfrobot_sen0500_t* self, float* result) WARN_UNUSED;
+float dfrobot_sen0500_humidity_from_raw(const dfrobot_sen0500_raw_t* raw);
 
 /* Pressure representation */
 typedef enum {
@@ -51,6 +68,8 @@ typedef enum {
   *result; otherwise false. */
 bool dfrobot_sen0500_get_atmospheric_pressure(dfrobot_sen0500_t* self, dfrobot_sen0500_pressure_t pt,
 					      unsigned* result) WARN_UNUSED;
+unsigned dfrobot_sen0500_atmospheric_pressure_from_raw(const dfrobot_sen0500_raw_t* raw,
+                                                       dfrobot_sen0500_pressure_t pt);
 
 /* Read the uv intensity register of the initialized device and return true on success, updating
    *result; otherwise false.  The output is in the range [0.0,15.0).
@@ -61,10 +80,12 @@ bool dfrobot_sen0500_get_atmospheric_pressure(dfrobot_sen0500_t* self, dfrobot_s
  
    Most likely, rounding *result to the nearest integer is going to be OK. */
 bool dfrobot_sen0500_get_ultraviolet_intensity(dfrobot_sen0500_t* self, float* result) WARN_UNUSED;
+float dfrobot_sen0500_ultraviolet_intensity_from_raw(const dfrobot_sen0500_raw_t* raw);
 
 /* Read the light intensity register of the initialized device and return true on success, updating
    *result; otherwise false.  The unit of the output is lux. */
 bool dfrobot_sen0500_get_luminous_intensity(dfrobot_sen0500_t* self, float* result) WARN_UNUSED;
+float dfrobot_sen0500_luminous_intensity_from_raw(const dfrobot_sen0500_raw_t* raw);
 
 #endif /* SNAPPY_I2C_SEN0500 */
 
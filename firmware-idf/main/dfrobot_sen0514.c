@@ -10,6 +10,7 @@
 #ifdef SNAPPY_I2C_SEN0514
 
 #include "esp32_i2c.h"
+#include "esp_timer.h"
 
 #define ENS160_PART_ID         0x160   ///< ENS160 chip version
 
@@ -48,42 +49,82 @@
 #define INT_MODE_DIS 0		/* Disable */
 #define INT_MODE_EN 1		/* Enable */
 
-static bool write_reg8(dfrobot_sen0514_t* self, unsigned reg, unsigned val) {
-  uint8_t msg[2] = { reg, val };
-  if (!i2c_master_write_to_device(self->bus, self->address, msg, sizeof(msg),
-				  pdMS_TO_TICKS(self->timeout_ms)) == ESP_OK) {
-    return false;
+/* INTn pin drive and polarity */
+#define INT_PIN_OPEN_DRAIN (0 << 5)
+#define INT_PIN_PUSH_PULL (1 << 5)
+#define INT_PIN_ACTIVE_LOW (0 << 6)
+#define INT_PIN_ACTIVE_HIGH (1 << 6)
+
+/* Settle time after a write, see dfrobot_sen0514_is_ready(). */
+#define WRITE_SETTLE_US 20000
+
+static void wait_until_ready(dfrobot_sen0514_t* self) {
+  int64_t wait_us = self->not_before_us - esp_timer_get_time();
+  if (wait_us > 0) {
+    vTaskDelay(pdMS_TO_TICKS((wait_us + 999) / 1000));
   }
-  vTaskDelay(pdMS_TO_TICKS(20)); 
-  return true;
 }
 
-static bool write_reg16(dfrobot_sen0514_t* self, unsigned reg, unsigned val) {
-  uint8_t msg[3] = { reg, val & 255, (val >> 8) & 255 };
-  if (!i2c_master_write_to_device(self->bus, self->address, msg, sizeof(msg),
-				  pdMS_TO_TICKS(self->timeout_ms)) == ESP_OK) {
+/* Write without waiting; the device must be ready. */
+static bool write_regs_now(dfrobot_sen0514_t* self, const uint8_t* msg, size_t len) {
+  if (i2c_write(self->bus, self->address, msg, len) != ESP_OK) {
     return false;
   }
-  vTaskDelay(pdMS_TO_TICKS(20)); 
+  self->not_before_us = esp_timer_get_time() + WRITE_SETTLE_US;
   return true;
 }
 
+/* Issue the write that begin() deferred.  The device must be ready. */
+static void write_deferred_config(dfrobot_sen0514_t* self) {
+  uint8_t msg[2] = { ENS160_CONFIG_REG, self->deferred_config };
+  self->deferred_config = -1;
+  if (!write_regs_now(self, msg, sizeof(msg))) {
+    LOG("SEN0514: Failed to set interrupt mode");
+  }
+}
+
+/* Wait until the device can be accessed, after any deferred write.  Callers on the main loop check
+   dfrobot_sen0514_is_ready() first, so this rarely waits. */
+static void settle(dfrobot_sen0514_t* self) {
+  wait_until_ready(self);
+  if (self->deferred_config >= 0) {
+    write_deferred_config(self);
+    wait_until_ready(self);
+  }
+}
+
+static bool write_regs(dfrobot_sen0514_t* self, const uint8_t* msg, size_t len) {
+  settle(self);
+  return write_regs_now(self, msg, len);
+}
+
+static bool write_reg8(dfrobot_sen0514_t* self, unsigned reg, unsigned val) {
+  uint8_t msg[2] = { reg, val };
+  return write_regs(self, msg, sizeof(msg));
+}
+
 static bool read_reg16(dfrobot_sen0514_t* self, unsigned reg, unsigned* response) {
+  settle(self);
   uint8_t msg = reg;
   uint8_t buf[2];
-  if (i2c_master_write_read_device(self->bus, self->address, &msg, 1,
-                                   buf, 2, pdMS_TO_TICKS(self->timeout_ms)) != ESP_OK) {
+  if (i2c_write_read(self->bus, self->address, &msg, 1, buf, 2) != ESP_OK) {
     return false;
   }
   *response = (buf[1] << 8) | buf[0];
   return true;
 }
 
+static bool read_regs(dfrobot_sen0514_t* self, unsigned reg, uint8_t* buf, size_t n) {
+  settle(self);
+  uint8_t msg = reg;
+  return i2c_write_read(self->bus, self->address, &msg, 1, buf, n) == ESP_OK;
+}
+
 static bool read_reg8(dfrobot_sen0514_t* self, unsigned reg, unsigned* response) {
+  settle(self);
   uint8_t msg = reg;
   uint8_t buf;
-  if (i2c_master_write_read_device(self->bus, self->address, &msg, 1,
-                                   &buf, 1, pdMS_TO_TICKS(self->timeout_ms)) != ESP_OK) {
+  if (i2c_write_read(self->bus, self->address, &msg, 1, &buf, 1) != ESP_OK) {
     return false;
   }
   *response = buf;
@@ -98,18 +139,17 @@ static bool set_power_mode(dfrobot_sen0514_t* self, unsigned mode) {
   return true;
 }
 
-static bool set_interrupt_mode(dfrobot_sen0514_t* self, unsigned mode) {
-  if (!write_reg8(self, ENS160_CONFIG_REG, mode | INT_DATA_DRDY_EN | INT_GPR_DRDY_DIS)) {
-    LOG("SEN0514: Failed to set interrupt mode");
-    return false;
-  }
-  return true;
+/* The CONFIG write that sets the interrupt mode must wait for the OPMODE write to settle, so it is
+   only recorded here, see settle() and dfrobot_sen0514_is_ready(). */
+static void set_interrupt_mode_deferred(dfrobot_sen0514_t* self, unsigned mode) {
+  self->deferred_config = mode | INT_DATA_DRDY_EN | INT_GPR_DRDY_DIS;
 }
 
 bool dfrobot_sen0514_begin(dfrobot_sen0514_t* self, unsigned i2c_bus, unsigned i2c_addr) {
   self->bus = i2c_bus;
   self->address = i2c_addr;
-  self->timeout_ms = 200;
+  self->not_before_us = 0;
+  self->deferred_config = -1;
   unsigned response;
   if (!read_reg16(self, ENS160_PART_ID_REG, &response)) {
     LOG("SEN0514: Could not read part ID");
@@ -120,7 +160,23 @@ bool dfrobot_sen0514_begin(dfrobot_sen0514_t* self, unsigned i2c_bus, unsigned i
     return false;
   }
   set_power_mode(self, ENS160_STANDARD_MODE);
-  set_interrupt_mode(self, INT_MODE_DIS);
+#ifdef SNAPPY_GPIO_SEN0514_INT
+  /* INTn is high while there are new data, and goes low when they are read. */
+  set_interrupt_mode_deferred(self, INT_MODE_EN | INT_PIN_PUSH_PULL | INT_PIN_ACTIVE_HIGH);
+#else
+  set_interrupt_mode_deferred(self, INT_MODE_DIS);
+#endif
+  return true;
+}
+
+bool dfrobot_sen0514_is_ready(dfrobot_sen0514_t* self) {
+  if (esp_timer_get_time() < self->not_before_us) {
+    return false;
+  }
+  if (self->deferred_config >= 0) {
+    write_deferred_config(self);
+    return false;
+  }
   return true;
 }
 
@@ -134,14 +190,30 @@ bool dfrobot_sen0514_get_sensor_status(dfrobot_sen0514_t* self, dfrobot_sen0514_
   return true;
 }
 
+bool dfrobot_sen0514_read_all(dfrobot_sen0514_t* self, dfrobot_sen0514_readings_t* result) {
+  /* DATA_STATUS, DATA_AQI, DATA_TVOC and DATA_ECO2 are contiguous. */
+  uint8_t buf[ENS160_DATA_ECO2_REG + 2 - ENS160_DATA_STATUS_REG];
+  if (!read_regs(self, ENS160_DATA_STATUS_REG, buf, sizeof(buf))) {
+    LOG("SEN0514: Failed to read status and data");
+    return false;
+  }
+  result->status = (dfrobot_sen0514_status_t)((buf[0] >> 2) & 3);
+  result->new_data = (buf[0] & 2) != 0;
+  result->aqi = buf[ENS160_DATA_AQI_REG - ENS160_DATA_STATUS_REG] & 7;
+  result->tvoc = (buf[ENS160_DATA_TVOC_REG + 1 - ENS160_DATA_STATUS_REG] << 8) |
+    buf[ENS160_DATA_TVOC_REG - ENS160_DATA_STATUS_REG];
+  result->co2 = (buf[ENS160_DATA_ECO2_REG + 1 - ENS160_DATA_STATUS_REG] << 8) |
+    buf[ENS160_DATA_ECO2_REG - ENS160_DATA_STATUS_REG];
+  return true;
+}
+
 bool dfrobot_sen0514_prime(dfrobot_sen0514_t* self, float temperature, float humidity) {
   unsigned t = (unsigned)((temperature + 273.15f) * 64.0f);
   unsigned rh = (unsigned)(humidity * 512.0f);
-  if (!write_reg16(self, ENS160_TEMP_IN_REG, t)) {
-    LOG("SEN0514: Failed to prime device with temperature");
-  }
-  if (!write_reg16(self, ENS160_RH_IN_REG, rh)) {
-    LOG("SEN0514: Failed to prime device with humidity");
+  /* TEMP_IN and RH_IN are contiguous, so write both at once and settle once. */
+  uint8_t msg[5] = { ENS160_TEMP_IN_REG, t & 255, (t >> 8) & 255, rh & 255, (rh >> 8) & 255 };
+  if (!write_regs(self, msg, sizeof(msg))) {
+    LOG("SEN0514: Failed to prime device with temperature and humidity");
   }
   return true;
 }
@@ -14,17 +14,26 @@
 typedef struct {
   unsigned bus;			/* Zero-based */
   unsigned address;		/* Unshifted bus address */
-  unsigned timeout_ms;
+  int64_t not_before_us;        /* esp_timer time before which the device must not be accessed */
+  int deferred_config;          /* Value still to be written to CONFIG by begin(), or -1 */
 } dfrobot_sen0514_t;
 
 /* Initialize the device and fill in the fields of `self`. The I2C bus must already have been turned
-   on.  Returns false if the device could not be found or initialized.
+   on.  Returns false if the device could not be found or initialized.  This does not wait for the
+   device to settle: the second of its two writes is deferred until the device is ready for it, see
+   dfrobot_sen0514_is_ready().
 
    This will work regardless of the previous contents of `self` and the current state of the
    device. */
 bool dfrobot_sen0514_begin(dfrobot_sen0514_t* self, unsigned i2c_bus, unsigned i2c_addr)
   WARN_UNUSED;
 
+/* The device needs time to settle after a register write.  Rather than sleep after every write,
+   the driver records when the device will be ready and an access that comes earlier than that waits
+   for the remainder.  This returns true if an access now would not wait.  If the device is ready
+   for a write that begin() deferred, this issues the write and returns false. */
+bool dfrobot_sen0514_is_ready(dfrobot_sen0514_t* self);
+
 /* These status codes are a bit tricky, but from the data sheet:
 
    The value "1" appears only for the first several minutes when the device is powered on *for the
@@ -46,6 +55,21 @@ typedef enum {
 bool dfrobot_sen0514_get_sensor_status(dfrobot_sen0514_t* self, dfrobot_sen0514_status_t* result)
   WARN_UNUSED;
 
+/* The status and the gas readings from one measurement cycle, see dfrobot_sen0514_read_all(). */
+typedef struct {
+  dfrobot_sen0514_status_t status;
+  bool new_data;                /* The readings have not been read before */
+  unsigned aqi;                 /* As dfrobot_sen0514_get_air_quality_index() */
+  unsigned tvoc;                /* As dfrobot_sen0514_get_total_volatile_organic_compounds() */
+  unsigned co2;                 /* As dfrobot_sen0514_get_co2() */
+} dfrobot_sen0514_readings_t;
+
+/* Read the status and all the gas readings in a single transaction rather than four.  This halves
+   the bytes on the bus, and the values are guaranteed to be from the same measurement cycle.
+   `*result` is updated only if the function returns true. */
+bool dfrobot_sen0514_read_all(dfrobot_sen0514_t* self, dfrobot_sen0514_readings_t* result)
+  WARN_UNUSED;
+
 /* Prime the device with temperature and humidity, to ensure readings are sensible.
    Temperature is degrees celsius, [-273, whatever)
    Humidity is relative humidity, [0,1]
@@ -1,44 +1,212 @@
 /* -*- fill-column: 100; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
 
 #include "esp32_i2c.h"
+#include "freertos/semphr.h"
 
-esp_err_t i2c_mem_write(unsigned i2c_num, unsigned device_address, unsigned mem_address,
-			const uint8_t* write_buffer, size_t write_size) {
-  /* Based on i2c_master_write_to_device() */
+/* Room in the queue for a full OLED flush plus the sensor traffic. */
+#define QUEUE_LENGTH 32
 
-  /* SPDX-FileCopyrightText: 2015-2022 Espressif Systems (Shanghai) CO LTD
-     SPDX-License-Identifier: Apache-2.0 */
+/* A transaction has at most two START sequences, see I2C_LINK_RECOMMENDED_SIZE. */
+#define LINK_BUFFER_SIZE I2C_LINK_RECOMMENDED_SIZE(2 * I2C_BATCH_MAX)
 
-  esp_err_t err = ESP_OK;
-  uint8_t buffer[I2C_LINK_RECOMMENDED_SIZE(2)] = { 0 };
+#define BUS_STACK_SIZE (2048 + LINK_BUFFER_SIZE)
 
-  i2c_cmd_handle_t handle = i2c_cmd_link_create_static(buffer, sizeof(buffer));
-  assert (handle != NULL);
+/* Descriptor queue per bus, NULL if the bus manager has not been started. */
+static QueueHandle_t bus_queue[I2C_NUM_MAX];
 
-  err = i2c_master_start(handle);
-  if (err != ESP_OK) {
-    goto end;
-  }
+static bool touches_bus(const i2c_txn_t* txn) {
+  return txn->mem_address != I2C_NO_MEM_ADDRESS || txn->write_size > 0 || txn->read_size > 0;
+}
 
-  err = i2c_master_write_byte(handle, device_address << 1 | I2C_MASTER_WRITE, true);
-  if (err != ESP_OK) {
-    goto end;
+/* Add the commands for one transaction to the link; the caller adds the final STOP.  Based on
+   i2c_master_write_read_device(). */
+static esp_err_t add_txn(i2c_cmd_handle_t handle, const i2c_txn_t* txn) {
+  esp_err_t err = ESP_OK;
+
+  if (txn->mem_address != I2C_NO_MEM_ADDRESS || txn->write_size > 0) {
+    err = i2c_master_start(handle);
+    if (err != ESP_OK) {
+      return err;
+    }
+    err = i2c_master_write_byte(handle, txn->address << 1 | I2C_MASTER_WRITE, true);
+    if (err != ESP_OK) {
+      return err;
+    }
+    if (txn->mem_address != I2C_NO_MEM_ADDRESS) {
+      err = i2c_master_write_byte(handle, txn->mem_address, true);
+      if (err != ESP_OK) {
+        return err;
+      }
+    }
+    if (txn->write_size > 0) {
+      err = i2c_master_write(handle, txn->write_buffer, txn->write_size, true);
+      if (err != ESP_OK) {
+        return err;
+      }
+    }
   }
 
-  err = i2c_master_write_byte(handle, mem_address, true);
-  if (err != ESP_OK) {
-    goto end;
+  if (txn->read_size > 0) {
+    err = i2c_master_start(handle);
+    if (err != ESP_OK) {
+      return err;
+    }
+    err = i2c_master_write_byte(handle, txn->address << 1 | I2C_MASTER_READ, true);
+    if (err != ESP_OK) {
+      return err;
+    }
+    err = i2c_master_read(handle, txn->read_buffer, txn->read_size, I2C_MASTER_LAST_NACK);
   }
-  
-  err = i2c_master_write(handle, write_buffer, write_size, true);
-  if (err != ESP_OK) {
-    goto end;
+
+  return err;
+}
+
+/* Run the transactions as one command link. */
+static esp_err_t run_link(unsigned i2c_num, uint8_t* link_buffer, i2c_txn_t** txns, size_t n) {
+  esp_err_t err = ESP_OK;
+  size_t on_bus = 0;
+
+  i2c_cmd_handle_t handle = i2c_cmd_link_create_static(link_buffer, LINK_BUFFER_SIZE);
+  assert (handle != NULL);
+
+  for ( size_t i = 0 ; i < n ; i++ ) {
+    if (touches_bus(txns[i])) {
+      err = add_txn(handle, txns[i]);
+      if (err != ESP_OK) {
+        goto end;
+      }
+      on_bus++;
+    }
   }
 
-  i2c_master_stop(handle);
-  err = i2c_master_cmd_begin(i2c_num, handle, portMAX_DELAY);
+  if (on_bus > 0) {
+    i2c_master_stop(handle);
+    err = i2c_master_cmd_begin(i2c_num, handle, pdMS_TO_TICKS(I2C_TIMEOUT_MS * on_bus));
+  }
 
  end:
   i2c_cmd_link_delete_static(handle);
   return err;
 }
+
+static void bus_loop(void* arg) {
+  unsigned i2c_num = (unsigned)(uintptr_t)arg;
+  QueueHandle_t queue = bus_queue[i2c_num];
+  uint8_t link_buffer[LINK_BUFFER_SIZE];
+  i2c_txn_t* batch[I2C_BATCH_MAX];
+
+  for (;;) {
+    size_t n = 0;
+    xQueueReceive(queue, &batch[n++], portMAX_DELAY);
+    /* Chain the waiting transactions for the same device, see esp32_i2c.h.  This task is the only
+       receiver, so the peeked transaction is the one received. */
+    i2c_txn_t* next;
+    bool have_address = touches_bus(batch[0]);
+    unsigned address = batch[0]->address;
+    while (n < I2C_BATCH_MAX && xQueuePeek(queue, &next, 0) == pdTRUE) {
+      if (touches_bus(next)) {
+        if (have_address && next->address != address) {
+          break;
+        }
+        have_address = true;
+        address = next->address;
+      }
+      xQueueReceive(queue, &batch[n++], 0);
+    }
+
+    esp_err_t err = run_link(i2c_num, link_buffer, batch, n);
+    for ( size_t i = 0 ; i < n ; i++ ) {
+      batch[i]->result = err;
+    }
+
+    for ( size_t i = 0 ; i < n ; i++ ) {
+      batch[i]->done(batch[i]);
+    }
+  }
+}
+
+bool i2c_bus_start(unsigned i2c_num) {
+  if (bus_queue[i2c_num] != NULL) {
+    return true;
+  }
+  bus_queue[i2c_num] = xQueueCreate(QUEUE_LENGTH, sizeof(i2c_txn_t*));
+  if (bus_queue[i2c_num] == NULL) {
+    return false;
+  }
+  if (xTaskCreate(bus_loop, "i2c", BUS_STACK_SIZE, (void*)(uintptr_t)i2c_num,
+                  I2C_BUS_PRIORITY, NULL) != pdPASS) {
+    /* Leaks the queue, but we're not going to get very far anyway. */
+    bus_queue[i2c_num] = NULL;
+    return false;
+  }
+  return true;
+}
+
+void i2c_bus_drain(unsigned i2c_num) {
+  if (bus_queue[i2c_num] != NULL) {
+    i2c_txn_t barrier = {
+      .mem_address = I2C_NO_MEM_ADDRESS,
+    };
+    (void)i2c_execute(i2c_num, &barrier);
+  }
+}
+
+bool i2c_submit(unsigned i2c_num, i2c_txn_t* txn) {
+  if (bus_queue[i2c_num] == NULL) {
+    return false;
+  }
+  return xQueueSend(bus_queue[i2c_num], &txn, portMAX_DELAY) == pdTRUE;
+}
+
+static void wake_waiter(i2c_txn_t* txn) {
+  xSemaphoreGive((SemaphoreHandle_t)txn->arg);
+}
+
+esp_err_t i2c_execute(unsigned i2c_num, i2c_txn_t* txn) {
+  StaticSemaphore_t semaphore_mem;
+  SemaphoreHandle_t completed = xSemaphoreCreateBinaryStatic(&semaphore_mem);
+  txn->done = wake_waiter;
+  txn->arg = completed;
+  if (!i2c_submit(i2c_num, txn)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  /* The bus manager always completes the transaction, the bus operations have timeouts. */
+  xSemaphoreTake(completed, portMAX_DELAY);
+  return txn->result;
+}
+
+esp_err_t i2c_mem_write(unsigned i2c_num, unsigned device_address, unsigned mem_address,
+			const uint8_t* write_buffer, size_t write_size) {
+  i2c_txn_t txn = {
+    .address = device_address,
+    .mem_address = mem_address,
+    .write_buffer = write_buffer,
+    .write_size = write_size,
+  };
+  return i2c_execute(i2c_num, &txn);
+}
+
+esp_err_t i2c_write(unsigned i2c_num, unsigned device_address,
+                    const uint8_t* write_buffer, size_t write_size) {
+  i2c_txn_t txn = {
+    .address = device_address,
+    .mem_address = I2C_NO_MEM_ADDRESS,
+    .write_buffer = write_buffer,
+    .write_size = write_size,
+  };
+  return i2c_execute(i2c_num, &txn);
+}
+
+esp_err_t i2c_write_read(unsigned i2c_num, unsigned device_address,
+                         const uint8_t* write_buffer, size_t write_size,
+                         uint8_t* read_buffer, size_t read_size) {
+  i2c_txn_t txn = {
+    .address = device_address,
+    .mem_address = I2C_NO_MEM_ADDRESS,
+    .write_buffer = write_buffer,
+    .write_size = write_size,
+    .read_buffer = read_buffer,
+    .read_size = read_size,
+  };
+  return i2c_execute(i2c_num, &txn);
+}
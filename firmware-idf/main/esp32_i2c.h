@@ -14,21 +14,78 @@ typedef enum {
   ...
 } esp_err_t;
 
-esp_err_t i2c_mem_write(unsigned i2c_num, unsigned device_address, unsigned mem_address,
-                        const uint8_t* write_buffer, size_t write_size);
+   Along with i2c_txn_t and the i2c_* functions declared below.
+
+   All traffic on a bus goes through a bus manager task that owns the bus.  Clients submit
+   transaction descriptors to it and are told of their completion through a callback, or they use
+   the synchronous wrappers, which submit a transaction and wait for it.  The manager takes the
+   transactions in the order they were submitted and chains those that are waiting for the same
+   device into one command link (with repeated starts between them), up to I2C_BATCH_MAX at a
+   time, so a client that submits many transactions at once (the OLED flushing its pages) does not
+   hold the bus for longer than one batch before another client's transactions get to run.
+
+   If a chained link fails, every transaction in it fails.  The driver does not say where in the
+   link the failure was, and the transactions before that point have taken effect, so none is run
+   again: neither a write nor a read that clears a status on the device can safely be repeated.
+   Since a link holds the transactions for only one device, a failing device does not fail the
+   transactions for the others. */
+
+/* Maximum number of transactions chained into one command link. */
+#define I2C_BATCH_MAX 8
+
+/* Timeout for one transaction on the bus. */
+#define I2C_TIMEOUT_MS 200
+
+/* No mem_address in a transaction. */
+#define I2C_NO_MEM_ADDRESS 0x100
+
+typedef struct i2c_txn i2c_txn_t;
 
-esp_err_t i2c_master_write_read_device(unsigned i2c_num, unsigned device_address,
-                                       const uint8_t* write_buffer, size_t write_size,
-                                       uint8_t* read_buffer, size_t read_size,
-                                       unsigned timeout_ticks);
+/* A transaction: START, the device address and the mem_address byte (if present) and the write
+   buffer (if not empty), then if there is something to read a repeated START, the device address
+   and the read.  A transaction with nothing to write or read does not touch the bus, but it
+   completes after all transactions submitted before it, so it can be used as a barrier.
 
-esp_err_t i2c_master_write_to_device(unsigned i2c_num, unsigned device_address,
-                                       const uint8_t* write_buffer, size_t write_size,
-                                       unsigned timeout_ticks);
+   The descriptor and its buffers belong to the bus manager from submission until `done` is
+   called.  `done` is called on the bus manager task with `result` filled in; it must not block. */
+struct i2c_txn {
+  unsigned address;             /* Unshifted device address */
+  unsigned mem_address;         /* Byte sent after the address, or I2C_NO_MEM_ADDRESS */
+  const uint8_t* write_buffer;
+  size_t write_size;
+  uint8_t* read_buffer;
+  size_t read_size;
+  void (*done)(i2c_txn_t* txn);
+  void* arg;                    /* For `done` */
+  esp_err_t result;             /* Set before `done` is called */
+};
 
- */
+/* Start the bus manager for the bus, if it is not already running.  The driver must have been
+   installed on the bus. */
+bool i2c_bus_start(unsigned i2c_num) WARN_UNUSED;
+
+/* Wait until all the transactions submitted to the bus have completed, eg before deleting the
+   driver. */
+void i2c_bus_drain(unsigned i2c_num);
+
+/* Submit a transaction to the bus manager.  Returns false if the manager is not running, in which
+   case `done` is not called. */
+bool i2c_submit(unsigned i2c_num, i2c_txn_t* txn) WARN_UNUSED;
+
+/* Submit a transaction and wait for its completion, returning its result.  `done` and `arg` are
+   overwritten. */
+esp_err_t i2c_execute(unsigned i2c_num, i2c_txn_t* txn) WARN_UNUSED;
+
+/* Synchronous wrappers. */
 
 esp_err_t i2c_mem_write(unsigned i2c_num, unsigned device_address, unsigned mem_address,
                         const uint8_t* write_buffer, size_t write_size) WARN_UNUSED;
 
+esp_err_t i2c_write(unsigned i2c_num, unsigned device_address,
+                    const uint8_t* write_buffer, size_t write_size) WARN_UNUSED;
+
+esp_err_t i2c_write_read(unsigned i2c_num, unsigned device_address,
+                         const uint8_t* write_buffer, size_t write_size,
+                         uint8_t* read_buffer, size_t read_size) WARN_UNUSED;
+
 #endif /* !esp32_i2c_h_included */
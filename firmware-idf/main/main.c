@@ -10,6 +10,7 @@
 #include <sys/time.h>
 #include <string.h>
 #include "esp_pm.h"
+#include "esp_timer.h"
 
 #include "device.h"
 #include "sound_player.h"
@@ -17,6 +18,7 @@
 #include "oled.h"
 #include "slideshow.h"
 #include "sensor.h"
+#include "trace.h"
 
 #ifdef SNAPPY_SOUND_EFFECTS
 /* Generated by the util/music-compiler program (see repo root) */
@@ -29,8 +31,8 @@ typedef struct {
   snappy_event_t code;
   union {
     int   ival;           /* For eg MEMS reading */
-    char* s;              /* For EV_MESSAGE, non-NULL heap-allocated NUL-terminated */
-    sensor_state_t* data; /* For EV_MONITOR_DATA, non-NULL heap-allocated */
+    const char* s;        /* For EV_MESSAGE, non-NULL static NUL-terminated */
+    sensor_state_t* data; /* For EV_MONITOR_DATA, non-NULL, from the sensor state pool */
   };
 } event_t;
    
@@ -46,6 +48,54 @@ static void init_queue() {
   }
 }
 
+/* Sensor readings travel through the event queue by pointer.  They are taken from a small fixed
+   pool instead of the heap so that the steady-state loop never allocates.  There are at most two
+   live readings in the slideshow plus one in flight, so four slots is ample; if the pool is
+   nevertheless exhausted the reading is dropped and counted. */
+
+#define SENSOR_STATE_POOL_SIZE 4
+
+static sensor_state_t sensor_state_pool[SENSOR_STATE_POOL_SIZE];
+static bool sensor_state_in_use[SENSOR_STATE_POOL_SIZE];
+static unsigned sensor_state_exhausted;
+
+/* The pool is used by the sensor task and the main task. */
+static portMUX_TYPE sensor_state_lock = portMUX_INITIALIZER_UNLOCKED;
+
+sensor_state_t* alloc_sensor_state() {
+  sensor_state_t* result = NULL;
+  taskENTER_CRITICAL(&sensor_state_lock);
+  for ( int i=0 ; i < SENSOR_STATE_POOL_SIZE ; i++ ) {
+    if (!sensor_state_in_use[i]) {
+      sensor_state_in_use[i] = true;
+      result = &sensor_state_pool[i];
+      break;
+    }
+  }
+  if (result == NULL) {
+    sensor_state_exhausted++;
+  }
+  taskEXIT_CRITICAL(&sensor_state_lock);
+  return result;
+}
+
+void free_sensor_state(sensor_state_t* data) {
+  if (data == NULL) {
+    return;
+  }
+  ptrdiff_t i = data - sensor_state_pool;
+  if (i < 0 || i >= SENSOR_STATE_POOL_SIZE || !sensor_state_in_use[i]) {
+    panic("Bad sensor state release");
+  }
+  taskENTER_CRITICAL(&sensor_state_lock);
+  sensor_state_in_use[i] = false;
+  taskEXIT_CRITICAL(&sensor_state_lock);
+}
+
+unsigned sensor_state_pool_exhausted() {
+  return sensor_state_exhausted;
+}
+
 void put_main_event(snappy_event_t code) {
   assert(code != EV_MESSAGE);
   event_t ev = { .code = code };
@@ -61,16 +111,14 @@ void put_main_event_with_ival(snappy_event_t code, int ival) {
 void put_main_event_with_data(snappy_event_t code, sensor_state_t* data) {
   assert(code == EV_MONITOR_DATA);
   event_t ev = { .code = code, .data = data };
-  xQueueSend(event_queue, &ev, 0); /* 0 because called from timer callbacks */
+  if (xQueueSend(event_queue, &ev, 0) != pdTRUE) { /* 0 because called from timer callbacks */
+    free_sensor_state(data);
+  }
 }
 
 void put_main_event_with_string(snappy_event_t code, const char* s) {
   assert(code == EV_MESSAGE);
-  char* t = strdup(s);
-  if (t == NULL) {
-    panic("OOM");
-  }
-  event_t ev = { .code = code, .s = t };
+  event_t ev = { .code = code, .s = s };
   xQueueSend(event_queue, &ev, 0); /* 0 because called from timer callbacks */
 }
 
@@ -125,6 +173,11 @@ void app_main(void) {
   /* Shared message queue */
   init_queue();
 
+  /* Learned state, read by the subsystems as they are initialized. */
+  if (!initialize_nvs()) {
+    LOG("Could not initialize NVS");
+  }
+
   if (!sensor_init()) {
     LOG("Could not start sensor subsystem");
     panic("Sensor fail");
@@ -195,18 +248,65 @@ void app_main(void) {
 
 static bool slideshow_mode = true;
 
+/* A press at least this long is a long press. */
+#define LONG_PRESS_MS 3000
+
+/* The time of the last button down, or -1 if the button is up.  The down edge can be lost when the
+   press wakes the device from light sleep, and such a press is always a short one. */
+static int64_t button_down_us = -1;
+
 static void button_down() {
   LOG("Button down");
+  button_down_us = esp_timer_get_time();
 }
 
 static void button_up() {
   /* FIXME - primitive */
   LOG("Button up");
-  put_main_event(EV_BUTTON_PRESS);
+  if (button_down_us >= 0 && esp_timer_get_time() - button_down_us >= LONG_PRESS_MS * 1000LL) {
+    put_main_event(EV_BUTTON_LONG_PRESS);
+  } else {
+    put_main_event(EV_BUTTON_PRESS);
+  }
+  button_down_us = -1;
+}
+
+/* Dispatch the edges recorded by the pin interrupts, in order. */
+static void handle_gpio_edges() {
+  static unsigned reported_overflows;
+  unsigned overflows = gpio_edge_overflows();
+  if (overflows != reported_overflows) {
+    LOG("GPIO edges dropped: %u", overflows - reported_overflows);
+    reported_overflows = overflows;
+  }
+  gpio_edge_t edge;
+  while (next_gpio_edge(&edge)) {
+    switch (edge.source) {
+    case EDGE_SOURCE_BUTTON:
+      if (edge.level) {
+        button_down();
+      } else {
+        button_up();
+      }
+      break;
+    case EDGE_SOURCE_PIR:
+#ifdef SNAPPY_READ_MOTION
+      record_motion();
+#endif
+      break;
+    case EDGE_SOURCE_SEN0514:
+#ifdef SNAPPY_GPIO_SEN0514_INT
+      record_air_sample();
+#endif
+      break;
+    }
+  }
 }
 
+/* Backstop: sensor.c closes the window when the sampling after the warmup is done, at most 60s
+   after the window opens.  The margin is for the timers, which may fire late. */
 static int monitoring_window_s() {
-  return 60;
+  return 70;
 }
 
 static int slideshow_mode_sleep_s() {
@@ -275,6 +375,10 @@ static void snappy_main() {
   for(;;) {
     event_t ev;
     if(xQueueReceive(event_queue, &ev, portMAX_DELAY)) {
+#ifdef SNAPPY_TRACE
+      int64_t start_us = esp_timer_get_time();
+      unsigned queued = uxQueueMessagesWaiting(event_queue);
+#endif
       switch (ev.code) {
 
       /*********************************************************************************/
@@ -334,6 +438,11 @@ static void snappy_main() {
         break;
 
       case EV_MONITOR_STOP:
+        /* Posted by sensor.c or by the backstop timer, whichever comes first. */
+        if (!in_monitoring_window) {
+          break;
+        }
+        cancel_master_timer();
         monitoring_stop();
         put_main_event(EV_START_CYCLE);
         LOG("Monitoring window closes");
@@ -349,6 +458,8 @@ static void snappy_main() {
         assert(ev.data != NULL);
 #ifdef SNAPPY_SLIDESHOW
         slideshow_new_data(ev.data);
+#else
+        free_sensor_state(ev.data);
 #endif
         break;
       }
@@ -372,6 +483,13 @@ static void snappy_main() {
         LOG("Button switching to mode %s", slideshow_next_mode ? "Slideshow mode" : "Monitoring mode");
         break;
 
+      case EV_BUTTON_LONG_PRESS:
+        /* Logging the trace takes a while, so it is done only when asked for. */
+#ifdef SNAPPY_TRACE
+        trace_dump();
+#endif
+        break;
+
       /*********************************************************************************/
       /* Monitor task */
 
@@ -415,14 +533,10 @@ static void snappy_main() {
         break;
 
       /*********************************************************************************/
-      /* Button monitor task */
+      /* Button and PIR interrupts */
 
-      case EV_BUTTON_DOWN:
-        button_down();
-        break;
-
-      case EV_BUTTON_UP:
-        button_up();
+      case EV_GPIO_EDGES:
+        handle_gpio_edges();
         break;
 
       /*********************************************************************************/
@@ -434,12 +548,6 @@ static void snappy_main() {
 #endif
         break;
 
-      case EV_MEMS_WORK:
-#ifdef SNAPPY_READ_NOISE
-        sample_noise();
-#endif
-        break;
-
       case EV_MEMS_SAMPLE:
 #ifdef SNAPPY_READ_NOISE
         record_noise(ev.ival);
@@ -449,6 +557,9 @@ static void snappy_main() {
       default:
         panic("Unknown event");
       }
+#ifdef SNAPPY_TRACE
+      trace_event(ev.code, start_us, queued);
+#endif
     } else {
       /* Timeout - just try again */
     }
@@ -548,6 +659,12 @@ static void bring_up_peripherals() {
   }
 #endif
 
+#ifdef SNAPPY_GPIO_SEN0514_INT
+  if (have_sen0514 && !initialize_gpio_sen0514_int()) {
+    LOG("Air/gas device interrupt inoperable");
+  }
+#endif
+
 #ifdef SNAPPY_GPIO_SEN0171
   /* Movement sensor */
   if (!initialize_gpio_sen0171()) {
@@ -556,10 +673,7 @@ static void bring_up_peripherals() {
 #endif
 
 #ifdef SNAPPY_ADC_SEN0487
-  /* Sound sensor - not currently in use */
-# error "Work needed"
-  /* FIXME: The ADC is initialized on startup, but there might not be anything to do for the MEMS
-     device per se */
+  /* Sound sensor */
   if (!initialize_adc_sen0487()) {
     LOG("Sound device inoperable");
   }
@@ -579,6 +693,9 @@ static void bring_up_peripherals() {
 static void shut_down_peripherals() {
 #ifdef SNAPPY_GPIO_SEN0171
   disable_gpio_sen0171();
+#endif
+#ifdef SNAPPY_GPIO_SEN0514_INT
+  disable_gpio_sen0514_int();
 #endif
   /* None of the other devices have shutdown actions, their init functions are idempotent. */
 #ifdef SNAPPY_I2C
@@ -54,6 +54,7 @@
 #define SNAPPY_SLIDESHOW        /* Rotating display of data values, if enabled */
 /*#define SNAPPY_SOUND_EFFECTS*/    /* Output sound to a speaker */
 #define SNAPPY_OLED             /* Output on a screen */
+/*#define SNAPPY_TRACE*/          /* Event trace in RAM, logged on a long button press; see trace.h */
 #define SNAPPY_READ_TEMPERATURE
 #define SNAPPY_READ_HUMIDITY
 #define SNAPPY_READ_PRESSURE
@@ -81,6 +82,11 @@
    https://wiki.dfrobot.com/SKU_SEN0514_Gravity_ENS160_Air_Quality_Sensor */
 #define SNAPPY_I2C_SEN0514
 
+/* The SEN0514's INTn output, as a data-ready interrupt on SEN0514_INT_PIN (see device.c).  With
+   this, the air sensor is read when it has a new sample rather than on the warmup clock.  INTn is
+   not connected on HW 1.0.0 - 1.2.0. */
+/*#define SNAPPY_GPIO_SEN0514_INT*/
+
 /* Sound sensor: DFRobot SEN0487 MEMS microphone
    https://wiki.dfrobot.com/Fermion_MEMS_Microphone_Sensor_SKU_SEN0487 */
 /*
@@ -131,6 +137,10 @@
 # error "SNAPPY_SLIDESHOW without an OLED device"
 #endif
 
+#if defined(SNAPPY_GPIO_SEN0514_INT) && !defined(SNAPPY_I2C_SEN0514)
+# error "SNAPPY_GPIO_SEN0514_INT without the sensor device"
+#endif
+
 #if defined(SNAPPY_READ_TEMPERATURE) && !defined(SNAPPY_I2C_SEN0500)
 # error "SNAPPY_READ_TEMPERATURE without a sensor device"
 #endif
@@ -195,6 +205,7 @@
 
 /* Task priorities for helper tasks. */
 #define PLAYER_PRIORITY 3
+#define I2C_BUS_PRIORITY 4
 
 /* Event codes.  The events are all sent on the main event queue, sometimes with payloads, see
    put_main_event() functions below and the implementation in main.c. */
@@ -207,6 +218,7 @@ typedef enum {
   EV_MONITOR_STOP,
   EV_MONITOR_DATA,
   EV_BUTTON_PRESS,
+  EV_BUTTON_LONG_PRESS,         /* Payload: nothing.  The button was held for LONG_PRESS_MS. */
 
   // Monitor task
   EV_MONITOR_WARMUP,
@@ -218,14 +230,12 @@ typedef enum {
   EV_SLIDESHOW_STOP,
   EV_SLIDESHOW_WORK,
 
-  // Button task
-  EV_BUTTON_DOWN,               /* Payload: nothing.  Button was pressed. */
-  EV_BUTTON_UP,                 /* Payload: nothing.  Button was released. */
+  // Button and PIR interrupts
+  EV_GPIO_EDGES,                /* Payload: nothing.  Edges are available from next_gpio_edge(). */
 
   // Sensor task
-  EV_MEMS_WORK,                 /* Payload: nothing.  Perform sound sampling. */
   EV_MEMS_SAMPLE,               /* Payload: sound level, 1..5. */
-  EV_MOTION_DETECTED,           /* Payload: nothing.  From ISR. */
+  EV_MOTION_DETECTED,           /* Payload: nothing.  PIR was already high when enabled. */
 } snappy_event_t;
 
 /* Put events into the event queue. */
@@ -234,13 +244,20 @@ void put_main_event_from_isr(snappy_event_t ev);
 
 void put_main_event_with_ival(snappy_event_t ev, int val);
 
-/* s points to statically allocated storage.  A heap copy will be made if necessary */
+/* s points to statically allocated storage.  It is not copied. */
 void put_main_event_with_string(snappy_event_t ev, const char* s);
 
-/* data points to heap-allocated data, ownership is transfered */
+/* data comes from alloc_sensor_state(), ownership is transfered.  If the queue is full the data
+   are returned to the pool. */
 typedef struct sensor_state sensor_state_t;
 void put_main_event_with_data(snappy_event_t ev, sensor_state_t* data);
 
+/* Fixed pool of sensor_state_t for passing readings through the event queue.  alloc returns NULL
+   if the pool is exhausted, and the exhaustion is counted.  free accepts NULL. */
+sensor_state_t* alloc_sensor_state();
+void free_sensor_state(sensor_state_t* data);
+unsigned sensor_state_pool_exhausted();
+
 void panic(const char* msg) NO_RETURN;
 
 #endif /* !main_h_included */
@@ -16,11 +16,46 @@ static sensor_state_t sensor;
 /* Trigger sensor readings */
 static TimerHandle_t warmup_clock = NULL;
 
-#define MONITORING_INTERVAL_S 15
+/* The warmup ends when the air sensor reports valid data, or after WARMUP_MAX_MS.  The sensors are
+   then sampled for SAMPLING_MS before the window closes.  The monitoring window in main.c is only a
+   backstop and must be longer than the sum.
+
+   Without the data-ready interrupt the air sensor's status is polled on each tick of the warmup
+   clock, once right after the sensor has been primed (if it stayed powered it is warm already)
+   and then from half the typical warmup time seen so far, which is learned as a running average
+   and kept in NVS.  With the interrupt the status of every sample is seen anyway. */
+#define WARMUP_MAX_MS 15000
+#define SAMPLING_MS 45000
+#define WARMUP_TICK_MS 1000
+/* The typical warmup time is saved only when it has moved this much, to spare the flash. */
+#define WARMUP_SAVE_DELTA_MS 1000
+#define WARMUP_NVS_KEY "warmup_ms"
+#ifdef SNAPPY_GPIO_SEN0514_INT
+/* The air sensor is read whenever it signals new data, so there are no timed reads during the
+   warmup. */
+# define WARMUP_READ_TICKS 0
+#else
+/* Read the sensors on every third tick, to activate them */
+# define WARMUP_READ_TICKS 3
+#endif
 
 static bool monitoring_running;
-static int num_warmups;
-#define NUM_WARMUPS 5
+static bool warming_up;
+static unsigned warmup_ticks;
+static TickType_t warmup_start;
+static unsigned typical_warmup_ms;      /* 0 until the air sensor has reported ready once */
+static unsigned saved_warmup_ms;        /* The value in NVS */
+#ifndef SNAPPY_GPIO_SEN0514_INT
+static bool have_polled_air_sensor;
+#endif
+
+#ifdef SNAPPY_GPIO_SEN0514_INT
+/* The latest sample delivered by the data-ready interrupt in this monitoring window */
+static dfrobot_sen0514_readings_t air_sample;
+static bool have_air_sample;
+/* True if the sensor signalled new data while it was settling after a write */
+static bool air_sample_deferred;
+#endif
 
 static void read_sensors(sensor_state_t* sensor);
 
@@ -29,17 +64,39 @@ static void warmup_callback(TimerHandle_t t) {
 }
 
 bool sensor_init() {
-  warmup_clock = xTimerCreate("warmup", pdMS_TO_TICKS((MONITORING_INTERVAL_S/NUM_WARMUPS)*1000),
+  warmup_clock = xTimerCreate("warmup", pdMS_TO_TICKS(WARMUP_TICK_MS),
                               /* restart= */ pdFALSE,
                               NULL, warmup_callback);
+  typical_warmup_ms = saved_warmup_ms = get_nvs_u32(WARMUP_NVS_KEY);
   return warmup_clock != NULL;
 }
 
 void monitoring_start() {
   if (!monitoring_running) {
-    num_warmups = 0;
+    warmup_ticks = 0;
+    warmup_start = xTaskGetTickCount();
+    warming_up = true;
     monitoring_running = true;
-    xTimerStart(warmup_clock, portMAX_DELAY);
+    /* This also starts the timer.  The period was changed for the sampling time.  It comes first
+       because the first air sample may end the warmup at once. */
+    xTimerChangePeriod(warmup_clock, pdMS_TO_TICKS(WARMUP_TICK_MS), portMAX_DELAY);
+#ifdef SNAPPY_GPIO_SEN0514_INT
+    /* If INTn is already high there will be no edge until the data have been read, so read them
+       now.  An edge that comes in between just causes a read that finds nothing new.  Then prime
+       the sensor.  If the sensor was just powered up it is still settling, and the read and the
+       priming are left to the warmup clock. */
+    have_air_sample = false;
+    air_sample_deferred = false;
+    if (have_sen0514) {
+      enable_gpio_sen0514_int();
+      record_air_sample();
+    }
+    sensor_state_t dummy;
+    memset(&dummy, 0, sizeof(dummy));
+    read_sensors(&dummy);
+#else
+    have_polled_air_sensor = false;
+#endif
 #ifdef SNAPPY_GPIO_SEN0171
     enable_gpio_sen0171();
 #endif
@@ -49,42 +106,122 @@ void monitoring_start() {
   }
 }
 
-void monitoring_warmup() {
-  if (monitoring_running) {
-    if (++num_warmups <= NUM_WARMUPS) {
-      /* Read the sensors but discard the values, we're warming up */
-      sensor_state_t dummy;
-      memset(&dummy, 0, sizeof(dummy));
-      read_sensors(&dummy);
-      xTimerStart(warmup_clock, portMAX_DELAY);
-      put_main_event_with_string(EV_MESSAGE, "Warming up");
-    } else {
-      sensor.motion = false;
-      sensor.have_sound_level = false;
+static void go_to_work() {
+  warming_up = false;
+  sensor.motion = false;
+#ifdef SNAPPY_READ_MOTION
+  sensor_set_valid(&sensor, FACTOR_MOTION, true);
+#endif
+  sensor_set_valid(&sensor, FACTOR_SOUND_LEVEL, false);
 #ifdef SNAPPY_READ_NOISE
-      sensor.sound_level = 0;
+  sensor.sound_level = 0;
+#endif
+  xTimerChangePeriod(warmup_clock, pdMS_TO_TICKS(SAMPLING_MS), portMAX_DELAY);
+  put_main_event_with_string(EV_MESSAGE, "Reading sensors");
+  LOG("Monitoring starts");
+}
+
+#ifdef SNAPPY_I2C_SEN0514
+static void air_sensor_ready() {
+  unsigned elapsed_ms = (xTaskGetTickCount() - warmup_start) * portTICK_PERIOD_MS;
+  typical_warmup_ms = typical_warmup_ms == 0 ? elapsed_ms : (3*typical_warmup_ms + elapsed_ms) / 4;
+  if (abs((int)typical_warmup_ms - (int)saved_warmup_ms) >= WARMUP_SAVE_DELTA_MS) {
+    put_nvs_u32(WARMUP_NVS_KEY, typical_warmup_ms);
+    saved_warmup_ms = typical_warmup_ms;
+  }
+  LOG("Air sensor ready after %u ms", elapsed_ms);
+  go_to_work();
+}
+
+# ifndef SNAPPY_GPIO_SEN0514_INT
+static bool poll_air_sensor() {
+  unsigned elapsed_ms = (xTaskGetTickCount() - warmup_start) * portTICK_PERIOD_MS;
+  dfrobot_sen0514_status_t status;
+  if (!have_sen0514 || !have_calibrated_sen0514 || !dfrobot_sen0514_is_ready(&sen0514)) {
+    return false;
+  }
+  if (have_polled_air_sensor && elapsed_ms < typical_warmup_ms / 2) {
+    return false;
+  }
+  have_polled_air_sensor = true;
+  return dfrobot_sen0514_get_sensor_status(&sen0514, &status) &&
+         status == DFROBOT_SEN0514_NORMAL_OPERATION;
+}
+# endif
 #endif
-      put_main_event_with_string(EV_MESSAGE, "Reading sensors");
-      LOG("Monitoring starts");
+
+void monitoring_warmup() {
+  if (!monitoring_running) {
+    return;
+  }
+  if (!warming_up) {
+    /* The sampling time is up */
+    put_main_event(EV_MONITOR_STOP);
+    return;
+  }
+  if (++warmup_ticks * WARMUP_TICK_MS >= WARMUP_MAX_MS) {
+    LOG("Air sensor not ready, warmup timed out");
+    go_to_work();
+    return;
+  }
+#ifdef SNAPPY_GPIO_SEN0514_INT
+  if (air_sample_deferred) {
+    record_air_sample();
+    if (!warming_up) {
+      return;
     }
   }
+  if (have_sen0514 && !have_calibrated_sen0514) {
+    sensor_state_t dummy;
+    memset(&dummy, 0, sizeof(dummy));
+    read_sensors(&dummy);
+  }
+#else
+# ifdef SNAPPY_I2C_SEN0514
+  if (poll_air_sensor()) {
+    air_sensor_ready();
+    return;
+  }
+# endif
+  if (warmup_ticks % WARMUP_READ_TICKS == 1) {
+    /* Read the sensors but discard the values, we're warming up */
+    sensor_state_t dummy;
+    memset(&dummy, 0, sizeof(dummy));
+    read_sensors(&dummy);
+    put_main_event_with_string(EV_MESSAGE, "Warming up");
+  }
+#endif
+  xTimerStart(warmup_clock, portMAX_DELAY);
 }
 
 void monitoring_stop() {
   if (monitoring_running) {
+#ifdef SNAPPY_GPIO_SEN0514_INT
+    if (air_sample_deferred) {
+      record_air_sample();
+    }
+#endif
     /* Read the sensors one final time, capture values */
     read_sensors(&sensor);
 #ifdef SNAPPY_GPIO_SEN0171
     disable_gpio_sen0171();
 #endif
+#ifdef SNAPPY_GPIO_SEN0514_INT
+    disable_gpio_sen0514_int();
+#endif
 #ifdef SNAPPY_READ_NOISE
     sound_sampler_stop();
 #endif
-    /* This timer shouldn't be running, but stop it anyway */
+    /* The timer is running if main's backstop closed the window */
     xTimerStop(warmup_clock, portMAX_DELAY);
     monitoring_running = false;
+    warming_up = false;
     put_main_event_with_string(EV_MESSAGE, "Sensors read");
-    sensor_state_t* data = malloc(sizeof(sensor_state_t));
+    sensor_state_t* data = alloc_sensor_state();
+    if (data == NULL) {
+      LOG("Sensor state pool exhausted, reading dropped");
+      return;
+    }
     memcpy(data, &sensor, sizeof(sensor_state_t));
     put_main_event_with_data(EV_MONITOR_DATA, data);
   }
@@ -98,95 +235,113 @@ void monitoring_stop() {
    providing an alternative device you're doing it wrong. */
 
 static void read_sensors(sensor_state_t* sensor) {
+#ifdef SNAPPY_I2C_SEN0500
+  /* All the environment readings come from one transaction. */
+  dfrobot_sen0500_raw_t env;
+  bool have_env = have_sen0500 && dfrobot_sen0500_read_raw(&sen0500, &env);
+#endif
+
 # ifdef SNAPPY_READ_TEMPERATURE
-  sensor->have_temperature =
-    have_sen0500 &&
-    dfrobot_sen0500_get_temperature(&sen0500, DFROBOT_SEN0500_TEMP_C, &sensor->temperature) &&
-    sensor->temperature != -45.0;
-  if (sensor->have_temperature) {
+  if (have_env) {
+    sensor->temperature = dfrobot_sen0500_temperature_from_raw(&env, DFROBOT_SEN0500_TEMP_C);
+  }
+  sensor_set_valid(sensor, FACTOR_TEMPERATURE, have_env && sensor->temperature != -45.0);
+  if (sensor_has(sensor, FACTOR_TEMPERATURE)) {
     LOG("Temperature = %.2f", sensor->temperature);
   }
 # endif
 
 # ifdef SNAPPY_READ_HUMIDITY
-  sensor->have_humidity =
-    have_sen0500 &&
-    dfrobot_sen0500_get_humidity(&sen0500, &sensor->humidity) &&
-    sensor->humidity != 0.0;
-  if (sensor->have_humidity) {
+  if (have_env) {
+    sensor->humidity = dfrobot_sen0500_humidity_from_raw(&env);
+  }
+  sensor_set_valid(sensor, FACTOR_HUMIDITY, have_env && sensor->humidity != 0.0);
+  if (sensor_has(sensor, FACTOR_HUMIDITY)) {
     LOG("Humidity = %.2f", sensor->humidity);
   }
 # endif
 
 # ifdef SNAPPY_READ_PRESSURE
-  sensor->have_atmospheric_pressure =
-    have_sen0500 &&
-    dfrobot_sen0500_get_atmospheric_pressure(&sen0500, DFROBOT_SEN0500_PRESSURE_HPA,
-					     &sensor->atmospheric_pressure) &&
-    sensor->atmospheric_pressure != 0;
-  if (sensor->have_atmospheric_pressure) {
+  if (have_env) {
+    sensor->atmospheric_pressure =
+      dfrobot_sen0500_atmospheric_pressure_from_raw(&env, DFROBOT_SEN0500_PRESSURE_HPA);
+  }
+  sensor_set_valid(sensor, FACTOR_ATMOSPHERIC_PRESSURE,
+                   have_env && sensor->atmospheric_pressure != 0);
+  if (sensor_has(sensor, FACTOR_ATMOSPHERIC_PRESSURE)) {
     LOG("Pressure = %u", sensor->atmospheric_pressure);
   }
 # endif
 
 # ifdef SNAPPY_READ_UV_INTENSITY
-  sensor->have_uv_intensity =
-    have_sen0500 &&
-    dfrobot_sen0500_get_ultraviolet_intensity(&sen0500, &sensor->uv_intensity) &&
-    sensor->uv_intensity != 0.0;
-  if (sensor->have_uv_intensity) {
+  if (have_env) {
+    sensor->uv_intensity = dfrobot_sen0500_ultraviolet_intensity_from_raw(&env);
+  }
+  sensor_set_valid(sensor, FACTOR_UV_INTENSITY, have_env && sensor->uv_intensity != 0.0);
+  if (sensor_has(sensor, FACTOR_UV_INTENSITY)) {
     LOG("UV intensity = %.2f", sensor->uv_intensity);
   }
 # endif
 
 # ifdef SNAPPY_READ_LIGHT_INTENSITY
-  sensor->have_luminous_intensity =
-    have_sen0500 &&
-    dfrobot_sen0500_get_luminous_intensity(&sen0500, &sensor->luminous_intensity) &&
-    sensor->luminous_intensity != 0.0;
-  if (sensor->have_luminous_intensity) {
+  if (have_env) {
+    sensor->luminous_intensity = dfrobot_sen0500_luminous_intensity_from_raw(&env);
+  }
+  sensor_set_valid(sensor, FACTOR_LUMINOUS_INTENSITY,
+                   have_env && sensor->luminous_intensity != 0.0);
+  if (sensor_has(sensor, FACTOR_LUMINOUS_INTENSITY)) {
     LOG("Luminous intensity = %.2f", sensor->luminous_intensity);
   }
 # endif
 
 #if defined(SNAPPY_READ_CO2) || defined(SNAPPY_READ_VOLATILE_ORGANICS) || defined(SNAPPY_READ_AIR_QUALITY_INDEX)
-  dfrobot_sen0514_status_t stat;
+  dfrobot_sen0514_readings_t air;
 
   /* TODO: It's far from clear *when* this calibration should occur - whether it's every time we
-     want to read the device or just the first time, or when temp and humidity change "a lot".  */
+     want to read the device or just the first time, or when temp and humidity change "a lot".
+     Priming a device that is still settling would block, so that is left to the next pass.  */
   if (have_sen0514 &&
-      sensor->have_temperature &&
-      sensor->have_humidity &&
+      sensor_has(sensor, FACTOR_TEMPERATURE) &&
+      sensor_has(sensor, FACTOR_HUMIDITY) &&
       !have_calibrated_sen0514 &&
+      dfrobot_sen0514_is_ready(&sen0514) &&
       dfrobot_sen0514_prime(&sen0514, sensor->temperature, sensor->humidity/100.0f)) {
     have_calibrated_sen0514 = true;
   }
 
-  if (have_calibrated_sen0514 &&
-      dfrobot_sen0514_get_sensor_status(&sen0514, &stat) &&
-      /* See the header for an explanation of the status codes */
-      stat != DFROBOT_SEN0514_INVALID_OUTPUT) {
+#ifdef SNAPPY_GPIO_SEN0514_INT
+  /* The samples are read as they come, take the latest. */
+  bool have_air = have_air_sample;
+  if (have_air) {
+    air = air_sample;
+  }
+#else
+  /* If the device was primed just now it is still settling.  Don't wait for it; the readings will
+     be picked up on the next pass. */
+  bool have_air = have_calibrated_sen0514 &&
+                  dfrobot_sen0514_is_ready(&sen0514) &&
+                  dfrobot_sen0514_read_all(&sen0514, &air);
+#endif
+  /* See the header for an explanation of the status codes */
+  if (have_air && air.status != DFROBOT_SEN0514_INVALID_OUTPUT) {
 # ifdef SNAPPY_READ_CO2
-    sensor->have_co2 =
-      dfrobot_sen0514_get_co2(&sen0514, &sensor->co2) &&
-      sensor->co2 > 400;
-    if (sensor->have_co2) {
+    sensor->co2 = air.co2;
+    sensor_set_valid(sensor, FACTOR_CO2, sensor->co2 > 400);
+    if (sensor_has(sensor, FACTOR_CO2)) {
       LOG("CO2 = %u", sensor->co2);
     }
 # endif
 # ifdef SNAPPY_READ_VOLATILE_ORGANICS
-    sensor->have_tvoc =
-      dfrobot_sen0514_get_total_volatile_organic_compounds(&sen0514, &sensor->tvoc) &&
-      sensor->tvoc > 0;
-    if (sensor->have_tvoc) {
+    sensor->tvoc = air.tvoc;
+    sensor_set_valid(sensor, FACTOR_TVOC, sensor->tvoc > 0);
+    if (sensor_has(sensor, FACTOR_TVOC)) {
       LOG("TVOC = %u", sensor->tvoc);
     }
 # endif
 # ifdef SNAPPY_READ_AIR_QUALITY_INDEX
-    sensor->have_aqi =
-      dfrobot_sen0514_get_air_quality_index(&sen0514, &sensor->aqi) &&
-      sensor->aqi >= 1 && sensor->aqi <= 5;
-    if (sensor->have_aqi) {
+    sensor->aqi = air.aqi;
+    sensor_set_valid(sensor, FACTOR_AQI, sensor->aqi >= 1 && sensor->aqi <= 5);
+    if (sensor_has(sensor, FACTOR_AQI)) {
       LOG("AQI = %u", sensor->aqi);
     }
 # endif
@@ -200,5 +355,29 @@ void record_motion() {
 
 void record_noise(uint32_t level) {
   sensor.sound_level = level;
-  sensor.have_sound_level = true;
+  sensor_set_valid(&sensor, FACTOR_SOUND_LEVEL, true);
+}
+
+#ifdef SNAPPY_GPIO_SEN0514_INT
+void record_air_sample() {
+  dfrobot_sen0514_readings_t air;
+  if (!monitoring_running || !have_sen0514) {
+    return;
+  }
+  if (!dfrobot_sen0514_is_ready(&sen0514)) {
+    /* INTn stays high until the data are read, so there will be no new edge.  Read them on the
+       next tick of the warmup clock, or when the window closes. */
+    air_sample_deferred = true;
+    return;
+  }
+  air_sample_deferred = false;
+  if (dfrobot_sen0514_read_all(&sen0514, &air) &&
+      air.new_data) {
+    air_sample = air;
+    have_air_sample = true;
+    if (warming_up && air.status == DFROBOT_SEN0514_NORMAL_OPERATION) {
+      air_sensor_ready();
+    }
+  }
 }
+#endif
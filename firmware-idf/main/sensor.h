@@ -5,59 +5,61 @@
 
 #include "main.h"
 
-/* Sensor readings. Zero-initializing this brings it to a known good state. */
+/* The factors, in the order they are shown.  SENSOR_FACTORS(X) expands to X(FLAG, field, type) for
+   each factor; the fields of sensor_state_t, their validity bits FACTOR_FLAG, and the slideshow's
+   table of slides are generated from it. */
+#define SENSOR_FACTORS(X)                                                                   \
+  X(TEMPERATURE, temperature, float)                   /* Degrees C */                      \
+  X(HUMIDITY, humidity, float)                         /* Percent relative humidity */      \
+  X(ATMOSPHERIC_PRESSURE, atmospheric_pressure, unsigned) /* 10^2 Pascal */                 \
+  X(UV_INTENSITY, uv_intensity, float)                 /* [0,15), supposedly a UV index */  \
+  X(LUMINOUS_INTENSITY, luminous_intensity, float)     /* Lux */                            \
+  X(CO2, co2, unsigned)                                /* Equivalent CO_2 content, ppm */   \
+  X(TVOC, tvoc, unsigned)                              /* Total volatile organics, ppb */   \
+  X(AQI, aqi, unsigned)                                /* 1..5, air quality index */        \
+  X(MOTION, motion, bool)                              /* Motion in the window, see below */ \
+  X(SOUND_LEVEL, sound_level, unsigned)                /* 1 (quiet) to 5 (unbearable) */
+
+typedef enum {
+#define SENSOR_FACTOR_BIT(FLAG, field, type) FACTOR_##FLAG,
+  SENSOR_FACTORS(SENSOR_FACTOR_BIT)
+#undef SENSOR_FACTOR_BIT
+  NUM_FACTORS
+} sensor_factor_t;
+
+_Static_assert(NUM_FACTORS <= 32, "Too many factors for the validity mask");
+
+/* Sensor readings. Zero-initializing this brings it to a known good state.
+
+   The motion factor is valid throughout the monitoring window if SNAPPY_READ_MOTION is enabled: it
+   doesn't look like we have any way of detecting whether there is a motion sensor or not. */
 typedef struct sensor_state {
-  /* Degrees C */
-  bool have_temperature;
-  float temperature;
-
-  /* Percent relative humidity */
-  bool have_humidity;
-  float humidity;
-
-  /* 10^2 Pascal */
-  bool have_atmospheric_pressure;
-  unsigned atmospheric_pressure;
-
-  /* [0,15), supposedly a UV index value */
-  bool have_uv_intensity;
-  float uv_intensity;
-
-  /* Lux */
-  bool have_luminous_intensity;
-  float luminous_intensity;
-
-  /* Equivalent CO_2 content, ppm */
-  bool have_co2;
-  unsigned co2;
-
-  /* Total volatile organic compounds, ppb */
-  bool have_tvoc;
-  unsigned tvoc;
-
-  /* 1..5, air quality index */
-  bool have_aqi;
-  unsigned aqi;
+  uint32_t valid;                       /* Bit FACTOR_X is set iff the field for X is valid */
+#define SENSOR_FIELD(FLAG, field, type) type field;
+  SENSOR_FACTORS(SENSOR_FIELD)
+#undef SENSOR_FIELD
+} sensor_state_t;
 
-  /* Whether motion was detected during the monitoring window or not, true or false.  It doesn't
-     look like we have any way of detecting whether there is a motion sensor or not. */
-  bool motion;
+static inline bool sensor_has(const sensor_state_t* s, sensor_factor_t f) {
+  return (s->valid >> f) & 1;
+}
 
-  /* Sound level on a scale from 1 (quiet) to 5 (unbearable) */
-  bool have_sound_level;
-  unsigned sound_level;
-} sensor_state_t;
+static inline void sensor_set_valid(sensor_state_t* s, sensor_factor_t f, bool valid) {
+  s->valid = valid ? s->valid | (1u << f) : s->valid & ~(1u << f);
+}
 
 bool sensor_init() WARN_UNUSED;   /* True on success, false on failure */
 
 void monitoring_start();           /* In response to EV_MONITOR_START */
 void monitoring_stop();            /* In response to EV_MONITOR_STOP */
-void monitoring_warmup();
-
-void sample_noise();
+void monitoring_warmup();          /* In response to EV_MONITOR_WARMUP; posts EV_MONITOR_STOP when
+                                      the sampling time after the warmup is up */
 
 void record_motion();              /* In response to EV_MOTION */
 void record_noise(uint32_t level); /* In response to EV_SOUND_SAMPLE */
+#ifdef SNAPPY_GPIO_SEN0514_INT
+void record_air_sample();          /* In response to EDGE_SOURCE_SEN0514 */
+#endif
 
 /* Abstraction leak: information about whether this specific sensor has been calibrated, used for
    some logging.
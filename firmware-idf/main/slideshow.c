@@ -20,7 +20,7 @@ static TimerHandle_t slideshow_clock;
 static sensor_state_t* current_data;
 static sensor_state_t* next_data;
 
-static char* message;
+static const char* message;
 
 static void slideshow_clock_callback(TimerHandle_t t) {
   put_main_event(EV_SLIDESHOW_WORK);
@@ -50,160 +50,135 @@ void slideshow_new_data(sensor_state_t* data) {
     assert(next_data == NULL);
     current_data = data;
   } else {
-    if (next_data != NULL) {
-      free(next_data);
-    }
+    free_sensor_state(next_data);
     next_data = data;
   }
 }
 
-void slideshow_show_message_once(char* msg) {
-  free(message);
+void slideshow_show_message_once(const char* msg) {
   message = msg;
 }
 
+/* The slides for the factors, one per factor in sensor.h.  A slide is only shown if its factor is
+   valid. */
+
+static void show_temperature(const sensor_state_t* data) {
+  oled_show_text("Temperature\n\n%.1f C", data->temperature);
+}
+
+static void show_humidity(const sensor_state_t* data) {
+  oled_show_text("Humidity\n\n%.1f %%", data->humidity);
+}
+
+static void show_atmospheric_pressure(const sensor_state_t* data) {
+  oled_show_text("Pressure\n\n%u hPa", data->atmospheric_pressure);
+}
+
+static void show_uv_intensity(const sensor_state_t* data) {
+  oled_show_text("UV index\n\n%d", (int)roundf(data->uv_intensity));
+}
+
+static void show_luminous_intensity(const sensor_state_t* data) {
+  oled_show_text("Light\n\n%.1f lux", data->luminous_intensity);
+}
+
+static void show_co2(const sensor_state_t* data) {
+  const char* co2_text;
+  /* The scale is from the data sheet */
+  if (data->co2 <= 600) {
+    co2_text = "excellent";
+  } else if (data->co2 <= 800) {
+    co2_text = "good";
+  } else if (data->co2 <= 1000) {
+    co2_text = "adequate";
+  } else if (data->co2 <= 1500) {
+    co2_text = "bad";
+  } else {
+    co2_text = "terrible";
+  };
+  oled_show_text("CO_2\n\n%uppm - %s", data->co2, co2_text);
+}
+
+static void show_tvoc(const sensor_state_t* data) {
+  const char* tvoc_text;
+  /* The scale is partly from the data sheet */
+  if (data->tvoc < 50) {
+    tvoc_text = "good";
+  } else if (data->tvoc < 200) {
+    tvoc_text = "adequate";
+  } else if (data->tvoc < 750) {
+    tvoc_text = "not great";
+  } else if (data->tvoc < 6000) {
+    tvoc_text = "bad";
+  } else {
+    tvoc_text = "dangerous";
+  }
+  oled_show_text("Volatile organics\n\n%uppb - %s", data->tvoc, tvoc_text);
+}
+
+static void show_aqi(const sensor_state_t* data) {
+  /* The scale is from the data sheet */
+  static const char* aqi_text[] = {
+    "",
+    "excellent",
+    "good",
+    "adequate",
+    "bad",
+    "terrible" };
+  oled_show_text("Air quality index\n\n%d - %s", data->aqi, aqi_text[data->aqi]);
+}
+
+static void show_motion(const sensor_state_t* data) {
+  oled_show_text("Movement\n\n%s", data->motion ? "Yes" : "No");
+}
+
+static void show_sound_level(const sensor_state_t* data) {
+  /* The scale is made-up */
+  static const char* sound_text[] = {
+    "",
+    "eerie",
+    "quiet",
+    "normal",
+    "bad",
+    "runway?" };
+  oled_show_text("Sound level\n\n%d - %s", data->sound_level, sound_text[data->sound_level]);
+}
+
+static void (*const slides[NUM_FACTORS])(const sensor_state_t* data) = {
+#define SLIDE(FLAG, field, type) [FACTOR_##FLAG] = show_##field,
+  SENSOR_FACTORS(SLIDE)
+#undef SLIDE
+};
+
+/* Slide 0 is the splash screen, slide i > 0 shows factor i-1.  After the last slide a tick is
+   spent showing nothing new before the cycle restarts. */
 void slideshow_next() {
   if (message) {
     oled_show_text("%s", message);
-    free(message);
     message = NULL;
     return;
   }
 
-  switch (slide_index) {
-  case 0:
+  if (slide_index == 0) {
     slide_index++;
     oled_splash_screen();
     if (next_data != NULL) {
-      free(current_data);
+      free_sensor_state(current_data);
       current_data = next_data;
       next_data = NULL;
     }
-    break;
-    /* FALLTHROUGH */
-  case 1:
-    slide_index++;
-    if (current_data && current_data->have_temperature) {
-      oled_show_text("Temperature\n\n%.1f C", current_data->temperature);
-      break;
-    }
-    /* FALLTHROUGH */
-  case 2:
-    slide_index++;
-    if (current_data && current_data->have_humidity) {
-      oled_show_text("Humidity\n\n%.1f %%", current_data->humidity);
-      break;
-    }
-    /* FALLTHROUGH */
-  case 3:
-    slide_index++;
-    if (current_data && current_data->have_atmospheric_pressure) {
-      oled_show_text("Pressure\n\n%u hPa", current_data->atmospheric_pressure);
-      break;
-    }
-    /* FALLTHROUGH */
-  case 4:
-    slide_index++;
-    if (current_data && current_data->have_uv_intensity) {
-      oled_show_text("UV index\n\n%d", (int)roundf(current_data->uv_intensity));
-      break;
-    }
-    /* FALLTHROUGH */
-  case 5:
-    slide_index++;
-    if (current_data && current_data->have_luminous_intensity) {
-      oled_show_text("Light\n\n%.1f lux", current_data->luminous_intensity);
-      break;
-    }
-    /* FALLTHROUGH */
-  case 6:
-    slide_index++;
-    if (current_data && current_data->have_co2) {
-      const char* co2_text;
-      /* The scale is from the data sheet */
-      if (current_data->co2 <= 600) {
-        co2_text = "excellent";
-      } else if (current_data->co2 <= 800) {
-        co2_text = "good";
-      } else if (current_data->co2 <= 1000) {
-        co2_text = "adequate";
-      } else if (current_data->co2 <= 1500) {
-        co2_text = "bad";
-      } else {
-        co2_text = "terrible";
-      };
-      oled_show_text("CO_2\n\n%uppm - %s", current_data->co2, co2_text);
-      break;
-    }
-    /* FALLTHROUGH */
-  case 7:
-    slide_index++;
-    if (current_data && current_data->have_tvoc) {
-      const char* tvoc_text;
-      /* The scale is partly from the data sheet */
-      if (current_data->tvoc < 50) {
-        tvoc_text = "good";
-      } else if (current_data->tvoc < 200) {
-        tvoc_text = "adequate";
-      } else if (current_data->tvoc < 750) {
-        tvoc_text = "not great";
-      } else if (current_data->tvoc < 6000) {
-        tvoc_text = "bad";
-      } else {
-        tvoc_text = "dangerous";
-      }
-      oled_show_text("Volatile organics\n\n%uppb - %s", current_data->tvoc, tvoc_text);
-      break;
-    }
-    /* FALLTHROUGH */
-  case 8:
-    slide_index++;
-    if (current_data && current_data->have_aqi) {
-      /* The scale is from the data sheet */
-      static const char* aqi_text[] = {
-        "",
-        "excellent",
-        "good",
-        "adequate",
-        "bad",
-        "terrible" };
-      oled_show_text("Air quality index\n\n%d - %s", current_data->aqi, aqi_text[current_data->aqi]);
-      break;
-    }
-    /* FALLTHROUGH */
-  case 9:
-    slide_index++;
-#ifdef SNAPPY_READ_MOTION
-    if (current_data) {
-      oled_show_text("Movement\n\n%s", current_data->motion ? "Yes" : "No");
-      break;
-    }
-#endif
-    /* FALLTHROUGH */
-  case 10:
+    return;
+  }
+
+  while (slide_index <= NUM_FACTORS) {
+    sensor_factor_t f = slide_index - 1;
     slide_index++;
-#ifdef SNAPPY_READ_SOUND
-    if (current_data && current_data->have_sound_level) {
-      /* The scale is made-up */
-      static const char* sound_text[] = {
-        "",
-        "eerie",
-        "quiet",
-        "normal",
-        "bad",
-        "runway?" };
-      oled_show_text("Sound level\n\n%d - %s", current_data->sound_level, sound_text[current_data->sound_level]);
-      break;
+    if (current_data && sensor_has(current_data, f)) {
+      slides[f](current_data);
+      return;
     }
-#endif
-    /* FALLTHROUGH */
-  case 11:
-    slide_index++;
-    /* FALLTHROUGH */
-  default:
-    slide_index = 0;
-    break;
   }
+  slide_index = 0;
 }
 
 #endif  /* SNAPPY_SLIDESHOW */
@@ -21,10 +21,10 @@ void slideshow_next();
 /* Reset slideshow to start of cycle */
 void slideshow_reset();
 
-/* Takes ownership of data, which is always malloc'd */
+/* Takes ownership of data, which always comes from alloc_sensor_state() */
 void slideshow_new_data(sensor_state_t* data);
 
-/* Takes ownership of msg, which is always malloc'd */
-void slideshow_show_message_once(char* msg);
+/* msg has static extent and is not copied */
+void slideshow_show_message_once(const char* msg);
 
 #endif /* !slideshow_h_included */
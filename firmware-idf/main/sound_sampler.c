@@ -1,58 +1,74 @@
 /* -*- fill-column: 100; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
 
-/* Generic sound sampler.  The sampler can be enabled or disabled.  When it is enabled, it will read
-   the available sound sampler device, integrate the readings over time, and occasionally report the
-   integrated readings on the event queue. */
+/* Generic sound sampler.  The sampler can be enabled or disabled.  When it is enabled, a task reads
+   blocks of samples from the available sound sampler device and integrates the readings over time,
+   and when it is disabled it reports the integrated reading on the event queue. */
 
 #include "sound_sampler.h"
 
 #ifdef SNAPPY_READ_NOISE
 
 #include "device.h"
+#include "dfrobot_sen0487.h"
+#include "freertos/semphr.h"
 
-#define SAMPLER_INTERVAL_MS 10
+#define SAMPLER_PRIORITY 2
 
-static TimerHandle_t sampler_clock;
-static bool sampler_running;
+static TaskHandle_t sampler_task;
+static SemaphoreHandle_t sampler_parked;
+static volatile bool sampler_running;
 static unsigned sampler_accum;
 static bool have_sampled_value;
 
-static void clock_callback(TimerHandle_t t) {
-  put_main_event(EV_MEMS_WORK);
+static void sampler_loop(void* arg) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    unsigned peak = 0;
+    bool have_peak = false;
+#ifdef SNAPPY_ADC_SEN0487
+    bool ok = sen0487_start();
+    if (!ok) {
+      LOG("Could not start sound device");
+    }
+    while (ok && sampler_running) {
+      unsigned block_peak;
+      if (sen0487_read_peak(&block_peak)) {
+        peak = block_peak > peak ? block_peak : peak;
+        have_peak = true;
+      }
+    }
+    if (ok) {
+      sen0487_stop();
+    }
+#endif
+    /* The semaphore orders these stores before the main task's reads. */
+#ifdef SNAPPY_ADC_SEN0487
+    sampler_accum = sen0487_sound_level(peak);
+#endif
+    have_sampled_value = have_peak;
+    xSemaphoreGive(sampler_parked);
+  }
 }
 
 bool sound_sampler_begin() {
-  sampler_clock = xTimerCreate("sampler",
-                               pdMS_TO_TICKS(SAMPLER_INTERVAL_MS),
-                               pdTRUE,
-                               NULL,
-                               clock_callback);
-  return sampler_clock != NULL;
+  sampler_parked = xSemaphoreCreateBinary();
+  if (sampler_parked == NULL) {
+    return false;
+  }
+  return xTaskCreate(sampler_loop, "sampler", 2048, NULL, SAMPLER_PRIORITY, &sampler_task) == pdPASS;
 }
 
 void sound_sampler_start() {
-  if (!sampler_running) {
-    xTimerStart(sampler_clock, portMAX_DELAY);
-    sampler_accum = 0;
-    have_sampled_value = false;
+  if (sampler_task != NULL && !sampler_running) {
     sampler_running = true;
-  }
-}
-
-void sample_noise() {
-  if (sampler_running) {
-#ifdef SNAPPY_ADC_SEN0487
-    unsigned r = sen0487_sound_level();
-#endif
-    have_sampled_value = true;
-    sampler_accum = r > sampler_accum ? r : sampler_accum;
+    xTaskNotifyGive(sampler_task);
   }
 }
 
 void sound_sampler_stop() {
   if (sampler_running) {
-    sampler_running = 0;
-    xTimerStop(sampler_clock, portMAX_DELAY);
+    sampler_running = false;
+    xSemaphoreTake(sampler_parked, portMAX_DELAY);
     if (have_sampled_value) {
       put_main_event_with_ival(EV_MEMS_SAMPLE, sampler_accum);
     }
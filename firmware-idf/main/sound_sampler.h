@@ -7,17 +7,15 @@
 
 #ifdef SNAPPY_READ_NOISE
 
-/* Initialize the sampler subsystem. */
+/* Initialize the sampler subsystem and create the sampler task. */
 bool sound_sampler_begin() WARN_UNUSED;
 
-/* Start the sound sensor timer, this will place tick events on the main queue causing the
-   main thread to call sound_sampler_work().  */
+/* Start sampling in the background.  The sampler task consumes blocks of conversions from the
+   sound device as they become available; the main task is not involved until the sampler stops. */
 void sound_sampler_start();
 
-/* Perform some sampling. */
-void sample_noise();
-
-/* Stop the sound sensor, report the current reading on the main event queue if pertinent.  */
+/* Stop the sound sensor and wait for the sampler task to finish its last block, then report the
+   reading for the window on the main event queue if pertinent.  */
 void sound_sampler_stop();
 
 #endif /* SNAPPY_READ_NOISE */
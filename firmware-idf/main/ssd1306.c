@@ -30,7 +30,7 @@ SOFTWARE.
 */
 
 #include "ssd1306.h"
-#include "esp32_i2c.h"
+#include <string.h>
 
 static void ssd1306_WriteCommand(SSD1306_Device_t* device, uint8_t byte) {
   if (!device->i2c_failure) {
@@ -139,7 +139,7 @@ static void ssd1306_Init(SSD1306_Device_t* device) {
 }
 
 bool ssd1306_Create(SSD1306_Device_t* device, unsigned bus, unsigned i2c_addr,
-                    unsigned width, unsigned height, unsigned flags) {
+                    unsigned width, unsigned height, unsigned flags, uint8_t* flush_buffer) {
   device->bus = bus;
   device->addr = i2c_addr;
   device->width = width;
@@ -148,24 +148,78 @@ bool ssd1306_Create(SSD1306_Device_t* device, unsigned bus, unsigned i2c_addr,
   device->initialized = false;
   device->display_on = false;
   device->i2c_failure = false;
+  device->flush_buffer = flush_buffer;
+  device->flush_failed = false;
+  device->flush_idle = xSemaphoreCreateBinaryStatic(&device->flush_idle_mem);
+  xSemaphoreGive(device->flush_idle);
   ssd1306_Init(device);
   return !device->i2c_failure;
 }
 
+static void page_flushed(i2c_txn_t* txn) {
+  SSD1306_Device_t* device = txn->arg;
+  if (txn->result != ESP_OK) {
+    device->flush_failed = true;
+  }
+  if (txn == &device->flush_txns[device->height/8 - 1]) {
+    /* The semaphore orders the store to flush_failed before the next flush reads it. */
+    xSemaphoreGive(device->flush_idle);
+  }
+}
+
 void ssd1306_UpdateScreen(SSD1306_Device_t* device, framebuf_t* fb, unsigned x_offset) {
   unsigned x_offset_lower = x_offset & 0x0F;
   unsigned x_offset_upper = (x_offset >> 4) & 0x07;
+  unsigned pages = device->height/8;
+  unsigned page_size = SSD1306_PAGE_HEADER_SIZE + device->width;
+
+  xSemaphoreTake(device->flush_idle, portMAX_DELAY);
+  if (device->flush_failed) {
+    device->i2c_failure = true;
+  }
+  if (device->i2c_failure) {
+    xSemaphoreGive(device->flush_idle);
+    return;
+  }
+  device->flush_failed = false;
+
   // Write data to each page of RAM. Number of pages
   // depends on the screen height:
   //
   //  * 32px   ==  4 pages
   //  * 64px   ==  8 pages
   //  * 128px  ==  16 pages
-  for(uint8_t i = 0; i < device->height/8; i++) {
-    ssd1306_WriteCommand(device, 0xB0 + i); // Set the current RAM page address.
-    ssd1306_WriteCommand(device, 0x00 + x_offset_lower);
-    ssd1306_WriteCommand(device, 0x10 + x_offset_upper);
-    ssd1306_WriteData(device, &fb->buffer[fb->width*i], device->width);
+  //
+  // Each page is one transaction: the control byte 0x80 says that one command byte follows, and
+  // 0x40 that the rest is data.  The pages are submitted together so that the bus manager can
+  // chain them.
+  for(uint8_t i = 0; i < pages; i++) {
+    uint8_t* page = &device->flush_buffer[page_size*i];
+    page[0] = 0x80;
+    page[1] = 0xB0 + i; // Set the current RAM page address.
+    page[2] = 0x80;
+    page[3] = 0x00 + x_offset_lower;
+    page[4] = 0x80;
+    page[5] = 0x10 + x_offset_upper;
+    page[6] = 0x40;
+    memcpy(&page[SSD1306_PAGE_HEADER_SIZE], &fb->buffer[fb->width*i], device->width);
+    device->flush_txns[i] = (i2c_txn_t){
+      .address = device->addr,
+      .mem_address = I2C_NO_MEM_ADDRESS,
+      .write_buffer = page,
+      .write_size = page_size,
+      .done = page_flushed,
+      .arg = device,
+    };
+  }
+  for(uint8_t i = 0; i < pages; i++) {
+    // Submission fails only if the bus manager is not running, so either every page is submitted
+    // or none is.
+    if (!i2c_submit(device->bus, &device->flush_txns[i])) {
+      device->i2c_failure = true;
+      xSemaphoreGive(device->flush_idle);
+      return;
+    }
   }
 }
 
@@ -34,6 +34,17 @@ SOFTWARE.
 
 #include "main.h"
 #include "framebuf.h"
+#include "esp32_i2c.h"
+#include "freertos/semphr.h"
+
+/* The display is flushed one page (eight pixel rows) per transaction.  Each page is sent with a
+   header that addresses it, see ssd1306_UpdateScreen(). */
+#define SSD1306_MAX_PAGES 16
+#define SSD1306_PAGE_HEADER_SIZE 7
+
+/* The size of the buffer that ssd1306_Create() needs for flushing a display of the given size. */
+#define SSD1306_FLUSH_BUFFER_SIZE(width, height) \
+  (((height) / 8) * (SSD1306_PAGE_HEADER_SIZE + (width)))
 
 /* All fields should be considered private to the driver.  */
 typedef struct {
@@ -45,6 +56,11 @@ typedef struct {
   bool     i2c_failure;		/* Set to true if low-level i2c write commands fail */
   bool     initialized;         /* Set to true once ssd1306_Init succeeds */
   bool     display_on;          /* Set to true once the display has been enabled */
+  uint8_t* flush_buffer;        /* Copy of the screen being flushed, with page headers */
+  i2c_txn_t flush_txns[SSD1306_MAX_PAGES];
+  bool     flush_failed;        /* Set by the bus manager, read once flush_idle is taken */
+  SemaphoreHandle_t flush_idle; /* Available when no flush is in progress */
+  StaticSemaphore_t flush_idle_mem;
 } SSD1306_Device_t;
 
 enum {
@@ -55,21 +71,26 @@ enum {
 
 /* This will initialize the device struct, then initialize the hardware device.  The I2C bus must
    already have been turned on.  The only valid heights are 32, 64, and 128.  The effects of other
-   values are unspecified.  Flags is bitwise OR of SSD1306_FLAG_ values above.  Returns false if
-   device initialization failed.
+   values are unspecified.  Flags is bitwise OR of SSD1306_FLAG_ values above.  `flush_buffer` must
+   have room for SSD1306_FLUSH_BUFFER_SIZE(width, height) bytes and belongs to the driver from now
+   on.  Returns false if device initialization failed.
 
    This will work regardless of the previous contents of `dev` and the current state of the
    display.  */
 bool ssd1306_Create(SSD1306_Device_t* dev, unsigned bus, unsigned i2c_addr,
-                    unsigned width, unsigned height, unsigned flags) WARN_UNUSED;
+                    unsigned width, unsigned height, unsigned flags, uint8_t* flush_buffer)
+  WARN_UNUSED;
 
 /* Device operations.  Where noted these set device->i2c_failure if there's a write failure to the
    device, and will frequently be no-ops if that flag is already set.  Writes outside the buffer
    bounds will silently be ignored.  */
 
 /* Flush the buffer to the OLED device.  If your screen horizontal axis does not start in column 0
-   you can use x_offset to adjust the horizontal offset; normally this is zero.  Sets
-   device->i2c_failure on failure. */
+   you can use x_offset to adjust the horizontal offset; normally this is zero.
+
+   The buffer is copied and the copy is flushed in the background, so `fb` can be changed as soon as
+   this returns.  If the previous flush has not finished yet this waits for it.  A failure of the
+   previous flush sets device->i2c_failure. */
 void ssd1306_UpdateScreen(SSD1306_Device_t* device, framebuf_t* fb, unsigned x_offset);
 
 /* Set the OLED display contrast.  The contrast increases as the value increases.
@@ -0,0 +1,49 @@
+/* -*- fill-column: 100; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include "trace.h"
+
+#ifdef SNAPPY_TRACE
+
+#include <inttypes.h>
+#include "esp_timer.h"
+
+/* Record layout and span kind are shared with the Arduino firmware. */
+#define SPAN_EVENT 0
+
+typedef struct {
+  uint32_t start_us;
+  uint32_t duration_us;
+  uint8_t code;
+  uint8_t span;
+  uint16_t depth;
+} trace_record_t;
+
+/* Only the main task writes and dumps the ring, so there is no synchronization. */
+static trace_record_t trace_ring[TRACE_ENTRIES];
+static uint32_t trace_next;
+
+void trace_event(snappy_event_t code, int64_t start_us, unsigned queued) {
+  trace_record_t* r = &trace_ring[trace_next++ % TRACE_ENTRIES];
+  r->start_us = (uint32_t)start_us;
+  r->duration_us = (uint32_t)(esp_timer_get_time() - start_us);
+  r->code = (uint8_t)code;
+  r->span = SPAN_EVENT;
+  r->depth = queued > 0xFFFF ? 0xFFFF : queued;
+}
+
+void trace_dump() {
+  uint32_t count = trace_next < TRACE_ENTRIES ? trace_next : TRACE_ENTRIES;
+  LOG("trace: begin 1 idf %" PRIu32 " %" PRIu32, count, trace_next - count);
+  for ( uint32_t i = trace_next - count; i != trace_next; i++ ) {
+    trace_record_t* r = &trace_ring[i % TRACE_ENTRIES];
+    LOG("trace: %02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x",
+        (uint8_t)r->start_us, (uint8_t)(r->start_us >> 8), (uint8_t)(r->start_us >> 16),
+        (uint8_t)(r->start_us >> 24),
+        (uint8_t)r->duration_us, (uint8_t)(r->duration_us >> 8), (uint8_t)(r->duration_us >> 16),
+        (uint8_t)(r->duration_us >> 24),
+        r->code, r->span, (uint8_t)r->depth, (uint8_t)(r->depth >> 8));
+  }
+  LOG("trace: end");
+}
+
+#endif /* SNAPPY_TRACE */
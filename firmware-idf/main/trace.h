@@ -0,0 +1,30 @@
+/* -*- fill-column: 100; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* Event trace: a record of where the time goes in the main loop.
+
+   Every event that snappy_main() dispatches leaves a record of its start time, duration and code
+   in a ring in RAM, along with the number of events that were still queued when it started.
+   trace_dump() logs the ring in the same format as the Arduino firmware's `trace` command (see
+   firmware-arduino/src/trace.h), and util/trace2chrome converts the log to the Chrome trace
+   format. */
+
+#ifndef trace_h_included
+#define trace_h_included
+
+#include "main.h"
+
+#ifdef SNAPPY_TRACE
+
+/* Number of records kept, must be a power of 2.  Each takes 12 bytes. */
+#define TRACE_ENTRIES 512
+
+/* Record an event that started at `start_us` (from esp_timer_get_time()) and ends now.  Call from
+   the main task only. */
+void trace_event(snappy_event_t code, int64_t start_us, unsigned queued);
+
+/* Log the records, oldest first. */
+void trace_dump();
+
+#endif /* SNAPPY_TRACE */
+
+#endif /* !trace_h_included */
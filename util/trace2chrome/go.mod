@@ -0,0 +1,3 @@
+module trace2chrome
+
+go 1.19
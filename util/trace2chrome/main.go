@@ -0,0 +1,286 @@
+// -*- fill-column: 100; tab-width: 2; indent-tabs-mode: t -*-
+//
+// Event trace converter.
+//
+// Translate the event trace printed by the firmware to the Chrome trace format, for viewing in
+// about://tracing or https://ui.perfetto.dev.  See README.md.
+//
+// Usage:
+//   trace2chrome [-src firmware-source-dir] [input-file] > trace.json
+
+package main
+
+import (
+	"bufio"
+	"encoding/binary"
+	"encoding/hex"
+	"encoding/json"
+	"flag"
+	"fmt"
+	"io"
+	"log"
+	"os"
+	"path/filepath"
+	"regexp"
+	"strconv"
+	"strings"
+)
+
+// Span kinds - these values are fixed by the firmware, see trace.h
+const (
+	span_event    = 0
+	span_net_job  = 1
+	span_mqtt_job = 2
+)
+
+const record_size = 12
+
+type record struct {
+	start    uint64 // Microseconds, unwrapped
+	duration uint32
+	code     uint8
+	span     uint8
+	depth    uint16
+}
+
+type dump struct {
+	firmware string
+	dropped  uint64
+	records  []record
+}
+
+type chromeEvent struct {
+	Name string         `json:"name"`
+	Cat  string         `json:"cat,omitempty"`
+	Ph   string         `json:"ph"`
+	Ts   uint64         `json:"ts"`
+	Dur  *uint32        `json:"dur,omitempty"`
+	Pid  int            `json:"pid"`
+	Tid  int            `json:"tid"`
+	Args map[string]any `json:"args,omitempty"`
+}
+
+func main() {
+	src := flag.String("src", "", "Firmware source directory, for event names")
+	flag.Parse()
+
+	var input io.Reader = os.Stdin
+	switch flag.NArg() {
+	case 0:
+	case 1:
+		f, err := os.Open(flag.Arg(0))
+		if err != nil {
+			log.Fatal(err)
+		}
+		defer f.Close()
+		input = f
+	default:
+		log.Fatal("Usage: trace2chrome [-src firmware-source-dir] [input-file]")
+	}
+
+	d, err := readLastDump(input)
+	if err != nil {
+		log.Fatal(err)
+	}
+
+	names := map[uint8][]string{}
+	if *src != "" {
+		names, err = readNames(*src, d.firmware)
+		if err != nil {
+			log.Fatal(err)
+		}
+	}
+
+	out := struct {
+		TraceEvents     []chromeEvent `json:"traceEvents"`
+		DisplayTimeUnit string        `json:"displayTimeUnit"`
+	}{DisplayTimeUnit: "ms"}
+	out.TraceEvents = append(out.TraceEvents,
+		chromeEvent{Name: "process_name", Ph: "M", Pid: 1, Args: map[string]any{"name": "snappysense " + d.firmware}},
+		chromeEvent{Name: "thread_name", Ph: "M", Pid: 1, Tid: 1, Args: map[string]any{"name": "main"}})
+	if d.firmware == "arduino" {
+		out.TraceEvents = append(out.TraceEvents,
+			chromeEvent{Name: "thread_name", Ph: "M", Pid: 1, Tid: 2, Args: map[string]any{"name": "net"}})
+	}
+	for i := range d.records {
+		r := &d.records[i]
+		tid := 1
+		if r.span != span_event {
+			tid = 2
+		}
+		e := chromeEvent{
+			Name: name(names, r.span, r.code),
+			Cat:  spanCategory(r.span),
+			Ph:   "X",
+			Ts:   r.start,
+			Dur:  &r.duration,
+			Pid:  1,
+			Tid:  tid,
+		}
+		if r.span == span_event {
+			e.Args = map[string]any{"queued": r.depth}
+			out.TraceEvents = append(out.TraceEvents, chromeEvent{
+				Name: "queued events", Ph: "C", Ts: r.start, Pid: 1, Args: map[string]any{"queued": r.depth},
+			})
+		}
+		out.TraceEvents = append(out.TraceEvents, e)
+	}
+	if d.dropped > 0 {
+		fmt.Fprintf(os.Stderr, "trace2chrome: %d older records were overwritten on the device\n", d.dropped)
+	}
+
+	w := bufio.NewWriter(os.Stdout)
+	enc := json.NewEncoder(w)
+	if err := enc.Encode(out); err != nil {
+		log.Fatal(err)
+	}
+	w.Flush()
+}
+
+// Each trace line contains "trace: " followed by the payload; anything before that (a timestamp
+// from the serial monitor, an ESP log prefix) is ignored, as are all other lines.  If the input
+// holds several dumps, the last complete one is used.
+func readLastDump(input io.Reader) (*dump, error) {
+	var last, current *dump
+	var prevStart uint32
+	var base uint64
+	scanner := bufio.NewScanner(input)
+	for scanner.Scan() {
+		line := scanner.Text()
+		ix := strings.Index(line, "trace: ")
+		if ix < 0 {
+			continue
+		}
+		payload := strings.TrimSpace(line[ix+len("trace: "):])
+		fields := strings.Fields(payload)
+		switch {
+		case len(fields) > 0 && fields[0] == "begin":
+			if len(fields) != 5 || fields[1] != "1" {
+				return nil, fmt.Errorf("Unsupported trace header: %s", payload)
+			}
+			dropped, err := strconv.ParseUint(fields[4], 10, 64)
+			if err != nil {
+				return nil, fmt.Errorf("Bad trace header: %s", payload)
+			}
+			current = &dump{firmware: fields[2], dropped: dropped}
+			prevStart, base = 0, 0
+		case payload == "end":
+			if current != nil {
+				last = current
+				current = nil
+			}
+		case current != nil:
+			bytes, err := hex.DecodeString(payload)
+			if err != nil || len(bytes) != record_size {
+				return nil, fmt.Errorf("Bad trace record: %s", payload)
+			}
+			start := binary.LittleEndian.Uint32(bytes[0:])
+			// The microsecond clock wraps around every 71 minutes.  Records are in order of
+			// completion, which is close enough to the order of their start times.
+			if len(current.records) > 0 && start < prevStart && prevStart-start > 1<<31 {
+				base += 1 << 32
+			}
+			prevStart = start
+			current.records = append(current.records, record{
+				start:    base + uint64(start),
+				duration: binary.LittleEndian.Uint32(bytes[4:]),
+				code:     bytes[8],
+				span:     bytes[9],
+				depth:    binary.LittleEndian.Uint16(bytes[10:]),
+			})
+		}
+	}
+	if err := scanner.Err(); err != nil {
+		return nil, err
+	}
+	if last == nil {
+		return nil, fmt.Errorf("No complete trace in the input")
+	}
+	return last, nil
+}
+
+func spanCategory(span uint8) string {
+	switch span {
+	case span_event:
+		return "event"
+	case span_net_job:
+		return "net"
+	case span_mqtt_job:
+		return "mqtt"
+	default:
+		return "unknown"
+	}
+}
+
+func name(names map[uint8][]string, span, code uint8) string {
+	if ns := names[span]; int(code) < len(ns) {
+		return ns[code]
+	}
+	return fmt.Sprintf("%s %d", spanCategory(span), code)
+}
+
+// The names of the codes are the enumerators of the enums that the firmware casts to the code
+// byte, read from the source.  The net task's jobs are named by the event they post when done.
+func readNames(src, firmware string) (map[uint8][]string, error) {
+	names := map[uint8][]string{}
+	switch firmware {
+	case "arduino":
+		events, err := readEnum(filepath.Join(src, "main.h"), `enum\s+class\s+EvCode\s*\{`)
+		if err != nil {
+			return nil, err
+		}
+		jobs, err := readEnum(filepath.Join(src, "mqtt.cpp"), `enum\s+class\s+MqttJob\s*\{`)
+		if err != nil {
+			return nil, err
+		}
+		names[span_event] = events
+		names[span_net_job] = events
+		for i := range jobs {
+			jobs[i] = "MQTT " + jobs[i]
+		}
+		names[span_mqtt_job] = jobs
+	case "idf":
+		events, err := readEnum(filepath.Join(src, "main.h"), `typedef\s+enum\s*\{[^}]*\}\s*snappy_event_t`)
+		if err != nil {
+			return nil, err
+		}
+		names[span_event] = events
+	default:
+		return nil, fmt.Errorf("Unknown firmware %s", firmware)
+	}
+	return names, nil
+}
+
+var commentRe = regexp.MustCompile(`//[^\n]*|/\*(?s:.*?)\*/`)
+
+// Read the enumerators of the first enum in `file` matched by `start`, in order of value.  Only
+// enums whose explicit values (if any) equal their positions are supported.
+func readEnum(file, start string) ([]string, error) {
+	bytes, err := os.ReadFile(file)
+	if err != nil {
+		return nil, err
+	}
+	text := commentRe.ReplaceAllString(string(bytes), "")
+	loc := regexp.MustCompile(start).FindStringIndex(text)
+	if loc == nil {
+		return nil, fmt.Errorf("%s: enum not found", file)
+	}
+	body := text[strings.Index(text[loc[0]:], "{")+loc[0]+1:]
+	body = body[:strings.Index(body, "}")]
+	var names []string
+	for _, item := range strings.Split(body, ",") {
+		item = strings.TrimSpace(item)
+		if item == "" {
+			continue
+		}
+		if eq := strings.Index(item, "="); eq >= 0 {
+			v, err := strconv.Atoi(strings.TrimSpace(item[eq+1:]))
+			if err != nil || v != len(names) {
+				return nil, fmt.Errorf("%s: unsupported enumerator %s", file, item)
+			}
+			item = strings.TrimSpace(item[:eq])
+		}
+		names = append(names, item)
+	}
+	return names, nil
+}